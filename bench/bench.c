@@ -0,0 +1,472 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "common.h"
+#include "capture_writer.h"
+#include "checksum.h"
+#include "ethernet_frame.h"
+#include "flow_table.h"
+#include "frame_descriptor.h"
+#include "logger.h"
+#include "matcher.h"
+#include "metrics.h"
+#include "sketches.h"
+#include "sniffer.h"
+#include "traffic.h"
+
+#define DEFAULT_FRAMES          2000000
+#define DEFAULT_MIN_MILLIS      200
+#define DEFAULT_SEED            1
+#define TRAFFIC_FRAMES          200000
+#define TRAFFIC_BUFFER_SIZE     (512 << 10)
+#define TRAFFIC_FLOWS           4096
+#define SAMPLE_FRAMES           1024
+#define HEX_STRING_OCTETS       48
+#define BENCH_FLOW_LIMIT        65536
+#define BENCH_FLOW_TIMEOUT      60
+#define BENCH_CLOSED_TIMEOUT    5
+#define BENCH_TEXT_SIZE         4096
+#define BENCH_SKETCH_MEMORY     256
+#define BENCH_SKETCH_TOP        10
+#define BENCH_SKETCH_INTERVAL   10
+#define BENCH_MERGE_SOURCES     2
+#define BENCH_MERGE_WINDOW      10
+#define BENCH_MATCH_PATTERNS    5000
+#define BENCH_MATCH_OCTETS      60
+#define BENCH_ENCODERS          2
+#define NANOSECONDS_PER_SECOND  1000000000.0
+
+// NOTE ~> Results are written as one JSON object per line (to what stdout was
+//  when the program started), so that runs can be saved and compared with any
+//  tool that reads JSON. Everything the code being measured prints goes to
+//  /dev/null instead.
+//
+// Allocations are counted by standing in for malloc(...) and friends, which
+//  only glibc makes easy. Elsewhere they are reported as null.
+
+typedef void (*MicroBody)(ULONG iterations);
+
+static FILE* results;
+static UINT minMillis = DEFAULT_MIN_MILLIS;
+static ULONG numFrames = DEFAULT_FRAMES;
+static uint32_t seed = DEFAULT_SEED;
+
+static Traffic* traffic;
+static OCTET* samples[SAMPLE_FRAMES];
+static UINT sampleLengths[SAMPLE_FRAMES];
+static volatile ULONG sink;
+static Matcher* matcher;
+
+#if defined(__GLIBC__)
+static ULONG allocations = 0;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+
+    return __libc_realloc(ptr, size);
+}
+#define COUNTS_ALLOCATIONS 1
+#else
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+static void parseArguments(int argc, char** argv);
+static void pickSamples();
+static void loadMatcher();
+static void runMicro(const char* name, MicroBody body);
+static void runSniff(const char* name, bool flows, bool sketches, UINT num_sources);
+static void runWrite(const char* name, CaptureFileFormat format);
+static void report(const char* name, ULONG ops, double seconds, ULONG allocs, double bits);
+static ULONG getAllocations();
+static double getSeconds();
+static void benchGetEthernetType(ULONG iterations);
+static void benchGetVLANTag(ULONG iterations);
+static void benchOctetsToHexString(ULONG iterations);
+static void benchOctetsToInt(ULONG iterations);
+static void benchOutput(ULONG iterations);
+static void benchMatcherSearch(ULONG iterations);
+static void benchChecksumVerify(ULONG iterations);
+
+int main(int argc, char** argv) {
+    int descriptor;
+
+    parseArguments(argc, argv);
+
+    // Keep the real stdout for results and send everything else to /dev/null
+    if ((descriptor = dup(STDOUT_FILENO)) == -1 || (results = fdopen(descriptor, "w")) == NULL ||
+            freopen("/dev/null", "w", stdout) == NULL) {
+        fatal("Failed to set up the benchmark's output.");
+    }
+
+    setLoggerOptions(LL_INFO, LO_NOLABEL);
+
+    traffic = Traffic_generate(TRAFFIC_FRAMES, TRAFFIC_BUFFER_SIZE, TRAFFIC_FLOWS, seed);
+    pickSamples();
+    loadMatcher();
+
+    runMicro("micro/EthernetFrame_getEthernetType", benchGetEthernetType);
+    runMicro("micro/EthernetFrame_getVLANTag", benchGetVLANTag);
+    runMicro("micro/octetsToHexString", benchOctetsToHexString);
+    runMicro("micro/octetsToInt", benchOctetsToInt);
+    runMicro("micro/output", benchOutput);
+    runMicro("micro/Matcher_search", benchMatcherSearch);
+    runMicro("micro/Checksum_verify", benchChecksumVerify);
+
+    runSniff("sniff/print", false, false, 1);
+    runSniff("sniff/flows", true, false, 1);
+    runSniff("sniff/sketches", false, true, 1);
+    runSniff("sniff/merge", false, false, BENCH_MERGE_SOURCES);
+    runWrite("write/pcap", CFF_PCAP);
+    runWrite("write/compact", CFF_COMPACT);
+
+    Matcher_free(matcher);
+    Traffic_free(traffic);
+    fclose(results);
+
+    return 0;
+}
+
+/**
+ * Parses the program arguments (the number of frames to push through each
+ * end-to-end run, the least time to spend on each microbenchmark and the seed
+ * that traffic is generated from).
+ */
+static void parseArguments(int argc, char** argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                numFrames = strtoul(optarg, NULL, 0);
+                break;
+
+            case 't':
+                minMillis = strtoul(optarg, NULL, 0);
+                break;
+
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                fprintf(stderr, "USAGE:\t%s [-n frames][-t min_ms][-s seed]\n", argv[0]);
+                exit(opt == 'h' ? 0 : 1);
+        }
+    }
+
+    if (numFrames == 0) {
+        numFrames = DEFAULT_FRAMES;
+    }
+}
+
+/**
+ * Picks frames (spread evenly over the generated traffic) for the
+ * microbenchmarks to work on.
+ */
+static void pickSamples() {
+    CaptureSource* source = Traffic_openSource(traffic, 1);
+    CapturedFrame frame;
+    UINT stride = traffic->num_frames / SAMPLE_FRAMES;
+    UINT seen = 0, picked = 0;
+
+    while (picked < SAMPLE_FRAMES && CaptureSource_fill(source) != CS_END) {
+        while (picked < SAMPLE_FRAMES && CaptureSource_next(source, &frame)) {
+            if (seen++ % stride == 0) {
+                sampleLengths[picked] = frame.caplen;
+                samples[picked++] = frame.data;
+            }
+        }
+    }
+
+    CaptureSource_close(source);
+}
+
+/**
+ * Compiles a set of random text patterns (written out to a temporary file,
+ * since that's where the matcher reads them from) for the search
+ * microbenchmark to look for.
+ */
+static void loadMatcher() {
+    char path[] = "/tmp/socker-bench-XXXXXX";
+    FILE* file;
+    UINT i, j, length;
+    int descriptor;
+
+    if ((descriptor = mkstemp(path)) == -1 || (file = fdopen(descriptor, "w")) == NULL) {
+        fatal("Failed to create the benchmark's pattern file (%i: %s).", errno, strerror(errno));
+    }
+
+    srand(seed);
+
+    for (i = 0; i < BENCH_MATCH_PATTERNS; i++) {
+        length = 4 + rand() % 8;
+
+        for (j = 0; j < length; j++) {
+            fputc('a' + rand() % 26, file);
+        }
+
+        fputc('\n', file);
+    }
+
+    fclose(file);
+    matcher = Matcher_load(path, false);
+    unlink(path);
+}
+
+/**
+ * Runs the provided microbenchmark with twice as many iterations each time
+ * until a run takes at least the minimum time, and reports that run.
+ */
+static void runMicro(const char* name, MicroBody body) {
+    ULONG iterations = SAMPLE_FRAMES;
+    ULONG allocs;
+    double start, elapsed;
+
+    while (true) {
+        allocs = getAllocations();
+        start = getSeconds();
+        body(iterations);
+        elapsed = getSeconds() - start;
+        allocs = getAllocations() - allocs;
+
+        if (elapsed * 1000 >= minMillis) {
+            break;
+        }
+
+        iterations *= 2;
+    }
+
+    report(name, iterations, elapsed, allocs, 0);
+}
+
+/**
+ * Pushes (at least) the requested number of generated frames through the
+ * capture loop, printing them or tracking them as flows or in sketches, and
+ * reports how long that took. With several sources, the frames are split
+ * between them and merged back into one stream on the way in.
+ */
+static void runSniff(const char* name, bool flows, bool sketches, UINT num_sources) {
+    SniffContext context;
+    UINT passes = (numFrames + traffic->num_frames - 1) / traffic->num_frames;
+    CaptureSource* sources[MAX_INTERFACES];
+    ULONG allocs;
+    double start, elapsed;
+    UINT i;
+
+    memset(&context, 0x00, sizeof(context));
+
+    if (num_sources == 1) {
+        context.source = Traffic_openSource(traffic, passes);
+    } else {
+        for (i = 0; i < num_sources; i++) {
+            sources[i] = Traffic_openSource(traffic, (passes + num_sources - 1) / num_sources);
+        }
+
+        context.source = CaptureSource_openMerged(sources, num_sources, BENCH_MERGE_WINDOW);
+    }
+    context.counters = Metrics_register(name + strlen("sniff/"));
+
+    if (flows) {
+        context.flows = FlowTable_new(BENCH_FLOW_LIMIT, BENCH_FLOW_TIMEOUT, BENCH_CLOSED_TIMEOUT, Flow_output,
+                TextBuffer_new(BENCH_TEXT_SIZE));
+    }
+
+    if (sketches) {
+        context.sketches = Sketches_new(BENCH_SKETCH_MEMORY, BENCH_SKETCH_TOP, BENCH_SKETCH_INTERVAL);
+    }
+
+    allocs = getAllocations();
+    start = getSeconds();
+    Sniffer_run(&context);
+    elapsed = getSeconds() - start;
+    allocs = getAllocations() - allocs;
+
+    report(name, context.counters->frames, elapsed, allocs, (double) context.counters->octets * 8);
+
+    if (context.flows != NULL) {
+        FlowTable_flush(context.flows);
+        TextBuffer_free((TextBuffer*) FlowTable_getContext(context.flows));
+        FlowTable_free(context.flows);
+    }
+
+    if (context.sketches != NULL) {
+        Sketches_flush(context.sketches);
+        Sketches_free(context.sketches);
+    }
+
+    CaptureSource_close(context.source);
+}
+
+/**
+ * Pushes (at least) the requested number of generated frames through the
+ * capture loop into a capture writer of the provided format (writing to
+ * /dev/null, so that only the work of getting frames ready for the disk is
+ * measured), and reports how long that took, closing the writer included.
+ */
+static void runWrite(const char* name, CaptureFileFormat format) {
+    SniffContext context;
+    CaptureWriterLimits limits = { .encoders = BENCH_ENCODERS };
+    UINT passes = (numFrames + traffic->num_frames - 1) / traffic->num_frames;
+    ULONG allocs;
+    double start, elapsed;
+
+    memset(&context, 0x00, sizeof(context));
+    context.source = Traffic_openSource(traffic, passes);
+    context.counters = Metrics_register(name + strlen("write/"));
+    context.writer = CaptureWriter_open("/dev/null", format, &limits);
+
+    allocs = getAllocations();
+    start = getSeconds();
+    Sniffer_run(&context);
+    CaptureWriter_close(context.writer);
+    elapsed = getSeconds() - start;
+    allocs = getAllocations() - allocs;
+
+    report(name, context.counters->frames, elapsed, allocs, (double) context.counters->octets * 8);
+
+    CaptureSource_close(context.source);
+}
+
+/**
+ * Writes out the result of a single benchmark (with its bit rate, if it has
+ * one).
+ */
+static void report(const char* name, ULONG ops, double seconds, ULONG allocs, double bits) {
+    fprintf(results, "{\"name\":\"%s\",\"ops\":%lu,\"seconds\":%.6f,\"ns_per_op\":%.3f,\"ops_per_sec\":%.1f", name,
+            ops, seconds, seconds * NANOSECONDS_PER_SECOND / ops, ops / seconds);
+
+    if (bits > 0) {
+        fprintf(results, ",\"bits_per_sec\":%.1f", bits / seconds);
+    }
+
+    if (COUNTS_ALLOCATIONS) {
+        fprintf(results, ",\"allocations\":%lu,\"allocs_per_op\":%.6f}\n", allocs, (double) allocs / ops);
+    } else {
+        fprintf(results, ",\"allocations\":null,\"allocs_per_op\":null}\n");
+    }
+
+    fflush(results);
+}
+
+/**
+ * Returns the number of allocations made so far (or zero if they aren't
+ * counted).
+ */
+static ULONG getAllocations() {
+#if COUNTS_ALLOCATIONS
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Returns the time (in seconds) on a clock that only ever moves forward.
+ */
+static double getSeconds() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / NANOSECONDS_PER_SECOND;
+}
+
+static void benchGetEthernetType(ULONG iterations) {
+    ULONG i, total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        total += EthernetFrame_getEthernetType((EthernetFrame*) samples[i % SAMPLE_FRAMES]);
+    }
+
+    sink = total;
+}
+
+static void benchGetVLANTag(ULONG iterations) {
+    ULONG i, total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        total += EthernetFrame_getVLANTag((EthernetFrame*) samples[i % SAMPLE_FRAMES]);
+    }
+
+    sink = total;
+}
+
+static void benchOctetsToHexString(ULONG iterations) {
+    char buff[HEX_STRING_OCTETS * 3 + 1];
+    ULONG i, total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        total += octetsToHexString(samples[i % SAMPLE_FRAMES], HEX_STRING_OCTETS, buff, ' ', 2);
+    }
+
+    sink = total;
+}
+
+static void benchOctetsToInt(ULONG iterations) {
+    ULONG i, total = 0;
+    UINT value;
+
+    for (i = 0; i < iterations; i++) {
+        octetsToInt(samples[i % SAMPLE_FRAMES] + 12, 2, &value);
+        total += value;
+    }
+
+    sink = total;
+}
+
+static void benchOutput(ULONG iterations) {
+    ULONG i;
+
+    for (i = 0; i < iterations; i++) {
+        output(LC_GREEN, "[%s]\t%lu\t%s\n", "ETHERNET", i, "IPv4");
+    }
+
+    fflush(stdout);
+}
+
+static void benchMatcherSearch(ULONG iterations) {
+    Match matches[MAX_REPORTED_MATCHES];
+    ULONG i, total = 0;
+    UINT state;
+
+    for (i = 0; i < iterations; i++) {
+        state = 0;
+        total += Matcher_search(matcher, samples[i % SAMPLE_FRAMES], BENCH_MATCH_OCTETS, &state, 0, matches,
+                MAX_REPORTED_MATCHES);
+    }
+
+    sink = total;
+}
+
+static void benchChecksumVerify(ULONG iterations) {
+    FrameDescriptor descriptor;
+    ULONG i, total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        FrameDescriptor_decode(&descriptor, samples[i % SAMPLE_FRAMES], sampleLengths[i % SAMPLE_FRAMES]);
+        total += Checksum_verify(&descriptor);
+    }
+
+    sink = total;
+}
@@ -0,0 +1,378 @@
+#include "traffic.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "ethernet_frame.h"
+#include "logger.h"
+
+#define WORD_ALIGNMENT      4
+#define WORD_ALIGN(x)       (((x) + (WORD_ALIGNMENT - 1)) & ~(WORD_ALIGNMENT - 1))
+#define HEADER_SIZE         18
+#define ETHERNET_SIZE       14
+#define VLAN_TAG_SIZE       4
+#define IPV4_HEADER_SIZE    20
+#define IPV6_HEADER_SIZE    40
+#define TCP_HEADER_SIZE     20
+#define UDP_HEADER_SIZE     8
+#define ARP_SIZE            28
+#define MIN_FRAME_SIZE      60
+#define MAX_FRAME_SIZE      1514
+#define IP_PROTOCOL_TCP     6
+#define IP_PROTOCOL_UDP     17
+#define FRAMES_PER_SECOND   100000
+
+/**
+ * State of a capture source that replays generated traffic.
+ */
+typedef struct TrafficSource {
+    const Traffic* traffic;
+
+    /**
+     * Number of buffers left to hand out (counting every pass).
+     */
+    ULONG remaining;
+
+    /**
+     * Index of the buffer that is handed out next.
+     */
+    UINT next_buffer;
+
+    /**
+     * Bounds of the current buffer, and position of the next unprocessed
+     * header in it.
+     */
+    OCTET* buffer;
+    OCTET* end;
+    OCTET* ptr;
+} TrafficSource;
+
+static int TrafficSource_fill(void* state);
+static bool TrafficSource_next(void* state, CapturedFrame* frame);
+static void TrafficSource_close(void* state);
+
+static const CaptureSourceOps trafficSourceOps = {
+    .fill = TrafficSource_fill,
+    .next = TrafficSource_next,
+    .release = NULL,
+    .close = TrafficSource_close,
+    .getDescriptor = NULL,
+    .getDrops = NULL,
+    .rewind = NULL
+};
+
+static uint32_t nextRandom(uint32_t* state);
+static UINT pickSize(uint32_t* state);
+static size_t buildFrame(OCTET* data, UINT size, UINT flow, uint32_t* state);
+static void addBuffer(Traffic* o, OCTET* buffer, size_t length);
+static void writeUint16(OCTET* ptr, UINT value);
+
+/**
+ * Generates the provided number of frames into buffers of (at most) the
+ * provided size. Frames belong to one of the provided number of flows, and a
+ * quarter of them are VLAN tagged (a few twice). Most are IPv4 or IPv6 TCP or
+ * UDP (of a mix of sizes, mostly small with some full-sized) and the rest are
+ * ARP.
+ */
+Traffic* Traffic_generate(UINT num_frames, size_t buffer_size, UINT num_flows, uint32_t seed) {
+    Traffic* o = (Traffic*) calloc(1, sizeof(Traffic));
+    OCTET* buffer = NULL;
+    size_t length = 0;
+    TrafficHeader* header;
+    uint32_t state = (seed != 0) ? seed : 1;
+    UINT i, size;
+
+    if (o == NULL) {
+        fatal("Failed to allocate generated traffic.");
+    }
+
+    for (i = 0; i < num_frames; i++) {
+        size = pickSize(&state);
+
+        if (buffer == NULL || length + WORD_ALIGN(HEADER_SIZE + size) > buffer_size) {
+            if (buffer != NULL) {
+                addBuffer(o, buffer, length);
+            }
+
+            if ((buffer = (OCTET*) calloc(1, buffer_size)) == NULL) {
+                fatal("Failed to allocate a traffic buffer.");
+            }
+
+            length = 0;
+        }
+
+        // NOTE ~> Like a BPF device, the header length is chosen so that the
+        //  network layer header ends up aligned.
+        header = (TrafficHeader*) (buffer + length);
+        header->tv_sec = i / FRAMES_PER_SECOND;
+        header->tv_usec = (i % FRAMES_PER_SECOND) * (1000000 / FRAMES_PER_SECOND);
+        header->hdrlen = WORD_ALIGN(HEADER_SIZE + ETHERNET_SIZE) - ETHERNET_SIZE;
+        header->caplen = buildFrame(buffer + length + header->hdrlen, size, nextRandom(&state) % num_flows, &state);
+        header->datalen = header->caplen;
+
+        length += WORD_ALIGN(header->hdrlen + header->caplen);
+        o->num_octets += header->caplen;
+    }
+
+    if (buffer != NULL) {
+        addBuffer(o, buffer, length);
+    }
+
+    o->num_frames = num_frames;
+
+    return o;
+}
+
+/**
+ * Wraps the provided generated traffic in a CaptureSource that hands out all
+ * of its buffers (one per batch) the provided number of times over.
+ */
+CaptureSource* Traffic_openSource(const Traffic* o, UINT passes) {
+    TrafficSource* source = (TrafficSource*) calloc(1, sizeof(TrafficSource));
+
+    if (source == NULL) {
+        fatal("Failed to allocate a traffic source.");
+    }
+
+    source->traffic = o;
+    source->remaining = (ULONG) o->num_buffers * passes;
+
+    return CaptureSource_new("generated traffic", &trafficSourceOps, source);
+}
+
+/**
+ * Frees the provided generated traffic.
+ */
+void Traffic_free(Traffic* o) {
+    UINT i;
+
+    for (i = 0; i < o->num_buffers; i++) {
+        free(o->buffers[i]);
+    }
+
+    free(o->buffers);
+    free(o->buffer_lengths);
+    free(o);
+}
+
+/**
+ * Hands out the next buffer, or reports that every pass is done.
+ */
+static int TrafficSource_fill(void* state) {
+    TrafficSource* o = (TrafficSource*) state;
+    const Traffic* traffic = o->traffic;
+
+    if (o->remaining == 0) {
+        return CS_END;
+    }
+
+    o->buffer = traffic->buffers[o->next_buffer];
+    o->end = o->buffer + traffic->buffer_lengths[o->next_buffer];
+    o->ptr = o->buffer;
+
+    o->next_buffer = (o->next_buffer + 1) % traffic->num_buffers;
+    o->remaining--;
+
+    return (int) (o->end - o->buffer);
+}
+
+/**
+ * Walks to the next header in the current buffer and describes the frame that
+ * follows it (exactly as the BPF device source does).
+ */
+static bool TrafficSource_next(void* state, CapturedFrame* frame) {
+    TrafficSource* o = (TrafficSource*) state;
+    TrafficHeader* header;
+
+    if (o->ptr >= o->end) {
+        return false;
+    }
+
+    header = (TrafficHeader*) o->ptr;
+
+    frame->timestamp.tv_sec = header->tv_sec;
+    frame->timestamp.tv_nsec = header->tv_usec * 1000;
+    frame->caplen = header->caplen;
+    frame->wirelen = header->datalen;
+    frame->data = o->ptr + header->hdrlen;
+
+    o->ptr += WORD_ALIGN(header->hdrlen + header->caplen);
+
+    return true;
+}
+
+/**
+ * Frees the state of a traffic source (but not the traffic it replays).
+ */
+static void TrafficSource_close(void* state) {
+    free(state);
+}
+
+/**
+ * Returns the next number from the provided xorshift generator state.
+ */
+static uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return (*state = x);
+}
+
+/**
+ * Picks a frame size, mostly small with some medium and a few full-sized ones
+ * (roughly the 7:4:1 mix commonly used for this), plus a few at random.
+ */
+static UINT pickSize(uint32_t* state) {
+    UINT pick = nextRandom(state) % 16;
+
+    if (pick < 7) {
+        return MIN_FRAME_SIZE + nextRandom(state) % 8;
+    } else if (pick < 11) {
+        return 590;
+    } else if (pick < 12) {
+        return MAX_FRAME_SIZE;
+    }
+
+    return MIN_FRAME_SIZE + nextRandom(state) % (MAX_FRAME_SIZE - MIN_FRAME_SIZE + 1);
+}
+
+/**
+ * Builds a frame of (about) the provided size belonging to the provided flow
+ * at the provided location. Returns the size of the frame.
+ */
+static size_t buildFrame(OCTET* data, UINT size, UINT flow, uint32_t* state) {
+    UINT kind = nextRandom(state) % 20;
+    UINT tags = (kind % 4 == 0) ? ((kind == 0) ? 2 : 1) : 0;
+    UINT protocol = (flow % 3 == 0) ? IP_PROTOCOL_UDP : IP_PROTOCOL_TCP;
+    UINT transport = (protocol == IP_PROTOCOL_TCP) ? TCP_HEADER_SIZE : UDP_HEADER_SIZE;
+    OCTET* ptr = data;
+    UINT i, minimum, length;
+
+    // Ethernet header (and tags)
+    memset(ptr, 0x00, 12);
+    ptr[0] = 0x02;
+    ptr[5] = (OCTET) (flow & 0xff);
+    ptr[6] = 0x02;
+    ptr[11] = (OCTET) (flow >> 8);
+    ptr += 12;
+
+    for (i = 0; i < tags; i++) {
+        writeUint16(ptr, (tags == 2 && i == 0) ? ET_QINQTAGGED : ET_VLANTAGGED);
+        writeUint16(ptr + 2, 100 + (flow % 8));
+        ptr += VLAN_TAG_SIZE;
+    }
+
+    // ARP requests (one in ten frames) are always the same size
+    if (kind >= 18) {
+        writeUint16(ptr, ET_ARP);
+        ptr += 2;
+
+        memset(ptr, 0x00, ARP_SIZE);
+        writeUint16(ptr, 1);
+        writeUint16(ptr + 2, ET_IPV4);
+        ptr[4] = 6;
+        ptr[5] = 4;
+        writeUint16(ptr + 6, 1);
+        ptr[14] = 10;
+        ptr[17] = (OCTET) flow;
+        ptr[24] = 10;
+        ptr[27] = 1;
+        ptr += ARP_SIZE;
+
+        length = ptr - data;
+
+        if (length < MIN_FRAME_SIZE) {
+            memset(ptr, 0x00, MIN_FRAME_SIZE - length);
+            length = MIN_FRAME_SIZE;
+        }
+
+        return length;
+    }
+
+    // IPv6 for a third of the flows and IPv4 for the rest
+    minimum = (ptr - data) + 2 + ((flow % 3 == 1) ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE) + transport;
+    length = (size > minimum) ? size : minimum;
+
+    if (flow % 3 == 1) {
+        writeUint16(ptr, ET_IPV6);
+        ptr += 2;
+
+        memset(ptr, 0x00, IPV6_HEADER_SIZE);
+        ptr[0] = 0x60;
+        writeUint16(ptr + 4, length - (ptr - data) - IPV6_HEADER_SIZE);
+        ptr[6] = protocol;
+        ptr[7] = 64;
+        ptr[8] = 0xfd;
+        ptr[23] = 1;
+        ptr[24] = 0xfd;
+        ptr[38] = (OCTET) (flow >> 8);
+        ptr[39] = (OCTET) flow;
+        ptr += IPV6_HEADER_SIZE;
+    } else {
+        writeUint16(ptr, ET_IPV4);
+        ptr += 2;
+
+        memset(ptr, 0x00, IPV4_HEADER_SIZE);
+        ptr[0] = 0x45;
+        writeUint16(ptr + 2, length - (ptr - data));
+        writeUint16(ptr + 4, flow);
+        ptr[8] = 64;
+        ptr[9] = protocol;
+        ptr[12] = 10;
+        ptr[15] = 1;
+        ptr[16] = 10;
+        ptr[17] = 1;
+        ptr[18] = (OCTET) (flow >> 8);
+        ptr[19] = (OCTET) flow;
+        ptr += IPV4_HEADER_SIZE;
+    }
+
+    // Transport header
+    memset(ptr, 0x00, transport);
+    writeUint16(ptr, 1024 + (flow % 50000));
+    writeUint16(ptr + 2, (protocol == IP_PROTOCOL_TCP) ? 443 : 53);
+
+    if (protocol == IP_PROTOCOL_TCP) {
+        ptr[12] = 0x50;
+        ptr[13] = 0x10;
+    } else {
+        writeUint16(ptr + 4, length - (ptr - data));
+    }
+
+    ptr += transport;
+
+    // Payload
+    for (i = ptr - data; i < length; i++) {
+        data[i] = (OCTET) (nextRandom(state) & 0xff);
+    }
+
+    return length;
+}
+
+/**
+ * Adds the provided filled buffer to the provided generated traffic.
+ */
+static void addBuffer(Traffic* o, OCTET* buffer, size_t length) {
+    o->buffers = (OCTET**) realloc(o->buffers, (o->num_buffers + 1) * sizeof(OCTET*));
+    o->buffer_lengths = (size_t*) realloc(o->buffer_lengths, (o->num_buffers + 1) * sizeof(size_t));
+
+    if (o->buffers == NULL || o->buffer_lengths == NULL) {
+        fatal("Failed to allocate the list of traffic buffers.");
+    }
+
+    o->buffers[o->num_buffers] = buffer;
+    o->buffer_lengths[o->num_buffers] = length;
+    o->num_buffers++;
+}
+
+/**
+ * Writes the provided value as a two octet, network byte order integer at the
+ * provided position.
+ */
+static void writeUint16(OCTET* ptr, UINT value) {
+    ptr[0] = (OCTET) (value >> 8);
+    ptr[1] = (OCTET) value;
+}
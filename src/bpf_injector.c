@@ -0,0 +1,186 @@
+#include "injector.h"
+#include "common.h"
+
+#ifdef HAVE_BPF_DEVICE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/bpf.h>
+#include "logger.h"
+
+#define BATCH_BUFFER_SIZE   (1 << 20)
+#define MAX_FRAME_SIZE      (1 << 16)
+
+/**
+ * A frame queued in the batch buffer (followed by its octets, and padded so
+ * that the next one is aligned).
+ */
+typedef struct QueuedFrame {
+    UINT length;
+} QueuedFrame;
+
+/**
+ * State of an injector that writes to a BPF device.
+ */
+typedef struct BpfInjector {
+    /**
+     * Descriptor of the open BPF device.
+     */
+    int descriptor;
+
+    /**
+     * Frames queued since the last flush, back to back.
+     */
+    OCTET* batch;
+    size_t batch_used;
+} BpfInjector;
+
+static OCTET* BpfInjector_reserve(void* state, UINT* slot);
+static void BpfInjector_commit(void* state, UINT length);
+static void BpfInjector_flush(void* state);
+static void BpfInjector_close(void* state);
+
+static const InjectorOps bpfInjectorOps = {
+    .reserve = BpfInjector_reserve,
+    .commit = BpfInjector_commit,
+    .flush = BpfInjector_flush,
+    .close = BpfInjector_close
+};
+
+/**
+ * Attempts to grab a descriptor to a valid BPF device from the system,
+ * initialize it against the provided network interface for writing, and wrap
+ * it in an Injector.
+ */
+Injector* Injector_openDevice(const char* interface_name) {
+    int i, buffer_int, bpf;
+    char buffer_char[11] = { 0 };
+    struct ifreq bound_if;
+    BpfInjector* injector;
+
+    // Attempt to open the next available Berkley Packet Filter device (BPF)
+    for (i = 0; i < MAX_BPF_DEVICES; i++) {
+        sprintf(buffer_char, "/dev/bpf%u", i);
+
+        if ((bpf = open(buffer_char, O_WRONLY)) != -1) {
+            break;
+        } else if (errno == EACCES) {
+            fatal("The system is denying permission to its BPF devices. Make sure propper permissions are being used "
+                    "(e.g. root).");
+        }
+    }
+
+    if (bpf == -1) {
+        fatal("Failed to open a BPF device after %d tries. The error on the final attempt was \"%s\".", MAX_BPF_DEVICES,
+                strerror(errno));
+    }
+    else {
+        info("Opened the BPF device at %s for injection (file descriptor = %d).", buffer_char, bpf);
+    }
+
+    // Associate with a particular network interface
+    memset(&bound_if, 0x00, sizeof(bound_if));
+    strncpy(bound_if.ifr_name, interface_name, sizeof(bound_if.ifr_name) - 1);
+    if (ioctl(bpf, BIOCSETIF, &bound_if) == -1) {
+        fatal("Failed to associate the BPF device with the network interface \"%s\". (%i: %s)",
+                interface_name, errno, strerror(errno));
+    }
+    else {
+        info("Associated the BPF device with the network interface \"%s\".", interface_name);
+    }
+
+    // Send frames exactly as they are (rather than have the kernel fill in the
+    //  source MAC address of the interface)
+    buffer_int = 1;
+    if (ioctl(bpf, BIOCSHDRCMPLT, &buffer_int) == -1) {
+        fatal("Failed to have the BPF device leave the source MAC addresses alone. (%i: %s)", errno, strerror(errno));
+    }
+
+    injector = (BpfInjector*) calloc(1, sizeof(BpfInjector));
+
+    if (injector == NULL || (injector->batch = (OCTET*) malloc(BATCH_BUFFER_SIZE)) == NULL) {
+        fatal("Failed to allocate the BPF injector.");
+    }
+
+    injector->descriptor = bpf;
+
+    return Injector_new(interface_name, &bpfInjectorOps, injector, MAX_FRAME_SIZE - sizeof(QueuedFrame), 0);
+}
+
+/**
+ * Returns where the next frame goes in the batch buffer, unless there might
+ * not be room left for it.
+ */
+static OCTET* BpfInjector_reserve(void* state, UINT* slot) {
+    BpfInjector* o = (BpfInjector*) state;
+
+    if (o->batch_used + MAX_FRAME_SIZE > BATCH_BUFFER_SIZE) {
+        return NULL;
+    }
+
+    *slot = INJECTOR_NO_SLOT;
+
+    return (OCTET*) ((QueuedFrame*) (o->batch + o->batch_used) + 1);
+}
+
+/**
+ * Adds the frame (of the provided length) at the end of the batch buffer to
+ * the batch.
+ */
+static void BpfInjector_commit(void* state, UINT length) {
+    BpfInjector* o = (BpfInjector*) state;
+
+    ((QueuedFrame*) (o->batch + o->batch_used))->length = length;
+    o->batch_used += BPF_WORDALIGN(sizeof(QueuedFrame) + length);
+}
+
+/**
+ * Writes every queued frame to the BPF device.
+ * NOTE ~> A BPF device takes exactly one frame per write(...).
+ */
+static void BpfInjector_flush(void* state) {
+    BpfInjector* o = (BpfInjector*) state;
+    OCTET* ptr = o->batch;
+    QueuedFrame* queued;
+
+    while (ptr < o->batch + o->batch_used) {
+        queued = (QueuedFrame*) ptr;
+
+        if (write(o->descriptor, queued + 1, queued->length) == -1) {
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+
+            fatal("Failed to write a frame to the BPF device. (%i: %s)", errno, strerror(errno));
+        }
+
+        ptr += BPF_WORDALIGN(sizeof(QueuedFrame) + queued->length);
+    }
+
+    o->batch_used = 0;
+}
+
+/**
+ * Closes the BPF device and frees the batch buffer.
+ */
+static void BpfInjector_close(void* state) {
+    BpfInjector* o = (BpfInjector*) state;
+
+    close(o->descriptor);
+    info("Closed BPF device with file descriptor %d", o->descriptor);
+
+    free(o->batch);
+    free(o);
+}
+
+#endif
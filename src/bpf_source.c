@@ -0,0 +1,269 @@
+#include "capture_source.h"
+#include "common.h"
+
+#ifdef HAVE_BPF_DEVICE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/bpf.h>
+#include "large_buffer.h"
+#include "logger.h"
+#include "options.h"
+
+/**
+ * State of a capture source that reads from a BPF device.
+ */
+typedef struct BpfSource {
+    /**
+     * Descriptor of the open BPF device.
+     */
+    int descriptor;
+
+    /**
+     * Size of the BPF device's buffer (and thus of our own read buffer).
+     */
+    int buff_size;
+
+    /**
+     * Buffer that each read from the BPF device is placed into.
+     */
+    OCTET* buffer;
+
+    /**
+     * Number of octets placed into the buffer by the most recent read.
+     */
+    int read_bytes;
+
+    /**
+     * Position of the next unprocessed BPF header in the buffer.
+     */
+    OCTET* ptr;
+} BpfSource;
+
+static int BpfSource_fill(void* state);
+static bool BpfSource_next(void* state, CapturedFrame* frame);
+static void BpfSource_close(void* state);
+static int BpfSource_getDescriptor(void* state);
+static ULONG BpfSource_getDrops(void* state);
+
+static const CaptureSourceOps bpfSourceOps = {
+    .fill = BpfSource_fill,
+    .next = BpfSource_next,
+    .release = NULL,
+    .close = BpfSource_close,
+    .getDescriptor = BpfSource_getDescriptor,
+    .getDrops = BpfSource_getDrops,
+    .rewind = NULL
+};
+
+/**
+ * Attempts to grab a descriptor to a valid BPF device from the system,
+ * initialize it against the provided network interface, attach the provided
+ * Filter (if any) to it, and wrap it in a CaptureSource.
+ */
+CaptureSource* CaptureSource_openDevice(const char* interface_name, const Filter* filter) {
+    int i, buffer_int, bpf;
+    struct timeval timeout;
+    struct bpf_program program;
+    char buffer_char[11] = { 0 };
+    struct ifreq bound_if;
+    BpfSource* source;
+
+    // Attempt to open the next available Berkley Packet Filter device (BPF)
+    for (i = 0; i < MAX_BPF_DEVICES; i++) {
+        // Generate the path to the next possible BPF
+        sprintf(buffer_char, "/dev/bpf%u", i);
+
+        // Attempt to open the next possible BPF; If we don't fail, we have
+        //  succeeded in finding an available one
+        bpf = open(buffer_char, O_RDWR | O_NONBLOCK);
+
+        if (bpf != -1) {
+            break;
+        } else if (errno == EACCES) {
+            fatal("The system is denying permission to its BPF devices. Make sure propper permissions are being used "
+                    "(e.g. root).");
+        }
+    }
+
+    if (bpf == -1) {
+        fatal("Failed to open a BPF device after %d tries. The error on the final attempt was \"%s\".", MAX_BPF_DEVICES,
+                strerror(errno));
+    }
+    else {
+        info("Opened the BPF device at %s (file descriptor = %d).", buffer_char, bpf);
+    }
+
+    // Associate with a particular network interface
+    memset(&bound_if, 0x00, sizeof(bound_if));
+    strncpy(bound_if.ifr_name, interface_name, sizeof(bound_if.ifr_name) - 1);
+    if(ioctl(bpf, BIOCSETIF, &bound_if) == -1) {
+        fatal("Failed to associate the BPF device with the network interface \"%s\". (%i: %s)",
+                interface_name, errno, strerror(errno));
+    }
+    else {
+        info("Associated the BPF device with the network interface \"%s\".", interface_name);
+    }
+
+    // Turn "immediate" mode on or off depending on the capture mode
+    // NOTE ~> In "immediate" mode the device becomes readable as soon as new
+    //  socket data is available rather than when the read buffer is full or
+    //  the read timeout occurs. That favors latency over batching.
+    buffer_int = (Options_getCaptureMode() == CM_LATENCY) ? 1 : 0;
+    if (ioctl(bpf, BIOCIMMEDIATE, &buffer_int) == -1) {
+        fatal("Failed to set the BPF device's \"immediate\" mode. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Turned %s the BPF device's \"immediate\" mode.", buffer_int ? "on" : "off");
+    }
+
+    // Make sure that a partially filled buffer is still handed over after the
+    //  read timeout when batching
+    timeout.tv_sec = Options_getReadTimeout() / 1000;
+    timeout.tv_usec = (Options_getReadTimeout() % 1000) * 1000;
+    if (ioctl(bpf, BIOCSRTIMEOUT, &timeout) == -1) {
+        fatal("Failed to set the BPF device's read timeout. (%i: %s)", errno, strerror(errno));
+    }
+
+    // Have the kernel drop frames that don't match the filter before they ever
+    //  reach the read buffer
+    // NOTE ~> A FilterInstruction is laid out exactly like a bpf_insn. Setting
+    //  the filter also flushes anything that was captured before it was set.
+    if (filter != NULL) {
+        program.bf_len = Filter_getLength(filter);
+        program.bf_insns = (struct bpf_insn*) Filter_getInstructions(filter);
+
+        if (ioctl(bpf, BIOCSETF, &program) == -1) {
+            fatal("Failed to attach the filter to the BPF device. (%i: %s)", errno, strerror(errno));
+        }
+        else {
+            info("Attached a %u instruction filter to the BPF device.", program.bf_len);
+        }
+    }
+
+    // Set up the state that the rest of the source's operations will use
+    source = (BpfSource*) malloc(sizeof(BpfSource));
+
+    if (source == NULL) {
+        fatal("Failed to allocate the BPF capture source.");
+    }
+
+    source->descriptor = bpf;
+    source->read_bytes = 0;
+
+    // Get the buffer length (so that we can traverse multiple entries when
+    //  reading from the BPF)
+    if (ioctl(bpf, BIOCGBLEN, &source->buff_size) == -1) {
+        fatal("Failed to retrieve the BPF device's buffer length. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Retrieved the BPF device's buffer length (%i bytes).", source->buff_size);
+    }
+
+    source->buffer = (OCTET*) LargeBuffer_alloc(source->buff_size * sizeof(OCTET), ANY_NODE);
+    source->ptr = source->buffer;
+
+    if (source->buffer == NULL) {
+        fatal("Failed to allocate the %i byte BPF read buffer.", source->buff_size);
+    }
+
+    return CaptureSource_new(interface_name, &bpfSourceOps, source);
+}
+
+/**
+ * Reads the next buffer's worth of frames from the BPF device.
+ */
+static int BpfSource_fill(void* state) {
+    BpfSource* o = (BpfSource*) state;
+
+    // Read the buffer
+    // NOTE ~> The device is non-blocking, so this returns straight away (with
+    //  EAGAIN) when there is nothing to read yet. There is no need to clean the
+    //  buffer first since only the octets that were read are ever walked.
+    o->read_bytes = read(o->descriptor, o->buffer, o->buff_size);
+    o->ptr = o->buffer;
+
+    if (o->read_bytes < 0) {
+        o->read_bytes = 0;
+    }
+
+    return o->read_bytes;
+}
+
+/**
+ * Walks to the next BPF header in the most recently read buffer and describes
+ * the Ethernet Frame that follows it.
+ */
+static bool BpfSource_next(void* state, CapturedFrame* frame) {
+    BpfSource* o = (BpfSource*) state;
+    struct bpf_hdr* bpf_packet;
+
+    // Stop once there are no more unprocessed Ethernet Frames in the buffer
+    if (o->ptr >= (o->buffer + o->read_bytes)) {
+        return false;
+    }
+
+    // Grab pointers to both the BPF header for the Ethernet Frame and the
+    // Ethernet Frame itself
+    bpf_packet = (struct bpf_hdr*) o->ptr;
+
+    frame->timestamp.tv_sec = bpf_packet->bh_tstamp.tv_sec;
+    frame->timestamp.tv_nsec = bpf_packet->bh_tstamp.tv_usec * 1000;
+    frame->caplen = bpf_packet->bh_caplen;
+    frame->wirelen = bpf_packet->bh_datalen;
+    frame->data = o->ptr + bpf_packet->bh_hdrlen;
+
+    // Jump ahead to the next Ethernet Frame that is in the buffer
+    // NOTE ~> This algorithm does not currently support Ethernet Frames that
+    //  might only be partially in the buffer (due to trunctaion by the BPF).
+    o->ptr += BPF_WORDALIGN(bpf_packet->bh_hdrlen + bpf_packet->bh_caplen);
+
+    return true;
+}
+
+/**
+ * Closes the open BPF device and frees its read buffer.
+ */
+static void BpfSource_close(void* state) {
+    BpfSource* o = (BpfSource*) state;
+
+    close(o->descriptor);
+    info("Closed BPF device with file descriptor %d", o->descriptor);
+
+    LargeBuffer_free(o->buffer, o->buff_size * sizeof(OCTET));
+    free(o);
+}
+
+/**
+ * Returns the BPF device's descriptor, which polls as readable once a buffer's
+ * worth of frames can be read.
+ */
+static int BpfSource_getDescriptor(void* state) {
+    return ((BpfSource*) state)->descriptor;
+}
+
+/**
+ * Returns the number of frames that the BPF device has had to drop (because
+ * its buffer was full).
+ */
+static ULONG BpfSource_getDrops(void* state) {
+    struct bpf_stat stats;
+
+    if (ioctl(((BpfSource*) state)->descriptor, BIOCGSTATS, &stats) == -1) {
+        return 0;
+    }
+
+    return stats.bs_drop;
+}
+
+#endif
\ No newline at end of file
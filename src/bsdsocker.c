@@ -1,33 +1,198 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <signal.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/time.h>
-#include <sys/ioctl.h>
-#include <sys/socket.h>
-#include <net/if.h>
-#include <net/bpf.h>
+#include <getopt.h>
+#include <sys/stat.h>
 #include "common.h"
 #include "options.h"
+#include "capture_source.h"
+#include "capture_writer.h"
+#include "pipeline.h"
+#include "flow_table.h"
+#include "tcp_reassembly.h"
+#include "sketches.h"
+#include "matcher.h"
+#include "ip_defrag.h"
+#include "large_buffer.h"
+#include "metrics.h"
+#include "sniffer.h"
+#include "injector.h"
+#include "replay.h"
+#include "filter.h"
+#include "signals.h"
 #include "ethernet_frame.h"
+#include "frame_descriptor.h"
 #include "logger.h"
 #include "limits.h"
 
-static void parseArguments(int argc, char** argv);
-static void initializeDevice(int* descriptor, int* bpf_buff_size);
-static void sniff(int bpf, int bpf_buff_size);
-static void deinitializeDevice(int bpf);
-static void signalHandler(int sig_num);
+#define FLOW_CLOSED_TIMEOUT     5
+#define DEFRAG_MAX_DATAGRAMS    4096
+#define OUTPUT_BUFFER_SIZE      4096
+
+/**
+ * Identifiers for options that only have a long form.
+ */
+enum LongOnlyOptions {
+    OPT_RING_BLOCK_SIZE = 256,
+    OPT_RING_BLOCK_COUNT,
+    OPT_RING_BLOCK_TIMEOUT,
+    OPT_READ_TIMEOUT,
+    OPT_MERGE_WINDOW,
+    OPT_CAPTURE_MODE,
+    OPT_DUMP_FORMAT,
+    OPT_OUTPUT_FORMAT,
+    OPT_PREALLOCATE,
+    OPT_ENCODERS,
+    OPT_INDEX,
+    OPT_QUERY,
+    OPT_WORKERS,
+    OPT_QUEUE_SIZE,
+    OPT_CPU_AFFINITY,
+    OPT_FANOUT,
+    OPT_FANOUT_MODE,
+    OPT_FLOWS,
+    OPT_FLOW_LIMIT,
+    OPT_FLOW_TIMEOUT,
+    OPT_SKETCH,
+    OPT_SKETCH_MEMORY,
+    OPT_SKETCH_INTERVAL,
+    OPT_TOP,
+    OPT_MATCH,
+    OPT_MATCH_NOCASE,
+    OPT_MATCH_STREAMS,
+    OPT_REASSEMBLE,
+    OPT_REASSEMBLY_MEMORY,
+    OPT_STREAM_LIMIT,
+    OPT_DEFRAGMENT,
+    OPT_DEFRAG_MEMORY,
+    OPT_DEFRAG_TIMEOUT,
+    OPT_VERIFY_CHECKSUMS,
+    OPT_FLIGHT_RECORDER,
+    OPT_RECORDER_SIZE,
+    OPT_RECORDER_SECONDS,
+    OPT_TRIGGER,
+    OPT_STATS_INTERVAL,
+    OPT_STATS_SOCKET,
+    OPT_INJECT,
+    OPT_SPEED,
+    OPT_PPS,
+    OPT_TOP_SPEED,
+    OPT_LOOP,
+    OPT_GENERATE,
+    OPT_COUNT,
+    OPT_LOG_MODE,
+    OPT_LOG_OVERFLOW
+};
+
+static const char* usage =
+    "USAGE:\tsocker [-h][-d][-o output_file][-i interface_name ... | -r input_file][-f filter_expression]\n"
+    "\t\t[-C file_size_mb][-G rotate_seconds][--output-format pcap|pcapng|compact][--preallocate mb]\n"
+    "\t\t[--encoders count][--index][--query query]\n"
+    "\t\t[--ring-block-size bytes][--ring-block-count count][--ring-block-timeout ms]\n"
+    "\t\t[--read-timeout ms][--capture-mode latency|batch][--dump-format hex|hex-ascii|none]\n"
+    "\t\t[--merge-window ms]\n"
+    "\t\t[--workers count][--queue-size bytes][--cpu-affinity cpu,cpu,...]\n"
+    "\t\t[--fanout count][--fanout-mode hash|cpu|rollover]\n"
+    "\t\t[--flows][--flow-limit count][--flow-timeout seconds]\n"
+    "\t\t[--sketch][--sketch-memory kb][--sketch-interval seconds][--top count]\n"
+    "\t\t[--match pattern_file][--match-nocase][--match-streams]\n"
+    "\t\t[--reassemble directory][--reassembly-memory mb][--stream-limit count]\n"
+    "\t\t[--defragment][--defrag-memory mb][--defrag-timeout seconds][--verify-checksums]\n"
+    "\t\t[--flight-recorder file][--recorder-size mb][--recorder-seconds seconds][--trigger expression]\n"
+    "\t\t[--stats-interval seconds][--stats-socket path]\n"
+    "\t\t[--inject interface_name][--speed multiplier | --pps rate | --top-speed][--loop count]\n"
+    "\t\t[--generate template ...][--count frames]\n"
+    "\t\t[--log-mode sync|async][--log-overflow drop|block]\n";
+
+static const struct option longOptions[] = {
+    { "help",               no_argument,        NULL,   'h' },
+    { "output",             required_argument,  NULL,   'o' },
+    { "interface",          required_argument,  NULL,   'i' },
+    { "read",               required_argument,  NULL,   'r' },
+    { "filter",             required_argument,  NULL,   'f' },
+    { "dump-filter",        no_argument,        NULL,   'd' },
+    { "ring-block-size",    required_argument,  NULL,   OPT_RING_BLOCK_SIZE },
+    { "ring-block-count",   required_argument,  NULL,   OPT_RING_BLOCK_COUNT },
+    { "ring-block-timeout", required_argument,  NULL,   OPT_RING_BLOCK_TIMEOUT },
+    { "read-timeout",       required_argument,  NULL,   OPT_READ_TIMEOUT },
+    { "merge-window",       required_argument,  NULL,   OPT_MERGE_WINDOW },
+    { "capture-mode",       required_argument,  NULL,   OPT_CAPTURE_MODE },
+    { "dump-format",        required_argument,  NULL,   OPT_DUMP_FORMAT },
+    { "file-size",          required_argument,  NULL,   'C' },
+    { "rotate-seconds",     required_argument,  NULL,   'G' },
+    { "output-format",      required_argument,  NULL,   OPT_OUTPUT_FORMAT },
+    { "preallocate",        required_argument,  NULL,   OPT_PREALLOCATE },
+    { "encoders",           required_argument,  NULL,   OPT_ENCODERS },
+    { "index",              no_argument,        NULL,   OPT_INDEX },
+    { "query",              required_argument,  NULL,   OPT_QUERY },
+    { "workers",            required_argument,  NULL,   OPT_WORKERS },
+    { "queue-size",         required_argument,  NULL,   OPT_QUEUE_SIZE },
+    { "cpu-affinity",       required_argument,  NULL,   OPT_CPU_AFFINITY },
+    { "fanout",             required_argument,  NULL,   OPT_FANOUT },
+    { "fanout-mode",        required_argument,  NULL,   OPT_FANOUT_MODE },
+    { "flows",              no_argument,        NULL,   OPT_FLOWS },
+    { "flow-limit",         required_argument,  NULL,   OPT_FLOW_LIMIT },
+    { "flow-timeout",       required_argument,  NULL,   OPT_FLOW_TIMEOUT },
+    { "sketch",             no_argument,        NULL,   OPT_SKETCH },
+    { "sketch-memory",      required_argument,  NULL,   OPT_SKETCH_MEMORY },
+    { "sketch-interval",    required_argument,  NULL,   OPT_SKETCH_INTERVAL },
+    { "top",                required_argument,  NULL,   OPT_TOP },
+    { "match",              required_argument,  NULL,   OPT_MATCH },
+    { "match-nocase",       no_argument,        NULL,   OPT_MATCH_NOCASE },
+    { "match-streams",      no_argument,        NULL,   OPT_MATCH_STREAMS },
+    { "reassemble",         required_argument,  NULL,   OPT_REASSEMBLE },
+    { "reassembly-memory",  required_argument,  NULL,   OPT_REASSEMBLY_MEMORY },
+    { "stream-limit",       required_argument,  NULL,   OPT_STREAM_LIMIT },
+    { "defragment",         no_argument,        NULL,   OPT_DEFRAGMENT },
+    { "defrag-memory",      required_argument,  NULL,   OPT_DEFRAG_MEMORY },
+    { "defrag-timeout",     required_argument,  NULL,   OPT_DEFRAG_TIMEOUT },
+    { "verify-checksums",   no_argument,        NULL,   OPT_VERIFY_CHECKSUMS },
+    { "flight-recorder",    required_argument,  NULL,   OPT_FLIGHT_RECORDER },
+    { "recorder-size",      required_argument,  NULL,   OPT_RECORDER_SIZE },
+    { "recorder-seconds",   required_argument,  NULL,   OPT_RECORDER_SECONDS },
+    { "trigger",            required_argument,  NULL,   OPT_TRIGGER },
+    { "stats-interval",     required_argument,  NULL,   OPT_STATS_INTERVAL },
+    { "stats-socket",       required_argument,  NULL,   OPT_STATS_SOCKET },
+    { "inject",             required_argument,  NULL,   OPT_INJECT },
+    { "speed",              required_argument,  NULL,   OPT_SPEED },
+    { "pps",                required_argument,  NULL,   OPT_PPS },
+    { "top-speed",          no_argument,        NULL,   OPT_TOP_SPEED },
+    { "loop",               required_argument,  NULL,   OPT_LOOP },
+    { "generate",           required_argument,  NULL,   OPT_GENERATE },
+    { "count",              required_argument,  NULL,   OPT_COUNT },
+    { "log-mode",           required_argument,  NULL,   OPT_LOG_MODE },
+    { "log-overflow",       required_argument,  NULL,   OPT_LOG_OVERFLOW },
+    { NULL,                 0,                  NULL,   0 }
+};
 
-static bool running = true;
+/**
+ * A capture thread of its own for each socket of a fanout group.
+ */
+typedef struct FanoutWorker {
+    pthread_t thread;
+    SniffContext context;
+} FanoutWorker;
+
+static void parseArguments(int argc, char** argv);
+static Filter* compileFilter();
+static CaptureSource* openSource(const Filter* filter);
+static FlowTable* openFlowTable();
+static void closeFlowTable(FlowTable* flows);
+static TcpReassembler* openReassembler(UINT share, const Matcher* matcher);
+static void closeReassembler(TcpReassembler* streams);
+static void sniff(const Filter* filter, MetricsCounters* total);
+static void sniffFanout(const Filter* filter, const Matcher* matcher, MetricsCounters* total);
+static void* fanoutLoop(void* arg);
+static void logStats(const char* name, const MetricsCounters* counters);
+static void inject(const Filter* filter);
+static void generate();
 
 int main(int argc, char** argv) {
-    int bpf, bpf_buff_size;
+    MetricsCounters total;
+    Filter* filter;
+    bool captured = false;
 
     // Make sure that our assumptions about the configuration this program has
     // been compiled and run against are correct and fatal if not
@@ -35,7 +200,7 @@ int main(int argc, char** argv) {
 
     // Specify a signal handler to catch various signals (like those sent when
     // Ctrl+C is pressed)
-    signal(SIGINT, signalHandler); 
+    Signals_install();
 
     // Set up the logger with some default settings
     setLoggerOptions(LL_TRACE, LO_NOLABEL);
@@ -45,11 +210,45 @@ int main(int argc, char** argv) {
     // options
     parseArguments(argc, argv);
 
-    // Initialize a BPF device for the specified interface and run the main
-    // program
-    initializeDevice(&bpf, &bpf_buff_size);
-    sniff(bpf, bpf_buff_size);
-    deinitializeDevice(bpf);
+    // Hand logging off to a background thread if asked to (it is stopped, and
+    // everything logged is written out, at exit)
+    if (Options_getLogMode() == LM_ASYNC) {
+        startAsyncLogger(Options_getLogOverflow());
+    }
+
+    // Compile the filter (if one was specified)
+    filter = compileFilter();
+
+    // Stop right there if all that was asked for is a look at the compiled
+    // program or an index of the input file, replay the input file (or
+    // generate frames) onto an interface if asked to, and otherwise sniff
+    if (Options_getDumpFilter()) {
+        Filter_dump(filter);
+    } else if (Options_getIndex() && !*Options_getOutputFile()) {
+        CaptureSource_indexFile(Options_getInputFile());
+    } else if (*Options_getInjectInterface()) {
+        if (Options_getTemplateCount() > 0) {
+            generate();
+        } else {
+            inject(filter);
+        }
+    } else {
+        sniff(filter, &total);
+        captured = true;
+    }
+
+    // Stop keeping an eye on the capture (if anything did) and sum it up
+    Metrics_stop();
+
+    if (captured) {
+        logStats("Captured", &total);
+    }
+
+    LargeBuffer_logUsage();
+
+    if (filter != NULL) {
+        Filter_free(filter);
+    }
 
     return 0;
 }
@@ -62,10 +261,10 @@ static void parseArguments(int argc, char** argv) {
     int i;
 
     // Parse arguments into the options struct
-    while ((i = getopt(argc, argv, "ho:i:")) != -1) {
+    while ((i = getopt_long(argc, argv, "hdo:i:r:f:C:G:", longOptions, NULL)) != -1) {
         switch (i) {
             case 'h':
-                output(NULL, "USAGE:\tsocker [-h][-o output_file][-i interface_name]\n");
+                fputs(usage, stdout);
                 exit(0);
 
             case 'o':
@@ -73,11 +272,227 @@ static void parseArguments(int argc, char** argv) {
                 break;
             
             case 'i':
-                Options_setInterfaceName(optarg);
+                Options_addInterfaceName(optarg);
+                break;
+
+            case 'r':
+                Options_setInputFile(optarg);
+                break;
+
+            case 'f':
+                Options_setFilterExpression(optarg);
+                break;
+
+            case 'd':
+                Options_setDumpFilter(true);
+                break;
+
+            case OPT_RING_BLOCK_SIZE:
+                Options_setRingBlockSize(optarg);
+                break;
+
+            case OPT_RING_BLOCK_COUNT:
+                Options_setRingBlockCount(optarg);
+                break;
+
+            case OPT_RING_BLOCK_TIMEOUT:
+                Options_setRingBlockTimeout(optarg);
+                break;
+
+            case OPT_READ_TIMEOUT:
+                Options_setReadTimeout(optarg);
+                break;
+
+            case OPT_MERGE_WINDOW:
+                Options_setMergeWindow(optarg);
+                break;
+
+            case OPT_CAPTURE_MODE:
+                Options_setCaptureMode(optarg);
+                break;
+
+            case OPT_DUMP_FORMAT:
+                Options_setDumpFormat(optarg);
+                break;
+
+            case 'C':
+                Options_setRotateSize(optarg);
+                break;
+
+            case 'G':
+                Options_setRotateSeconds(optarg);
+                break;
+
+            case OPT_OUTPUT_FORMAT:
+                Options_setOutputFormat(optarg);
+                break;
+
+            case OPT_PREALLOCATE:
+                Options_setPreallocateSize(optarg);
+                break;
+
+            case OPT_ENCODERS:
+                Options_setEncoders(optarg);
+                break;
+
+            case OPT_INDEX:
+                Options_setIndex(true);
+                break;
+
+            case OPT_QUERY:
+                Options_setQuery(optarg);
+                break;
+
+            case OPT_WORKERS:
+                Options_setWorkers(optarg);
+                break;
+
+            case OPT_QUEUE_SIZE:
+                Options_setQueueSize(optarg);
+                break;
+
+            case OPT_CPU_AFFINITY:
+                Options_setCpuAffinity(optarg);
+                break;
+
+            case OPT_FANOUT:
+                Options_setFanoutCount(optarg);
+                break;
+
+            case OPT_FANOUT_MODE:
+                Options_setFanoutMode(optarg);
+                break;
+
+            case OPT_FLOWS:
+                Options_setFlows(true);
+                break;
+
+            case OPT_FLOW_LIMIT:
+                Options_setFlowLimit(optarg);
+                break;
+
+            case OPT_FLOW_TIMEOUT:
+                Options_setFlowTimeout(optarg);
+                break;
+
+            case OPT_SKETCH:
+                Options_setSketches(true);
+                break;
+
+            case OPT_SKETCH_MEMORY:
+                Options_setSketchMemory(optarg);
+                break;
+
+            case OPT_SKETCH_INTERVAL:
+                Options_setSketchInterval(optarg);
+                break;
+
+            case OPT_TOP:
+                Options_setTopCount(optarg);
+                break;
+
+            case OPT_MATCH:
+                Options_setMatchFile(optarg);
+                break;
+
+            case OPT_MATCH_NOCASE:
+                Options_setMatchIgnoreCase(true);
+                break;
+
+            case OPT_MATCH_STREAMS:
+                Options_setMatchStreams(true);
+                break;
+
+            case OPT_REASSEMBLE:
+                Options_setReassemblyDirectory(optarg);
+                break;
+
+            case OPT_REASSEMBLY_MEMORY:
+                Options_setReassemblyMemory(optarg);
+                break;
+
+            case OPT_STREAM_LIMIT:
+                Options_setStreamLimit(optarg);
+                break;
+
+            case OPT_DEFRAGMENT:
+                Options_setDefragment(true);
+                break;
+
+            case OPT_DEFRAG_MEMORY:
+                Options_setDefragMemory(optarg);
+                break;
+
+            case OPT_DEFRAG_TIMEOUT:
+                Options_setDefragTimeout(optarg);
+                break;
+
+            case OPT_VERIFY_CHECKSUMS:
+                Options_setVerifyChecksums(true);
+                break;
+
+            case OPT_FLIGHT_RECORDER:
+                Options_setRecorderFile(optarg);
+                break;
+
+            case OPT_RECORDER_SIZE:
+                Options_setRecorderSize(optarg);
+                break;
+
+            case OPT_RECORDER_SECONDS:
+                Options_setRecorderSeconds(optarg);
+                break;
+
+            case OPT_TRIGGER:
+                Options_setTriggerExpression(optarg);
+                break;
+
+            case OPT_STATS_INTERVAL:
+                Options_setStatsInterval(optarg);
+                break;
+
+            case OPT_STATS_SOCKET:
+                Options_setStatsSocket(optarg);
+                break;
+
+            case OPT_INJECT:
+                Options_setInjectInterface(optarg);
+                break;
+
+            case OPT_SPEED:
+                Options_setReplaySpeed(optarg);
+                break;
+
+            case OPT_PPS:
+                Options_setReplayRate(optarg);
+                break;
+
+            case OPT_TOP_SPEED:
+                Options_setReplayTopSpeed();
+                break;
+
+            case OPT_LOOP:
+                Options_setLoopCount(optarg);
+                break;
+
+            case OPT_GENERATE:
+                Options_addTemplate(optarg);
+                break;
+
+            case OPT_COUNT:
+                Options_setGenerateCount(optarg);
+                break;
+
+            case OPT_LOG_MODE:
+                Options_setLogMode(optarg);
+                break;
+
+            case OPT_LOG_OVERFLOW:
+                Options_setLogOverflow(optarg);
                 break;
             
             default:
-                fatal("Invalid option specified (-%c).", optopt);
+                fatal("Invalid option specified (%s).", argv[optind - 1]);
         }
     }
 
@@ -86,142 +501,369 @@ static void parseArguments(int argc, char** argv) {
 }
 
 /**
- * Attempts to grab a descriptor to a valid BPF device from the system and
- * initialize it.
+ * Compiles the filter expression from the options, if there is one.
  */
-static void initializeDevice(int* descriptor, int* bpf_buff_size) {
-    int i, buffer_int, bpf;
-    char buffer_char[11] = { 0 };
-    struct ifreq bound_if;
-
-    // Attempt to open the next available Berkley Packet Filter device (BPF)
-    for (i = 0; i < MAX_BPF_DEVICES; i++) {
-        // Generate the path to the next possible BPF
-        sprintf(buffer_char, "/dev/bpf%u", i);
-
-        // Attempt to open the next possible BPF; If we don't fail, we have
-        //  succeeded in finding an available one
-        bpf = open(buffer_char, O_RDWR | O_NONBLOCK);
-        
-        if (bpf != -1) {
-            break;
-        } else if (errno == EACCES) {
-            fatal("The system is denying permission to its BPF devices. Make sure propper permissions are being used "
-                    "(e.g. root).");
-        }
+static Filter* compileFilter() {
+    if (!*Options_getFilterExpression()) {
+        return NULL;
     }
 
-    if (bpf == -1) {
-        fatal("Failed to open a BPF device after %d tries. The error on the final attempt was \"%s\".", MAX_BPF_DEVICES,
-                strerror(errno));
+    return Filter_compile(Options_getFilterExpression());
+}
+
+/**
+ * Opens whichever capture source the options call for: a capture file if an
+ * input file was specified (of which only the frames that match the query are
+ * read, if there is one), and the system's live capture facility otherwise
+ * (on each interface that was specified, merged into one source if there are
+ * several of them).
+ */
+static CaptureSource* openSource(const Filter* filter) {
+    CaptureSource* sources[MAX_INTERFACES];
+    UINT i;
+
+    if (*Options_getInputFile()) {
+        return CaptureSource_queryFile(Options_getInputFile(), filter, *Options_getQuery() ? Options_getQuery() : NULL);
+    }
+
+    if (Options_getInterfaceCount() == 1) {
+        return CaptureSource_openDevice(Options_getInterfaceName(0), filter);
+    }
+
+    for (i = 0; i < Options_getInterfaceCount(); i++) {
+        sources[i] = CaptureSource_openDevice(Options_getInterfaceName(i), filter);
     }
-    else {
-        info("Opened the BPF device at %s (file descriptor = %d).", buffer_char, bpf);
+
+    return CaptureSource_openMerged(sources, Options_getInterfaceCount(), Options_getMergeWindow());
+}
+
+/**
+ * Creates a flow table that prints each flow as it leaves the table (with a
+ * TextBuffer of its own to put the lines together in), if the options call for
+ * flows to be tracked, and returns NULL otherwise.
+ */
+static FlowTable* openFlowTable() {
+    if (!Options_getFlows()) {
+        return NULL;
     }
 
-    // Associate with a particular network interface
-    strcpy(bound_if.ifr_name, Options_getInterfaceName());
-    if(ioctl(bpf, BIOCSETIF, &bound_if) == -1) {
-        fatal("Failed to associate the BPF device with the network interface \"%s\". (%i: %s)",
-                Options_getInterfaceName(), errno, strerror(errno));
+    return FlowTable_new(Options_getFlowLimit(), Options_getFlowTimeout(), FLOW_CLOSED_TIMEOUT, Flow_output,
+            TextBuffer_new(OUTPUT_BUFFER_SIZE));
+}
+
+/**
+ * Prints every flow still in the provided flow table (if there is one) and then
+ * frees it, along with its TextBuffer.
+ */
+static void closeFlowTable(FlowTable* flows) {
+    TextBuffer* text;
+
+    if (flows == NULL) {
+        return;
     }
-    else {
-        info("Associated the BPF device with the network interface \"%s\".", Options_getInterfaceName());
+
+    text = (TextBuffer*) FlowTable_getContext(flows);
+    FlowTable_flush(flows);
+    FlowTable_free(flows);
+    TextBuffer_free(text);
+}
+
+/**
+ * Creates a TCP reassembler that writes each stream out to files in the
+ * reassembly directory, or that looks for the patterns of the provided Matcher
+ * across each stream, if the options call for one, and returns NULL otherwise.
+ * The reassembler gets the provided share of the stream limit and reassembly
+ * memory.
+ */
+static TcpReassembler* openReassembler(UINT share, const Matcher* matcher) {
+    char* directory = Options_getReassemblyDirectory();
+    StreamMatchContext* match;
+
+    if (Options_getMatchStreams()) {
+        if ((match = (StreamMatchContext*) calloc(1, sizeof(StreamMatchContext))) == NULL) {
+            fatal("Failed to allocate the context of a stream matcher.");
+        }
+
+        match->matcher = matcher;
+        match->text = TextBuffer_new(OUTPUT_BUFFER_SIZE);
+
+        return TcpReassembler_new((Options_getStreamLimit() + share - 1) / share,
+                Options_getReassemblyMemory() / share, Options_getFlowTimeout(), TcpStream_match, match);
     }
 
-    // Turn on "immediate" mode
-    // NOTE ~> This means that blocking reads will return as soon as new socket
-    //  data is available rather than when the read buffer is full or a timeout
-    //  occurs.
-    buffer_int = 1;
-    if (ioctl(bpf, BIOCIMMEDIATE, &buffer_int) == -1) {
-        fatal("Failed to turn on the BPF device's \"immediate\" mode. (%i: %s)", errno, strerror(errno));
+    if (!*directory) {
+        return NULL;
     }
-    else {
-        info("Turned on the BPF device's \"immediate\" mode.");
+
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        fatal("Failed to create the reassembly directory \"%s\". (%i: %s)", directory, errno, strerror(errno));
     }
 
-    // Get the buffer length (so that we can traverse multiple entries when
-    //  reading from the BPF)
-    if (ioctl(bpf, BIOCGBLEN, bpf_buff_size) == -1) {
-        fatal("Failed to retrieve the BPF device's buffer length. (%i: %s)", errno, strerror(errno));
+    return TcpReassembler_new((Options_getStreamLimit() + share - 1) / share, Options_getReassemblyMemory() / share,
+            Options_getFlowTimeout(), TcpStream_writeFiles, directory);
+}
+
+/**
+ * Ends every stream still in the provided TCP reassembler (if there is one) and
+ * then frees it, along with the context of its matcher if it has one.
+ */
+static void closeReassembler(TcpReassembler* streams) {
+    StreamMatchContext* match;
+
+    if (streams == NULL) {
+        return;
     }
-    else {
-        info("Retrieved the BPF device's buffer length (%i bytes).", *bpf_buff_size);
+
+    TcpReassembler_flush(streams);
+
+    if (Options_getMatchStreams()) {
+        match = (StreamMatchContext*) TcpReassembler_getContext(streams);
+        TextBuffer_free(match->text);
+        free(match);
     }
 
-    // Place the BPF's descriptor into the provided variable reference
-    *descriptor = bpf;
+    TcpReassembler_free(streams);
 }
 
 /**
- * Actually sniffs and logs packets.
+ * Sniffs with the provided filter (which may be NULL) in whatever way the
+ * options call for, until the capture ends or is stopped, and adds up the
+ * counters of every capturing thread into the provided totals.
  */
-static void sniff(int bpf, int bpf_buff_size) {
-    EthernetFrame* ethernet_frame;
-    struct bpf_hdr* bpf_buffer = malloc(bpf_buff_size * sizeof(OCTET));
-    struct bpf_hdr* bpf_packet;
-    int read_bytes = 0;
-
-    while (running) {
-        // Clean the buffer
-        memset(bpf_buffer, 0x00, bpf_buff_size);
-
-        // Read the buffer
-        if((read_bytes = read(bpf, bpf_buffer, bpf_buff_size)) > 0) {
-            // Get a generic octet pointer to the buffer
-            OCTET* ptr = (OCTET*) bpf_buffer;
-
-            // While there are still unproccessed Ethernet Frames in the
-            // buffer...
-            while (ptr < (((OCTET*) bpf_buffer) + read_bytes)) {
-                // Grab pointers to both the BPF header for the Ethernet Frame
-                // and the Ethernet Frame itself
-                bpf_packet = (struct bpf_hdr*) ptr;
-                ethernet_frame = (EthernetFrame*)((OCTET*) bpf_packet + bpf_packet->bh_hdrlen);
-
-                // Process and output the Ethernet Frame
-                EthernetFrame_output(ethernet_frame, bpf_packet->bh_caplen);
-
-                // Jump ahead to the next Ethernet Frame that is in the buffer
-                // NOTE ~> This algorithm does not currently support Ethernet
-                //  Frames that might only be partially in the buffer (due to
-                //  trunctaion by the BPF).
-                ptr += BPF_WORDALIGN(bpf_packet->bh_hdrlen + bpf_packet->bh_caplen);
+static void sniff(const Filter* filter, MetricsCounters* total) {
+    SniffContext context;
+    Matcher* matcher = NULL;
+    Filter* trigger = NULL;
+    UINT i;
+
+    memset(&context, 0x00, sizeof(context));
+
+    // Start keeping an eye on how the capture is going if asked to (by logging
+    // a summary every so often, serving snapshots on a socket, or both)
+    Metrics_start(Options_getStatsInterval(), Options_getStatsSocket());
+
+    // Compile the patterns that frames (or streams) have to contain, if there
+    // are any
+    if (*Options_getMatchFile()) {
+        matcher = Matcher_load(Options_getMatchFile(), Options_getMatchIgnoreCase());
+    }
+
+    // Spread the interface over several sockets and threads if asked to, and
+    // otherwise open a capture source for the specified interface(s) or file (and
+    // a writer for the output file, a flight recorder, a pipeline, a
+    // defragmenter, a flow table, a TCP reassembler or sketches, if called for)
+    // and run the main program
+    if (Options_getFanoutCount() > 0) {
+        memset(total, 0x00, sizeof(*total));
+        sniffFanout(filter, matcher, total);
+    } else {
+        context.source = openSource(filter);
+        context.counters = Metrics_register("capture");
+
+        if (*Options_getOutputFile()) {
+            context.writer = CaptureWriter_open(Options_getOutputFile(), Options_getOutputFormat(),
+                    Options_getWriterLimits());
+
+            for (i = 0; i < Options_getInterfaceCount(); i++) {
+                CaptureWriter_addInterface(context.writer, Options_getInterfaceName(i));
+            }
+        }
+
+        if (*Options_getRecorderFile()) {
+            context.recorder = FlightRecorder_new(Options_getRecorderFile(), Options_getOutputFormat(),
+                    Options_getRecorderSize(), Options_getRecorderSeconds());
+
+            for (i = 0; i < Options_getInterfaceCount(); i++) {
+                FlightRecorder_addInterface(context.recorder, Options_getInterfaceName(i));
+            }
+
+            if (*Options_getTriggerExpression()) {
+                context.trigger = trigger = Filter_compile(Options_getTriggerExpression());
             }
         }
+
+        if (Options_getPipelineConfig()->num_workers > 0) {
+            context.pipeline = Pipeline_start(Options_getPipelineConfig());
+        }
+
+        if (Options_getDefragment()) {
+            context.fragments = Defragmenter_new(DEFRAG_MAX_DATAGRAMS, Options_getDefragMemory(),
+                    Options_getDefragTimeout());
+        }
+
+        context.flows = openFlowTable();
+        context.streams = openReassembler(1, matcher);
+        context.matcher = Options_getMatchStreams() ? NULL : matcher;
+        context.verify_checksums = Options_getVerifyChecksums();
+
+        if (Options_getSketches()) {
+            context.sketches = Sketches_new(Options_getSketchMemory(), Options_getTopCount(),
+                    Options_getSketchInterval());
+        }
+
+        Sniffer_run(&context);
+        CaptureSource_close(context.source);
+
+        if (context.writer != NULL) {
+            CaptureWriter_close(context.writer);
+        }
+
+        if (context.recorder != NULL) {
+            FlightRecorder_free(context.recorder);
+        }
+
+        if (context.pipeline != NULL) {
+            Pipeline_stop(context.pipeline);
+        }
+
+        if (context.fragments != NULL) {
+            Defragmenter_free(context.fragments);
+        }
+
+        closeFlowTable(context.flows);
+        closeReassembler(context.streams);
+
+        if (context.sketches != NULL) {
+            Sketches_flush(context.sketches);
+            Sketches_free(context.sketches);
+        }
+
+        *total = *context.counters;
+    }
+
+    if (matcher != NULL) {
+        Matcher_free(matcher);
     }
 
-    // Clean up after ourselves
-    // NOTE ~> This should happen automatically, but better be safe than sorry.
-    free(bpf_buffer);
+    if (trigger != NULL) {
+        Filter_free(trigger);
+    }
 }
 
 /**
- * Closes the open BPF device at the provided dscriptor.
+ * Opens as many sockets on the specified interface as asked for, all in one
+ * fanout group so that the kernel spreads the interface's frames over them,
+ * and sniffs each one on a thread of its own (with a flow table and TCP
+ * reassembler of its own if called for, since hashing sends every frame of a
+ * flow to the same socket). Returns once every thread has stopped, with the
+ * counters of all of them added up in the provided MetricsCounters.
  */
-static void deinitializeDevice(int bpf) {
-    close(bpf);
-    info("Closed BPF device with file descriptor %d", bpf);
+static void sniffFanout(const Filter* filter, const Matcher* matcher, MetricsCounters* total) {
+    UINT count = Options_getFanoutCount();
+    FanoutWorker* workers = (FanoutWorker*) calloc(count, sizeof(FanoutWorker));
+    int group = FANOUT_NEW_GROUP;
+    char name[32];
+    UINT i;
+
+    if (workers == NULL) {
+        fatal("Failed to allocate the fanout workers.");
+    }
+
+    // NOTE ~> Every socket has to be in the group before any of them is read
+    //  from, otherwise the first ones would briefly see everything.
+    for (i = 0; i < count; i++) {
+        workers[i].context.source = CaptureSource_openDeviceFanout(Options_getInterfaceName(0), filter,
+                Options_getFanoutMode(), &group);
+        workers[i].context.flows = openFlowTable();
+        workers[i].context.streams = openReassembler(count, matcher);
+        workers[i].context.matcher = Options_getMatchStreams() ? NULL : matcher;
+        workers[i].context.verify_checksums = Options_getVerifyChecksums();
+
+        snprintf(name, sizeof(name), "fanout-%u", i);
+        workers[i].context.counters = Metrics_register(name);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (Signals_createThread(&workers[i].thread, fanoutLoop, &workers[i]) != 0) {
+            fatal("Failed to start the capture thread for fanout socket %u.", i);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        pthread_join(workers[i].thread, NULL);
+
+        CaptureSource_close(workers[i].context.source);
+        closeFlowTable(workers[i].context.flows);
+        closeReassembler(workers[i].context.streams);
+
+        snprintf(name, sizeof(name), "Fanout socket %u:", i);
+        logStats(name, workers[i].context.counters);
+        Metrics_sum(total, workers[i].context.counters);
+    }
+
+    free(workers);
+}
+
+/**
+ * Body of the capture thread of a single fanout socket.
+ */
+static void* fanoutLoop(void* arg) {
+    FanoutWorker* worker = (FanoutWorker*) arg;
+
+    Sniffer_run(&worker->context);
+
+    return NULL;
+}
+
+/**
+ * Logs the provided capture counters under the provided name. Bad checksums
+ * are logged as a warning so that they stand out.
+ */
+static void logStats(const char* name, const MetricsCounters* counters) {
+    info("%s %lu frames (%lu bytes), %lu dropped by the kernel, %lu rejected by the filter.", name,
+            (ULONG) counters->frames, (ULONG) counters->octets, (ULONG) counters->drops, (ULONG) counters->filtered);
+
+    if (counters->bad_network_checksums > 0 || counters->bad_transport_checksums > 0) {
+        warn("%s %lu frames with verified checksums, %lu with a bad IPv4 header checksum, %lu with a bad TCP, UDP or "
+                "ICMP checksum.", name, (ULONG) counters->verified, (ULONG) counters->bad_network_checksums,
+                (ULONG) counters->bad_transport_checksums);
+    } else if (Options_getVerifyChecksums()) {
+        info("%s %lu frames with verified checksums, none of them bad.", name, (ULONG) counters->verified);
+    }
+}
+
+/**
+ * Replays the frames of the input file (those that match the provided Filter,
+ * if there is one) onto the interface that frames are to be injected onto, as
+ * many times over and at whatever pace was asked for.
+ */
+static void inject(const Filter* filter) {
+    CaptureSource* source = openSource(filter);
+    Injector* injector = Injector_openDevice(Options_getInjectInterface());
+    Replayer* replayer = Replayer_new(injector, Options_getReplayPace());
+    UINT i;
+
+    for (i = 0; i < Options_getLoopCount() && !Signals_stopRequested(); i++) {
+        if (i > 0 && !CaptureSource_rewind(source)) {
+            fatal("The input cannot be replayed more than once.");
+        }
+
+        Replayer_run(replayer, source);
+    }
+
+    Replayer_free(replayer);
+    Injector_close(injector);
+    CaptureSource_close(source);
 }
 
 /**
- * Provides overriden signal handling specific to this program's use cases for
- * registered signals.
+ * Generates frames from the templates that were specified onto the interface
+ * that frames are to be injected onto, as many of them and at whatever pace
+ * was asked for.
  */
-static void signalHandler(int sig_num) {
-    // Reset the signal handler
-    // NOTE ~> This is mainly for cases where we might not actually end the
-    //  program here so that we are able to catch it next time.
-    signal(SIGINT, signalHandler); 
-
-    // Handle possible signals
-    switch (sig_num) {
-        case SIGINT:
-            running = false;
-            break;
-
-        default:
-            break;
-    }
-}
\ No newline at end of file
+static void generate() {
+    Injector* injector = Injector_openDevice(Options_getInjectInterface());
+    Generator* generator = Generator_new(Injector_getMaxLength(injector), Injector_getSlotCount(injector));
+    Replayer* replayer = Replayer_new(injector, Options_getReplayPace());
+    UINT i;
+
+    for (i = 0; i < Options_getTemplateCount(); i++) {
+        Generator_addTemplate(generator, Options_getTemplate(i));
+    }
+
+    Replayer_generate(replayer, generator, Options_getGenerateCount());
+
+    Replayer_free(replayer);
+    Generator_free(generator);
+    Injector_close(injector);
+}
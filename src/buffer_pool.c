@@ -0,0 +1,216 @@
+#include "buffer_pool.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "large_buffer.h"
+#include "logger.h"
+
+#define CACHE_LINE_SIZE 64
+#define SLAB_SIZE       (2 << 20)
+
+/**
+ * A block that isn't handed out, linked into the free list through its own
+ * first octets.
+ */
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+struct BufferPool {
+    size_t block_size;
+    size_t blocks_per_slab;
+
+    /**
+     * Number of blocks carved from slabs so far, and how many there can be at
+     * most (which is what caps the pool's memory).
+     */
+    size_t num_blocks;
+    size_t max_blocks;
+
+    /**
+     * Every slab allocated so far, and how many there can be at most. Every
+     * slab but the last one holds blocks_per_slab blocks.
+     */
+    OCTET** slabs;
+    size_t num_slabs;
+    size_t max_slabs;
+
+    FreeBlock* free_blocks;
+    size_t num_free;
+
+    /**
+     * Number of blocks handed out right now, and the most there ever were.
+     */
+    size_t num_used;
+    size_t peak_used;
+};
+
+static bool addSlab(BufferPool* o);
+static size_t getSlabBlocks(const BufferPool* o, size_t slab);
+static size_t getSlabSize(const BufferPool* o, size_t slab);
+
+/**
+ * Allocates a new, empty BufferPool of blocks of (at least) the provided size,
+ * that never hands out more than the provided number of bytes (but always at
+ * least one block).
+ */
+BufferPool* BufferPool_new(size_t block_size, size_t max_size) {
+    BufferPool* o = (BufferPool*) calloc(1, sizeof(BufferPool));
+
+    if (o == NULL) {
+        fatal("Failed to allocate a buffer pool.");
+    }
+
+    // NOTE ~> Blocks are rounded up to whole cache lines so that no two of
+    //  them share one, and slabs hold at least one block.
+    o->block_size = (block_size + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+    o->blocks_per_slab = (SLAB_SIZE > o->block_size) ? SLAB_SIZE / o->block_size : 1;
+    o->max_blocks = (max_size > o->block_size) ? max_size / o->block_size : 1;
+    o->max_slabs = (o->max_blocks + o->blocks_per_slab - 1) / o->blocks_per_slab;
+
+    if ((o->slabs = (OCTET**) calloc(o->max_slabs, sizeof(OCTET*))) == NULL) {
+        fatal("Failed to allocate a buffer pool.");
+    }
+
+    return o;
+}
+
+/**
+ * Hands out a block from the provided BufferPool, or returns NULL if the pool
+ * has reached its memory cap and has no free blocks left.
+ */
+void* BufferPool_alloc(BufferPool* o) {
+    FreeBlock* block;
+
+    if (o->free_blocks == NULL && !addSlab(o)) {
+        return NULL;
+    }
+
+    block = o->free_blocks;
+    o->free_blocks = block->next;
+    o->num_free--;
+
+    if (++o->num_used > o->peak_used) {
+        o->peak_used = o->num_used;
+    }
+
+    return block;
+}
+
+/**
+ * Hands the provided block back to the provided BufferPool that it came from.
+ */
+void BufferPool_release(BufferPool* o, void* block) {
+    FreeBlock* free_block = (FreeBlock*) block;
+
+    free_block->next = o->free_blocks;
+    o->free_blocks = free_block;
+    o->num_free++;
+    o->num_used--;
+}
+
+/**
+ * Returns the (rounded up) size of the blocks of the provided BufferPool.
+ */
+size_t BufferPool_getBlockSize(const BufferPool* o) {
+    return o->block_size;
+}
+
+/**
+ * Returns the number of blocks that can still be allocated from the provided
+ * BufferPool before it runs out.
+ */
+size_t BufferPool_getAvailable(const BufferPool* o) {
+    return o->num_free + (o->max_blocks - o->num_blocks);
+}
+
+/**
+ * Returns the number of bytes of the provided BufferPool handed out right now.
+ */
+size_t BufferPool_getUsed(const BufferPool* o) {
+    return o->num_used * o->block_size;
+}
+
+/**
+ * Returns the most bytes of the provided BufferPool ever handed out at once.
+ */
+size_t BufferPool_getPeakUsed(const BufferPool* o) {
+    return o->peak_used * o->block_size;
+}
+
+/**
+ * Frees the provided BufferPool, and every block that came from it.
+ */
+void BufferPool_free(BufferPool* o) {
+    size_t i;
+
+    for (i = 0; i < o->num_slabs; i++) {
+        LargeBuffer_free(o->slabs[i], getSlabSize(o, i));
+    }
+
+    free(o->slabs);
+    free(o);
+}
+
+/**
+ * Allocates another slab for the provided BufferPool and puts its blocks on the
+ * free list, unless the pool already has as many blocks as it can.
+ */
+static bool addSlab(BufferPool* o) {
+    size_t blocks, size, i;
+    OCTET* slab;
+
+    if (o->num_slabs == o->max_slabs) {
+        return false;
+    }
+
+    blocks = getSlabBlocks(o, o->num_slabs);
+    size = getSlabSize(o, o->num_slabs);
+
+    if ((slab = (OCTET*) LargeBuffer_alloc(size, ANY_NODE)) == NULL) {
+        fatal("Failed to allocate a %lu byte buffer pool slab.", (ULONG) size);
+    }
+
+    o->slabs[o->num_slabs++] = slab;
+
+    // NOTE ~> Blocks are pushed last to first so that they are handed out in
+    //  address order.
+    for (i = blocks; i > 0; i--) {
+        FreeBlock* block = (FreeBlock*) (slab + ((i - 1) * o->block_size));
+
+        block->next = o->free_blocks;
+        o->free_blocks = block;
+    }
+
+    o->num_blocks += blocks;
+    o->num_free += blocks;
+
+    return true;
+}
+
+/**
+ * Returns the number of blocks that the provided slab of the provided
+ * BufferPool holds: as many as fit, except in the last one, which only holds
+ * what is left under the pool's cap.
+ */
+static size_t getSlabBlocks(const BufferPool* o, size_t slab) {
+    size_t left = o->max_blocks - slab * o->blocks_per_slab;
+
+    return (left < o->blocks_per_slab) ? left : o->blocks_per_slab;
+}
+
+/**
+ * Returns the size of the provided slab of the provided BufferPool. A full slab
+ * takes up all of SLAB_SIZE (so that it fills a huge page) even if its blocks
+ * don't quite, while a short one only takes up what its blocks do.
+ */
+static size_t getSlabSize(const BufferPool* o, size_t slab) {
+    size_t blocks = getSlabBlocks(o, slab);
+
+    if (blocks == o->blocks_per_slab && blocks * o->block_size < SLAB_SIZE) {
+        return SLAB_SIZE;
+    }
+
+    return blocks * o->block_size;
+}
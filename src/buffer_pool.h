@@ -0,0 +1,30 @@
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include "common.h"
+#include <stddef.h>
+
+// NOTE ~> A buffer pool hands out fixed-size blocks carved from large slabs, so
+//  that code which would otherwise call malloc(...) for every small piece of
+//  data (e.g. every buffered TCP segment) doesn't. Slabs are only allocated as
+//  they are needed, up to the pool's memory cap; once the cap is reached,
+//  allocation fails rather than growing, and it is up to the caller to make
+//  room by releasing blocks. The cap is counted in blocks, not slabs, so the
+//  last slab is cut short to fit under it. Released blocks go on a free list
+//  and are handed out again most recently released first, while they are
+//  still warm in the cache. Each full slab takes up a huge page (see
+//  large_buffer.h), so however many blocks are in use they stay within a few
+//  TLB entries. A pool is not thread-safe.
+
+typedef struct BufferPool BufferPool;
+
+BufferPool* BufferPool_new(size_t block_size, size_t max_size);
+void* BufferPool_alloc(BufferPool* o);
+void BufferPool_release(BufferPool* o, void* block);
+size_t BufferPool_getBlockSize(const BufferPool* o);
+size_t BufferPool_getAvailable(const BufferPool* o);
+size_t BufferPool_getUsed(const BufferPool* o);
+size_t BufferPool_getPeakUsed(const BufferPool* o);
+void BufferPool_free(BufferPool* o);
+
+#endif
@@ -0,0 +1,857 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "capture_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "frame_descriptor.h"
+#include "logger.h"
+
+/**
+ * Leading magic number of an index file ("SKIX"), which it also ends with.
+ */
+#define INDEX_MAGIC                 0x58494b53
+#define INDEX_VERSION               2
+
+#define INDEX_HEADER_SIZE           8
+#define INDEX_ENTRY_SIZE            48
+#define INDEX_TRAILER_SIZE          24
+#define INDEX_INITIAL_BLOCKS        64
+#define INDEX_INITIAL_KEYS          1024
+
+/**
+ * Each filter has at least this many bits for every value in it (and at most
+ * twice that, as its size is rounded up to a power of two), which with this
+ * many hashes makes for under one false positive in a hundred.
+ */
+#define INDEX_BITS_PER_KEY          10
+#define INDEX_FILTER_HASHES         7
+#define INDEX_MIN_FILTER_SIZE       64
+
+/**
+ * The most keys that a query can look for (one of each kind).
+ */
+#define QUERY_MAX_KEYS              4
+
+#define MAC_ADDRESS_SIZE            6
+#define IPV4_ADDRESS_SIZE           4
+#define IPV6_ADDRESS_SIZE           16
+#define MAX_VLAN_ID                 4095
+#define NANOSECONDS_PER_SECOND      1000000000ULL
+
+/**
+ * The kinds of values that go into a block's filter, which keep equal values
+ * of different kinds (e.g. a port and a VLAN ID) apart.
+ */
+typedef enum IndexKeyType {
+    IK_MAC = 1,
+    IK_VLAN,
+    IK_ADDRESS,
+    IK_PORT
+} IndexKeyType;
+
+/**
+ * State of an index file being written. Filters go straight to the file as
+ * blocks are added (each built in the same, growing buffer), while the table
+ * (which comes after all of them) is kept in memory until the index is closed.
+ */
+struct IndexWriter {
+    char path[MAX_PATH_LENGTH];
+    int descriptor;
+    OCTET* table;
+    UINT num_blocks;
+    UINT capacity;
+
+    OCTET* filter;
+    size_t filter_capacity;
+    uint64_t filters_end;
+};
+
+/**
+ * What a query looks for. Frames have to fall between the two times and match
+ * every one of the other values that was specified.
+ */
+struct IndexQuery {
+    uint64_t from;
+    uint64_t to;
+
+    OCTET host[IPV6_ADDRESS_SIZE];
+    UINT host_length;
+
+    bool has_port;
+    uint16_t port;
+
+    bool has_vlan;
+    uint16_t vlan;
+
+    bool has_mac;
+    OCTET mac[MAC_ADDRESS_SIZE];
+
+    /**
+     * Hashes of the values that a block's filter has to hold for the block to
+     * be read.
+     */
+    uint64_t keys[QUERY_MAX_KEYS];
+    UINT num_keys;
+};
+
+static uint64_t hashKey(IndexKeyType type, const OCTET* data, UINT length);
+static uint64_t hashNumber(IndexKeyType type, uint16_t value);
+static void addKey(IndexBlock* o, uint64_t hash);
+static void growKeys(IndexBlock* o);
+static size_t getFilterSize(UINT num_keys);
+static void setFilterBits(OCTET* filter, size_t size, uint64_t hash);
+static bool filterHolds(const OCTET* filter, size_t size, uint64_t hash);
+static bool filterHoldsAll(const OCTET* filter, size_t size, const IndexQuery* query);
+static uint64_t parseTime(const char* value, const char* name);
+static uint32_t parseNumber(const char* value, const char* name, uint32_t limit);
+static void buildPath(const char* capture_path, char* buff);
+static void writeAll(IndexWriter* o, const OCTET* data, size_t length);
+static uint64_t toNanoseconds(const CapturedFrame* frame);
+static void putUint32(OCTET* ptr, uint32_t value);
+static void putUint64(OCTET* ptr, uint64_t value);
+static uint32_t getUint32(const OCTET* ptr);
+static uint64_t getUint64(const OCTET* ptr);
+
+/**
+ * Sets up the provided IndexBlock, so that it describes no frames.
+ */
+void IndexBlock_init(IndexBlock* o) {
+    memset(o, 0x00, sizeof(IndexBlock));
+    o->first_timestamp = UINT64_MAX;
+}
+
+/**
+ * Empties the provided IndexBlock, so that it describes no frames (holding on
+ * to the memory it has for values).
+ */
+void IndexBlock_reset(IndexBlock* o) {
+    if (o->keys != NULL) {
+        memset(o->keys, 0x00, sizeof(uint64_t) * o->key_capacity);
+    }
+
+    o->num_frames = 0;
+    o->num_keys = 0;
+    o->first_timestamp = UINT64_MAX;
+    o->last_timestamp = 0;
+}
+
+/**
+ * Accounts for the provided frame in the provided IndexBlock, adding its MAC
+ * addresses, VLAN IDs, IP addresses and TCP/UDP ports to the block's filter.
+ */
+void IndexBlock_add(IndexBlock* o, const CapturedFrame* frame) {
+    FrameDescriptor descriptor;
+    uint64_t timestamp = toNanoseconds(frame);
+    UINT length, i;
+
+    if (timestamp < o->first_timestamp) {
+        o->first_timestamp = timestamp;
+    }
+    if (timestamp > o->last_timestamp) {
+        o->last_timestamp = timestamp;
+    }
+
+    o->num_frames++;
+
+    FrameDescriptor_decode(&descriptor, frame->data, frame->caplen);
+
+    if (!(descriptor.layers & FL_LINK)) {
+        return;
+    }
+
+    addKey(o, hashKey(IK_MAC, frame->data, MAC_ADDRESS_SIZE));
+    addKey(o, hashKey(IK_MAC, frame->data + MAC_ADDRESS_SIZE, MAC_ADDRESS_SIZE));
+
+    for (i = 0; i < descriptor.num_vlan_tags; i++) {
+        addKey(o, hashNumber(IK_VLAN, descriptor.vlan_tags[i].tci & MAX_VLAN_ID));
+    }
+
+    if (!(descriptor.layers & FL_NETWORK)) {
+        return;
+    }
+
+    length = (descriptor.ethernet_type == ET_IPV4) ? IPV4_ADDRESS_SIZE : IPV6_ADDRESS_SIZE;
+    addKey(o, hashKey(IK_ADDRESS, FrameDescriptor_getSourceAddress(&descriptor), length));
+    addKey(o, hashKey(IK_ADDRESS, FrameDescriptor_getDestinationAddress(&descriptor), length));
+
+    if ((descriptor.layers & FL_TRANSPORT) &&
+            (descriptor.ip_protocol == IP_TCP || descriptor.ip_protocol == IP_UDP)) {
+        addKey(o, hashNumber(IK_PORT, descriptor.src_port));
+        addKey(o, hashNumber(IK_PORT, descriptor.dst_port));
+    }
+}
+
+/**
+ * Frees the memory that the provided IndexBlock holds (but not the block
+ * itself).
+ */
+void IndexBlock_destroy(IndexBlock* o) {
+    free(o->keys);
+    o->keys = NULL;
+    o->key_capacity = 0;
+}
+
+/**
+ * Creates the index of the capture file at the provided path (replacing any
+ * that is already there), to which blocks are then appended in the order that
+ * they appear in the capture file.
+ */
+IndexWriter* IndexWriter_open(const char* capture_path) {
+    IndexWriter* o = (IndexWriter*) calloc(1, sizeof(IndexWriter));
+    OCTET header[INDEX_HEADER_SIZE];
+
+    if (o == NULL) {
+        fatal("Failed to allocate a capture index.");
+    }
+
+    buildPath(capture_path, o->path);
+
+    if ((o->descriptor = open(o->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        fatal("Failed to create the capture index \"%s\". (%i: %s)", o->path, errno, strerror(errno));
+    }
+
+    putUint32(header, INDEX_MAGIC);
+    putUint32(header + 4, INDEX_VERSION);
+    writeAll(o, header, sizeof(header));
+    o->filters_end = sizeof(header);
+
+    return o;
+}
+
+/**
+ * Adds the provided block, which takes up the provided number of bytes from
+ * the provided offset of the capture file, to the provided index.
+ */
+void IndexWriter_append(IndexWriter* o, const IndexBlock* block, ULONG offset, ULONG size) {
+    size_t filter_size = getFilterSize(block->num_keys);
+    OCTET* entry;
+    UINT i;
+
+    if (o->num_blocks == o->capacity) {
+        o->capacity = (o->capacity > 0) ? o->capacity * 2 : INDEX_INITIAL_BLOCKS;
+
+        if ((o->table = (OCTET*) realloc(o->table, (size_t) o->capacity * INDEX_ENTRY_SIZE)) == NULL) {
+            fatal("Failed to allocate the table of the capture index \"%s\".", o->path);
+        }
+    }
+
+    if (filter_size > o->filter_capacity) {
+        free(o->filter);
+        o->filter_capacity = filter_size;
+
+        if ((o->filter = (OCTET*) malloc(filter_size)) == NULL) {
+            fatal("Failed to allocate a filter of the capture index \"%s\".", o->path);
+        }
+    }
+
+    memset(o->filter, 0x00, filter_size);
+
+    for (i = 0; i < block->key_capacity; i++) {
+        if (block->keys[i] != 0) {
+            setFilterBits(o->filter, filter_size, block->keys[i]);
+        }
+    }
+
+    writeAll(o, o->filter, filter_size);
+
+    entry = o->table + (size_t) o->num_blocks++ * INDEX_ENTRY_SIZE;
+    putUint64(entry, offset);
+    putUint64(entry + 8, size);
+    putUint64(entry + 16, block->first_timestamp);
+    putUint64(entry + 24, block->last_timestamp);
+    putUint64(entry + 32, o->filters_end);
+    putUint32(entry + 40, (uint32_t) filter_size);
+    putUint32(entry + 44, block->num_frames);
+
+    o->filters_end += filter_size;
+}
+
+/**
+ * Writes out the table of the provided index, followed by a trailer that
+ * records the size of the capture file that it describes (the provided one)
+ * so that readers can tell whether the two still belong together, and then
+ * closes and frees it.
+ */
+void IndexWriter_close(IndexWriter* o, ULONG capture_size) {
+    OCTET trailer[INDEX_TRAILER_SIZE];
+
+    writeAll(o, o->table, (size_t) o->num_blocks * INDEX_ENTRY_SIZE);
+
+    putUint64(trailer, o->filters_end);
+    putUint64(trailer + 8, capture_size);
+    putUint32(trailer + 16, o->num_blocks);
+    putUint32(trailer + 20, INDEX_MAGIC);
+    writeAll(o, trailer, sizeof(trailer));
+
+    if (close(o->descriptor) == -1) {
+        fatal("Failed to write the capture index \"%s\". (%i: %s)", o->path, errno, strerror(errno));
+    }
+
+    free(o->table);
+    free(o->filter);
+    free(o);
+}
+
+/**
+ * Parses the provided query, a comma-separated list of name=value fields:
+ * "from" and "to" bound the timestamps of the frames (in seconds since the
+ * epoch, or as a local time like 2024-01-31T12:00:00, either with an optional
+ * fraction of a second), while "host" (an IPv4 or IPv6 address), "port" (TCP
+ * or UDP), "vlan" (ID) and "mac" (address) each match frames that carry the
+ * value anywhere (as the source or destination, or in any VLAN tag).
+ */
+IndexQuery* IndexQuery_parse(const char* spec) {
+    IndexQuery* o = (IndexQuery*) calloc(1, sizeof(IndexQuery));
+    char* context = NULL;
+    char* copy;
+    char* field;
+    char* value;
+
+    if (o == NULL || (copy = strdup(spec)) == NULL) {
+        fatal("Failed to allocate a query.");
+    }
+
+    o->to = UINT64_MAX;
+
+    for (field = strtok_r(copy, ",", &context); field != NULL; field = strtok_r(NULL, ",", &context)) {
+        if ((value = strchr(field, '=')) == NULL) {
+            fatal("Invalid query field specified (\"%s\"). Expected name=value.", field);
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(field, "from") == 0) {
+            o->from = parseTime(value, "start time");
+        } else if (strcmp(field, "to") == 0) {
+            o->to = parseTime(value, "end time");
+        } else if (strcmp(field, "host") == 0 && o->host_length == 0) {
+            if (inet_pton(AF_INET, value, o->host) == 1) {
+                o->host_length = IPV4_ADDRESS_SIZE;
+            } else if (inet_pton(AF_INET6, value, o->host) == 1) {
+                o->host_length = IPV6_ADDRESS_SIZE;
+            } else {
+                fatal("Invalid query host specified (\"%s\"). Expected an IPv4 or IPv6 address.", value);
+            }
+
+            o->keys[o->num_keys++] = hashKey(IK_ADDRESS, o->host, o->host_length);
+        } else if (strcmp(field, "port") == 0 && !o->has_port) {
+            o->has_port = true;
+            o->port = (uint16_t) parseNumber(value, "port", UINT16_MAX);
+            o->keys[o->num_keys++] = hashNumber(IK_PORT, o->port);
+        } else if (strcmp(field, "vlan") == 0 && !o->has_vlan) {
+            o->has_vlan = true;
+            o->vlan = (uint16_t) parseNumber(value, "VLAN ID", MAX_VLAN_ID);
+            o->keys[o->num_keys++] = hashNumber(IK_VLAN, o->vlan);
+        } else if (strcmp(field, "mac") == 0 && !o->has_mac) {
+            UINT octets[MAC_ADDRESS_SIZE];
+            char end;
+            int i;
+
+            if (sscanf(value, "%2x:%2x:%2x:%2x:%2x:%2x%c", &octets[0], &octets[1], &octets[2], &octets[3],
+                    &octets[4], &octets[5], &end) != MAC_ADDRESS_SIZE) {
+                fatal("Invalid query MAC address specified (\"%s\").", value);
+            }
+
+            for (i = 0; i < MAC_ADDRESS_SIZE; i++) {
+                o->mac[i] = (OCTET) octets[i];
+            }
+
+            o->has_mac = true;
+            o->keys[o->num_keys++] = hashKey(IK_MAC, o->mac, MAC_ADDRESS_SIZE);
+        } else {
+            fatal("Unknown (or repeated) query field specified (\"%s\"). Expected from, to, host, port, vlan or "
+                    "mac.", field);
+        }
+    }
+
+    free(copy);
+
+    if (o->from > o->to) {
+        fatal("The query's start time must not come after its end time.");
+    }
+
+    return o;
+}
+
+/**
+ * Determines whether the provided frame is one that the provided query looks
+ * for.
+ */
+bool IndexQuery_matches(const IndexQuery* o, const CapturedFrame* frame) {
+    FrameDescriptor descriptor;
+    uint64_t timestamp = toNanoseconds(frame);
+    UINT i;
+
+    if (timestamp < o->from || timestamp > o->to) {
+        return false;
+    }
+
+    if (o->num_keys == 0) {
+        return true;
+    }
+
+    FrameDescriptor_decode(&descriptor, frame->data, frame->caplen);
+
+    if (!(descriptor.layers & FL_LINK)) {
+        return false;
+    }
+
+    if (o->has_mac && memcmp(frame->data, o->mac, MAC_ADDRESS_SIZE) != 0 &&
+            memcmp(frame->data + MAC_ADDRESS_SIZE, o->mac, MAC_ADDRESS_SIZE) != 0) {
+        return false;
+    }
+
+    if (o->has_vlan) {
+        bool tagged = false;
+
+        for (i = 0; i < descriptor.num_vlan_tags; i++) {
+            tagged |= ((descriptor.vlan_tags[i].tci & MAX_VLAN_ID) == o->vlan);
+        }
+
+        if (!tagged) {
+            return false;
+        }
+    }
+
+    if (o->host_length > 0) {
+        if (!(descriptor.layers & FL_NETWORK) ||
+                o->host_length != ((descriptor.ethernet_type == ET_IPV4) ? IPV4_ADDRESS_SIZE : IPV6_ADDRESS_SIZE) ||
+                (memcmp(FrameDescriptor_getSourceAddress(&descriptor), o->host, o->host_length) != 0 &&
+                memcmp(FrameDescriptor_getDestinationAddress(&descriptor), o->host, o->host_length) != 0)) {
+            return false;
+        }
+    }
+
+    if (o->has_port) {
+        if (!(descriptor.layers & FL_TRANSPORT) ||
+                (descriptor.ip_protocol != IP_TCP && descriptor.ip_protocol != IP_UDP) ||
+                (descriptor.src_port != o->port && descriptor.dst_port != o->port)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Frees the provided IndexQuery.
+ */
+void IndexQuery_free(IndexQuery* o) {
+    free(o);
+}
+
+/**
+ * Looks up which parts of the capture file at the provided path (which is
+ * the provided number of bytes long) may hold frames that the provided query
+ * looks for, going by its index. Returns the runs of blocks to read, in the
+ * order that they appear in the file, along with their number and the number
+ * of blocks that the file has in all. If the file has no index, or it doesn't
+ * describe the file as it is now, says so and returns NULL.
+ *
+ * NOTE ~> The table is effectively a list of checkpoints from time to file
+ *  offset, so the filters of blocks that fall outside the query's time range
+ *  are never even read.
+ */
+IndexRange* CaptureIndex_find(const char* capture_path, ULONG capture_size, const IndexQuery* query,
+        UINT* num_ranges, UINT* num_blocks) {
+    char path[MAX_PATH_LENGTH];
+    struct stat file_stat;
+    IndexRange* ranges;
+    OCTET* map;
+    const OCTET* trailer;
+    uint64_t table_offset;
+    size_t map_size;
+    int descriptor;
+    UINT i;
+
+    buildPath(capture_path, path);
+
+    if ((descriptor = open(path, O_RDONLY)) == -1) {
+        warn("Failed to open the capture index \"%s\", so every frame of the capture file has to be checked. "
+                "(%i: %s)", path, errno, strerror(errno));
+
+        return NULL;
+    }
+
+    if (fstat(descriptor, &file_stat) == -1) {
+        fatal("Failed to determine the size of the capture index \"%s\". (%i: %s)", path, errno, strerror(errno));
+    }
+
+    map_size = file_stat.st_size;
+
+    if (map_size < INDEX_HEADER_SIZE + INDEX_TRAILER_SIZE) {
+        map = NULL;
+    } else if ((map = (OCTET*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, descriptor, 0)) == MAP_FAILED) {
+        fatal("Failed to map the capture index \"%s\" into memory. (%i: %s)", path, errno, strerror(errno));
+    }
+
+    close(descriptor);
+
+    // Make sure that the index is whole, and that it was written for the
+    //  capture file as it is now
+    if (map != NULL) {
+        trailer = map + map_size - INDEX_TRAILER_SIZE;
+        table_offset = getUint64(trailer);
+        *num_blocks = getUint32(trailer + 16);
+
+        if (getUint32(map) != INDEX_MAGIC || getUint32(map + 4) != INDEX_VERSION ||
+                getUint32(trailer + 20) != INDEX_MAGIC ||
+                table_offset < INDEX_HEADER_SIZE ||
+                table_offset + (uint64_t) *num_blocks * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE != map_size ||
+                getUint64(trailer + 8) != capture_size) {
+            munmap(map, map_size);
+            map = NULL;
+        }
+    }
+
+    if (map == NULL) {
+        warn("The capture index \"%s\" is incomplete or out of date, so every frame of the capture file has to be "
+                "checked.", path);
+
+        return NULL;
+    }
+
+    madvise(map, map_size, MADV_RANDOM);
+
+    if ((ranges = (IndexRange*) malloc(((size_t) *num_blocks + 1) * sizeof(IndexRange))) == NULL) {
+        fatal("Failed to allocate the blocks to read from the capture file.");
+    }
+
+    *num_ranges = 0;
+
+    for (i = 0; i < *num_blocks; i++) {
+        const OCTET* entry = map + table_offset + (size_t) i * INDEX_ENTRY_SIZE;
+        uint64_t offset = getUint64(entry);
+        uint64_t size = getUint64(entry + 8);
+        uint64_t filter_offset = getUint64(entry + 32);
+        uint32_t filter_size = getUint32(entry + 40);
+
+        if (offset > capture_size || size > capture_size - offset) {
+            warn("The capture index \"%s\" describes blocks beyond the end of the capture file, so every frame of "
+                    "it has to be checked.", path);
+            munmap(map, map_size);
+            free(ranges);
+
+            return NULL;
+        }
+
+        if (filter_offset < INDEX_HEADER_SIZE || filter_offset > table_offset ||
+                filter_size > table_offset - filter_offset || filter_size < INDEX_MIN_FILTER_SIZE ||
+                (filter_size & (filter_size - 1)) != 0) {
+            warn("The capture index \"%s\" has a malformed filter, so every frame of the capture file has to be "
+                    "checked.", path);
+            munmap(map, map_size);
+            free(ranges);
+
+            return NULL;
+        }
+
+        if (getUint64(entry + 16) > query->to || getUint64(entry + 24) < query->from ||
+                !filterHoldsAll(map + filter_offset, filter_size, query)) {
+            continue;
+        }
+
+        // Blocks that follow each other are read in one go
+        if (*num_ranges > 0 && ranges[*num_ranges - 1].offset + ranges[*num_ranges - 1].size == offset) {
+            ranges[*num_ranges - 1].size += size;
+        } else {
+            ranges[*num_ranges].offset = offset;
+            ranges[*num_ranges].size = size;
+            (*num_ranges)++;
+        }
+    }
+
+    munmap(map, map_size);
+
+    return ranges;
+}
+
+/**
+ * Hashes a value of the provided kind, an octet at a time (so that indices
+ * read the same on every machine).
+ */
+static uint64_t hashKey(IndexKeyType type, const OCTET* data, UINT length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ ((uint64_t) type << 8) ^ length;
+    UINT i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    // Zero marks an empty slot in a block's set of values
+    return (hash != 0) ? hash : 1;
+}
+
+/**
+ * Hashes a two octet number of the provided kind.
+ */
+static uint64_t hashNumber(IndexKeyType type, uint16_t value) {
+    OCTET octets[2] = { (OCTET) (value >> 8), (OCTET) value };
+
+    return hashKey(type, octets, sizeof(octets));
+}
+
+/**
+ * Adds the value with the provided hash to the set of values of the provided
+ * block, unless it is already there.
+ */
+static void addKey(IndexBlock* o, uint64_t hash) {
+    UINT i;
+
+    // NOTE ~> The set is kept at most half full so that probe sequences stay
+    //  short.
+    if ((o->num_keys + 1) * 2 > o->key_capacity) {
+        growKeys(o);
+    }
+
+    for (i = hash & (o->key_capacity - 1); o->keys[i] != 0; i = (i + 1) & (o->key_capacity - 1)) {
+        if (o->keys[i] == hash) {
+            return;
+        }
+    }
+
+    o->keys[i] = hash;
+    o->num_keys++;
+}
+
+/**
+ * Doubles the size of the set of values of the provided block.
+ */
+static void growKeys(IndexBlock* o) {
+    UINT capacity = (o->key_capacity > 0) ? o->key_capacity * 2 : INDEX_INITIAL_KEYS;
+    uint64_t* keys = (uint64_t*) calloc(capacity, sizeof(uint64_t));
+    UINT i, j;
+
+    if (keys == NULL) {
+        fatal("Failed to allocate the values of a block of the capture index.");
+    }
+
+    for (i = 0; i < o->key_capacity; i++) {
+        if (o->keys[i] != 0) {
+            for (j = o->keys[i] & (capacity - 1); keys[j] != 0; j = (j + 1) & (capacity - 1)) {
+            }
+
+            keys[j] = o->keys[i];
+        }
+    }
+
+    free(o->keys);
+    o->keys = keys;
+    o->key_capacity = capacity;
+}
+
+/**
+ * Returns the size (in octets, always a power of two) of the filter of a block
+ * with the provided number of distinct values.
+ */
+static size_t getFilterSize(UINT num_keys) {
+    size_t size = INDEX_MIN_FILTER_SIZE;
+
+    while (size * 8 < (size_t) num_keys * INDEX_BITS_PER_KEY) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+/**
+ * Sets the bits of the value with the provided hash in the provided filter
+ * (which is the provided number of octets long).
+ *
+ * NOTE ~> The bits are picked with double hashing (the nth is h1 + n * h2),
+ *  which is as good as using independent hash functions for a Bloom filter.
+ */
+static void setFilterBits(OCTET* filter, size_t size, uint64_t hash) {
+    uint32_t h1 = (uint32_t) hash;
+    uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+    size_t mask = size * 8 - 1;
+    UINT i, bit;
+
+    for (i = 0; i < INDEX_FILTER_HASHES; i++) {
+        bit = (h1 + i * h2) & mask;
+        filter[bit >> 3] |= (OCTET) (1 << (bit & 7));
+    }
+}
+
+/**
+ * Determines whether the provided filter (which is the provided number of
+ * octets long) may hold the value with the provided hash (or certainly
+ * doesn't).
+ */
+static bool filterHolds(const OCTET* filter, size_t size, uint64_t hash) {
+    uint32_t h1 = (uint32_t) hash;
+    uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+    size_t mask = size * 8 - 1;
+    UINT i, bit;
+
+    for (i = 0; i < INDEX_FILTER_HASHES; i++) {
+        bit = (h1 + i * h2) & mask;
+
+        if (!(filter[bit >> 3] & (1 << (bit & 7)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Determines whether the provided filter (which is the provided number of
+ * octets long) may hold every value that the provided query looks for.
+ */
+static bool filterHoldsAll(const OCTET* filter, size_t size, const IndexQuery* query) {
+    UINT i;
+
+    for (i = 0; i < query->num_keys; i++) {
+        if (!filterHolds(filter, size, query->keys[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Parses the provided time (seconds since the epoch or a local time, either
+ * with an optional fraction of a second) into nanoseconds since the epoch.
+ */
+static uint64_t parseTime(const char* value, const char* name) {
+    struct tm broken_down;
+    uint64_t seconds, nanoseconds = 0, scale = NANOSECONDS_PER_SECOND / 10;
+    const char* rest;
+    char* end;
+    time_t local;
+
+    memset(&broken_down, 0x00, sizeof(broken_down));
+
+    if ((rest = strptime(value, "%Y-%m-%dT%H:%M:%S", &broken_down)) != NULL) {
+        broken_down.tm_isdst = -1;
+
+        if ((local = mktime(&broken_down)) == -1) {
+            fatal("Invalid query %s specified (\"%s\"). It can't be represented.", name, value);
+        }
+
+        seconds = (uint64_t) local;
+    } else {
+        errno = 0;
+        seconds = strtoull(value, &end, 10);
+        rest = (errno != 0 || end == value || *value == '-') ? value : end;
+    }
+
+    if (rest != value && *rest == '.') {
+        for (rest++; *rest >= '0' && *rest <= '9'; rest++) {
+            nanoseconds += (*rest - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    if (rest == value || *rest != '\0') {
+        fatal("Invalid query %s specified (\"%s\"). Expected seconds since the epoch or a local time like "
+                "2024-01-31T12:00:00.", name, value);
+    }
+
+    return seconds * NANOSECONDS_PER_SECOND + nanoseconds;
+}
+
+/**
+ * Parses the provided number of up to the provided limit.
+ */
+static uint32_t parseNumber(const char* value, const char* name, uint32_t limit) {
+    char* end;
+    unsigned long parsed;
+
+    errno = 0;
+    parsed = strtoul(value, &end, 0);
+
+    if (errno != 0 || end == value || *end != '\0' || *value == '-' || parsed > limit) {
+        fatal("Invalid query %s specified (\"%s\"). Expected a number up to %u.", name, value, limit);
+    }
+
+    return (uint32_t) parsed;
+}
+
+/**
+ * Builds the path of the index of the capture file at the provided path.
+ */
+static void buildPath(const char* capture_path, char* buff) {
+    if (snprintf(buff, MAX_PATH_LENGTH, "%s%s", capture_path, INDEX_FILE_SUFFIX) >= MAX_PATH_LENGTH) {
+        fatal("The name of the index of the capture file \"%s\" is too long.", capture_path);
+    }
+}
+
+/**
+ * Writes the provided bytes to the provided index, however many calls it
+ * takes.
+ */
+static void writeAll(IndexWriter* o, const OCTET* data, size_t length) {
+    ssize_t written;
+
+    while (length > 0) {
+        if ((written = write(o->descriptor, data, length)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fatal("Failed to write the capture index \"%s\". (%i: %s)", o->path, errno, strerror(errno));
+        }
+
+        data += written;
+        length -= written;
+    }
+}
+
+/**
+ * Returns the timestamp of the provided frame in nanoseconds since the epoch.
+ */
+static uint64_t toNanoseconds(const CapturedFrame* frame) {
+    return (uint64_t) frame->timestamp.tv_sec * NANOSECONDS_PER_SECOND + frame->timestamp.tv_nsec;
+}
+
+/**
+ * Writes a four octet, little-endian integer.
+ */
+static void putUint32(OCTET* ptr, uint32_t value) {
+    ptr[0] = (OCTET) value;
+    ptr[1] = (OCTET) (value >> 8);
+    ptr[2] = (OCTET) (value >> 16);
+    ptr[3] = (OCTET) (value >> 24);
+}
+
+/**
+ * Writes an eight octet, little-endian integer.
+ */
+static void putUint64(OCTET* ptr, uint64_t value) {
+    putUint32(ptr, (uint32_t) value);
+    putUint32(ptr + 4, (uint32_t) (value >> 32));
+}
+
+/**
+ * Reads a four octet, little-endian integer.
+ */
+static uint32_t getUint32(const OCTET* ptr) {
+    return (uint32_t) ptr[0] | ((uint32_t) ptr[1] << 8) | ((uint32_t) ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+/**
+ * Reads an eight octet, little-endian integer.
+ */
+static uint64_t getUint64(const OCTET* ptr) {
+    return getUint32(ptr) | ((uint64_t) getUint32(ptr + 4) << 32);
+}
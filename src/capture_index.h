@@ -0,0 +1,82 @@
+#ifndef _CAPTURE_INDEX_H_
+#define _CAPTURE_INDEX_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// NOTE ~> A capture index is a small file kept next to a capture file (named
+//  after it, with ".idx" appended) that lets lookups by time, host, port, VLAN
+//  or MAC address skip every part of the capture file that can't contain what
+//  they are after. The capture file is described in blocks (each buffer that
+//  the capture writer wrote out, or each block of a compact file), and the
+//  index holds a Bloom filter over the addresses, ports, VLAN IDs and MAC
+//  addresses of each block's frames, sized from the number of distinct values
+//  in the block so that about one value in a hundred that isn't there looks
+//  like it is. The filters are followed by a table of where each block and its
+//  filter start and end, and the earliest and latest timestamps in the block.
+//  A lookup only reads the table and the filters of the blocks that overlap it
+//  in time, and then only the blocks whose filter may hold everything it asks
+//  for. Filters have false positives, so frames from those blocks are still
+//  checked one by one. Everything is little-endian.
+
+#define INDEX_FILE_SUFFIX   ".idx"
+
+/**
+ * About how many octets of a pcap or pcapng file each block covers when an
+ * index is built for a file that has already been written.
+ */
+#define INDEX_BLOCK_SIZE    (4 << 20)
+
+/**
+ * What the index says about a single block as it is being put together.
+ */
+typedef struct IndexBlock {
+    UINT num_frames;
+
+    /**
+     * Earliest and latest timestamps (in nanoseconds) of the block's frames.
+     */
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+
+    /**
+     * Hashes of the distinct values that the block's filter has to hold, in an
+     * open-addressing set (where zero marks an empty slot) that grows as
+     * needed. The filter itself is only built once the block is complete.
+     */
+    uint64_t* keys;
+    UINT num_keys;
+    UINT key_capacity;
+} IndexBlock;
+
+/**
+ * A run of (one or more adjacent) blocks of a capture file that a lookup has
+ * to read.
+ */
+typedef struct IndexRange {
+    ULONG offset;
+    ULONG size;
+} IndexRange;
+
+typedef struct IndexWriter IndexWriter;
+typedef struct IndexQuery IndexQuery;
+
+void IndexBlock_init(IndexBlock* o);
+void IndexBlock_reset(IndexBlock* o);
+void IndexBlock_add(IndexBlock* o, const CapturedFrame* frame);
+void IndexBlock_destroy(IndexBlock* o);
+
+IndexWriter* IndexWriter_open(const char* capture_path);
+void IndexWriter_append(IndexWriter* o, const IndexBlock* block, ULONG offset, ULONG size);
+void IndexWriter_close(IndexWriter* o, ULONG capture_size);
+
+IndexQuery* IndexQuery_parse(const char* spec);
+bool IndexQuery_matches(const IndexQuery* o, const CapturedFrame* frame);
+void IndexQuery_free(IndexQuery* o);
+
+IndexRange* CaptureIndex_find(const char* capture_path, ULONG capture_size, const IndexQuery* query,
+        UINT* num_ranges, UINT* num_blocks);
+
+#endif
@@ -0,0 +1,191 @@
+#include "capture_source.h"
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "logger.h"
+
+/**
+ * Wraps the state of a particular kind of capture source behind a common set
+ * of operations.
+ */
+struct CaptureSource {
+    /**
+     * Human-readable description of where frames are coming from (e.g. the
+     * path of a capture file).
+     */
+    char description[MAX_PATH_LENGTH];
+
+    /**
+     * The operations implemented by the kind of source this is.
+     */
+    const CaptureSourceOps* ops;
+
+    /**
+     * Opaque state owned by the kind of source this is.
+     */
+    void* state;
+
+    /**
+     * Filter that frames must match before they are handed out, if the kind
+     * of source this is cannot apply it by itself.
+     */
+    const Filter* filter;
+
+    /**
+     * Number of frames that the filter has rejected in user space.
+     */
+    ULONG filtered;
+};
+
+/**
+ * Allocates and initializes a new CaptureSource around the provided operations
+ * and state prior to returning a pointer to it.
+ */
+CaptureSource* CaptureSource_new(const char* description, const CaptureSourceOps* ops, void* state) {
+    CaptureSource* captureSource = (CaptureSource*) malloc(sizeof(CaptureSource));
+
+    if (captureSource == NULL) {
+        fatal("Failed to allocate a capture source.");
+    }
+
+    strncpy(captureSource->description, description, MAX_PATH_LENGTH - 1);
+    captureSource->description[MAX_PATH_LENGTH - 1] = '\0';
+    captureSource->ops = ops;
+    captureSource->state = state;
+    captureSource->filter = NULL;
+    captureSource->filtered = 0;
+
+    return captureSource;
+}
+
+#if !defined(HAVE_BPF_DEVICE) && !defined(HAVE_PACKET_MMAP)
+/**
+ * Stands in for live capture on platforms that do not provide a supported
+ * kernel capture facility.
+ */
+CaptureSource* CaptureSource_openDevice(const char* interface_name, const Filter* filter) {
+    fatal("Live capture on \"%s\" is not supported on this platform. Use -r to read a capture file instead.",
+            interface_name);
+
+    return NULL;
+}
+#endif
+
+#ifndef HAVE_PACKET_MMAP
+/**
+ * Stands in for fanout capture on platforms that cannot spread an interface's
+ * frames over several capture sockets.
+ */
+CaptureSource* CaptureSource_openDeviceFanout(const char* interface_name, const Filter* filter, FanoutMode mode,
+        int* group) {
+    fatal("Fanout capture on \"%s\" is only supported on Linux.", interface_name);
+
+    return NULL;
+}
+#endif
+
+/**
+ * Returns the human-readable description of the provided CaptureSource.
+ */
+const char* CaptureSource_getDescription(CaptureSource* o) {
+    return o->description;
+}
+
+/**
+ * Returns a descriptor that becomes readable when the provided CaptureSource
+ * has frames to give, or -1 if the source never needs to be waited on.
+ */
+int CaptureSource_getDescriptor(CaptureSource* o) {
+    if (o->ops->getDescriptor == NULL) {
+        return -1;
+    }
+
+    return o->ops->getDescriptor(o->state);
+}
+
+/**
+ * Makes the provided CaptureSource run the provided Filter over every frame
+ * itself, skipping those that do not match it.
+ */
+void CaptureSource_setFilter(CaptureSource* o, const Filter* filter) {
+    o->filter = filter;
+}
+
+/**
+ * Returns the number of frames that the kernel has dropped since the provided
+ * CaptureSource was opened, or zero if it has no way of telling.
+ */
+ULONG CaptureSource_getDrops(CaptureSource* o) {
+    if (o->ops->getDrops == NULL) {
+        return 0;
+    }
+
+    return o->ops->getDrops(o->state);
+}
+
+/**
+ * Returns the number of frames that the filter of the provided CaptureSource
+ * has rejected in user space (frames rejected by a filter attached to the
+ * kernel are never seen, so they aren't counted).
+ */
+ULONG CaptureSource_getFiltered(CaptureSource* o) {
+    return o->filtered;
+}
+
+/**
+ * Makes the next batch of frames available. Returns a positive value if a
+ * batch is available, zero if nothing was captured this time around, or
+ * CS_END if the source has been exhausted.
+ */
+int CaptureSource_fill(CaptureSource* o) {
+    return o->ops->fill(o->state);
+}
+
+/**
+ * Describes the next frame of the current batch in the provided CapturedFrame.
+ * Returns false once the batch has been fully walked.
+ */
+bool CaptureSource_next(CaptureSource* o, CapturedFrame* frame) {
+    frame->interface = 0;
+
+    while (o->ops->next(o->state, frame)) {
+        if (o->filter == NULL || Filter_matches(o->filter, frame->data, frame->caplen, frame->wirelen)) {
+            return true;
+        }
+
+        o->filtered++;
+    }
+
+    return false;
+}
+
+/**
+ * Hands the current batch back to the source. Frames from the batch must not be
+ * touched after this is called.
+ */
+void CaptureSource_release(CaptureSource* o) {
+    if (o->ops->release != NULL) {
+        o->ops->release(o->state);
+    }
+}
+
+/**
+ * Goes back to the first frame of the provided CaptureSource, so that every
+ * frame is handed out again. Returns false if the kind of source it is can't
+ * do that (e.g. a live capture).
+ */
+bool CaptureSource_rewind(CaptureSource* o) {
+    if (o->ops->rewind == NULL) {
+        return false;
+    }
+
+    return o->ops->rewind(o->state);
+}
+
+/**
+ * Closes the provided CaptureSource and frees everything associated with it.
+ */
+void CaptureSource_close(CaptureSource* o) {
+    o->ops->close(o->state);
+    free(o);
+}
\ No newline at end of file
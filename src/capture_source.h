@@ -0,0 +1,129 @@
+#ifndef _CAPTURE_SOURCE_H_
+#define _CAPTURE_SOURCE_H_
+
+#include "common.h"
+#include "filter.h"
+#include <stdbool.h>
+#include <time.h>
+
+// NOTE ~> A capture source is anything that can hand the sniffer a sequence of
+//  Ethernet Frames (e.g. a BPF device or a saved capture file). The sniffer
+//  drives every source the same way: fill a batch, walk the frames in it, and
+//  then release it. Frames are always handed out in place, so a frame's data
+//  is only valid until the batch it came from is released. Filling never
+//  blocks; sources backed by a descriptor expose it so that the sniffer can
+//  wait for it to become readable when there is nothing to fill. A filter
+//  handed to a source when it is opened is attached to the kernel where there
+//  is one and is run in user space otherwise, so frames that do not match it
+//  are never handed out either way.
+//  Several sources can be merged into one (e.g. to capture both directions of
+//  a link tapped on separate interfaces in a single loop), which hands out the
+//  frames of all of them in the order of their timestamps.
+
+/**
+ * Value returned by CaptureSource_fill(...) once a source has nothing left to
+ * give (e.g. the end of a capture file has been reached).
+ */
+#define CS_END -1
+
+/**
+ * The most sources (i.e. interfaces) that can be merged into one.
+ */
+#define MAX_INTERFACES 8
+
+/**
+ * Describes a single captured Ethernet Frame without copying it.
+ */
+typedef struct CapturedFrame {
+    /**
+     * The time at which the frame was captured.
+     */
+    struct timespec timestamp;
+
+    /**
+     * The number of octets of the frame that were actually captured (and are
+     * thus available at the data pointer).
+     */
+    UINT caplen;
+
+    /**
+     * The number of octets that the frame originally had on the wire.
+     */
+    UINT wirelen;
+
+    /**
+     * Pointer to the first octet of the frame (i.e. the destination MAC
+     * address).
+     */
+    OCTET* data;
+
+    /**
+     * Index of the interface that the frame was captured on, amongst the ones
+     * merged into the source it came from (zero if it came from a single one).
+     */
+    UINT interface;
+} CapturedFrame;
+
+/**
+ * How frames are spread over the sockets of a fanout group (see
+ * CaptureSource_openDeviceFanout(...)).
+ */
+typedef enum FanoutMode {
+    /**
+     * By a hash of the frame's flow, so every frame of a flow (in either
+     * direction) ends up at the same socket.
+     */
+    FM_HASH,
+
+    /**
+     * By the CPU that the frame arrived on.
+     */
+    FM_CPU,
+
+    /**
+     * To the first socket that has room for it.
+     */
+    FM_ROLLOVER
+} FanoutMode;
+
+/**
+ * Has CaptureSource_openDeviceFanout(...) create a new fanout group rather than
+ * join an existing one.
+ */
+#define FANOUT_NEW_GROUP -1
+
+typedef struct CaptureSource CaptureSource;
+
+/**
+ * The operations that each kind of capture source must implement.
+ */
+typedef struct CaptureSourceOps {
+    int (*fill)(void* state);
+    bool (*next)(void* state, CapturedFrame* frame);
+    void (*release)(void* state);
+    void (*close)(void* state);
+    int (*getDescriptor)(void* state);
+    ULONG (*getDrops)(void* state);
+    bool (*rewind)(void* state);
+} CaptureSourceOps;
+
+CaptureSource* CaptureSource_new(const char* description, const CaptureSourceOps* ops, void* state);
+CaptureSource* CaptureSource_openDevice(const char* interface_name, const Filter* filter);
+CaptureSource* CaptureSource_openDeviceFanout(const char* interface_name, const Filter* filter, FanoutMode mode,
+        int* group);
+CaptureSource* CaptureSource_openFile(const char* path, const Filter* filter);
+CaptureSource* CaptureSource_queryFile(const char* path, const Filter* filter, const char* query);
+void CaptureSource_indexFile(const char* path);
+CaptureSource* CaptureSource_openMerged(CaptureSource** sources, UINT count, UINT window);
+const char* CaptureSource_getDescription(CaptureSource* o);
+int CaptureSource_getDescriptor(CaptureSource* o);
+void CaptureSource_setFilter(CaptureSource* o, const Filter* filter);
+ULONG CaptureSource_getDrops(CaptureSource* o);
+ULONG CaptureSource_getFiltered(CaptureSource* o);
+int CaptureSource_fill(CaptureSource* o);
+bool CaptureSource_next(CaptureSource* o, CapturedFrame* frame);
+void CaptureSource_release(CaptureSource* o);
+bool CaptureSource_rewind(CaptureSource* o);
+void CaptureSource_close(CaptureSource* o);
+
+#endif
\ No newline at end of file
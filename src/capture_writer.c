@@ -0,0 +1,945 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "capture_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "common.h"
+#include "capture_index.h"
+#include "compact_format.h"
+#include "large_buffer.h"
+#include "logger.h"
+#include "signals.h"
+
+#define WRITER_BUFFER_SIZE          (4 << 20)
+#define WRITER_MIN_BUFFER_SIZE      (512 << 10)
+#define WRITER_NUM_BUFFERS          8
+#define WRITER_MAX_BUFFERS          (WRITER_MAX_ENCODERS + 2)
+#define WRITER_SNAPLEN              262144
+
+#define PCAP_MAGIC_NSEC             0xa1b23c4d
+#define PCAP_GLOBAL_HEADER_SIZE     24
+#define PCAP_RECORD_HEADER_SIZE     16
+
+#define PCAPNG_BLOCK_SHB            0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB            0x00000001
+#define PCAPNG_BLOCK_EPB            0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1a2b3c4d
+#define PCAPNG_OPTION_END           0
+#define PCAPNG_OPTION_IF_NAME       2
+#define PCAPNG_OPTION_IF_TSRESOL    9
+#define PCAPNG_MAX_NAME_LENGTH      64
+#define PCAPNG_SHB_SIZE             28
+#define PCAPNG_IDB_SIZE             32
+#define PCAPNG_EPB_OVERHEAD         32
+
+#define LINKTYPE_ETHERNET           1
+
+/**
+ * A buffer of records on its way to the disk.
+ */
+typedef struct WriterBuffer {
+    OCTET* data;
+    size_t length;
+
+    /**
+     * The block that the buffer's (staged) frames were encoded as, for compact
+     * files, and whether the buffer is ready to be written out (i.e. it has
+     * been encoded, if it has to be).
+     */
+    OCTET* encoded;
+    size_t encoded_length;
+    bool ready;
+
+    /**
+     * Whether the writer thread has to start a new file (at the path below)
+     * before writing this buffer out.
+     */
+    bool starts_file;
+    char path[MAX_PATH_LENGTH];
+
+    /**
+     * Where the buffer's frames start (after the file's header, if it starts a
+     * file), and what the index of the file says about them, if it has one.
+     */
+    size_t frames_offset;
+    IndexBlock index;
+} WriterBuffer;
+
+/**
+ * State of a capture writer. Everything above the lock is only touched by the
+ * capturing thread and everything below the queues only by the writer thread.
+ */
+struct CaptureWriter {
+    char path[MAX_PATH_LENGTH];
+    CaptureFileFormat format;
+    CaptureWriterLimits limits;
+
+    /**
+     * Names of the interfaces that frames come from (in the order of their
+     * indices), each of which gets an "Interface Description Block" of its own
+     * in pcapng files (there is a single, unnamed one if there are none).
+     */
+    char interface_names[MAX_INTERFACES][PCAPNG_MAX_NAME_LENGTH];
+    UINT num_interfaces;
+
+    /**
+     * The buffer that frames are currently being copied into, and how full it
+     * gets before it is handed on (buffers of compact files are one block).
+     */
+    WriterBuffer* current;
+    size_t buffer_limit;
+
+    /**
+     * Size of the current file (as it will be once everything handed to the
+     * writer thread has been written), and when and with which index it was
+     * started.
+     */
+    ULONG file_size;
+    time_t file_started;
+    UINT file_index;
+    bool file_open;
+
+    ULONG frames;
+    ULONG stalls;
+
+    /**
+     * Buffers allocated so far, and how many there can be at most. Buffers are
+     * only allocated when there is no free one to take, so a capture that the
+     * disk keeps up with never needs more than a couple.
+     */
+    WriterBuffer buffers[WRITER_MAX_BUFFERS];
+    UINT num_buffers;
+    UINT max_buffers;
+
+    /**
+     * Buffers that are free to be filled and buffers that are waiting to be
+     * written out (oldest first), of which the encoder threads have taken the
+     * first few, guarded by the lock.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    WriterBuffer* free_buffers[WRITER_MAX_BUFFERS];
+    UINT num_free;
+    WriterBuffer* full_buffers[WRITER_MAX_BUFFERS];
+    UINT full_head;
+    UINT num_full;
+    UINT num_claimed;
+    bool stopping;
+
+    pthread_t encoder_threads[WRITER_MAX_ENCODERS];
+    UINT num_encoders;
+    ULONG staged_bytes;
+
+    pthread_t thread;
+    int descriptor;
+    ULONG file_written;
+    IndexWriter* index;
+    ULONG bytes_written;
+    UINT files_written;
+    bool warned_preallocate;
+};
+
+static void startFile(CaptureWriter* o, const CapturedFrame* frame);
+static bool needsNewFile(CaptureWriter* o, const CapturedFrame* frame, size_t record_size);
+static void buildPath(CaptureWriter* o, char* buff);
+static OCTET* reserve(CaptureWriter* o, size_t size);
+static void submit(CaptureWriter* o);
+static void queueBuffer(CaptureWriter* o, WriterBuffer* buffer);
+static WriterBuffer* takeFreeBuffer(CaptureWriter* o);
+static WriterBuffer* allocateBuffer(CaptureWriter* o);
+static void* encoderLoop(void* arg);
+static void* writerLoop(void* arg);
+static void openFile(CaptureWriter* o, const char* path);
+static void closeFile(CaptureWriter* o);
+static void preallocate(CaptureWriter* o, const char* path);
+static void writeAll(CaptureWriter* o, const OCTET* data, size_t length);
+static void indexBuffer(CaptureWriter* o, WriterBuffer* buffer);
+static size_t readRecord(CaptureFileFormat format, const OCTET* in, CapturedFrame* frame);
+static size_t headerSize(CaptureWriter* o);
+static size_t writeFileHeader(CaptureWriter* o, OCTET* out);
+static size_t writeInterface(const char* name, OCTET* out);
+static size_t interfaceSize(const char* name);
+static size_t writeRecord(CaptureFileFormat format, const CapturedFrame* frame, UINT caplen, OCTET* out);
+static size_t recordSize(CaptureFileFormat format, UINT caplen);
+static void putUint16(OCTET* ptr, uint16_t value);
+static void putUint32(OCTET* ptr, uint32_t value);
+
+/**
+ * Allocates a new CaptureWriter that writes frames to the provided path (or, if
+ * it rotates, to files named after it) in the provided format and starts its
+ * writer thread (and encoder threads, for compact files). No file is created
+ * until the first frame is written.
+ *
+ * NOTE ~> When rotating by time the path is run through strftime(...), so it
+ *  may contain conversions like "%H%M%S". When rotating by size, every file
+ *  after the first gets an increasing number appended to its name.
+ */
+CaptureWriter* CaptureWriter_open(const char* path, CaptureFileFormat format, const CaptureWriterLimits* limits) {
+    CaptureWriter* o = (CaptureWriter*) calloc(1, sizeof(CaptureWriter));
+    int i;
+
+    if (o == NULL) {
+        fatal("Failed to allocate the capture writer.");
+    }
+
+    strncpy(o->path, path, MAX_PATH_LENGTH - 1);
+    o->format = format;
+    o->limits = *limits;
+    o->descriptor = -1;
+
+    // Buffers of compact files are one block each, and there have to be enough
+    //  of them to keep every encoder thread busy. Other buffers needn't be any
+    //  larger than a file can get (as long as the largest record fits).
+    if (format == CFF_COMPACT) {
+        o->num_encoders = (limits->encoders > 0) ? limits->encoders : 1;
+        o->buffer_limit = COMPACT_BLOCK_SIZE;
+        o->max_buffers = (o->num_encoders + 2 > WRITER_NUM_BUFFERS) ? o->num_encoders + 2 : WRITER_NUM_BUFFERS;
+    } else {
+        o->buffer_limit = WRITER_BUFFER_SIZE;
+        o->max_buffers = WRITER_NUM_BUFFERS;
+
+        if (limits->rotate_size > 0 && limits->rotate_size < o->buffer_limit) {
+            o->buffer_limit = (limits->rotate_size > WRITER_MIN_BUFFER_SIZE) ?
+                    limits->rotate_size : WRITER_MIN_BUFFER_SIZE;
+        }
+    }
+
+    pthread_mutex_init(&o->lock, NULL);
+    pthread_cond_init(&o->changed, NULL);
+
+    o->current = takeFreeBuffer(o);
+
+    if (Signals_createThread(&o->thread, writerLoop, o) != 0) {
+        fatal("Failed to start the capture writer thread.");
+    }
+
+    if (format == CFF_COMPACT) {
+        for (i = 0; i < (int) o->num_encoders; i++) {
+            if (Signals_createThread(&o->encoder_threads[i], encoderLoop, o) != 0) {
+                fatal("Failed to start the capture writer's encoder threads.");
+            }
+        }
+    }
+
+    return o;
+}
+
+/**
+ * Describes the interface that frames with the next index (counting from zero)
+ * come from in every file written from now on. Only pcapng files describe
+ * interfaces; names are cut short if they are unusually long.
+ */
+void CaptureWriter_addInterface(CaptureWriter* o, const char* name) {
+    if (o->num_interfaces == MAX_INTERFACES) {
+        fatal("No more than %u interfaces can be described in a capture file.", MAX_INTERFACES);
+    }
+
+    strncpy(o->interface_names[o->num_interfaces++], name, PCAPNG_MAX_NAME_LENGTH - 1);
+}
+
+/**
+ * Copies the provided frame, with its original timestamp and lengths, into the
+ * current buffer. Handing buffers to the writer thread and starting new files
+ * happens along the way as needed.
+ */
+void CaptureWriter_write(CaptureWriter* o, const CapturedFrame* frame) {
+    UINT caplen = (frame->caplen > WRITER_SNAPLEN) ? WRITER_SNAPLEN : frame->caplen;
+    size_t size = recordSize(o->format, caplen);
+
+    if (!o->file_open || needsNewFile(o, frame, size)) {
+        startFile(o, frame);
+    }
+
+    writeRecord(o->format, frame, caplen, reserve(o, size));
+    o->file_size += size;
+    o->staged_bytes += size;
+    o->frames++;
+}
+
+/**
+ * Hands whatever is left to the writer thread, waits for everything to reach
+ * the disk, and then frees the provided CaptureWriter.
+ */
+void CaptureWriter_close(CaptureWriter* o) {
+    UINT i;
+
+    // NOTE ~> The last buffer is queued without moving on to another one, which
+    //  might have to be allocated for nothing.
+    if (o->current->length > 0) {
+        queueBuffer(o, o->current);
+    }
+
+    pthread_mutex_lock(&o->lock);
+    o->stopping = true;
+    pthread_cond_broadcast(&o->changed);
+    pthread_mutex_unlock(&o->lock);
+
+    for (i = 0; i < o->num_encoders; i++) {
+        pthread_join(o->encoder_threads[i], NULL);
+    }
+
+    pthread_join(o->thread, NULL);
+    closeFile(o);
+
+    info("Wrote %lu frames (%lu bytes) to %u capture file(s).", o->frames, o->bytes_written, o->files_written);
+
+    if (o->format == CFF_COMPACT && o->bytes_written > 0) {
+        info("Encoded %lu bytes of frames into %lu bytes (%.1f:1) with %u thread(s).", o->staged_bytes,
+                o->bytes_written, (double) o->staged_bytes / o->bytes_written, o->num_encoders);
+    }
+
+    if (o->stalls > 0) {
+        warn("Capture waited on the disk %lu time(s) while writing.", o->stalls);
+    }
+
+    pthread_mutex_destroy(&o->lock);
+    pthread_cond_destroy(&o->changed);
+
+    for (i = 0; i < o->num_buffers; i++) {
+        LargeBuffer_free(o->buffers[i].data, o->buffer_limit);
+
+        if (o->buffers[i].encoded != NULL) {
+            LargeBuffer_free(o->buffers[i].encoded, COMPACT_MAX_ENCODED_SIZE);
+        }
+
+        IndexBlock_destroy(&o->buffers[i].index);
+    }
+
+    free(o);
+}
+
+/**
+ * Starts a new file, beginning with a fresh buffer, and writes the file's
+ * header into it.
+ */
+static void startFile(CaptureWriter* o, const CapturedFrame* frame) {
+    time_t started = frame->timestamp.tv_sec;
+
+    if (o->file_open) {
+        // A new time period starts counting files from scratch
+        if (o->limits.rotate_seconds > 0 && started >= o->file_started + (time_t) o->limits.rotate_seconds) {
+            o->file_index = 0;
+        } else {
+            o->file_index++;
+            started = o->file_started;
+        }
+
+        if (o->current->length > 0) {
+            submit(o);
+        }
+    }
+
+    o->file_open = true;
+    o->file_started = started;
+    o->current->starts_file = true;
+    buildPath(o, o->current->path);
+
+    o->file_size = writeFileHeader(o, reserve(o, headerSize(o)));
+    o->current->frames_offset = o->current->length;
+}
+
+/**
+ * Determines whether the provided frame (which will take up the provided number
+ * of bytes) has to go into a new file.
+ */
+static bool needsNewFile(CaptureWriter* o, const CapturedFrame* frame, size_t record_size) {
+    // NOTE ~> A file always gets at least one frame, however large it is.
+    if (o->limits.rotate_size > 0 && o->file_size > headerSize(o) &&
+            o->file_size + record_size > o->limits.rotate_size) {
+        return true;
+    }
+
+    return o->limits.rotate_seconds > 0 &&
+            frame->timestamp.tv_sec >= o->file_started + (time_t) o->limits.rotate_seconds;
+}
+
+/**
+ * Builds the name of the current file from the configured path.
+ */
+static void buildPath(CaptureWriter* o, char* buff) {
+    char base[MAX_PATH_LENGTH];
+    struct tm started;
+
+    if (o->limits.rotate_seconds > 0) {
+        localtime_r(&o->file_started, &started);
+
+        if (strftime(base, sizeof(base), o->path, &started) == 0) {
+            fatal("The output file name \"%s\" is too long once formatted.", o->path);
+        }
+    } else {
+        strcpy(base, o->path);
+    }
+
+    if (o->file_index > 0) {
+        snprintf(buff, MAX_PATH_LENGTH, "%s%u", base, o->file_index);
+    } else {
+        strcpy(buff, base);
+    }
+}
+
+/**
+ * Makes sure that there is room for the provided number of bytes in the
+ * current buffer (handing it to the writer thread and moving on to a free one
+ * if there is not) and returns a pointer to that room.
+ */
+static OCTET* reserve(CaptureWriter* o, size_t size) {
+    OCTET* ptr;
+
+    if (o->current->length + size > o->buffer_limit) {
+        submit(o);
+    }
+
+    ptr = o->current->data + o->current->length;
+    o->current->length += size;
+
+    return ptr;
+}
+
+/**
+ * Queues the current buffer up to be written out (once it has been encoded, for
+ * compact files) and moves on to a free one.
+ */
+static void submit(CaptureWriter* o) {
+    queueBuffer(o, o->current);
+    o->current = takeFreeBuffer(o);
+}
+
+/**
+ * Queues the provided buffer up to be written out (once it has been encoded,
+ * for compact files).
+ */
+static void queueBuffer(CaptureWriter* o, WriterBuffer* buffer) {
+    buffer->ready = (o->format != CFF_COMPACT);
+
+    pthread_mutex_lock(&o->lock);
+    o->full_buffers[(o->full_head + o->num_full) % o->max_buffers] = buffer;
+    o->num_full++;
+    pthread_cond_broadcast(&o->changed);
+    pthread_mutex_unlock(&o->lock);
+}
+
+/**
+ * Takes a free buffer, allocating another one if there is none, or waiting for
+ * the writer thread to free one up if no more can be allocated.
+ */
+static WriterBuffer* takeFreeBuffer(CaptureWriter* o) {
+    WriterBuffer* buffer;
+
+    pthread_mutex_lock(&o->lock);
+
+    // NOTE ~> Only the capturing thread touches the count of buffers, so the
+    //  lock isn't held while allocating another one.
+    if (o->num_free == 0 && o->num_buffers < o->max_buffers) {
+        pthread_mutex_unlock(&o->lock);
+        buffer = allocateBuffer(o);
+    } else {
+        if (o->num_free == 0) {
+            o->stalls++;
+
+            while (o->num_free == 0) {
+                pthread_cond_wait(&o->changed, &o->lock);
+            }
+        }
+
+        buffer = o->free_buffers[--o->num_free];
+        pthread_mutex_unlock(&o->lock);
+    }
+
+    buffer->length = 0;
+    buffer->starts_file = false;
+    buffer->frames_offset = 0;
+
+    return buffer;
+}
+
+/**
+ * Allocates another buffer (along with room for its encoded block, for compact
+ * files).
+ */
+static WriterBuffer* allocateBuffer(CaptureWriter* o) {
+    WriterBuffer* buffer = &o->buffers[o->num_buffers];
+
+    if ((buffer->data = (OCTET*) LargeBuffer_alloc(o->buffer_limit, ANY_NODE)) == NULL) {
+        fatal("Failed to allocate the capture writer's buffers.");
+    }
+
+    if (o->format == CFF_COMPACT &&
+            (buffer->encoded = (OCTET*) LargeBuffer_alloc(COMPACT_MAX_ENCODED_SIZE, ANY_NODE)) == NULL) {
+        fatal("Failed to allocate the capture writer's buffers.");
+    }
+
+    IndexBlock_init(&buffer->index);
+    o->num_buffers++;
+
+    return buffer;
+}
+
+/**
+ * Body of an encoder thread. Takes the oldest queued buffer that no other
+ * encoder thread has taken yet and encodes (and indexes) it as a block, until
+ * asked to stop with nothing left to take.
+ */
+static void* encoderLoop(void* arg) {
+    CaptureWriter* o = (CaptureWriter*) arg;
+    CompactEncoder* encoder = CompactEncoder_new();
+    WriterBuffer* buffer;
+
+    while (true) {
+        pthread_mutex_lock(&o->lock);
+
+        while (o->num_claimed == o->num_full && !o->stopping) {
+            pthread_cond_wait(&o->changed, &o->lock);
+        }
+
+        if (o->num_claimed == o->num_full) {
+            pthread_mutex_unlock(&o->lock);
+            break;
+        }
+
+        buffer = o->full_buffers[(o->full_head + o->num_claimed) % o->max_buffers];
+        o->num_claimed++;
+        pthread_mutex_unlock(&o->lock);
+
+        buffer->encoded_length = CompactEncoder_encode(encoder, buffer->data, buffer->length, buffer->encoded);
+
+        if (o->limits.index) {
+            indexBuffer(o, buffer);
+        }
+
+        pthread_mutex_lock(&o->lock);
+        buffer->ready = true;
+        pthread_cond_broadcast(&o->changed);
+        pthread_mutex_unlock(&o->lock);
+    }
+
+    CompactEncoder_free(encoder);
+
+    return NULL;
+}
+
+/**
+ * Body of the writer thread. Writes out each queued buffer in turn as soon as
+ * it is ready (starting new files as asked to), adds it to the file's index if
+ * there is one, and hands it back, until asked to stop with nothing queued.
+ */
+static void* writerLoop(void* arg) {
+    CaptureWriter* o = (CaptureWriter*) arg;
+    OCTET header[COMPACT_FILE_HEADER_SIZE];
+    WriterBuffer* buffer;
+    ULONG offset;
+
+    while (true) {
+        pthread_mutex_lock(&o->lock);
+
+        while ((o->num_full == 0) ? !o->stopping : !o->full_buffers[o->full_head]->ready) {
+            pthread_cond_wait(&o->changed, &o->lock);
+        }
+
+        if (o->num_full == 0) {
+            pthread_mutex_unlock(&o->lock);
+            break;
+        }
+
+        buffer = o->full_buffers[o->full_head];
+        o->full_head = (o->full_head + 1) % o->max_buffers;
+        o->num_full--;
+
+        if (o->format == CFF_COMPACT) {
+            o->num_claimed--;
+        }
+
+        pthread_mutex_unlock(&o->lock);
+
+        if (buffer->starts_file) {
+            openFile(o, buffer->path);
+
+            if (o->format == CFF_COMPACT) {
+                writeAll(o, header, CompactFormat_writeFileHeader(header));
+            }
+        }
+
+        offset = o->file_written;
+
+        if (o->format == CFF_COMPACT) {
+            writeAll(o, buffer->encoded, buffer->encoded_length);
+        } else {
+            writeAll(o, buffer->data, buffer->length);
+        }
+
+        // NOTE ~> The buffers of pcap and pcapng files are indexed right here,
+        //  as they aren't encoded, and the header of a file never goes into
+        //  its first block.
+        if (o->index != NULL) {
+            if (o->format != CFF_COMPACT) {
+                indexBuffer(o, buffer);
+                offset += buffer->frames_offset;
+            }
+
+            if (buffer->index.num_frames > 0) {
+                IndexWriter_append(o->index, &buffer->index, offset, o->file_written - offset);
+            }
+        }
+
+        pthread_mutex_lock(&o->lock);
+        o->free_buffers[o->num_free++] = buffer;
+        pthread_cond_broadcast(&o->changed);
+        pthread_mutex_unlock(&o->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Closes the file being written (if any) and creates the one at the provided
+ * path in its place.
+ */
+static void openFile(CaptureWriter* o, const char* path) {
+    closeFile(o);
+
+    if ((o->descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        fatal("Failed to create the capture file \"%s\". (%i: %s)", path, errno, strerror(errno));
+    }
+
+    if (o->limits.preallocate_size > 0) {
+        preallocate(o, path);
+    }
+
+    if (o->limits.index) {
+        o->index = IndexWriter_open(path);
+    }
+
+    o->file_written = 0;
+    o->files_written++;
+    info("Writing frames to \"%s\".", path);
+}
+
+/**
+ * Closes the file being written, if any, handing back whatever preallocated
+ * space it did not end up using, and finishes off its index.
+ */
+static void closeFile(CaptureWriter* o) {
+    off_t size;
+
+    if (o->descriptor == -1) {
+        return;
+    }
+
+    if (o->limits.preallocate_size > 0 && (size = lseek(o->descriptor, 0, SEEK_CUR)) != -1) {
+        ftruncate(o->descriptor, size);
+    }
+
+    close(o->descriptor);
+    o->descriptor = -1;
+
+    if (o->index != NULL) {
+        IndexWriter_close(o->index, o->file_written);
+        o->index = NULL;
+    }
+}
+
+/**
+ * Reserves the configured amount of disk space for the file being written,
+ * without changing its apparent size, so that the file system can lay it out
+ * in one piece and never has to allocate while capture is running.
+ */
+static void preallocate(CaptureWriter* o, const char* path) {
+    int result;
+
+#if defined(__linux__)
+    result = fallocate(o->descriptor, FALLOC_FL_KEEP_SIZE, 0, (off_t) o->limits.preallocate_size);
+#elif defined(F_PREALLOCATE)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t) o->limits.preallocate_size, 0 };
+
+    if ((result = fcntl(o->descriptor, F_PREALLOCATE, &store)) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        result = fcntl(o->descriptor, F_PREALLOCATE, &store);
+    }
+#else
+    result = -1;
+    errno = ENOTSUP;
+#endif
+
+    if (result == -1 && !o->warned_preallocate) {
+        warn("Failed to preallocate space for the capture file \"%s\". (%i: %s)", path, errno, strerror(errno));
+        o->warned_preallocate = true;
+    }
+}
+
+/**
+ * Writes the provided bytes to the current file, however many calls it takes.
+ */
+static void writeAll(CaptureWriter* o, const OCTET* data, size_t length) {
+    ssize_t written;
+
+    while (length > 0) {
+        if ((written = write(o->descriptor, data, length)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fatal("Failed to write to the capture file. (%i: %s)", errno, strerror(errno));
+        }
+
+        data += written;
+        length -= written;
+        o->file_written += written;
+        o->bytes_written += written;
+    }
+}
+
+/**
+ * Describes the frames of the provided (full) buffer in its IndexBlock.
+ */
+static void indexBuffer(CaptureWriter* o, WriterBuffer* buffer) {
+    CapturedFrame frame;
+    size_t offset = buffer->frames_offset;
+
+    IndexBlock_reset(&buffer->index);
+
+    while (offset < buffer->length) {
+        offset += readRecord(o->format, buffer->data + offset, &frame);
+        IndexBlock_add(&buffer->index, &frame);
+    }
+}
+
+/**
+ * Returns the size of the header that every file of the provided writer
+ * starts with.
+ */
+static size_t headerSize(CaptureWriter* o) {
+    size_t size = PCAPNG_SHB_SIZE;
+    UINT i;
+
+    if (o->format == CFF_PCAP) {
+        return PCAP_GLOBAL_HEADER_SIZE;
+    }
+
+    // NOTE ~> The header of a compact file isn't part of any block, so the
+    //  writer thread writes it as it creates the file.
+    if (o->format == CFF_COMPACT) {
+        return 0;
+    }
+
+    if (o->num_interfaces == 0) {
+        return size + interfaceSize("");
+    }
+
+    for (i = 0; i < o->num_interfaces; i++) {
+        size += interfaceSize(o->interface_names[i]);
+    }
+
+    return size;
+}
+
+/**
+ * Writes the header that every file of the provided writer starts with to the
+ * provided position and returns its size. Files are written in this machine's
+ * byte order, with nanosecond timestamps.
+ */
+static size_t writeFileHeader(CaptureWriter* o, OCTET* out) {
+    OCTET* start = out;
+    UINT i;
+
+    if (o->format == CFF_COMPACT) {
+        return 0;
+    }
+
+    if (o->format == CFF_PCAP) {
+        putUint32(out, PCAP_MAGIC_NSEC);
+        putUint16(out + 4, 2);
+        putUint16(out + 6, 4);
+        putUint32(out + 8, 0);
+        putUint32(out + 12, 0);
+        putUint32(out + 16, WRITER_SNAPLEN);
+        putUint32(out + 20, LINKTYPE_ETHERNET);
+
+        return PCAP_GLOBAL_HEADER_SIZE;
+    }
+
+    // Section Header Block (with an unknown section length)
+    putUint32(out, PCAPNG_BLOCK_SHB);
+    putUint32(out + 4, PCAPNG_SHB_SIZE);
+    putUint32(out + 8, PCAPNG_BYTE_ORDER_MAGIC);
+    putUint16(out + 12, 1);
+    putUint16(out + 14, 0);
+    putUint32(out + 16, 0xffffffff);
+    putUint32(out + 20, 0xffffffff);
+    putUint32(out + 24, PCAPNG_SHB_SIZE);
+    out += PCAPNG_SHB_SIZE;
+
+    if (o->num_interfaces == 0) {
+        out += writeInterface("", out);
+    }
+
+    for (i = 0; i < o->num_interfaces; i++) {
+        out += writeInterface(o->interface_names[i], out);
+    }
+
+    return out - start;
+}
+
+/**
+ * Writes an "Interface Description Block" for the interface with the provided
+ * name (with an "if_name" option unless the name is empty, and an "if_tsresol"
+ * option of 10^-9) to the provided position and returns its size.
+ */
+static size_t writeInterface(const char* name, OCTET* out) {
+    size_t size = interfaceSize(name);
+    size_t length = strlen(name);
+    OCTET* option = out + 16;
+
+    putUint32(out, PCAPNG_BLOCK_IDB);
+    putUint32(out + 4, size);
+    putUint16(out + 8, LINKTYPE_ETHERNET);
+    putUint16(out + 10, 0);
+    putUint32(out + 12, WRITER_SNAPLEN);
+
+    if (length > 0) {
+        putUint16(option, PCAPNG_OPTION_IF_NAME);
+        putUint16(option + 2, length);
+        memset(option + 4, 0x00, (length + 3) & ~3U);
+        memcpy(option + 4, name, length);
+        option += 4 + ((length + 3) & ~3U);
+    }
+
+    putUint16(option, PCAPNG_OPTION_IF_TSRESOL);
+    putUint16(option + 2, 1);
+    putUint32(option + 4, 9);
+    putUint16(option + 8, PCAPNG_OPTION_END);
+    putUint16(option + 10, 0);
+    putUint32(out + size - 4, size);
+
+    return size;
+}
+
+/**
+ * Returns the size of the "Interface Description Block" for the interface with
+ * the provided name.
+ */
+static size_t interfaceSize(const char* name) {
+    size_t length = strlen(name);
+
+    return PCAPNG_IDB_SIZE + ((length > 0) ? 4 + ((length + 3) & ~3U) : 0);
+}
+
+/**
+ * Writes the record (pcap), "Enhanced Packet Block" (pcapng) or staged frame
+ * (compact) for the provided frame, limited to the provided number of octets,
+ * to the provided position and returns its size.
+ */
+static size_t writeRecord(CaptureFileFormat format, const CapturedFrame* frame, UINT caplen, OCTET* out) {
+    size_t size = recordSize(format, caplen);
+    uint64_t units;
+
+    if (format == CFF_COMPACT) {
+        CompactFormat_stage(frame, caplen, out);
+
+        return size;
+    }
+
+    if (format == CFF_PCAP) {
+        putUint32(out, (uint32_t) frame->timestamp.tv_sec);
+        putUint32(out + 4, (uint32_t) frame->timestamp.tv_nsec);
+        putUint32(out + 8, caplen);
+        putUint32(out + 12, frame->wirelen);
+        memcpy(out + PCAP_RECORD_HEADER_SIZE, frame->data, caplen);
+
+        return size;
+    }
+
+    units = ((uint64_t) frame->timestamp.tv_sec * 1000000000ULL) + frame->timestamp.tv_nsec;
+
+    putUint32(out, PCAPNG_BLOCK_EPB);
+    putUint32(out + 4, size);
+    putUint32(out + 8, frame->interface);
+    putUint32(out + 12, (uint32_t) (units >> 32));
+    putUint32(out + 16, (uint32_t) units);
+    putUint32(out + 20, caplen);
+    putUint32(out + 24, frame->wirelen);
+    memcpy(out + 28, frame->data, caplen);
+    memset(out + 28 + caplen, 0x00, size - PCAPNG_EPB_OVERHEAD - caplen);
+    putUint32(out + size - 4, size);
+
+    return size;
+}
+
+/**
+ * Describes the frame in the record (pcap), "Enhanced Packet Block" (pcapng) or
+ * staged frame (compact) at the provided position (as written by this writer)
+ * and returns its size.
+ */
+static size_t readRecord(CaptureFileFormat format, const OCTET* in, CapturedFrame* frame) {
+    uint32_t value;
+    uint64_t units;
+
+    if (format == CFF_COMPACT) {
+        return CompactFormat_readStaged(in, frame);
+    }
+
+    if (format == CFF_PCAP) {
+        memcpy(&value, in, sizeof(value));
+        frame->timestamp.tv_sec = value;
+        memcpy(&value, in + 4, sizeof(value));
+        frame->timestamp.tv_nsec = value;
+        memcpy(&frame->caplen, in + 8, sizeof(frame->caplen));
+        memcpy(&frame->wirelen, in + 12, sizeof(frame->wirelen));
+        frame->data = (OCTET*) in + PCAP_RECORD_HEADER_SIZE;
+
+        return PCAP_RECORD_HEADER_SIZE + frame->caplen;
+    }
+
+    memcpy(&value, in + 12, sizeof(value));
+    units = (uint64_t) value << 32;
+    memcpy(&value, in + 16, sizeof(value));
+    units |= value;
+    frame->timestamp.tv_sec = units / 1000000000ULL;
+    frame->timestamp.tv_nsec = units % 1000000000ULL;
+    memcpy(&frame->interface, in + 8, sizeof(frame->interface));
+    memcpy(&frame->caplen, in + 20, sizeof(frame->caplen));
+    memcpy(&frame->wirelen, in + 24, sizeof(frame->wirelen));
+    frame->data = (OCTET*) in + 28;
+    memcpy(&value, in + 4, sizeof(value));
+
+    return value;
+}
+
+/**
+ * Returns the size of the record (pcap), block (pcapng) or staged frame
+ * (compact) for a frame with the provided number of octets.
+ */
+static size_t recordSize(CaptureFileFormat format, UINT caplen) {
+    if (format == CFF_PCAP) {
+        return PCAP_RECORD_HEADER_SIZE + caplen;
+    }
+
+    if (format == CFF_COMPACT) {
+        return CompactFormat_stagedSize(caplen);
+    }
+
+    // NOTE ~> pcapng pads the frame out to a multiple of four octets.
+    return PCAPNG_EPB_OVERHEAD + ((caplen + 3) & ~3U);
+}
+
+/**
+ * Writes a two octet integer in this machine's byte order.
+ */
+static void putUint16(OCTET* ptr, uint16_t value) {
+    memcpy(ptr, &value, sizeof(value));
+}
+
+/**
+ * Writes a four octet integer in this machine's byte order.
+ */
+static void putUint32(OCTET* ptr, uint32_t value) {
+    memcpy(ptr, &value, sizeof(value));
+}
@@ -0,0 +1,80 @@
+#ifndef _CAPTURE_WRITER_H_
+#define _CAPTURE_WRITER_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include <stdbool.h>
+
+// NOTE ~> A capture writer records captured frames to pcap, pcapng or compact
+//  files.
+//  Frames are copied into large, page-aligned buffers on the capturing thread
+//  and a background thread writes each full buffer out with a single call, so
+//  a slow disk only ever delays the writer thread. If every buffer is waiting
+//  on the disk, the capturing thread waits for one to free up rather than
+//  dropping frames (the kernel's capture buffers take up the slack meanwhile).
+//  pcapng files describe each interface that frames were captured on, and
+//  record which of them every frame came from. Compact files (see
+//  compact_format.h) take a further step between the two: each full buffer is
+//  encoded as a block by one of a number of encoder threads, and the writer
+//  thread writes the encoded blocks out in the order they were filled. Files
+//  can also be indexed as they are written, block by block (i.e. buffer by
+//  buffer), by whichever thread gets to each buffer before the writer thread.
+
+/**
+ * The capture file formats that can be written.
+ */
+typedef enum CaptureFileFormat {
+    CFF_PCAP,
+    CFF_PCAPNG,
+    CFF_COMPACT
+} CaptureFileFormat;
+
+/**
+ * The most threads that can encode blocks of compact files.
+ */
+#define WRITER_MAX_ENCODERS 16
+
+/**
+ * When a capture writer moves on to a new file, how much disk space it reserves
+ * for each file up front (zero turns either feature off), how many threads it
+ * encodes compact files with, and whether it indexes the files.
+ */
+typedef struct CaptureWriterLimits {
+    /**
+     * Start a new file before the current one grows past this many bytes
+     * (before they are encoded, for compact files).
+     */
+    ULONG rotate_size;
+
+    /**
+     * Start a new file once this many seconds of traffic have been written to
+     * the current one.
+     */
+    UINT rotate_seconds;
+
+    /**
+     * Number of bytes to allocate on disk for each file as soon as it is
+     * created.
+     */
+    ULONG preallocate_size;
+
+    /**
+     * Number of threads that encode blocks of compact files (one if zero).
+     */
+    UINT encoders;
+
+    /**
+     * Whether to build an index (see capture_index.h) of each file as it is
+     * written.
+     */
+    bool index;
+} CaptureWriterLimits;
+
+typedef struct CaptureWriter CaptureWriter;
+
+CaptureWriter* CaptureWriter_open(const char* path, CaptureFileFormat format, const CaptureWriterLimits* limits);
+void CaptureWriter_addInterface(CaptureWriter* o, const char* name);
+void CaptureWriter_write(CaptureWriter* o, const CapturedFrame* frame);
+void CaptureWriter_close(CaptureWriter* o);
+
+#endif
@@ -0,0 +1,262 @@
+#include "checksum.h"
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_AVX2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CHECKSUM_NEON
+#endif
+#include "common.h"
+#include "ethernet_frame.h"
+
+#define IPV4_ADDRESSES_OFFSET   12
+#define IPV4_ADDRESSES_SIZE     8
+#define IPV6_ADDRESSES_OFFSET   8
+#define IPV6_ADDRESSES_SIZE     32
+#define UDP_CHECKSUM_OFFSET     6
+
+/**
+ * Most blocks that a vector sum adds up in its 32-bit lanes before moving them
+ * into the 64-bit total, so that none of them can overflow.
+ */
+#define MAX_VECTOR_BLOCKS       16384
+
+/**
+ * Adds up the provided data as native 16-bit words (padding it with a zero
+ * octet if its length is odd), leaving the result to be folded.
+ */
+typedef uint64_t (*SumFunction)(const OCTET* data, size_t length);
+
+typedef struct SumImplementation {
+    const char* name;
+    SumFunction sum;
+} SumImplementation;
+
+static uint64_t sumScalar(const OCTET* data, size_t length);
+#if defined(CHECKSUM_AVX2)
+static uint64_t sumAvx2(const OCTET* data, size_t length);
+#elif defined(CHECKSUM_NEON)
+static uint64_t sumNeon(const OCTET* data, size_t length);
+#endif
+static const SumImplementation* getImplementation();
+static uint16_t fold(uint64_t sum);
+
+static const SumImplementation SCALAR = { "scalar", sumScalar };
+#if defined(CHECKSUM_AVX2)
+static const SumImplementation AVX2 = { "AVX2", sumAvx2 };
+#elif defined(CHECKSUM_NEON)
+static const SumImplementation NEON = { "NEON", sumNeon };
+#endif
+
+static const SumImplementation* implementation = NULL;
+
+/**
+ * Returns the folded ones' complement sum of the provided data. It is in the
+ * same byte order as the data, so its complement can be copied as is into a
+ * checksum field.
+ */
+uint16_t Checksum_sum(const OCTET* data, size_t length) {
+    return fold(getImplementation()->sum(data, length));
+}
+
+/**
+ * Verifies every checksum of the provided decoded frame that can be verified,
+ * and returns which ones were and which of those were wrong (as a bitmask of
+ * ChecksumFlags), which are also kept in the FrameDescriptor.
+ */
+UINT Checksum_verify(FrameDescriptor* frame) {
+    const OCTET* network = frame->data + frame->network_offset;
+    bool is_ipv4 = (frame->ethernet_type == ET_IPV4);
+    UINT flags = 0, length;
+    uint64_t sum = 0;
+
+    if (!(frame->layers & FL_NETWORK)) {
+        return frame->checksums = 0;
+    }
+
+    // NOTE ~> IPv6 headers have no checksum of their own.
+    if (is_ipv4) {
+        flags |= CS_NETWORK_VERIFIED;
+
+        if (fold(sumScalar(network, frame->network_header_size)) != 0xffff) {
+            flags |= CS_NETWORK_BAD;
+        }
+    }
+
+    // The transport checksum covers all of the segment (and more), so it can
+    //  only be verified if none of it is missing
+    if ((frame->layers & (FL_TRANSPORT | FL_FRAGMENT)) != FL_TRANSPORT || frame->datagram_end > frame->caplen) {
+        return frame->checksums = flags;
+    }
+
+    // NOTE ~> A UDP datagram sent over IPv4 doesn't have to have a checksum,
+    //  in which case the field is left as zero.
+    if (frame->ip_protocol == IP_UDP && is_ipv4 &&
+            frame->data[frame->transport_offset + UDP_CHECKSUM_OFFSET] == 0 &&
+            frame->data[frame->transport_offset + UDP_CHECKSUM_OFFSET + 1] == 0) {
+        return frame->checksums = flags;
+    }
+
+    length = frame->datagram_end - frame->transport_offset;
+
+    // Every checksum but the ICMP one also covers a pseudo-header made out of
+    //  the IP addresses, the protocol and the length of the segment
+    if (frame->ip_protocol != IP_ICMP) {
+        sum = is_ipv4 ? sumScalar(network + IPV4_ADDRESSES_OFFSET, IPV4_ADDRESSES_SIZE) :
+                sumScalar(network + IPV6_ADDRESSES_OFFSET, IPV6_ADDRESSES_SIZE);
+        sum += htons(frame->ip_protocol) + htons(length & 0xffff) + htons(length >> 16);
+    }
+
+    sum += getImplementation()->sum(frame->data + frame->transport_offset, length);
+    flags |= CS_TRANSPORT_VERIFIED;
+
+    if (fold(sum) != 0xffff) {
+        flags |= CS_TRANSPORT_BAD;
+    }
+
+    return frame->checksums = flags;
+}
+
+/**
+ * Returns the name of the implementation that sums are taken with.
+ */
+const char* Checksum_getImplementation() {
+    return getImplementation()->name;
+}
+
+/**
+ * Sums the provided data up 64 bits at a time, adding each half to a 64-bit
+ * total (which can't overflow for anything short of gigabytes).
+ */
+static uint64_t sumScalar(const OCTET* data, size_t length) {
+    uint64_t sum = 0, words[4], word;
+
+    while (length >= sizeof(words)) {
+        memcpy(words, data, sizeof(words));
+        sum += (words[0] & 0xffffffff) + (words[0] >> 32) + (words[1] & 0xffffffff) + (words[1] >> 32) +
+                (words[2] & 0xffffffff) + (words[2] >> 32) + (words[3] & 0xffffffff) + (words[3] >> 32);
+        data += sizeof(words);
+        length -= sizeof(words);
+    }
+
+    while (length >= sizeof(word)) {
+        memcpy(&word, data, sizeof(word));
+        sum += (word & 0xffffffff) + (word >> 32);
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    // NOTE ~> Copying what is left over a zeroed word keeps every octet in the
+    //  same position within its 16-bit word, whatever the host's byte order.
+    if (length > 0) {
+        word = 0;
+        memcpy(&word, data, length);
+        sum += (word & 0xffffffff) + (word >> 32);
+    }
+
+    return sum;
+}
+
+#if defined(CHECKSUM_AVX2)
+/**
+ * Sums the provided data up 256 bits at a time, splitting every 32-bit lane
+ * into its two 16-bit words.
+ */
+__attribute__((target("avx2")))
+static uint64_t sumAvx2(const OCTET* data, size_t length) {
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    uint32_t lanes[16];
+    uint64_t sum = 0;
+    UINT blocks, i;
+
+    while (length >= sizeof(__m256i)) {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+
+        for (blocks = 0; blocks < MAX_VECTOR_BLOCKS && length >= sizeof(__m256i); blocks++) {
+            __m256i words = _mm256_loadu_si256((const __m256i*) data);
+
+            low = _mm256_add_epi32(low, _mm256_and_si256(words, mask));
+            high = _mm256_add_epi32(high, _mm256_srli_epi32(words, 16));
+            data += sizeof(__m256i);
+            length -= sizeof(__m256i);
+        }
+
+        _mm256_storeu_si256((__m256i*) lanes, low);
+        _mm256_storeu_si256((__m256i*) (lanes + 8), high);
+
+        for (i = 0; i < 16; i++) {
+            sum += lanes[i];
+        }
+    }
+
+    return sum + sumScalar(data, length);
+}
+#elif defined(CHECKSUM_NEON)
+/**
+ * Sums the provided data up 128 bits at a time, adding pairs of 16-bit words
+ * into 32-bit lanes.
+ */
+static uint64_t sumNeon(const OCTET* data, size_t length) {
+    uint64_t sum = 0;
+    UINT blocks;
+
+    while (length >= sizeof(uint16x8_t)) {
+        uint32x4_t lanes = vdupq_n_u32(0);
+
+        for (blocks = 0; blocks < MAX_VECTOR_BLOCKS && length >= sizeof(uint16x8_t); blocks++) {
+            lanes = vpadalq_u16(lanes, vreinterpretq_u16_u8(vld1q_u8(data)));
+            data += sizeof(uint16x8_t);
+            length -= sizeof(uint16x8_t);
+        }
+
+        sum += vaddlvq_u32(lanes);
+    }
+
+    return sum + sumScalar(data, length);
+}
+#endif
+
+/**
+ * Returns the widest implementation that the CPU supports, picking it the
+ * first time around (NEON is always there on AArch64, whereas AVX2 has to be
+ * asked for).
+ */
+static const SumImplementation* getImplementation() {
+    const SumImplementation* selected = __atomic_load_n(&implementation, __ATOMIC_ACQUIRE);
+
+    if (selected != NULL) {
+        return selected;
+    }
+
+    selected = &SCALAR;
+
+#if defined(CHECKSUM_AVX2)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        selected = &AVX2;
+    }
+#elif defined(CHECKSUM_NEON)
+    selected = &NEON;
+#endif
+
+    __atomic_store_n(&implementation, selected, __ATOMIC_RELEASE);
+
+    return selected;
+}
+
+/**
+ * Folds the provided sum down to 16 bits, carrying around everything that
+ * overflows them.
+ */
+static uint16_t fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t) sum;
+}
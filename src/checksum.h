@@ -0,0 +1,41 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include "common.h"
+#include "frame_descriptor.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// NOTE ~> Checksums are verified straight from a frame's FrameDescriptor: the
+//  IPv4 header checksum, and the TCP, UDP, ICMP and ICMPv6 checksums (along
+//  with their pseudo-headers, where they have one). Ones' complement sums are
+//  the same whatever order their words are added in, and in whatever byte
+//  order they are read, as long as every word is read the same way. So rather
+//  than adding up one big-endian 16-bit word at a time, the sum is taken over
+//  wide native words (with AVX2 or NEON when there is any), and only the last
+//  few octets are handled on their own. The widest implementation that the CPU
+//  supports is picked the first time a sum is taken.
+
+/**
+ * Flags describing which checksums of a frame were verified, and which of
+ * those were found to be wrong.
+ */
+typedef enum ChecksumFlags {
+    CS_NETWORK_VERIFIED     = 0x01,
+    CS_NETWORK_BAD          = 0x02,
+
+    /**
+     * The checksum of a TCP segment, UDP datagram or ICMP(v6) message is only
+     * verified if all of it has been captured, in a single frame.
+     */
+    CS_TRANSPORT_VERIFIED   = 0x04,
+    CS_TRANSPORT_BAD        = 0x08
+} ChecksumFlags;
+
+#define CS_BAD (CS_NETWORK_BAD | CS_TRANSPORT_BAD)
+
+uint16_t Checksum_sum(const OCTET* data, size_t length);
+UINT Checksum_verify(FrameDescriptor* frame);
+const char* Checksum_getImplementation();
+
+#endif
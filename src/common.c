@@ -39,38 +39,54 @@ void octetsToInt(OCTET* octets, size_t num_octets, UINT* buff) {
 
 /**
  * Packs the character representation of each of the provided octets into the
- * provided buffer. It is expected that the buffer is big enough to hold the
- * number of octets provided plus one for a null terminator.
+ * provided buffer, substituting a '.' for any that isn't printable. It is
+ * expected that the buffer is big enough to hold the number of octets provided
+ * plus one for a null terminator. Returns the number of characters packed (not
+ * counting the null terminator).
  */
-void octetsToCharString(OCTET* octets, size_t num_octets, char* buff) {
-    // TODO: Implement this function.
+size_t octetsToCharString(OCTET* octets, size_t num_octets, char* buff) {
+    size_t i;
+
+    for (i = 0; i < num_octets; i++) {
+        buff[i] = (octets[i] >= 0x20 && octets[i] < 0x7f) ? (char) octets[i] : '.';
+    }
+
+    buff[num_octets] = '\0';
+
+    return num_octets;
 }
 
 /**
  * Packs the hex character representation of each of the provided octets into
- * the provided buffer. It is expected that the buffer is big enough to hold the
- * hex representation number of octets (2 characters each) provided, plus enough
- * for the separator, plus one for a null terminator.
+ * the provided buffer, with the provided separator between every
+ * sep_interval hex characters (or no separators at all if sep_interval is 0).
+ * It is expected that the buffer is big enough to hold the hex representation
+ * of the number of octets provided (2 characters each), plus enough for the
+ * separators, plus one for a null terminator. Returns the number of characters
+ * packed (not counting the null terminator).
  */
-void octetsToHexString(OCTET* octets, size_t num_octets, char* buff, char sep, size_t sep_interval) {
-    // Come up with the real buffer size and clean the buffer
-    size_t num_seps = (((num_octets * 2) / sep_interval) - 1);
-    size_t buff_size = ((num_octets * 2) + num_seps + 1);
-
-    memset(buff, 0x00, (sizeof(*buff) * buff_size));
+size_t octetsToHexString(OCTET* octets, size_t num_octets, char* buff, char sep, size_t sep_interval) {
+    static const char hexDigits[] = "0123456789abcdef";
+    char* out = buff;
+    size_t i;
 
-    // Pack the octets into the buffer
-    int processed_octets = 0;
+    // NOTE ~> Without an interval the countdown to the next separator starts
+    //  out too high to ever run out.
+    size_t until_sep = (sep_interval > 0) ? sep_interval : (size_t) -1;
 
-    while (processed_octets < num_octets) {
+    for (i = 0; i < num_octets * 2; i++) {
         // Add a separator if necessary
-        if (processed_octets > 0 && (processed_octets / sep_interval) % 1 == 0)
-            *(buff + strlen(buff)) = sep;
-
-        // Add the hex-formatted octet
-        sprintf((buff + strlen(buff)), "%02x", octets[processed_octets]);
+        if (until_sep == 0) {
+            *out++ = sep;
+            until_sep = sep_interval;
+        }
 
-        // Count the octet that we just processed
-        processed_octets++;
+        // Add the hex-formatted nibble
+        *out++ = hexDigits[(i & 1) ? (octets[i >> 1] & 0x0f) : (octets[i >> 1] >> 4)];
+        until_sep--;
     }
+
+    *out = '\0';
+
+    return out - buff;
 }
\ No newline at end of file
@@ -12,13 +12,24 @@
 #define MAX_BPF_DEVICES 99
 #define MAX_PATH_LENGTH 256
 
+// NOTE ~> Live capture is done through whichever kernel facility the platform
+//  being compiled for provides. BSD-based systems (including macOS) provide the
+//  BPF device, while Linux provides memory-mapped AF_PACKET rings. On any other
+//  platform only offline capture files can be read.
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || \
+        defined(__DragonFly__)
+#define HAVE_BPF_DEVICE
+#elif defined(__linux__)
+#define HAVE_PACKET_MMAP
+#endif
+
 typedef unsigned char OCTET;
 typedef unsigned int UINT;
 typedef unsigned long ULONG;
 
 void verifyConfiguration();
 void octetsToInt(OCTET* octets, size_t num_octets, UINT* buff);
-void octetsToCharString(OCTET* octets, size_t num_octets, char* buff);
-void octetsToHexString(OCTET* octets, size_t num_octets, char* buff, char sep, size_t sep_interval);
+size_t octetsToCharString(OCTET* octets, size_t num_octets, char* buff);
+size_t octetsToHexString(OCTET* octets, size_t num_octets, char* buff, char sep, size_t sep_interval);
 
 #endif
\ No newline at end of file
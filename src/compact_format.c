@@ -0,0 +1,982 @@
+#include "compact_format.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "frame_descriptor.h"
+#include "flow_table.h"
+#include "large_buffer.h"
+#include "logger.h"
+
+#define NANOSECONDS_PER_SECOND      1000000000ULL
+
+#define COMPACT_VERSION             1
+#define COMPACT_BLOCK_MAGIC         0x4b4c4253
+
+/**
+ * Staged frames are laid out as their timestamp (in nanoseconds), captured
+ * length, original length and interface, followed by their data.
+ */
+#define STAGED_HEADER_SIZE          20
+
+#define DICTIONARY_SLOTS            4096
+#define MAX_DICTIONARY_HEADER       128
+
+/**
+ * The octet that starts the description of each frame says how its headers are
+ * stored (in the low two bits) and which optional values follow.
+ */
+#define HEADER_NONE                 0
+#define HEADER_DELTA                1
+#define HEADER_LITERAL              2
+#define FLAG_HEADER_MASK            0x03
+#define FLAG_WIRELEN                0x04
+#define FLAG_INTERFACE              0x08
+
+/**
+ * The most octets that the descriptions of a block's frames can take up.
+ */
+#define MAX_META_SIZE               (3 * COMPACT_BLOCK_SIZE)
+
+#define LZ_MIN_MATCH                4
+#define LZ_MAX_OFFSET               65535
+#define LZ_HASH_BITS                16
+
+/**
+ * The headers of the previous frame of a flow, as stored in the dictionary
+ * slot that the flow hashes to.
+ */
+typedef struct DictionaryEntry {
+    /**
+     * The block that the entry was last filled in for (entries from earlier
+     * blocks are empty) and the hash of its flow.
+     */
+    UINT block;
+    uint32_t key;
+
+    UINT length;
+    OCTET header[MAX_DICTIONARY_HEADER];
+} DictionaryEntry;
+
+/**
+ * State of an encoder, which only one thread may use at a time.
+ */
+struct CompactEncoder {
+    DictionaryEntry* dictionary;
+    UINT block;
+
+    /**
+     * Where each hash of four octets was last seen by the compressor (plus
+     * one, so that zero means never).
+     */
+    uint32_t* positions;
+
+    /**
+     * Where the descriptions of a block's frames and their payloads are put
+     * together before they are compressed.
+     */
+    OCTET* meta;
+    OCTET* payload;
+};
+
+/**
+ * State of a decoder, which hands out the frames of the block that it last
+ * loaded one by one.
+ */
+struct CompactDecoder {
+    DictionaryEntry* dictionary;
+    UINT block;
+
+    /**
+     * Where streams that were compressed are decompressed into, and where
+     * frames are put back together.
+     */
+    OCTET* meta_buffer;
+    OCTET* payload_buffer;
+    OCTET* frames;
+
+    /**
+     * The unread parts of the current block's streams and the free part of
+     * the frame buffer.
+     */
+    const OCTET* meta;
+    const OCTET* meta_end;
+    const OCTET* payload;
+    const OCTET* payload_end;
+    OCTET* out;
+    OCTET* out_end;
+
+    /**
+     * Number of frames left in the current block, and the timestamp and
+     * interface of the previous one.
+     */
+    UINT remaining;
+    uint64_t timestamp;
+    UINT interface;
+};
+
+static UINT findHeader(const OCTET* data, UINT caplen, uint32_t* key);
+static OCTET* encodeHeader(CompactEncoder* o, uint32_t key, const OCTET* header, UINT length, OCTET* flags,
+        OCTET* out);
+static size_t packStream(CompactEncoder* o, const OCTET* in, size_t length, OCTET* out);
+static bool decodeFrame(CompactDecoder* o, CapturedFrame* frame);
+static const OCTET* decodeHeader(CompactDecoder* o, const OCTET* meta, UINT mode, UINT caplen, UINT* length,
+        const OCTET** header);
+static bool unpackStream(const OCTET* in, size_t packed_size, OCTET* buffer, size_t size, const OCTET** stream);
+static size_t compress(uint32_t* positions, const OCTET* in, size_t length, OCTET* out, size_t capacity);
+static size_t matchLength(const OCTET* ptr, const OCTET* candidate, const OCTET* end);
+static OCTET* emitSequence(OCTET* out, const OCTET* out_end, const OCTET* literals, size_t num_literals,
+        size_t offset, size_t match_length);
+static bool decompress(const OCTET* in, size_t length, OCTET* out, size_t size);
+static bool readLength(const OCTET** in, const OCTET* end, size_t* length);
+static OCTET* putVarint(OCTET* out, uint64_t value);
+static const OCTET* getVarint(const OCTET* in, const OCTET* end, uint64_t* value);
+static void putLe32(OCTET* ptr, uint32_t value);
+static void putLe64(OCTET* ptr, uint64_t value);
+static uint32_t getLe32(const OCTET* ptr);
+static uint64_t getLe64(const OCTET* ptr);
+
+/**
+ * Writes the header that every compact capture file starts with to the
+ * provided position and returns its size.
+ */
+size_t CompactFormat_writeFileHeader(OCTET* out) {
+    putLe32(out, COMPACT_MAGIC);
+    putLe32(out + 4, COMPACT_VERSION);
+
+    return COMPACT_FILE_HEADER_SIZE;
+}
+
+/**
+ * Determines whether the provided data starts with the header of a compact
+ * capture file of a version that we can read.
+ */
+bool CompactFormat_checkFileHeader(const OCTET* data, size_t length) {
+    return length >= COMPACT_FILE_HEADER_SIZE && getLe32(data) == COMPACT_MAGIC &&
+            getLe32(data + 4) == COMPACT_VERSION;
+}
+
+/**
+ * Reads the header of the block at the provided position, making sure that
+ * the block is whole (going by the provided number of octets that are left)
+ * and that its sizes make sense. Returns false if it isn't a valid block.
+ */
+bool CompactFormat_readBlockInfo(const OCTET* data, size_t length, CompactBlockInfo* info) {
+    uint32_t meta_size, meta_packed, payload_size, payload_packed;
+
+    if (length < COMPACT_BLOCK_HEADER_SIZE || getLe32(data + 20) != COMPACT_BLOCK_MAGIC) {
+        return false;
+    }
+
+    meta_size = getLe32(data + 4);
+    meta_packed = getLe32(data + 8);
+    payload_size = getLe32(data + 12);
+    payload_packed = getLe32(data + 16);
+
+    if (meta_size > MAX_META_SIZE || meta_packed > meta_size || payload_size > COMPACT_BLOCK_SIZE ||
+            payload_packed > payload_size) {
+        return false;
+    }
+
+    info->num_frames = getLe32(data);
+    info->size = COMPACT_BLOCK_HEADER_SIZE + (size_t) meta_packed + payload_packed;
+    info->first_timestamp = getLe64(data + 24);
+    info->last_timestamp = getLe64(data + 32);
+
+    return info->size <= length;
+}
+
+/**
+ * Returns the number of octets that staging a frame with the provided number of
+ * octets takes up.
+ */
+size_t CompactFormat_stagedSize(UINT caplen) {
+    return STAGED_HEADER_SIZE + caplen;
+}
+
+/**
+ * Stages the provided frame, limited to the provided number of octets, at the
+ * provided position, ready to be encoded as part of a block.
+ */
+void CompactFormat_stage(const CapturedFrame* frame, UINT caplen, OCTET* out) {
+    uint64_t timestamp = (uint64_t) frame->timestamp.tv_sec * NANOSECONDS_PER_SECOND + frame->timestamp.tv_nsec;
+
+    memcpy(out, &timestamp, sizeof(timestamp));
+    memcpy(out + 8, &caplen, sizeof(caplen));
+    memcpy(out + 12, &frame->wirelen, sizeof(frame->wirelen));
+    memcpy(out + 16, &frame->interface, sizeof(frame->interface));
+    memcpy(out + STAGED_HEADER_SIZE, frame->data, caplen);
+}
+
+/**
+ * Describes the frame staged at the provided position and returns the number
+ * of octets that it takes up.
+ */
+size_t CompactFormat_readStaged(const OCTET* staged, CapturedFrame* frame) {
+    uint64_t timestamp;
+
+    memcpy(&timestamp, staged, sizeof(timestamp));
+    memcpy(&frame->caplen, staged + 8, sizeof(frame->caplen));
+    memcpy(&frame->wirelen, staged + 12, sizeof(frame->wirelen));
+    memcpy(&frame->interface, staged + 16, sizeof(frame->interface));
+    frame->timestamp.tv_sec = timestamp / NANOSECONDS_PER_SECOND;
+    frame->timestamp.tv_nsec = timestamp % NANOSECONDS_PER_SECOND;
+    frame->data = (OCTET*) staged + STAGED_HEADER_SIZE;
+
+    return STAGED_HEADER_SIZE + frame->caplen;
+}
+
+/**
+ * Allocates a new CompactEncoder.
+ */
+CompactEncoder* CompactEncoder_new() {
+    CompactEncoder* o = (CompactEncoder*) calloc(1, sizeof(CompactEncoder));
+
+    if (o == NULL) {
+        fatal("Failed to allocate the compact encoder.");
+    }
+
+    o->dictionary = (DictionaryEntry*) LargeBuffer_alloc(DICTIONARY_SLOTS * sizeof(DictionaryEntry), ANY_NODE);
+    o->positions = (uint32_t*) LargeBuffer_alloc(sizeof(uint32_t) << LZ_HASH_BITS, ANY_NODE);
+    o->meta = (OCTET*) LargeBuffer_alloc(MAX_META_SIZE, ANY_NODE);
+    o->payload = (OCTET*) LargeBuffer_alloc(COMPACT_BLOCK_SIZE, ANY_NODE);
+
+    if (o->dictionary == NULL || o->positions == NULL || o->meta == NULL || o->payload == NULL) {
+        fatal("Failed to allocate the compact encoder's buffers.");
+    }
+
+    return o;
+}
+
+/**
+ * Encodes the provided staged frames (no more than COMPACT_BLOCK_SIZE octets of
+ * them) as a single block at the provided position, which must have room for
+ * COMPACT_MAX_ENCODED_SIZE octets, and returns the size of the block.
+ */
+size_t CompactEncoder_encode(CompactEncoder* o, const OCTET* staged, size_t length, OCTET* out) {
+    const OCTET* end = staged + length;
+    OCTET* meta = o->meta;
+    OCTET* payload = o->payload;
+    uint64_t first = UINT64_MAX, last = 0, previous = 0, timestamp, delta;
+    UINT num_frames = 0, interface = 0, caplen, wirelen, frame_interface, header_length;
+    uint32_t key;
+    size_t meta_packed, payload_packed;
+
+    // Everything in the dictionary belongs to the previous block
+    o->block++;
+
+    while (staged < end) {
+        OCTET* flags;
+
+        memcpy(&timestamp, staged, sizeof(timestamp));
+        memcpy(&caplen, staged + 8, sizeof(caplen));
+        memcpy(&wirelen, staged + 12, sizeof(wirelen));
+        memcpy(&frame_interface, staged + 16, sizeof(frame_interface));
+        staged += STAGED_HEADER_SIZE;
+
+        // Describe the frame, with its timestamp as a (zigzag encoded) step
+        //  from the previous one and only the values that aren't implied
+        flags = meta++;
+        *flags = 0;
+
+        delta = timestamp - previous;
+        meta = putVarint(meta, (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63));
+        meta = putVarint(meta, caplen);
+
+        if (wirelen != caplen) {
+            *flags |= FLAG_WIRELEN;
+            meta = putVarint(meta, wirelen);
+        }
+
+        if (frame_interface != interface) {
+            *flags |= FLAG_INTERFACE;
+            meta = putVarint(meta, frame_interface);
+        }
+
+        // Then its headers, against those of the previous frame of its flow,
+        //  and set its payload aside to be compressed with all of the others
+        if ((header_length = findHeader(staged, caplen, &key)) > 0) {
+            meta = encodeHeader(o, key, staged, header_length, flags, meta);
+        }
+
+        memcpy(payload, staged + header_length, caplen - header_length);
+        payload += caplen - header_length;
+        staged += caplen;
+
+        previous = timestamp;
+        interface = frame_interface;
+        first = (timestamp < first) ? timestamp : first;
+        last = (timestamp > last) ? timestamp : last;
+        num_frames++;
+    }
+
+    out += COMPACT_BLOCK_HEADER_SIZE;
+    meta_packed = packStream(o, o->meta, meta - o->meta, out);
+    payload_packed = packStream(o, o->payload, payload - o->payload, out + meta_packed);
+    out -= COMPACT_BLOCK_HEADER_SIZE;
+
+    putLe32(out, num_frames);
+    putLe32(out + 4, meta - o->meta);
+    putLe32(out + 8, meta_packed);
+    putLe32(out + 12, payload - o->payload);
+    putLe32(out + 16, payload_packed);
+    putLe32(out + 20, COMPACT_BLOCK_MAGIC);
+    putLe64(out + 24, (num_frames > 0) ? first : 0);
+    putLe64(out + 32, last);
+
+    return COMPACT_BLOCK_HEADER_SIZE + meta_packed + payload_packed;
+}
+
+/**
+ * Frees the provided CompactEncoder.
+ */
+void CompactEncoder_free(CompactEncoder* o) {
+    LargeBuffer_free(o->dictionary, DICTIONARY_SLOTS * sizeof(DictionaryEntry));
+    LargeBuffer_free(o->positions, sizeof(uint32_t) << LZ_HASH_BITS);
+    LargeBuffer_free(o->meta, MAX_META_SIZE);
+    LargeBuffer_free(o->payload, COMPACT_BLOCK_SIZE);
+    free(o);
+}
+
+/**
+ * Allocates a new CompactDecoder, with no block loaded.
+ */
+CompactDecoder* CompactDecoder_new() {
+    CompactDecoder* o = (CompactDecoder*) calloc(1, sizeof(CompactDecoder));
+
+    if (o == NULL) {
+        fatal("Failed to allocate the compact decoder.");
+    }
+
+    o->dictionary = (DictionaryEntry*) LargeBuffer_alloc(DICTIONARY_SLOTS * sizeof(DictionaryEntry), ANY_NODE);
+    o->meta_buffer = (OCTET*) LargeBuffer_alloc(MAX_META_SIZE, ANY_NODE);
+    o->payload_buffer = (OCTET*) LargeBuffer_alloc(COMPACT_BLOCK_SIZE, ANY_NODE);
+    o->frames = (OCTET*) LargeBuffer_alloc(COMPACT_BLOCK_SIZE, ANY_NODE);
+
+    if (o->dictionary == NULL || o->meta_buffer == NULL || o->payload_buffer == NULL || o->frames == NULL) {
+        fatal("Failed to allocate the compact decoder's buffers.");
+    }
+
+    return o;
+}
+
+/**
+ * Loads the block at the provided position (going by the provided number of
+ * octets that are left), so that its frames can be handed out, and returns its
+ * size. Returns zero if it isn't a valid block.
+ *
+ * NOTE ~> Streams that were stored as they are are read straight from the
+ *  provided data, which therefore has to stay put until the next block is
+ *  loaded.
+ */
+size_t CompactDecoder_load(CompactDecoder* o, const OCTET* data, size_t length) {
+    CompactBlockInfo info;
+    const OCTET* packed = data + COMPACT_BLOCK_HEADER_SIZE;
+    uint32_t meta_size, meta_packed, payload_size, payload_packed;
+
+    o->remaining = 0;
+
+    if (!CompactFormat_readBlockInfo(data, length, &info)) {
+        return 0;
+    }
+
+    meta_size = getLe32(data + 4);
+    meta_packed = getLe32(data + 8);
+    payload_size = getLe32(data + 12);
+    payload_packed = getLe32(data + 16);
+
+    if (!unpackStream(packed, meta_packed, o->meta_buffer, meta_size, &o->meta) ||
+            !unpackStream(packed + meta_packed, payload_packed, o->payload_buffer, payload_size, &o->payload)) {
+        return 0;
+    }
+
+    o->meta_end = o->meta + meta_size;
+    o->payload_end = o->payload + payload_size;
+    o->out = o->frames;
+    o->out_end = o->frames + COMPACT_BLOCK_SIZE;
+
+    o->block++;
+    o->remaining = info.num_frames;
+    o->timestamp = 0;
+    o->interface = 0;
+
+    return info.size;
+}
+
+/**
+ * Describes the next frame of the loaded block. The frame stays valid until
+ * the next block is loaded. Returns false once the block has no frames left
+ * (or turns out to be malformed, in which case the rest of it is skipped).
+ */
+bool CompactDecoder_next(CompactDecoder* o, CapturedFrame* frame) {
+    if (o->remaining == 0) {
+        return false;
+    }
+
+    if (!decodeFrame(o, frame)) {
+        warn("The capture file contains a malformed block, skipping %u frame(s).", o->remaining);
+        o->remaining = 0;
+
+        return false;
+    }
+
+    o->remaining--;
+
+    return true;
+}
+
+/**
+ * Returns the number of frames of the loaded block that have yet to be handed
+ * out.
+ */
+UINT CompactDecoder_getRemaining(const CompactDecoder* o) {
+    return o->remaining;
+}
+
+/**
+ * Drops whatever is left of the loaded block.
+ */
+void CompactDecoder_reset(CompactDecoder* o) {
+    o->remaining = 0;
+}
+
+/**
+ * Frees the provided CompactDecoder.
+ */
+void CompactDecoder_free(CompactDecoder* o) {
+    LargeBuffer_free(o->dictionary, DICTIONARY_SLOTS * sizeof(DictionaryEntry));
+    LargeBuffer_free(o->meta_buffer, MAX_META_SIZE);
+    LargeBuffer_free(o->payload_buffer, COMPACT_BLOCK_SIZE);
+    LargeBuffer_free(o->frames, COMPACT_BLOCK_SIZE);
+    free(o);
+}
+
+/**
+ * Works out how many of the provided frame's leading octets are headers (up to
+ * a limit), and the key of the flow and direction that they belong to. Frames
+ * that aren't IP are treated as having no headers at all.
+ */
+static UINT findHeader(const OCTET* data, UINT caplen, uint32_t* key) {
+    FrameDescriptor descriptor;
+    FlowKey flow;
+    UINT direction, length;
+
+    FrameDescriptor_decode(&descriptor, data, caplen);
+
+    if (!(descriptor.layers & FL_NETWORK)) {
+        return 0;
+    }
+
+    length = (descriptor.payload_offset < caplen) ? descriptor.payload_offset : caplen;
+
+    FlowKey_build(&descriptor, &flow, &direction);
+    *key = FlowKey_hash(&flow) ^ direction;
+
+    return (length < MAX_DICTIONARY_HEADER) ? length : MAX_DICTIONARY_HEADER;
+}
+
+/**
+ * Describes the provided headers at the provided position, as the octets that
+ * differ from those of the previous frame of the flow with the provided key if
+ * the dictionary still has them, or as they are otherwise, and returns the
+ * position just past them. The flags of the frame are updated to match.
+ */
+static OCTET* encodeHeader(CompactEncoder* o, uint32_t key, const OCTET* header, UINT length, OCTET* flags,
+        OCTET* out) {
+    UINT slot = key & (DICTIONARY_SLOTS - 1);
+    DictionaryEntry* entry = &o->dictionary[slot];
+    OCTET* bitmap;
+    uint64_t word, previous_word;
+    UINT i, j;
+
+    out = putVarint(out, slot);
+
+    if (entry->block != o->block || entry->key != key || entry->length != length) {
+        *flags |= HEADER_LITERAL;
+        out = putVarint(out, length);
+        memcpy(out, header, length);
+
+        entry->block = o->block;
+        entry->key = key;
+        entry->length = length;
+        memcpy(entry->header, header, length);
+
+        return out + length;
+    }
+
+    // Mark each octet that changed in a bitmap, followed by the new values of
+    //  those octets (skipping over unchanged stretches a word at a time)
+    *flags |= HEADER_DELTA;
+    bitmap = out;
+    out += (length + 7) / 8;
+    memset(bitmap, 0x00, (length + 7) / 8);
+
+    for (i = 0; i < length; i += 8) {
+        if (i + 8 <= length) {
+            memcpy(&word, header + i, sizeof(word));
+            memcpy(&previous_word, entry->header + i, sizeof(previous_word));
+
+            if (word == previous_word) {
+                continue;
+            }
+        }
+
+        for (j = i; j < i + 8 && j < length; j++) {
+            if (header[j] != entry->header[j]) {
+                bitmap[j >> 3] |= 1 << (j & 7);
+                *out++ = header[j];
+                entry->header[j] = header[j];
+            }
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Compresses the provided stream to the provided position and returns the
+ * size that it ended up taking up there. Streams that don't get any smaller
+ * are stored as they are (so a stream is compressed if and only if its size
+ * changed).
+ */
+static size_t packStream(CompactEncoder* o, const OCTET* in, size_t length, OCTET* out) {
+    size_t packed;
+
+    if (length > 0 && (packed = compress(o->positions, in, length, out, length - 1)) > 0) {
+        return packed;
+    }
+
+    memcpy(out, in, length);
+
+    return length;
+}
+
+/**
+ * Puts the next frame of the loaded block back together.
+ */
+static bool decodeFrame(CompactDecoder* o, CapturedFrame* frame) {
+    const OCTET* meta = o->meta;
+    const OCTET* header = NULL;
+    uint64_t delta, caplen, wirelen, interface;
+    UINT flags, header_length = 0;
+
+    if (meta >= o->meta_end) {
+        return false;
+    }
+
+    flags = *meta++;
+
+    if ((meta = getVarint(meta, o->meta_end, &delta)) == NULL ||
+            (meta = getVarint(meta, o->meta_end, &caplen)) == NULL) {
+        return false;
+    }
+
+    wirelen = caplen;
+    interface = o->interface;
+
+    if ((flags & FLAG_WIRELEN) && (meta = getVarint(meta, o->meta_end, &wirelen)) == NULL) {
+        return false;
+    }
+
+    if ((flags & FLAG_INTERFACE) && (meta = getVarint(meta, o->meta_end, &interface)) == NULL) {
+        return false;
+    }
+
+    if (caplen > (uint64_t) (o->out_end - o->out) || wirelen > UINT32_MAX || interface >= MAX_INTERFACES) {
+        return false;
+    }
+
+    if ((flags & FLAG_HEADER_MASK) != HEADER_NONE &&
+            (meta = decodeHeader(o, meta, flags & FLAG_HEADER_MASK, caplen, &header_length, &header)) == NULL) {
+        return false;
+    }
+
+    if (caplen - header_length > (uint64_t) (o->payload_end - o->payload)) {
+        return false;
+    }
+
+    // The frame is its headers (if it has any) followed by its payload
+    if (header_length > 0) {
+        memcpy(o->out, header, header_length);
+    }
+
+    memcpy(o->out + header_length, o->payload, caplen - header_length);
+    o->payload += caplen - header_length;
+    o->meta = meta;
+
+    o->timestamp += (delta >> 1) ^ -(delta & 1);
+    o->interface = interface;
+
+    frame->timestamp.tv_sec = o->timestamp / NANOSECONDS_PER_SECOND;
+    frame->timestamp.tv_nsec = o->timestamp % NANOSECONDS_PER_SECOND;
+    frame->caplen = caplen;
+    frame->wirelen = wirelen;
+    frame->interface = interface;
+    frame->data = o->out;
+    o->out += caplen;
+
+    return true;
+}
+
+/**
+ * Reads the headers of a frame with the provided number of octets, stored as
+ * the provided mode says, from the provided position, bringing the dictionary
+ * up to date. Returns the position just past them (and where the headers and
+ * their length are) or NULL if they are malformed.
+ */
+static const OCTET* decodeHeader(CompactDecoder* o, const OCTET* meta, UINT mode, UINT caplen, UINT* length,
+        const OCTET** header) {
+    DictionaryEntry* entry;
+    uint64_t slot, value;
+    const OCTET* bitmap;
+    UINT i;
+
+    if ((meta = getVarint(meta, o->meta_end, &slot)) == NULL || slot >= DICTIONARY_SLOTS) {
+        return NULL;
+    }
+
+    entry = &o->dictionary[slot];
+
+    if (mode == HEADER_LITERAL) {
+        if ((meta = getVarint(meta, o->meta_end, &value)) == NULL || value > MAX_DICTIONARY_HEADER ||
+                value > caplen || value > (uint64_t) (o->meta_end - meta)) {
+            return NULL;
+        }
+
+        entry->block = o->block;
+        entry->length = value;
+        memcpy(entry->header, meta, value);
+        meta += value;
+    } else {
+        if (mode != HEADER_DELTA || entry->block != o->block || entry->length > caplen ||
+                (entry->length + 7) / 8 > (size_t) (o->meta_end - meta)) {
+            return NULL;
+        }
+
+        bitmap = meta;
+        meta += (entry->length + 7) / 8;
+
+        for (i = 0; i < entry->length; i++) {
+            if (bitmap[i >> 3] & (1 << (i & 7))) {
+                if (meta >= o->meta_end) {
+                    return NULL;
+                }
+
+                entry->header[i] = *meta++;
+            }
+        }
+    }
+
+    *length = entry->length;
+    *header = entry->header;
+
+    return meta;
+}
+
+/**
+ * Gets the provided stream, which takes up the provided number of octets and
+ * has to come to the provided size, ready to be read: streams that were stored
+ * as they are are read in place, and others are decompressed into the provided
+ * buffer.
+ */
+static bool unpackStream(const OCTET* in, size_t packed_size, OCTET* buffer, size_t size, const OCTET** stream) {
+    if (packed_size == size) {
+        *stream = in;
+
+        return true;
+    }
+
+    *stream = buffer;
+
+    return decompress(in, packed_size, buffer, size);
+}
+
+/**
+ * Compresses the provided data to the provided position (with the provided
+ * number of octets of room) and returns its compressed size, or zero if it
+ * didn't fit.
+ *
+ * NOTE ~> The output is a series of sequences, each of which is a token octet
+ *  (the number of literals in its high four bits and that of matched octets,
+ *  less the minimum, in its low four bits, either of which continues in the
+ *  octets that follow if it is 15), the literals, and then the offset that the
+ *  match is copied from (two octets). The last sequence has no match. Matches
+ *  are found through a table of where each hash of four octets was last seen,
+ *  and the search speeds up the longer it goes without finding one, so that
+ *  data that doesn't compress is skipped over quickly.
+ */
+static size_t compress(uint32_t* positions, const OCTET* in, size_t length, OCTET* out, size_t capacity) {
+    const OCTET* end = in + length;
+    const OCTET* ptr = in;
+    const OCTET* anchor = in;
+    const OCTET* candidate;
+    const OCTET* out_end = out + capacity;
+    OCTET* start = out;
+    uint32_t sequence, candidate_sequence, hash;
+    size_t match_length;
+    UINT misses = 0;
+
+    memset(positions, 0x00, sizeof(uint32_t) << LZ_HASH_BITS);
+
+    while (ptr + LZ_MIN_MATCH <= end) {
+        memcpy(&sequence, ptr, sizeof(sequence));
+        hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+        candidate = (positions[hash] > 0) ? in + positions[hash] - 1 : NULL;
+        positions[hash] = (ptr - in) + 1;
+
+        if (candidate != NULL && ptr - candidate <= LZ_MAX_OFFSET) {
+            memcpy(&candidate_sequence, candidate, sizeof(candidate_sequence));
+
+            if (candidate_sequence == sequence) {
+                match_length = LZ_MIN_MATCH + matchLength(ptr + LZ_MIN_MATCH, candidate + LZ_MIN_MATCH, end);
+
+                if ((out = emitSequence(out, out_end, anchor, ptr - anchor, ptr - candidate, match_length)) == NULL) {
+                    return 0;
+                }
+
+                ptr += match_length;
+                anchor = ptr;
+                misses = 0;
+                continue;
+            }
+        }
+
+        ptr += 1 + (misses++ >> 5);
+    }
+
+    if (anchor < end && (out = emitSequence(out, out_end, anchor, end - anchor, 0, 0)) == NULL) {
+        return 0;
+    }
+
+    return out - start;
+}
+
+/**
+ * Returns the number of octets from the provided position (up to the provided
+ * end) that are the same as those from the provided candidate, comparing eight
+ * of them at a time.
+ */
+static size_t matchLength(const OCTET* ptr, const OCTET* candidate, const OCTET* end) {
+    const OCTET* start = ptr;
+    uint64_t word, candidate_word;
+
+    while (ptr + sizeof(word) <= end) {
+        memcpy(&word, ptr, sizeof(word));
+        memcpy(&candidate_word, candidate, sizeof(candidate_word));
+
+        if (word != candidate_word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return (ptr - start) + (__builtin_ctzll(word ^ candidate_word) >> 3);
+#else
+            return (ptr - start) + (__builtin_clzll(word ^ candidate_word) >> 3);
+#endif
+        }
+
+        ptr += sizeof(word);
+        candidate += sizeof(word);
+    }
+
+    while (ptr < end && *ptr == *candidate) {
+        ptr++;
+        candidate++;
+    }
+
+    return ptr - start;
+}
+
+/**
+ * Writes a single sequence (without a match if its length is zero) to the
+ * provided position and returns the position just past it, or NULL if it
+ * doesn't fit before the provided end.
+ */
+static OCTET* emitSequence(OCTET* out, const OCTET* out_end, const OCTET* literals, size_t num_literals,
+        size_t offset, size_t match_length) {
+    OCTET* token = out;
+    size_t remaining;
+
+    if ((size_t) (out_end - out) < num_literals + num_literals / 255 + match_length / 255 + 6) {
+        return NULL;
+    }
+
+    out++;
+    *token = ((num_literals < 15) ? num_literals : 15) << 4;
+
+    if (num_literals >= 15) {
+        for (remaining = num_literals - 15; remaining >= 255; remaining -= 255) {
+            *out++ = 255;
+        }
+
+        *out++ = remaining;
+    }
+
+    memcpy(out, literals, num_literals);
+    out += num_literals;
+
+    if (match_length == 0) {
+        return out;
+    }
+
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+    match_length -= LZ_MIN_MATCH;
+    *token |= (match_length < 15) ? match_length : 15;
+
+    if (match_length >= 15) {
+        for (remaining = match_length - 15; remaining >= 255; remaining -= 255) {
+            *out++ = 255;
+        }
+
+        *out++ = remaining;
+    }
+
+    return out;
+}
+
+/**
+ * Decompresses the provided data (see compress(...)) to the provided position,
+ * where it has to come to exactly the provided size. Returns false if it is
+ * malformed.
+ */
+static bool decompress(const OCTET* in, size_t length, OCTET* out, size_t size) {
+    const OCTET* end = in + length;
+    OCTET* start = out;
+    OCTET* out_end = out + size;
+    size_t num_literals, match_length, offset, i;
+    UINT token;
+
+    while (in < end) {
+        token = *in++;
+        num_literals = token >> 4;
+
+        if (num_literals == 15 && !readLength(&in, end, &num_literals)) {
+            return false;
+        }
+
+        if (num_literals > (size_t) (end - in) || num_literals > (size_t) (out_end - out)) {
+            return false;
+        }
+
+        memcpy(out, in, num_literals);
+        out += num_literals;
+        in += num_literals;
+
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        match_length = token & 15;
+
+        if (match_length == 15 && !readLength(&in, end, &match_length)) {
+            return false;
+        }
+
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t) (out - start) || match_length > (size_t) (out_end - out)) {
+            return false;
+        }
+
+        // NOTE ~> A match may overlap the octets that it produces (that's how
+        //  runs are stored), so it has to be copied front to back.
+        for (i = 0; i < match_length; i++) {
+            out[i] = out[i - offset];
+        }
+
+        out += match_length;
+    }
+
+    return out == out_end;
+}
+
+/**
+ * Adds the continuation octets of a length (each of which adds up to 255, the
+ * last being the one that is less) to the provided length.
+ */
+static bool readLength(const OCTET** in, const OCTET* end, size_t* length) {
+    OCTET value;
+
+    do {
+        if (*in >= end) {
+            return false;
+        }
+
+        value = *(*in)++;
+        *length += value;
+    } while (value == 255);
+
+    return true;
+}
+
+/**
+ * Writes the provided value seven bits at a time (least significant first, with
+ * the top bit of each octet set if more follow) and returns the position just
+ * past it.
+ */
+static OCTET* putVarint(OCTET* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *out++ = value;
+
+    return out;
+}
+
+/**
+ * Reads a value written by putVarint(...), returning the position just past it
+ * or NULL if it runs past the provided end (or is too long).
+ */
+static const OCTET* getVarint(const OCTET* in, const OCTET* end, uint64_t* value) {
+    UINT shift;
+
+    *value = 0;
+
+    for (shift = 0; shift < 64 && in < end; shift += 7) {
+        *value |= (uint64_t) (*in & 0x7f) << shift;
+
+        if (!(*in++ & 0x80)) {
+            return in;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Writes a four octet little-endian integer.
+ */
+static void putLe32(OCTET* ptr, uint32_t value) {
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+/**
+ * Writes an eight octet little-endian integer.
+ */
+static void putLe64(OCTET* ptr, uint64_t value) {
+    putLe32(ptr, (uint32_t) value);
+    putLe32(ptr + 4, (uint32_t) (value >> 32));
+}
+
+/**
+ * Reads a four octet little-endian integer.
+ */
+static uint32_t getLe32(const OCTET* ptr) {
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+/**
+ * Reads an eight octet little-endian integer.
+ */
+static uint64_t getLe64(const OCTET* ptr) {
+    return getLe32(ptr) | ((uint64_t) getLe32(ptr + 4) << 32);
+}
@@ -0,0 +1,79 @@
+#ifndef _COMPACT_FORMAT_H_
+#define _COMPACT_FORMAT_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// NOTE ~> The compact capture format is this program's own, and trades being
+//  readable by other tools for taking up a fraction of the space of a pcap
+//  file. A file is a short header followed by independent blocks of frames,
+//  each of which can be encoded (and decoded) on its own, so that blocks are
+//  encoded in parallel. Within a block, each frame's headers (everything up to
+//  its payload, as found by the decoder) are stored as the octets that changed
+//  since the previous frame of the same flow and direction, held in a
+//  dictionary, and its timestamp as the difference from the previous frame's.
+//  The description of the frames and their payloads then go through a simple
+//  LZ77 compressor as two separate streams. Everything is little-endian.
+
+/**
+ * Leading magic number of a compact capture file ("SKC1").
+ */
+#define COMPACT_MAGIC               0x31434b53
+
+#define COMPACT_FILE_HEADER_SIZE    8
+#define COMPACT_BLOCK_HEADER_SIZE   40
+
+/**
+ * The most octets of staged frames that make up a single block.
+ */
+#define COMPACT_BLOCK_SIZE          (1 << 20)
+
+/**
+ * The most octets that encoding a block of staged frames can take up (blocks
+ * that don't compress are stored as they are).
+ */
+#define COMPACT_MAX_ENCODED_SIZE    (COMPACT_BLOCK_HEADER_SIZE + 3 * COMPACT_BLOCK_SIZE)
+
+/**
+ * What the header of a block says about it.
+ */
+typedef struct CompactBlockInfo {
+    UINT num_frames;
+
+    /**
+     * Size of the whole block, header included.
+     */
+    size_t size;
+
+    /**
+     * Earliest and latest timestamps (in nanoseconds) of the block's frames.
+     */
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+} CompactBlockInfo;
+
+typedef struct CompactEncoder CompactEncoder;
+typedef struct CompactDecoder CompactDecoder;
+
+size_t CompactFormat_writeFileHeader(OCTET* out);
+bool CompactFormat_checkFileHeader(const OCTET* data, size_t length);
+bool CompactFormat_readBlockInfo(const OCTET* data, size_t length, CompactBlockInfo* info);
+size_t CompactFormat_stagedSize(UINT caplen);
+void CompactFormat_stage(const CapturedFrame* frame, UINT caplen, OCTET* out);
+size_t CompactFormat_readStaged(const OCTET* staged, CapturedFrame* frame);
+
+CompactEncoder* CompactEncoder_new();
+size_t CompactEncoder_encode(CompactEncoder* o, const OCTET* staged, size_t length, OCTET* out);
+void CompactEncoder_free(CompactEncoder* o);
+
+CompactDecoder* CompactDecoder_new();
+size_t CompactDecoder_load(CompactDecoder* o, const OCTET* data, size_t length);
+bool CompactDecoder_next(CompactDecoder* o, CapturedFrame* frame);
+UINT CompactDecoder_getRemaining(const CompactDecoder* o);
+void CompactDecoder_reset(CompactDecoder* o);
+void CompactDecoder_free(CompactDecoder* o);
+
+#endif
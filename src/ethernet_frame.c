@@ -3,7 +3,13 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "common.h"
+#include "checksum.h"
+#include "frame_descriptor.h"
+#include "options.h"
 #include "logger.h"
 
 #define DEST_MAC_SIZE                   6
@@ -49,40 +55,32 @@ struct EthernetFrame {
     OCTET payload[PAYLD_MAX_SIZE];
 };
 
+static void appendEthernetType(TextBuffer* buff, EthernetType et);
+static void appendTag(TextBuffer* buff, const FrameDescriptor* frame);
+
 /**
- * Allocates and initializes a new EthernetFrame prior to returning a pointer to
- * it.
+ * Reads the two octet, network byte order integer at the provided position.
  */
-EthernetFrame* EthernetFrame_new() {
-    EthernetFrame* ethernetFrame = (EthernetFrame*) malloc(sizeof(EthernetFrame));
-
-    return ethernetFrame;
+static inline UINT readUint16(const OCTET* ptr) {
+    return (ptr[0] << 8) | ptr[1];
 }
 
 /**
  * Determines whether or not the provided EthernetFrame has been VLAN-tagged
- * according to IEEE 802.1Q standards (meaning that the retular "EtherType"
- * field actually contains the TPID value) and returns the two octet "TCI" field
- * that follows if so or -1 if not.
+ * according to IEEE 802.1Q (or 802.1ad) standards (meaning that the retular
+ * "EtherType" field actually contains the TPID value) and returns the two octet
+ * "TCI" field that follows if so or -1 if not.
  * 
- * NOTE ~> We do not currently support 801.2ad standard extensions to this
- *  section of the frame.
+ * NOTE ~> Only the outermost tag is looked at here. Use a FrameDescriptor to
+ *  get at every tag of a stacked (QinQ) frame.
  */
 UINT EthernetFrame_getVLANTag(EthernetFrame* o) {
-    UINT ethernet_type = 0x0000;
-
-    // Retrieve the 2 octet "EtherType" field of the EthernetFrame
-    ethernet_type = ((o->ethernet_type[0] << 8) | o->ethernet_type[1]);
+    UINT ethernet_type = readUint16(o->ethernet_type);
 
     // If the TPID is specified where the "EtherType" field usually exists,
     // return the two octect "TCI" field that follows
-    if (ethernet_type == ET_VLANTAGGED) {
-        OCTET* tci_pointer = o->payload;
-        UINT buff[1] = { 0x0000 };
-
-        octetsToInt(tci_pointer, 2, buff);
-    
-        return (*buff);
+    if (ethernet_type == ET_VLANTAGGED || ethernet_type == ET_QINQTAGGED) {
+        return readUint16(o->payload);
     }
 
     return -1;
@@ -93,21 +91,12 @@ UINT EthernetFrame_getVLANTag(EthernetFrame* o) {
  * returns it.
  */
 EthernetType EthernetFrame_getEthernetType(EthernetFrame* o) {
-    OCTET* ethernet_type_pointer;
-
-    // Find our "EtherType" field and get a pointer to it
+    // Find our "EtherType" field and return its value
     if (EthernetFrame_getVLANTag(o) != -1) {
-        ethernet_type_pointer = (OCTET*) (o->payload + PAYLD_VLAN_ETHER_TYPE_OFFSET);
-    } else {
-        ethernet_type_pointer = o->ethernet_type;
+        return readUint16(o->payload + PAYLD_VLAN_ETHER_TYPE_OFFSET);
     }
-    
-    // Retrieve the value of the "EtherType" field and return it
-    UINT buff[1] = { 0x0000 };
 
-    octetsToInt(ethernet_type_pointer, 2, buff);
-    
-    return (*buff);
+    return readUint16(o->ethernet_type);
 }
 
 /**
@@ -137,48 +126,138 @@ OCTET* EthernetFrame_getPayloadPointer(EthernetFrame* o) {
 }
 
 /**
- * Generates a printable string representation of the provided EthernetFrame
- * according to the program's options.
+ * Appends a printable string representation of the Ethernet Frame described by
+ * the provided FrameDescriptor, according to the program's options, to the
+ * provided TextBuffer.
  */
-void EthernetFrame_output(EthernetFrame* o, size_t size) {
-    UINT tci;
-    char buff[18] = { 0 };
-
-    // Grab the necessary peices
-    char et[12] = { 0 };
-    EthernetType_toString(EthernetFrame_getEthernetType(o), et, 12);
+void EthernetFrame_format(const FrameDescriptor* frame, TextBuffer* buff) {
+    EthernetFrame* o = (EthernetFrame*) frame->data;
+    UINT i;
+
+    // Frames too short to even have an "EtherType" have nothing to show
+    if (!(frame->layers & FL_LINK)) {
+        appendTag(buff, frame);
+        TextBuffer_appendString(buff, "Runt frame (");
+        TextBuffer_appendUnsigned(buff, frame->caplen);
+        TextBuffer_appendString(buff, " bytes)\n");
+
+        return;
+    }
 
     // Output a readable version of the EthernetFrame
-    output(NULL, "[    ]\t");
-    output(LC_BLUE, et);
+    appendTag(buff, frame);
+    TextBuffer_appendString(buff, LC_BLUE);
+    appendEthernetType(buff, frame->ethernet_type);
+
+    TextBuffer_appendString(buff, "\t");
+    for (i = 0; i < frame->num_vlan_tags; i++) {
+        TextBuffer_appendString(buff, (i == 0) ? "0x" : "/0x");
+        TextBuffer_appendHex(buff, (const OCTET*) frame->data + DEST_MAC_SIZE + SRC_MAC_SIZE + (i * VLAN_TAG_SIZE) +
+                ETHER_TYPE_SIZE, 2, 0, 0);
+    }
 
-    output(NULL, "\t");
-    if ((tci = EthernetFrame_getVLANTag(o)) != -1)
-        output(LC_BLUE, "0x%04x", tci);
+    TextBuffer_appendString(buff, "\tDest MAC: ");
+    TextBuffer_appendHex(buff, o->destination_mac_address, DEST_MAC_SIZE, '-', 2);
+
+    TextBuffer_appendString(buff, "\tSource MAC: ");
+    TextBuffer_appendHex(buff, o->source_mac_address, SRC_MAC_SIZE, '-', 2);
+
+    // Summarize the network and transport layers if we could decode them
+    if (frame->layers & FL_NETWORK) {
+        int family = (frame->ethernet_type == ET_IPV4) ? AF_INET : AF_INET6;
+        bool has_ports = (frame->layers & FL_TRANSPORT) &&
+                (frame->ip_protocol == IP_TCP || frame->ip_protocol == IP_UDP);
+        char protocol[16] = { 0 };
+
+        TextBuffer_appendString(buff, "\t");
+        TextBuffer_appendAddress(buff, family, FrameDescriptor_getSourceAddress(frame));
+        if (has_ports) {
+            TextBuffer_appendString(buff, (family == AF_INET) ? ":" : ".");
+            TextBuffer_appendUnsigned(buff, frame->src_port);
+        }
+
+        TextBuffer_appendString(buff, " > ");
+        TextBuffer_appendAddress(buff, family, FrameDescriptor_getDestinationAddress(frame));
+        if (has_ports) {
+            TextBuffer_appendString(buff, (family == AF_INET) ? ":" : ".");
+            TextBuffer_appendUnsigned(buff, frame->dst_port);
+        }
+
+        IpProtocol_toString(frame->ip_protocol, protocol, sizeof(protocol));
+        TextBuffer_appendString(buff, " ");
+        TextBuffer_appendString(buff, protocol);
+
+        if ((frame->layers & FL_TRANSPORT) && !has_ports) {
+            TextBuffer_appendString(buff, " type ");
+            TextBuffer_appendUnsigned(buff, frame->src_port);
+            TextBuffer_appendString(buff, " code ");
+            TextBuffer_appendUnsigned(buff, frame->dst_port);
+        }
+
+        if (frame->layers & FL_FRAGMENT) {
+            TextBuffer_appendString(buff, " (fragment)");
+        }
+
+        // Flag whichever checksums were verified and turned out to be wrong
+        if (frame->checksums & CS_BAD) {
+            TextBuffer_appendString(buff, LC_RED_BOLD);
+            TextBuffer_appendString(buff, " (bad ");
+
+            if (frame->checksums & CS_NETWORK_BAD) {
+                TextBuffer_appendString(buff, (frame->checksums & CS_TRANSPORT_BAD) ? "IPv4/" : "IPv4");
+            }
+
+            if (frame->checksums & CS_TRANSPORT_BAD) {
+                TextBuffer_appendString(buff, protocol);
+            }
+
+            TextBuffer_appendString(buff, " checksum)");
+        }
+    }
 
-    octetsToHexString(o->destination_mac_address, 6, buff, '-', 2);
-    output(LC_BLUE, "\tDest MAC: %s", buff);
+    TextBuffer_appendString(buff, LC_RESET);
+    TextBuffer_appendString(buff, "\t");
 
-    octetsToHexString(o->source_mac_address, 6, buff, '-', 2);
-    output(LC_BLUE, "\tSource MAC: %s", buff);
+    // Dump everything that follows the link layer header
+    TextBuffer_appendDump(buff, frame->data + frame->network_offset, frame->caplen - frame->network_offset,
+            Options_getDumpFormat());
 
-    output(NULL, "\t");
-    
-    OCTET* data_ptr = EthernetFrame_getPayloadPointer(o);
-    size_t pyld_size = (size - EthernetFrame_getHeaderSize(o));
-    size_t data_read = 0;
+    TextBuffer_appendString(buff, "\n");
+}
 
-    while (data_read < pyld_size) {
-        if ((data_read % 48) == 0)
-            output(NULL, "\n\t");
-        
-        output(NULL, "%02x ", *data_ptr);
+/**
+ * Appends the tag that every line starts with to the provided TextBuffer: the
+ * name of the interface that the frame was captured on if several of them are
+ * being captured, and a blank one otherwise.
+ */
+static void appendTag(TextBuffer* buff, const FrameDescriptor* frame) {
+    const char* name;
+    size_t length;
 
-        data_ptr++;
-        data_read++;
+    if (Options_getInterfaceCount() < 2) {
+        TextBuffer_appendString(buff, "[    ]\t");
+        return;
     }
 
-    output(NULL, "\n");
+    name = Options_getInterfaceName(frame->interface);
+
+    TextBuffer_appendString(buff, "[");
+    TextBuffer_appendString(buff, name);
+    for (length = strlen(name); length < 4; length++) {
+        TextBuffer_appendString(buff, " ");
+    }
+    TextBuffer_appendString(buff, "]\t");
+}
+
+/**
+ * Appends the string representation of the provided EtherType to the provided
+ * TextBuffer.
+ */
+static void appendEthernetType(TextBuffer* buff, EthernetType et) {
+    char string[12] = { 0 };
+
+    EthernetType_toString(et, string, sizeof(string));
+    TextBuffer_appendString(buff, string);
 }
 
 /**
@@ -202,6 +281,10 @@ void EthernetType_toString(EthernetType et, char* buff, int buff_size) {
             strncpy(buff, "VLAN Tagged", buff_size);
             break;
 
+        case ET_QINQTAGGED:
+            strncpy(buff, "QinQ Tagged", buff_size);
+            break;
+
         default:
             sprintf(buff, "0x%04x", et);
             break;
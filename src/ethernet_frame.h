@@ -2,9 +2,11 @@
 #define _ETHERNET_FRAME_H_
 
 #include "common.h"
+#include "text_buffer.h"
 #include <stdbool.h>
 
 typedef struct EthernetFrame EthernetFrame;
+typedef struct FrameDescriptor FrameDescriptor;
 
 /**
  * Represents possible values of an ethernet frame's "EtherType" field. Not all
@@ -16,16 +18,16 @@ typedef enum EthernetType {
     ET_IPV4         = 0x0800,
     ET_IPV6         = 0x86DD,
     ET_ARP          = 0x0806,
-    ET_VLANTAGGED   = 0x8100
+    ET_VLANTAGGED   = 0x8100,
+    ET_QINQTAGGED   = 0x88A8
 } EthernetType;
 
 void EthernetType_toString(EthernetType et, char* buff, int buff_size);
 
-EthernetFrame* EthernetFrame_new();
 UINT EthernetFrame_getVLANTag(EthernetFrame* o);
 EthernetType EthernetFrame_getEthernetType(EthernetFrame* o);
 size_t EthernetFrame_getHeaderSize(EthernetFrame* o);
 OCTET* EthernetFrame_getPayloadPointer(EthernetFrame* o);
-void EthernetFrame_output(EthernetFrame* o, size_t size);
+void EthernetFrame_format(const FrameDescriptor* frame, TextBuffer* buff);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1323 @@
+#include "filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "common.h"
+#include "ethernet_frame.h"
+#include "frame_descriptor.h"
+#include "logger.h"
+
+// NOTE ~> Classic BPF opcodes are the same on every platform, so they are
+//  spelled out here rather than pulled in from whichever kernel header the
+//  platform happens to provide.
+#define OP_CLASS(code)      ((code) & 0x07)
+#define OP_SIZE(code)       ((code) & 0x18)
+#define OP_MODE(code)       ((code) & 0xe0)
+#define OP_OP(code)         ((code) & 0xf0)
+#define OP_SRC(code)        ((code) & 0x08)
+
+#define OP_LD               0x00
+#define OP_LDX              0x01
+#define OP_ST               0x02
+#define OP_STX              0x03
+#define OP_ALU              0x04
+#define OP_JMP              0x05
+#define OP_RET              0x06
+#define OP_MISC             0x07
+
+#define OP_W                0x00
+#define OP_H                0x08
+#define OP_B                0x10
+
+#define OP_IMM              0x00
+#define OP_ABS              0x20
+#define OP_IND              0x40
+#define OP_MEM              0x60
+#define OP_LEN              0x80
+#define OP_MSH              0xa0
+
+#define OP_ADD              0x00
+#define OP_SUB              0x10
+#define OP_MUL              0x20
+#define OP_DIV              0x30
+#define OP_OR               0x40
+#define OP_AND              0x50
+#define OP_LSH              0x60
+#define OP_RSH              0x70
+#define OP_NEG              0x80
+#define OP_MOD              0x90
+#define OP_XOR              0xa0
+
+#define OP_JA               0x00
+#define OP_JEQ              0x10
+#define OP_JGT              0x20
+#define OP_JGE              0x30
+#define OP_JSET             0x40
+
+#define OP_K                0x00
+#define OP_X                0x08
+#define OP_A                0x10
+
+#define OP_TAX              0x00
+#define OP_TXA              0x80
+
+#define MEMORY_WORDS        16
+
+// NOTE ~> Linux lets filters read metadata that isn't part of the frame by
+//  loading from "ancillary" offsets near the top of the address space. Only the
+//  VLAN tag (which the kernel strips off of frames before filtering them) is
+//  of interest here.
+#define ANCILLARY_OFFSET            0xfffff000
+#define ANCILLARY_VLAN_TAG          44
+#define ANCILLARY_VLAN_TAG_PRESENT  48
+
+// NOTE ~> Accepted frames are kept whole (up to the largest snapshot length
+//  that any capture tool uses).
+#define ACCEPT_SNAPLEN      262144
+
+#define MEMORY_LINK_OFFSET  0
+
+#define ETHER_DST_OFFSET    0
+#define ETHER_SRC_OFFSET    6
+#define ETHER_TYPE_OFFSET   12
+#define VLAN_TCI_OFFSET     14
+#define VLAN_TAG_SIZE       4
+#define VLAN_ID_MASK        0x0fff
+#define VLAN_WALK_STEP_SIZE 4
+#define LINK_HEADER_SIZE    14
+
+// NOTE ~> Offsets of fields behind the EtherType are given as they would be in
+//  an untagged frame. Loads of them are indexed by the X register, which holds
+//  the size of the VLAN tag (if there is one).
+#define IPV4_IHL_OFFSET         (LINK_HEADER_SIZE + 0)
+#define IPV4_FRAGMENT_OFFSET    (LINK_HEADER_SIZE + 6)
+#define IPV4_PROTOCOL_OFFSET    (LINK_HEADER_SIZE + 9)
+#define IPV4_SRC_OFFSET         (LINK_HEADER_SIZE + 12)
+#define IPV4_DST_OFFSET         (LINK_HEADER_SIZE + 16)
+#define IPV4_FRAGMENT_MASK      0x1fff
+#define IPV6_NEXT_HEADER_OFFSET (LINK_HEADER_SIZE + 6)
+#define IPV6_SRC_OFFSET         (LINK_HEADER_SIZE + 8)
+#define IPV6_DST_OFFSET         (LINK_HEADER_SIZE + 24)
+#define IPV6_HEADER_SIZE        40
+#define SRC_PORT_OFFSET         (LINK_HEADER_SIZE + 0)
+#define DST_PORT_OFFSET         (LINK_HEADER_SIZE + 2)
+
+#define PROTO_ICMP          1
+#define PROTO_TCP           6
+#define PROTO_UDP           17
+#define PROTO_ICMP6         58
+#define PROTO_SCTP          132
+
+#define NO_BRANCHES         -1
+
+/**
+ * Which addresses or ports of a frame a primitive should look at.
+ */
+typedef enum Direction {
+    DIR_ANY,
+    DIR_SRC,
+    DIR_DST
+} Direction;
+
+/**
+ * The IP versions that a protocol primitive should look at.
+ */
+typedef enum IpFamilies {
+    IF_IPV4 = 0x01,
+    IF_IPV6 = 0x02,
+    IF_BOTH = 0x03
+} IpFamilies;
+
+/**
+ * The not yet resolved branches out of a compiled (sub-)expression.
+ *
+ * NOTE ~> Each list is threaded through the compiler's links array. An entry
+ *  identifies an instruction and which of its two branches (jt or jf) still
+ *  needs a target, so that "and" and "or" can be compiled into short-circuiting
+ *  jumps in a single pass by filling the targets in once they are known.
+ */
+typedef struct Branches {
+    /**
+     * The instruction at which the (sub-)expression starts.
+     */
+    UINT start;
+
+    int when_true;
+    int when_false;
+} Branches;
+
+static const Branches noBranches = { 0, NO_BRANCHES, NO_BRANCHES };
+
+/**
+ * State of a single compilation of a filter expression.
+ */
+typedef struct Compiler {
+    /**
+     * The expression split into tokens (which all live in the buffer).
+     */
+    char* buffer;
+    char** tokens;
+    UINT num_tokens;
+    UINT position;
+
+    /**
+     * The program compiled so far.
+     */
+    FilterInstruction program[FILTER_MAX_INSTRUCTIONS];
+    int links[FILTER_MAX_INSTRUCTIONS * 2];
+    UINT length;
+
+    /**
+     * Whether an instruction that repurposes the X register has been emitted
+     * yet, after which the link header offset must be reloaded before use.
+     */
+    bool x_clobbered;
+} Compiler;
+
+/**
+ * Represents a compiled filter.
+ */
+struct Filter {
+    FilterInstruction* instructions;
+    UINT length;
+};
+
+static void tokenize(Compiler* c, const char* expression);
+static const char* peekToken(Compiler* c, UINT ahead);
+static const char* nextToken(Compiler* c, const char* expected);
+static bool acceptToken(Compiler* c, const char* token);
+static Branches parseExpression(Compiler* c);
+static Branches parseTerm(Compiler* c);
+static Branches parseFactor(Compiler* c);
+static Branches parsePrimitive(Compiler* c);
+static Branches parseEther(Compiler* c);
+static Branches parseHostOrPort(Compiler* c, Direction direction);
+static Branches parseTransport(Compiler* c, UINT protocol);
+static UINT parseNumber(const char* token, UINT max, const char* what);
+static void parseMac(const char* token, OCTET* mac);
+static UINT emit(Compiler* c, uint16_t code, uint32_t k);
+static void emitLoad(Compiler* c, uint16_t size, bool indexed, uint32_t offset);
+static Branches emitJump(Compiler* c, uint16_t op, uint32_t k);
+static int mergeBranches(Compiler* c, int first, int second);
+static void patchBranches(Compiler* c, int list, UINT target);
+static Branches joinAnd(Compiler* c, Branches left, Branches right);
+static Branches joinOr(Compiler* c, Branches left, Branches right);
+static Branches negate(Branches branches);
+static Branches testField(Compiler* c, uint16_t size, bool indexed, uint32_t offset, uint32_t mask, uint32_t value);
+static Branches testFieldOneOf(Compiler* c, uint16_t size, bool indexed, uint32_t offset, const UINT* values,
+        UINT num_values);
+static Branches testEtherType(Compiler* c, UINT type);
+static Branches testVlan(Compiler* c, bool has_id, UINT id);
+static Branches testVlanInFrame(Compiler* c, UINT depth, bool has_id, UINT id);
+static Branches testMac(Compiler* c, Direction direction, const OCTET* mac);
+static Branches testIpv4Host(Compiler* c, Direction direction, const OCTET* address);
+static Branches testIpv6Host(Compiler* c, Direction direction, const OCTET* address);
+static Branches testProtocol(Compiler* c, IpFamilies families, UINT protocol);
+static Branches testPort(Compiler* c, Direction direction, UINT port);
+static Branches testTransportPort(Compiler* c, Direction direction, bool ipv6, UINT port);
+static void describeInstruction(const FilterInstruction* i, UINT pc, char* buff, size_t buff_size);
+
+/**
+ * Compiles the provided filter expression into a classic BPF program, fataling
+ * the program if the expression is invalid.
+ */
+Filter* Filter_compile(const char* expression) {
+    Compiler* c = (Compiler*) calloc(1, sizeof(Compiler));
+    Filter* filter;
+    Branches branches;
+    UINT i, j;
+
+    if (c == NULL) {
+        fatal("Failed to allocate the filter compiler.");
+    }
+
+    tokenize(c, expression);
+
+    if (c->num_tokens == 0) {
+        fatal("The filter expression is empty.");
+    }
+
+    // Work out where the network layer header starts once, up front, and keep
+    //  it in the X register (and in scratch memory in case X gets repurposed)
+    // NOTE ~> Every other frame field that sits behind the EtherType is then
+    //  loaded relative to X, so a single program handles untagged frames as
+    //  well as frames with as many stacked 802.1Q/802.1ad tags as the decoder
+    //  walks past. The tags are walked with one unrolled step each, which ends
+    //  with X just past the tag if there was one and jumps straight to the end
+    //  of the walk otherwise.
+    emit(c, OP_LDX | OP_IMM, 0);
+
+    for (i = 0; i < FD_MAX_VLAN_TAGS; i++) {
+        emitLoad(c, OP_H, false, ETHER_TYPE_OFFSET + i * VLAN_TAG_SIZE);
+        j = emit(c, OP_JMP | OP_JEQ | OP_K, ET_VLANTAGGED);
+        c->program[j].jt = 1;
+        c->program[j].jf = 0;
+        j = emit(c, OP_JMP | OP_JEQ | OP_K, ET_QINQTAGGED);
+        c->program[j].jt = 0;
+        c->program[j].jf = 1 + (FD_MAX_VLAN_TAGS - 1 - i) * VLAN_WALK_STEP_SIZE;
+        emit(c, OP_LDX | OP_IMM, (i + 1) * VLAN_TAG_SIZE);
+    }
+
+    emit(c, OP_STX, MEMORY_LINK_OFFSET);
+
+    branches = parseExpression(c);
+
+    if (c->position != c->num_tokens) {
+        fatal("Unexpected \"%s\" in the filter expression.", c->tokens[c->position]);
+    }
+
+    patchBranches(c, branches.when_true, emit(c, OP_RET | OP_K, ACCEPT_SNAPLEN));
+    patchBranches(c, branches.when_false, emit(c, OP_RET | OP_K, 0));
+
+    // Hand back just the program
+    filter = (Filter*) malloc(sizeof(Filter));
+
+    if (filter == NULL || (filter->instructions = malloc(sizeof(FilterInstruction) * c->length)) == NULL) {
+        fatal("Failed to allocate the compiled filter.");
+    }
+
+    memcpy(filter->instructions, c->program, sizeof(FilterInstruction) * c->length);
+    filter->length = c->length;
+
+    free(c->tokens);
+    free(c->buffer);
+    free(c);
+
+    return filter;
+}
+
+/**
+ * Returns the instructions of the provided compiled Filter.
+ */
+const FilterInstruction* Filter_getInstructions(const Filter* o) {
+    return o->instructions;
+}
+
+/**
+ * Returns the number of instructions in the provided compiled Filter.
+ */
+UINT Filter_getLength(const Filter* o) {
+    return o->length;
+}
+
+/**
+ * Runs the provided Filter against the provided frame and returns whether or
+ * not the frame should be kept. This is the user-space counterpart of the
+ * kernel's own BPF interpreter and follows the same rules (e.g. a load from
+ * beyond the end of the frame rejects it).
+ */
+bool Filter_matches(const Filter* o, const OCTET* data, UINT caplen, UINT wirelen) {
+    uint32_t a = 0, x = 0, memory[MEMORY_WORDS] = { 0 };
+    uint64_t offset;
+    UINT pc;
+
+    for (pc = 0; pc < o->length; pc++) {
+        const FilterInstruction* i = &o->instructions[pc];
+
+        switch (i->code) {
+            case OP_LD | OP_W | OP_ABS:
+            case OP_LD | OP_H | OP_ABS:
+            case OP_LD | OP_B | OP_ABS:
+            case OP_LD | OP_W | OP_IND:
+            case OP_LD | OP_H | OP_IND:
+            case OP_LD | OP_B | OP_IND: {
+                UINT size = (OP_SIZE(i->code) == OP_W) ? 4 : (OP_SIZE(i->code) == OP_H) ? 2 : 1;
+
+                // NOTE ~> Frames handed to the interpreter always have their
+                //  VLAN tags in place, so there is never any tag metadata.
+                if (OP_MODE(i->code) == OP_ABS && i->k >= ANCILLARY_OFFSET) {
+                    a = 0;
+                    break;
+                }
+
+                offset = (uint64_t) i->k + ((OP_MODE(i->code) == OP_IND) ? x : 0);
+
+                if (offset + size > caplen) {
+                    return false;
+                }
+
+                if (size == 4) {
+                    a = ((uint32_t) data[offset] << 24) | ((uint32_t) data[offset + 1] << 16) |
+                            ((uint32_t) data[offset + 2] << 8) | data[offset + 3];
+                } else if (size == 2) {
+                    a = ((uint32_t) data[offset] << 8) | data[offset + 1];
+                } else {
+                    a = data[offset];
+                }
+                break;
+            }
+
+            case OP_LD | OP_W | OP_LEN:
+                a = wirelen;
+                break;
+
+            case OP_LD | OP_IMM:
+                a = i->k;
+                break;
+
+            case OP_LD | OP_MEM:
+                if (i->k >= MEMORY_WORDS) {
+                    return false;
+                }
+                a = memory[i->k];
+                break;
+
+            case OP_LDX | OP_W | OP_IMM:
+                x = i->k;
+                break;
+
+            case OP_LDX | OP_W | OP_MEM:
+                if (i->k >= MEMORY_WORDS) {
+                    return false;
+                }
+                x = memory[i->k];
+                break;
+
+            case OP_LDX | OP_W | OP_LEN:
+                x = wirelen;
+                break;
+
+            case OP_LDX | OP_B | OP_MSH:
+                if (i->k >= caplen) {
+                    return false;
+                }
+                x = (data[i->k] & 0x0f) << 2;
+                break;
+
+            case OP_ST:
+            case OP_STX:
+                if (i->k >= MEMORY_WORDS) {
+                    return false;
+                }
+                memory[i->k] = (i->code == OP_ST) ? a : x;
+                break;
+
+            case OP_ALU | OP_ADD | OP_K:    a += i->k;              break;
+            case OP_ALU | OP_ADD | OP_X:    a += x;                 break;
+            case OP_ALU | OP_SUB | OP_K:    a -= i->k;              break;
+            case OP_ALU | OP_SUB | OP_X:    a -= x;                 break;
+            case OP_ALU | OP_MUL | OP_K:    a *= i->k;              break;
+            case OP_ALU | OP_MUL | OP_X:    a *= x;                 break;
+            case OP_ALU | OP_OR | OP_K:     a |= i->k;              break;
+            case OP_ALU | OP_OR | OP_X:     a |= x;                 break;
+            case OP_ALU | OP_AND | OP_K:    a &= i->k;              break;
+            case OP_ALU | OP_AND | OP_X:    a &= x;                 break;
+            case OP_ALU | OP_XOR | OP_K:    a ^= i->k;              break;
+            case OP_ALU | OP_XOR | OP_X:    a ^= x;                 break;
+            case OP_ALU | OP_LSH | OP_K:    a = (i->k < 32) ? (a << i->k) : 0;  break;
+            case OP_ALU | OP_LSH | OP_X:    a = (x < 32) ? (a << x) : 0;        break;
+            case OP_ALU | OP_RSH | OP_K:    a = (i->k < 32) ? (a >> i->k) : 0;  break;
+            case OP_ALU | OP_RSH | OP_X:    a = (x < 32) ? (a >> x) : 0;        break;
+            case OP_ALU | OP_NEG:           a = -a;                 break;
+
+            case OP_ALU | OP_DIV | OP_K:
+            case OP_ALU | OP_DIV | OP_X:
+            case OP_ALU | OP_MOD | OP_K:
+            case OP_ALU | OP_MOD | OP_X: {
+                uint32_t divisor = (OP_SRC(i->code) == OP_X) ? x : i->k;
+
+                if (divisor == 0) {
+                    return false;
+                }
+                a = (OP_OP(i->code) == OP_DIV) ? (a / divisor) : (a % divisor);
+                break;
+            }
+
+            case OP_JMP | OP_JA:
+                pc += i->k;
+                break;
+
+            case OP_JMP | OP_JEQ | OP_K:    pc += (a == i->k) ? i->jt : i->jf;      break;
+            case OP_JMP | OP_JEQ | OP_X:    pc += (a == x) ? i->jt : i->jf;         break;
+            case OP_JMP | OP_JGT | OP_K:    pc += (a > i->k) ? i->jt : i->jf;       break;
+            case OP_JMP | OP_JGT | OP_X:    pc += (a > x) ? i->jt : i->jf;          break;
+            case OP_JMP | OP_JGE | OP_K:    pc += (a >= i->k) ? i->jt : i->jf;      break;
+            case OP_JMP | OP_JGE | OP_X:    pc += (a >= x) ? i->jt : i->jf;         break;
+            case OP_JMP | OP_JSET | OP_K:   pc += (a & i->k) ? i->jt : i->jf;       break;
+            case OP_JMP | OP_JSET | OP_X:   pc += (a & x) ? i->jt : i->jf;          break;
+
+            case OP_RET | OP_K:
+                return i->k != 0;
+
+            case OP_RET | OP_A:
+                return a != 0;
+
+            case OP_MISC | OP_TAX:
+                x = a;
+                break;
+
+            case OP_MISC | OP_TXA:
+                a = x;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Outputs a human-readable listing of the provided Filter's program (in the
+ * same format as "tcpdump -d").
+ */
+void Filter_dump(const Filter* o) {
+    char buff[64];
+    UINT pc;
+
+    for (pc = 0; pc < o->length; pc++) {
+        describeInstruction(&o->instructions[pc], pc, buff, sizeof(buff));
+        output(NULL, "(%03u) %s\n", pc, buff);
+    }
+}
+
+/**
+ * Frees the provided Filter.
+ */
+void Filter_free(Filter* o) {
+    free(o->instructions);
+    free(o);
+}
+
+/**
+ * Splits the provided expression into whitespace separated tokens. Parentheses
+ * and a leading "!" are always tokens of their own.
+ */
+static void tokenize(Compiler* c, const char* expression) {
+    size_t length = strlen(expression);
+    const char* in = expression;
+    char* out;
+
+    // NOTE ~> No expression can have more tokens than characters, and no token
+    //  needs more than its characters plus a terminator.
+    c->buffer = (char*) malloc(length * 2 + 1);
+    c->tokens = (char**) malloc(sizeof(char*) * (length + 1));
+
+    if (c->buffer == NULL || c->tokens == NULL) {
+        fatal("Failed to allocate the filter compiler's tokens.");
+    }
+
+    out = c->buffer;
+
+    while (*in) {
+        if (isspace((unsigned char) *in)) {
+            in++;
+            continue;
+        }
+
+        c->tokens[c->num_tokens++] = out;
+
+        if (*in == '(' || *in == ')' || *in == '!') {
+            *out++ = *in++;
+        } else {
+            while (*in && !isspace((unsigned char) *in) && *in != '(' && *in != ')') {
+                *out++ = *in++;
+            }
+        }
+
+        *out++ = '\0';
+    }
+}
+
+/**
+ * Returns the token the provided number of tokens ahead of the current one, or
+ * NULL if the expression ends before then.
+ */
+static const char* peekToken(Compiler* c, UINT ahead) {
+    if (c->position + ahead >= c->num_tokens) {
+        return NULL;
+    }
+
+    return c->tokens[c->position + ahead];
+}
+
+/**
+ * Consumes and returns the current token, fataling the program if the
+ * expression has already ended.
+ */
+static const char* nextToken(Compiler* c, const char* expected) {
+    if (c->position >= c->num_tokens) {
+        fatal("The filter expression ends early (expected %s).", expected);
+    }
+
+    return c->tokens[c->position++];
+}
+
+/**
+ * Consumes the current token if it is the provided one.
+ */
+static bool acceptToken(Compiler* c, const char* token) {
+    const char* current = peekToken(c, 0);
+
+    if (current != NULL && strcmp(current, token) == 0) {
+        c->position++;
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * expression := term { ("or" | "||") term }
+ */
+static Branches parseExpression(Compiler* c) {
+    Branches branches = parseTerm(c);
+
+    while (acceptToken(c, "or") || acceptToken(c, "||")) {
+        branches = joinOr(c, branches, parseTerm(c));
+    }
+
+    return branches;
+}
+
+/**
+ * term := factor { ("and" | "&&") factor }
+ */
+static Branches parseTerm(Compiler* c) {
+    Branches branches = parseFactor(c);
+
+    while (acceptToken(c, "and") || acceptToken(c, "&&")) {
+        branches = joinAnd(c, branches, parseFactor(c));
+    }
+
+    return branches;
+}
+
+/**
+ * factor := ("not" | "!") factor | "(" expression ")" | primitive
+ */
+static Branches parseFactor(Compiler* c) {
+    Branches branches;
+
+    if (acceptToken(c, "not") || acceptToken(c, "!")) {
+        return negate(parseFactor(c));
+    }
+
+    if (acceptToken(c, "(")) {
+        branches = parseExpression(c);
+
+        if (!acceptToken(c, ")")) {
+            fatal("The filter expression is missing a closing parenthesis.");
+        }
+
+        return branches;
+    }
+
+    return parsePrimitive(c);
+}
+
+/**
+ * Parses and compiles a single primitive (see filter.h for the full list).
+ */
+static Branches parsePrimitive(Compiler* c) {
+    const char* token = nextToken(c, "a primitive");
+    const char* next;
+
+    if (strcmp(token, "ether") == 0) {
+        return parseEther(c);
+    } else if (strcmp(token, "vlan") == 0) {
+        // NOTE ~> The VLAN ID is optional, so only take the next token if it
+        //  actually is a number.
+        next = peekToken(c, 0);
+
+        if (next != NULL && isdigit((unsigned char) *next)) {
+            return testVlan(c, true, parseNumber(nextToken(c, "a VLAN ID"), VLAN_ID_MASK, "VLAN ID"));
+        }
+
+        return testVlan(c, false, 0);
+    } else if (strcmp(token, "ip") == 0 || strcmp(token, "ipv4") == 0) {
+        return testEtherType(c, ET_IPV4);
+    } else if (strcmp(token, "ip6") == 0 || strcmp(token, "ipv6") == 0) {
+        return testEtherType(c, ET_IPV6);
+    } else if (strcmp(token, "arp") == 0) {
+        return testEtherType(c, ET_ARP);
+    } else if (strcmp(token, "tcp") == 0) {
+        return parseTransport(c, PROTO_TCP);
+    } else if (strcmp(token, "udp") == 0) {
+        return parseTransport(c, PROTO_UDP);
+    } else if (strcmp(token, "icmp") == 0) {
+        return testProtocol(c, IF_IPV4, PROTO_ICMP);
+    } else if (strcmp(token, "icmp6") == 0) {
+        return testProtocol(c, IF_IPV6, PROTO_ICMP6);
+    } else if (strcmp(token, "proto") == 0) {
+        return testProtocol(c, IF_BOTH, parseNumber(nextToken(c, "a protocol number"), 0xff, "protocol number"));
+    } else if (strcmp(token, "src") == 0) {
+        return parseHostOrPort(c, DIR_SRC);
+    } else if (strcmp(token, "dst") == 0) {
+        return parseHostOrPort(c, DIR_DST);
+    } else if (strcmp(token, "host") == 0 || strcmp(token, "port") == 0) {
+        c->position--;
+
+        return parseHostOrPort(c, DIR_ANY);
+    }
+
+    fatal("Unexpected \"%s\" in the filter expression.", token);
+
+    return noBranches;
+}
+
+/**
+ * ether type <number|name> | ether [src|dst] [host] <mac>
+ */
+static Branches parseEther(Compiler* c) {
+    Direction direction = DIR_ANY;
+    OCTET mac[6];
+    const char* token;
+
+    if (acceptToken(c, "type")) {
+        token = nextToken(c, "an EtherType");
+
+        if (strcmp(token, "ip") == 0 || strcmp(token, "ipv4") == 0) {
+            return testEtherType(c, ET_IPV4);
+        } else if (strcmp(token, "ip6") == 0 || strcmp(token, "ipv6") == 0) {
+            return testEtherType(c, ET_IPV6);
+        } else if (strcmp(token, "arp") == 0) {
+            return testEtherType(c, ET_ARP);
+        }
+
+        return testEtherType(c, parseNumber(token, 0xffff, "EtherType"));
+    }
+
+    if (acceptToken(c, "src")) {
+        direction = DIR_SRC;
+    } else if (acceptToken(c, "dst")) {
+        direction = DIR_DST;
+    }
+
+    acceptToken(c, "host");
+    parseMac(nextToken(c, "a MAC address"), mac);
+
+    return testMac(c, direction, mac);
+}
+
+/**
+ * host <ipv4|ipv6> | port <number> (once any direction has been consumed)
+ */
+static Branches parseHostOrPort(Compiler* c, Direction direction) {
+    const char* token = nextToken(c, "\"host\" or \"port\"");
+    OCTET address[16];
+
+    if (strcmp(token, "port") == 0) {
+        return testPort(c, direction, parseNumber(nextToken(c, "a port number"), 0xffff, "port number"));
+    } else if (strcmp(token, "host") != 0) {
+        fatal("Expected \"host\" or \"port\" in the filter expression, not \"%s\".", token);
+    }
+
+    token = nextToken(c, "an IP address");
+
+    if (inet_pton(AF_INET, token, address) == 1) {
+        return testIpv4Host(c, direction, address);
+    } else if (inet_pton(AF_INET6, token, address) == 1) {
+        return testIpv6Host(c, direction, address);
+    }
+
+    fatal("Invalid IP address in the filter expression (\"%s\").", token);
+
+    return noBranches;
+}
+
+/**
+ * tcp|udp [[src|dst] port <number>]
+ */
+static Branches parseTransport(Compiler* c, UINT protocol) {
+    Branches branches = testProtocol(c, IF_BOTH, protocol);
+    const char* next = peekToken(c, 0);
+    const char* after = peekToken(c, 1);
+
+    if (next == NULL) {
+        return branches;
+    }
+
+    if (strcmp(next, "port") == 0 ||
+            ((strcmp(next, "src") == 0 || strcmp(next, "dst") == 0) && after != NULL && strcmp(after, "port") == 0)) {
+        branches = joinAnd(c, branches, parsePrimitive(c));
+    }
+
+    return branches;
+}
+
+/**
+ * Parses the provided token as an unsigned number (in any base that
+ * strtoul(...) understands) no larger than the provided maximum, fataling the
+ * program if it is not one.
+ */
+static UINT parseNumber(const char* token, UINT max, const char* what) {
+    char* end;
+    unsigned long parsed;
+
+    errno = 0;
+    parsed = strtoul(token, &end, 0);
+
+    if (errno != 0 || end == token || *end != '\0' || *token == '-' || parsed > max) {
+        fatal("Invalid %s in the filter expression (\"%s\").", what, token);
+    }
+
+    return (UINT) parsed;
+}
+
+/**
+ * Parses the provided token as a MAC address whose octets are separated by
+ * either colons or dashes, fataling the program if it is not one.
+ */
+static void parseMac(const char* token, OCTET* mac) {
+    const char* ptr = token;
+    char* end;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        unsigned long octet;
+
+        if (!isxdigit((unsigned char) *ptr)) {
+            break;
+        }
+
+        octet = strtoul(ptr, &end, 16);
+
+        if (end - ptr > 2 || octet > 0xff) {
+            break;
+        }
+
+        mac[i] = (OCTET) octet;
+        ptr = end;
+
+        if (i < 5) {
+            if (*ptr != ':' && *ptr != '-') {
+                break;
+            }
+            ptr++;
+        }
+    }
+
+    if (i != 6 || *ptr != '\0') {
+        fatal("Invalid MAC address in the filter expression (\"%s\").", token);
+    }
+}
+
+/**
+ * Appends a single instruction to the program being compiled and returns its
+ * index.
+ */
+static UINT emit(Compiler* c, uint16_t code, uint32_t k) {
+    if (c->length == FILTER_MAX_INSTRUCTIONS) {
+        fatal("The filter expression compiles to more than %d instructions.", FILTER_MAX_INSTRUCTIONS);
+    }
+
+    c->program[c->length].code = code;
+    c->program[c->length].jt = 0;
+    c->program[c->length].jf = 0;
+    c->program[c->length].k = k;
+
+    return c->length++;
+}
+
+/**
+ * Loads the frame field at the provided offset into the accumulator. Indexed
+ * loads are shifted by the size of the frame's VLAN tag (if there is one).
+ */
+static void emitLoad(Compiler* c, uint16_t size, bool indexed, uint32_t offset) {
+    if (!indexed) {
+        emit(c, OP_LD | size | OP_ABS, offset);
+
+        return;
+    }
+
+    if (c->x_clobbered) {
+        emit(c, OP_LDX | OP_MEM, MEMORY_LINK_OFFSET);
+    }
+
+    emit(c, OP_LD | size | OP_IND, offset);
+}
+
+/**
+ * Appends a conditional jump whose targets are yet to be determined.
+ */
+static Branches emitJump(Compiler* c, uint16_t op, uint32_t k) {
+    Branches branches;
+    UINT i = emit(c, OP_JMP | op | OP_K, k);
+
+    c->links[i * 2] = NO_BRANCHES;
+    c->links[i * 2 + 1] = NO_BRANCHES;
+
+    branches.start = i;
+    branches.when_true = i * 2;
+    branches.when_false = i * 2 + 1;
+
+    return branches;
+}
+
+/**
+ * Joins two lists of unresolved branches into one.
+ */
+static int mergeBranches(Compiler* c, int first, int second) {
+    int entry = first;
+
+    if (first == NO_BRANCHES) {
+        return second;
+    }
+
+    while (c->links[entry] != NO_BRANCHES) {
+        entry = c->links[entry];
+    }
+
+    c->links[entry] = second;
+
+    return first;
+}
+
+/**
+ * Points every branch in the provided list at the provided instruction.
+ */
+static void patchBranches(Compiler* c, int list, UINT target) {
+    while (list != NO_BRANCHES) {
+        UINT i = list / 2;
+        UINT distance = target - i - 1;
+
+        // NOTE ~> Conditional jumps can only skip ahead by as many instructions
+        //  as fit in a single octet.
+        if (distance > 0xff) {
+            fatal("The filter expression is too complex (a branch would need to skip %u instructions).", distance);
+        }
+
+        if (list % 2 == 0) {
+            c->program[i].jt = distance;
+        } else {
+            c->program[i].jf = distance;
+        }
+
+        list = c->links[list];
+    }
+}
+
+/**
+ * Combines the branches of two consecutively compiled sub-expressions into
+ * those of their conjunction.
+ */
+static Branches joinAnd(Compiler* c, Branches left, Branches right) {
+    patchBranches(c, left.when_true, right.start);
+
+    right.start = left.start;
+    right.when_false = mergeBranches(c, left.when_false, right.when_false);
+
+    return right;
+}
+
+/**
+ * Combines the branches of two consecutively compiled sub-expressions into
+ * those of their disjunction.
+ */
+static Branches joinOr(Compiler* c, Branches left, Branches right) {
+    patchBranches(c, left.when_false, right.start);
+
+    right.start = left.start;
+    right.when_true = mergeBranches(c, left.when_true, right.when_true);
+
+    return right;
+}
+
+/**
+ * Swaps the provided branches, negating the sub-expression they came from.
+ */
+static Branches negate(Branches branches) {
+    int when_true = branches.when_true;
+
+    branches.when_true = branches.when_false;
+    branches.when_false = when_true;
+
+    return branches;
+}
+
+/**
+ * Compiles a test of whether the frame field at the provided offset (once
+ * masked, if the mask is not zero) is equal to the provided value.
+ */
+static Branches testField(Compiler* c, uint16_t size, bool indexed, uint32_t offset, uint32_t mask, uint32_t value) {
+    UINT start = c->length;
+    Branches branches;
+
+    emitLoad(c, size, indexed, offset);
+
+    if (mask != 0) {
+        emit(c, OP_ALU | OP_AND | OP_K, mask);
+    }
+
+    branches = emitJump(c, OP_JEQ, value);
+    branches.start = start;
+
+    return branches;
+}
+
+/**
+ * Compiles a test of whether the frame field at the provided offset is equal to
+ * any of the provided values (loading it only once).
+ */
+static Branches testFieldOneOf(Compiler* c, uint16_t size, bool indexed, uint32_t offset, const UINT* values,
+        UINT num_values) {
+    UINT start = c->length;
+    Branches branches;
+    UINT i;
+
+    emitLoad(c, size, indexed, offset);
+    branches = emitJump(c, OP_JEQ, values[0]);
+
+    for (i = 1; i < num_values; i++) {
+        branches = joinOr(c, branches, emitJump(c, OP_JEQ, values[i]));
+    }
+
+    branches.start = start;
+
+    return branches;
+}
+
+/**
+ * Compiles a test of the frame's EtherType (the one following any VLAN tag).
+ */
+static Branches testEtherType(Compiler* c, UINT type) {
+    return testField(c, OP_H, true, ETHER_TYPE_OFFSET, 0, type);
+}
+
+/**
+ * Compiles a test of whether the frame is VLAN tagged and, optionally, of
+ * whether any of its tags carries the provided VLAN ID.
+ */
+static Branches testVlan(Compiler* c, bool has_id, UINT id) {
+#ifdef HAVE_PACKET_MMAP
+    // NOTE ~> The Linux kernel strips the outermost tag off of frames before
+    //  they are filtered, so it has to be looked for in the frame's metadata
+    //  first. Only frames without such metadata (including every frame handed
+    //  to the interpreter) are checked for a tag of their own, as are frames
+    //  whose stripped tag has some other VLAN ID (in case an inner one has it).
+    Branches absent = testField(c, OP_W, false, ANCILLARY_OFFSET + ANCILLARY_VLAN_TAG_PRESENT, 0, 0);
+    Branches stripped = { absent.start, absent.when_false, NO_BRANCHES };
+    Branches in_frame;
+
+    if (has_id) {
+        stripped = testField(c, OP_W, false, ANCILLARY_OFFSET + ANCILLARY_VLAN_TAG, VLAN_ID_MASK, id);
+        patchBranches(c, absent.when_false, stripped.start);
+    }
+
+    in_frame = testVlanInFrame(c, 0, has_id, id);
+    patchBranches(c, absent.when_true, in_frame.start);
+    patchBranches(c, stripped.when_false, in_frame.start);
+
+    in_frame.start = absent.start;
+    in_frame.when_true = mergeBranches(c, stripped.when_true, in_frame.when_true);
+
+    return in_frame;
+#else
+    return testVlanInFrame(c, 0, has_id, id);
+#endif
+}
+
+/**
+ * Compiles a test of whether the frame carries an 802.1Q or 802.1ad tag of its
+ * own at the provided depth and, optionally, of whether the VLAN ID in it or in
+ * any tag stacked behind it (as far as the decoder goes) is the provided one.
+ */
+static Branches testVlanInFrame(Compiler* c, UINT depth, bool has_id, UINT id) {
+    static const UINT TAG_TYPES[] = { ET_VLANTAGGED, ET_QINQTAGGED };
+    UINT offset = depth * VLAN_TAG_SIZE;
+    Branches branches = testFieldOneOf(c, OP_H, false, ETHER_TYPE_OFFSET + offset, TAG_TYPES, 2);
+    Branches ids;
+
+    if (!has_id) {
+        return branches;
+    }
+
+    ids = testField(c, OP_H, false, VLAN_TCI_OFFSET + offset, VLAN_ID_MASK, id);
+
+    if (depth + 1 < FD_MAX_VLAN_TAGS) {
+        ids = joinOr(c, ids, testVlanInFrame(c, depth + 1, true, id));
+    }
+
+    return joinAnd(c, branches, ids);
+}
+
+/**
+ * Compiles a test of the frame's source and/or destination MAC address.
+ */
+static Branches testMac(Compiler* c, Direction direction, const OCTET* mac) {
+    uint32_t high = ((uint32_t) mac[0] << 24) | ((uint32_t) mac[1] << 16) | ((uint32_t) mac[2] << 8) | mac[3];
+    uint32_t low = ((uint32_t) mac[4] << 8) | mac[5];
+    Branches src, dst;
+
+    if (direction == DIR_SRC) {
+        src = testField(c, OP_W, false, ETHER_SRC_OFFSET, 0, high);
+
+        return joinAnd(c, src, testField(c, OP_H, false, ETHER_SRC_OFFSET + 4, 0, low));
+    }
+
+    dst = testField(c, OP_W, false, ETHER_DST_OFFSET, 0, high);
+    dst = joinAnd(c, dst, testField(c, OP_H, false, ETHER_DST_OFFSET + 4, 0, low));
+
+    if (direction == DIR_DST) {
+        return dst;
+    }
+
+    return joinOr(c, dst, testMac(c, DIR_SRC, mac));
+}
+
+/**
+ * Compiles a test of the frame's source and/or destination IPv4 address.
+ */
+static Branches testIpv4Host(Compiler* c, Direction direction, const OCTET* address) {
+    uint32_t value = ((uint32_t) address[0] << 24) | ((uint32_t) address[1] << 16) | ((uint32_t) address[2] << 8) |
+            address[3];
+    Branches branches = testEtherType(c, ET_IPV4);
+    Branches addresses;
+
+    if (direction == DIR_DST) {
+        addresses = testField(c, OP_W, true, IPV4_DST_OFFSET, 0, value);
+    } else {
+        addresses = testField(c, OP_W, true, IPV4_SRC_OFFSET, 0, value);
+
+        if (direction == DIR_ANY) {
+            addresses = joinOr(c, addresses, testField(c, OP_W, true, IPV4_DST_OFFSET, 0, value));
+        }
+    }
+
+    return joinAnd(c, branches, addresses);
+}
+
+/**
+ * Compiles a test of the frame's source and/or destination IPv6 address.
+ */
+static Branches testIpv6Host(Compiler* c, Direction direction, const OCTET* address) {
+    Branches branches = testEtherType(c, ET_IPV6);
+    Branches addresses[2];
+    UINT offsets[2] = { IPV6_SRC_OFFSET, IPV6_DST_OFFSET };
+    UINT first = (direction == DIR_DST) ? 1 : 0;
+    UINT last = (direction == DIR_SRC) ? 0 : 1;
+    UINT side, word;
+
+    // Compare each address a word at a time
+    for (side = first; side <= last; side++) {
+        for (word = 0; word < 4; word++) {
+            const OCTET* octets = address + (word * 4);
+            uint32_t value = ((uint32_t) octets[0] << 24) | ((uint32_t) octets[1] << 16) |
+                    ((uint32_t) octets[2] << 8) | octets[3];
+            Branches test = testField(c, OP_W, true, offsets[side] + (word * 4), 0, value);
+
+            addresses[side] = (word == 0) ? test : joinAnd(c, addresses[side], test);
+        }
+    }
+
+    if (first != last) {
+        addresses[first] = joinOr(c, addresses[first], addresses[last]);
+    }
+
+    return joinAnd(c, branches, addresses[first]);
+}
+
+/**
+ * Compiles a test of the IPv4 "Protocol" and/or IPv6 "Next Header" field.
+ *
+ * NOTE ~> IPv6 extension headers are not walked, so only protocols whose
+ *  header directly follows the fixed IPv6 header are matched.
+ */
+static Branches testProtocol(Compiler* c, IpFamilies families, UINT protocol) {
+    Branches ipv4, ipv6;
+
+    if (families & IF_IPV4) {
+        ipv4 = testEtherType(c, ET_IPV4);
+        ipv4 = joinAnd(c, ipv4, testField(c, OP_B, true, IPV4_PROTOCOL_OFFSET, 0, protocol));
+
+        if (families == IF_IPV4) {
+            return ipv4;
+        }
+    }
+
+    ipv6 = testEtherType(c, ET_IPV6);
+    ipv6 = joinAnd(c, ipv6, testField(c, OP_B, true, IPV6_NEXT_HEADER_OFFSET, 0, protocol));
+
+    if (families == IF_IPV6) {
+        return ipv6;
+    }
+
+    return joinOr(c, ipv4, ipv6);
+}
+
+/**
+ * Compiles a test of the frame's TCP, UDP, or SCTP source and/or destination
+ * port.
+ */
+static Branches testPort(Compiler* c, Direction direction, UINT port) {
+    static const UINT protocols[] = { PROTO_TCP, PROTO_UDP, PROTO_SCTP };
+    Branches ipv4, ipv6;
+
+    // NOTE ~> Only the first fragment of a fragmented IPv4 datagram carries the
+    //  transport header.
+    ipv4 = testEtherType(c, ET_IPV4);
+    ipv4 = joinAnd(c, ipv4, testFieldOneOf(c, OP_B, true, IPV4_PROTOCOL_OFFSET, protocols, 3));
+    ipv4 = joinAnd(c, ipv4, testField(c, OP_H, true, IPV4_FRAGMENT_OFFSET, IPV4_FRAGMENT_MASK, 0));
+    ipv4 = joinAnd(c, ipv4, testTransportPort(c, direction, false, port));
+
+    ipv6 = testEtherType(c, ET_IPV6);
+    ipv6 = joinAnd(c, ipv6, testFieldOneOf(c, OP_B, true, IPV6_NEXT_HEADER_OFFSET, protocols, 3));
+    ipv6 = joinAnd(c, ipv6, testTransportPort(c, direction, true, port));
+
+    return joinOr(c, ipv4, ipv6);
+}
+
+/**
+ * Compiles a test of the source and/or destination port in the transport
+ * header that follows the network layer header.
+ */
+static Branches testTransportPort(Compiler* c, Direction direction, bool ipv6, UINT port) {
+    uint32_t offset = (direction == DIR_DST) ? DST_PORT_OFFSET : SRC_PORT_OFFSET;
+    UINT start = c->length;
+    Branches branches;
+
+    // Point X at the transport header
+    // NOTE ~> An IPv4 header's length is variable, so the offset has to be
+    //  worked out from its "IHL" field at run time.
+    if (c->x_clobbered) {
+        emit(c, OP_LDX | OP_MEM, MEMORY_LINK_OFFSET);
+    }
+
+    if (ipv6) {
+        emit(c, OP_MISC | OP_TXA, 0);
+        emit(c, OP_ALU | OP_ADD | OP_K, IPV6_HEADER_SIZE);
+    } else {
+        emit(c, OP_LD | OP_B | OP_IND, IPV4_IHL_OFFSET);
+        emit(c, OP_ALU | OP_AND | OP_K, 0x0f);
+        emit(c, OP_ALU | OP_LSH | OP_K, 2);
+        emit(c, OP_ALU | OP_ADD | OP_X, 0);
+    }
+
+    emit(c, OP_MISC | OP_TAX, 0);
+    emit(c, OP_LD | OP_H | OP_IND, offset);
+    c->x_clobbered = true;
+
+    branches = emitJump(c, OP_JEQ, port);
+    branches.start = start;
+
+    if (direction == DIR_ANY) {
+        branches = joinOr(c, branches, testTransportPort(c, DIR_DST, ipv6, port));
+    }
+
+    return branches;
+}
+
+/**
+ * Writes a human-readable description of the provided instruction (found at
+ * the provided index) into the provided buffer.
+ */
+static void describeInstruction(const FilterInstruction* i, UINT pc, char* buff, size_t buff_size) {
+    static const char* aluNames[] = { "add", "sub", "mul", "div", "or", "and", "lsh", "rsh", "neg", "mod", "xor" };
+    static const char* jumpNames[] = { "ja", "jeq", "jgt", "jge", "jset" };
+    const char* size = (OP_SIZE(i->code) == OP_H) ? "h" : (OP_SIZE(i->code) == OP_B) ? "b" : "";
+    const char* source = (OP_SRC(i->code) == OP_X) ? "x" : NULL;
+
+    switch (OP_CLASS(i->code)) {
+        case OP_LD:
+            switch (OP_MODE(i->code)) {
+                case OP_ABS:
+                    if (i->k == ANCILLARY_OFFSET + ANCILLARY_VLAN_TAG) {
+                        snprintf(buff, buff_size, "ld%-6s [vlan_tci]", size);
+                    } else if (i->k == ANCILLARY_OFFSET + ANCILLARY_VLAN_TAG_PRESENT) {
+                        snprintf(buff, buff_size, "ld%-6s [vlan_avail]", size);
+                    } else {
+                        snprintf(buff, buff_size, "ld%-6s [%u]", size, i->k);
+                    }
+                    return;
+
+                case OP_IND:
+                    snprintf(buff, buff_size, "ld%-6s [x + %u]", size, i->k);
+                    return;
+
+                case OP_IMM:
+                    snprintf(buff, buff_size, "ld       #0x%x", i->k);
+                    return;
+
+                case OP_MEM:
+                    snprintf(buff, buff_size, "ld       M[%u]", i->k);
+                    return;
+
+                case OP_LEN:
+                    snprintf(buff, buff_size, "ld       #pktlen");
+                    return;
+            }
+            break;
+
+        case OP_LDX:
+            switch (OP_MODE(i->code)) {
+                case OP_IMM:
+                    snprintf(buff, buff_size, "ldx      #0x%x", i->k);
+                    return;
+
+                case OP_MEM:
+                    snprintf(buff, buff_size, "ldx      M[%u]", i->k);
+                    return;
+
+                case OP_LEN:
+                    snprintf(buff, buff_size, "ldx      #pktlen");
+                    return;
+
+                case OP_MSH:
+                    snprintf(buff, buff_size, "ldxb     4*([%u]&0xf)", i->k);
+                    return;
+            }
+            break;
+
+        case OP_ST:
+            snprintf(buff, buff_size, "st       M[%u]", i->k);
+            return;
+
+        case OP_STX:
+            snprintf(buff, buff_size, "stx      M[%u]", i->k);
+            return;
+
+        case OP_ALU:
+            if ((OP_OP(i->code) >> 4) < sizeof(aluNames) / sizeof(aluNames[0])) {
+                if (OP_OP(i->code) == OP_NEG) {
+                    snprintf(buff, buff_size, "neg");
+                } else if (source != NULL) {
+                    snprintf(buff, buff_size, "%-8s x", aluNames[OP_OP(i->code) >> 4]);
+                } else {
+                    snprintf(buff, buff_size, "%-8s #0x%x", aluNames[OP_OP(i->code) >> 4], i->k);
+                }
+                return;
+            }
+            break;
+
+        case OP_JMP:
+            if (OP_OP(i->code) == OP_JA) {
+                snprintf(buff, buff_size, "ja       %u", pc + 1 + i->k);
+                return;
+            } else if ((OP_OP(i->code) >> 4) < sizeof(jumpNames) / sizeof(jumpNames[0])) {
+                char operand[16];
+
+                if (source != NULL) {
+                    snprintf(operand, sizeof(operand), "x");
+                } else {
+                    snprintf(operand, sizeof(operand), "#0x%x", i->k);
+                }
+
+                snprintf(buff, buff_size, "%-8s %-16s jt %u\tjf %u", jumpNames[OP_OP(i->code) >> 4], operand,
+                        pc + 1 + i->jt, pc + 1 + i->jf);
+                return;
+            }
+            break;
+
+        case OP_RET:
+            if ((i->code & 0x18) == OP_A) {
+                snprintf(buff, buff_size, "ret      a");
+            } else {
+                snprintf(buff, buff_size, "ret      #%u", i->k);
+            }
+            return;
+
+        case OP_MISC:
+            snprintf(buff, buff_size, "%s", (i->code & 0xf8) == OP_TXA ? "txa" : "tax");
+            return;
+    }
+
+    snprintf(buff, buff_size, "unknown  0x%04x", i->code);
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include "common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// NOTE ~> A filter is a small expression (e.g. "vlan 100 and tcp port 80")
+//  compiled down to a classic BPF program. Live capture sources hand the
+//  program to the kernel so that unmatched frames never leave it, while offline
+//  sources run the very same program through the interpreter in filter.c.
+//
+// The expression language is made up of the following primitives, which can be
+// combined with "and" ("&&"), "or" ("||"), "not" ("!") and parentheses:
+//
+//  ether type <number|ip|ip6|arp>      vlan [id]
+//  ether [src|dst] host <mac>          ip | ip6 | arp
+//  [src|dst] host <ipv4|ipv6>          proto <number>
+//  [src|dst] port <number>             tcp | udp | icmp | icmp6
+//
+// "tcp" and "udp" may be directly followed by a port primitive (e.g.
+// "tcp dst port 443"), which is the same as joining the two with "and".
+
+/**
+ * Maximum number of instructions that a compiled filter may contain (the same
+ * limit that the kernels enforce).
+ */
+#define FILTER_MAX_INSTRUCTIONS 4096
+
+/**
+ * A single classic BPF instruction. The layout is the same as the kernel's
+ * "struct bpf_insn" (BSD) and "struct sock_filter" (Linux).
+ */
+typedef struct FilterInstruction {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+} FilterInstruction;
+
+typedef struct Filter Filter;
+
+Filter* Filter_compile(const char* expression);
+const FilterInstruction* Filter_getInstructions(const Filter* o);
+UINT Filter_getLength(const Filter* o);
+bool Filter_matches(const Filter* o, const OCTET* data, UINT caplen, UINT wirelen);
+void Filter_dump(const Filter* o);
+void Filter_free(Filter* o);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,410 @@
+#include "flight_recorder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "large_buffer.h"
+#include "logger.h"
+#include "signals.h"
+
+#define RECORD_ALIGNMENT        8
+#define RECORD_WRAP             0xffffffffU
+#define MAX_NAME_LENGTH         64
+#define NANOS_PER_SECOND        1000000000ULL
+
+/**
+ * A frame held in one of the recorder's buffers, followed by its data (padded
+ * out to the record alignment).
+ */
+typedef struct RecorderRecord {
+    /**
+     * The number of octets of the frame that were captured, or RECORD_WRAP if
+     * the rest of the buffer was skipped and the next record is at its start.
+     */
+    UINT caplen;
+    UINT wirelen;
+
+    /**
+     * When the frame was captured, in nanoseconds since the epoch.
+     */
+    uint64_t timestamp;
+
+    UINT interface;
+    OCTET data[];
+} RecorderRecord;
+
+/**
+ * One of the recorder's two buffers: a circular buffer of records, the number
+ * of octets of it that are in use (including any space skipped at the end),
+ * where the oldest record is and where the next one goes, and how many records
+ * there are.
+ */
+typedef struct RecorderBuffer {
+    OCTET* data;
+    size_t used;
+    size_t read;
+    size_t write;
+    ULONG frames;
+} RecorderBuffer;
+
+struct FlightRecorder {
+    char path[MAX_PATH_LENGTH];
+    CaptureFileFormat format;
+    char interface_names[MAX_INTERFACES][MAX_NAME_LENGTH];
+    UINT num_interfaces;
+
+    /**
+     * Size of each buffer, and how long frames are kept for in nanoseconds
+     * (zero for as long as there is room for them).
+     */
+    size_t size;
+    uint64_t window;
+
+    RecorderBuffer buffers[2];
+
+    /**
+     * The buffer that frames are recorded into. Only the capturing thread uses
+     * it, and the other buffer is only ever touched by the capturing thread
+     * while no snapshot is being written.
+     */
+    RecorderBuffer* current;
+
+    /**
+     * Guards everything below, which the capturing thread and the thread that
+     * writes snapshots out share.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+
+    /**
+     * The buffer being written out (NULL if none), and the index of the
+     * snapshot that it is.
+     */
+    RecorderBuffer* dumping;
+    UINT dump_index;
+    bool stopping;
+
+    /**
+     * Number of snapshots taken, skipped because another one was still being
+     * written, and frames too large to ever be held.
+     */
+    UINT snapshots;
+    ULONG skipped;
+    ULONG oversized;
+};
+
+static void* dumpLoop(void* arg);
+static void writeSnapshot(FlightRecorder* o, RecorderBuffer* buffer, UINT index);
+static RecorderRecord* oldestRecord(FlightRecorder* o, RecorderBuffer* buffer);
+static void dropOldest(FlightRecorder* o, RecorderBuffer* buffer);
+static size_t recordSize(UINT caplen);
+
+/**
+ * Allocates a new FlightRecorder that keeps (at most) the provided number of
+ * bytes of frames, and those of no more than the provided number of seconds
+ * (unless zero), and writes snapshots of them to capture files of the provided
+ * format at the provided path. Snapshots after the first have their index
+ * appended to the path.
+ */
+FlightRecorder* FlightRecorder_new(const char* path, CaptureFileFormat format, size_t size, UINT seconds) {
+    FlightRecorder* o = (FlightRecorder*) calloc(1, sizeof(FlightRecorder));
+    UINT i;
+
+    if (o == NULL) {
+        fatal("Failed to allocate the flight recorder.");
+    }
+
+    strncpy(o->path, path, MAX_PATH_LENGTH - 1);
+    o->format = format;
+    o->size = size & ~((size_t) RECORD_ALIGNMENT - 1);
+    o->window = (uint64_t) seconds * NANOS_PER_SECOND;
+
+    // NOTE ~> The second buffer only takes up memory once it is first recorded
+    //  into, after the first snapshot.
+    for (i = 0; i < 2; i++) {
+        if ((o->buffers[i].data = (OCTET*) LargeBuffer_alloc(o->size, ANY_NODE)) == NULL) {
+            fatal("Failed to allocate the flight recorder's %lu byte buffers.", (ULONG) o->size);
+        }
+    }
+
+    o->current = &o->buffers[0];
+
+    pthread_mutex_init(&o->lock, NULL);
+    pthread_cond_init(&o->changed, NULL);
+
+    if (Signals_createThread(&o->thread, dumpLoop, o) != 0) {
+        fatal("Failed to start the flight recorder thread.");
+    }
+
+    return o;
+}
+
+/**
+ * Describes the interface that frames with the next index (counting from zero)
+ * come from in every snapshot, just like CaptureWriter_addInterface(...).
+ */
+void FlightRecorder_addInterface(FlightRecorder* o, const char* name) {
+    if (o->num_interfaces == MAX_INTERFACES) {
+        fatal("No more than %u interfaces can be described in a capture file.", MAX_INTERFACES);
+    }
+
+    strncpy(o->interface_names[o->num_interfaces++], name, MAX_NAME_LENGTH - 1);
+}
+
+/**
+ * Copies the provided frame into the current buffer of the provided
+ * FlightRecorder, dropping as many of the oldest frames as it takes to make
+ * room for it, along with those that have grown too old. Only the capturing
+ * thread may call this.
+ */
+void FlightRecorder_record(FlightRecorder* o, const CapturedFrame* frame) {
+    RecorderBuffer* buffer = o->current;
+    uint64_t timestamp = ((uint64_t) frame->timestamp.tv_sec * NANOS_PER_SECOND) + frame->timestamp.tv_nsec;
+    size_t size = recordSize(frame->caplen);
+    size_t skipped;
+    RecorderRecord* record;
+
+    if (size > o->size) {
+        o->oversized++;
+        return;
+    }
+
+    if (o->window > 0) {
+        while (buffer->frames > 0 && oldestRecord(o, buffer)->timestamp + o->window < timestamp) {
+            dropOldest(o, buffer);
+        }
+    }
+
+    // NOTE ~> Records never wrap around the end of the buffer. If one doesn't
+    //  fit before the end, whatever is left there is skipped.
+    while (true) {
+        skipped = (buffer->write + size > o->size) ? o->size - buffer->write : 0;
+
+        if (buffer->used + skipped + size <= o->size) {
+            break;
+        }
+
+        dropOldest(o, buffer);
+    }
+
+    if (skipped > 0) {
+        ((RecorderRecord*) (buffer->data + buffer->write))->caplen = RECORD_WRAP;
+        buffer->used += skipped;
+        buffer->write = 0;
+    }
+
+    record = (RecorderRecord*) (buffer->data + buffer->write);
+    record->caplen = frame->caplen;
+    record->wirelen = frame->wirelen;
+    record->timestamp = timestamp;
+    record->interface = frame->interface;
+    memcpy(record->data, frame->data, frame->caplen);
+
+    buffer->write = (buffer->write + size == o->size) ? 0 : buffer->write + size;
+    buffer->used += size;
+    buffer->frames++;
+}
+
+/**
+ * Hands the frames recorded so far by the provided FlightRecorder over to be
+ * written out as a snapshot, logging the provided reason for it, and carries
+ * on recording into its other buffer. Returns false (and does nothing) if the
+ * previous snapshot is still being written, or if there is nothing to write.
+ * Only the capturing thread may call this.
+ */
+bool FlightRecorder_snapshot(FlightRecorder* o, const char* reason) {
+    RecorderBuffer* full = o->current;
+    UINT index;
+
+    pthread_mutex_lock(&o->lock);
+
+    if (o->dumping != NULL || full->frames == 0) {
+        if (o->dumping != NULL) {
+            o->skipped++;
+        }
+
+        pthread_mutex_unlock(&o->lock);
+        return false;
+    }
+
+    index = o->snapshots++;
+    o->dumping = full;
+    o->dump_index = index;
+    o->current = (full == &o->buffers[0]) ? &o->buffers[1] : &o->buffers[0];
+
+    pthread_cond_signal(&o->changed);
+    pthread_mutex_unlock(&o->lock);
+
+    info("Taking snapshot %u of the flight recorder (%s): %lu frames.", index, reason, full->frames);
+
+    return true;
+}
+
+/**
+ * Waits for the snapshot being written (if any) to finish, logs what the
+ * provided FlightRecorder did and frees it. Frames recorded since the last
+ * snapshot are not written out.
+ */
+void FlightRecorder_free(FlightRecorder* o) {
+    UINT i;
+
+    pthread_mutex_lock(&o->lock);
+    o->stopping = true;
+    pthread_cond_signal(&o->changed);
+    pthread_mutex_unlock(&o->lock);
+
+    pthread_join(o->thread, NULL);
+
+    info("Took %u snapshot(s) with the flight recorder, skipped %lu while one was being written.", o->snapshots,
+            o->skipped);
+
+    if (o->oversized > 0) {
+        warn("The flight recorder could not hold %lu frame(s) larger than its buffers.", o->oversized);
+    }
+
+    pthread_mutex_destroy(&o->lock);
+    pthread_cond_destroy(&o->changed);
+
+    for (i = 0; i < 2; i++) {
+        LargeBuffer_free(o->buffers[i].data, o->size);
+    }
+
+    free(o);
+}
+
+/**
+ * Body of the flight recorder thread. Writes out each buffer handed over as a
+ * snapshot and empties it for the capturing thread to record into again, until
+ * the recorder is stopped.
+ */
+static void* dumpLoop(void* arg) {
+    FlightRecorder* o = (FlightRecorder*) arg;
+    RecorderBuffer* buffer;
+    UINT index;
+
+    pthread_mutex_lock(&o->lock);
+
+    while (true) {
+        while (o->dumping == NULL && !o->stopping) {
+            pthread_cond_wait(&o->changed, &o->lock);
+        }
+
+        if (o->dumping == NULL) {
+            break;
+        }
+
+        buffer = o->dumping;
+        index = o->dump_index;
+        pthread_mutex_unlock(&o->lock);
+
+        writeSnapshot(o, buffer, index);
+        buffer->used = buffer->read = buffer->write = 0;
+        buffer->frames = 0;
+
+        pthread_mutex_lock(&o->lock);
+        o->dumping = NULL;
+    }
+
+    pthread_mutex_unlock(&o->lock);
+
+    return NULL;
+}
+
+/**
+ * Writes every frame in the provided buffer, oldest first, to the capture file
+ * of the snapshot with the provided index.
+ */
+static void writeSnapshot(FlightRecorder* o, RecorderBuffer* buffer, UINT index) {
+    static const CaptureWriterLimits limits = { 0, 0, 0, 0, false };
+    char path[MAX_PATH_LENGTH];
+    CaptureWriter* writer;
+    CapturedFrame frame;
+    RecorderRecord* record;
+    size_t read = buffer->read;
+    ULONG i;
+
+    if (index > 0) {
+        if (snprintf(path, sizeof(path), "%s%u", o->path, index) >= (int) sizeof(path)) {
+            warn("Skipped snapshot %u, as its file name would be too long.", index);
+
+            return;
+        }
+    } else {
+        strncpy(path, o->path, sizeof(path) - 1);
+        path[sizeof(path) - 1] = '\0';
+    }
+
+    writer = CaptureWriter_open(path, o->format, &limits);
+
+    for (i = 0; i < o->num_interfaces; i++) {
+        CaptureWriter_addInterface(writer, o->interface_names[i]);
+    }
+
+    for (i = 0; i < buffer->frames; i++) {
+        record = (RecorderRecord*) (buffer->data + read);
+
+        if (record->caplen == RECORD_WRAP) {
+            read = 0;
+            record = (RecorderRecord*) buffer->data;
+        }
+
+        frame.timestamp.tv_sec = (time_t) (record->timestamp / NANOS_PER_SECOND);
+        frame.timestamp.tv_nsec = (long) (record->timestamp % NANOS_PER_SECOND);
+        frame.caplen = record->caplen;
+        frame.wirelen = record->wirelen;
+        frame.data = record->data;
+        frame.interface = record->interface;
+        CaptureWriter_write(writer, &frame);
+
+        read += recordSize(record->caplen);
+        read = (read == o->size) ? 0 : read;
+    }
+
+    CaptureWriter_close(writer);
+}
+
+/**
+ * Returns the oldest record in the provided buffer (which there must be),
+ * skipping over the end of the buffer if that's where it is.
+ */
+static RecorderRecord* oldestRecord(FlightRecorder* o, RecorderBuffer* buffer) {
+    RecorderRecord* record = (RecorderRecord*) (buffer->data + buffer->read);
+
+    if (record->caplen == RECORD_WRAP) {
+        buffer->used -= o->size - buffer->read;
+        buffer->read = 0;
+        record = (RecorderRecord*) buffer->data;
+    }
+
+    return record;
+}
+
+/**
+ * Drops the oldest record in the provided buffer, or empties it outright if
+ * there are no records left in it (only skipped space).
+ */
+static void dropOldest(FlightRecorder* o, RecorderBuffer* buffer) {
+    size_t size;
+
+    if (buffer->frames == 0) {
+        buffer->used = buffer->read = buffer->write = 0;
+        return;
+    }
+
+    size = recordSize(oldestRecord(o, buffer)->caplen);
+    buffer->read = (buffer->read + size == o->size) ? 0 : buffer->read + size;
+    buffer->used -= size;
+    buffer->frames--;
+}
+
+/**
+ * Returns the number of octets that a record of a frame with the provided
+ * number of captured octets takes up.
+ */
+static size_t recordSize(UINT caplen) {
+    return (sizeof(RecorderRecord) + caplen + RECORD_ALIGNMENT - 1) & ~((size_t) RECORD_ALIGNMENT - 1);
+}
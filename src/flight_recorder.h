@@ -0,0 +1,27 @@
+#ifndef _FLIGHT_RECORDER_H_
+#define _FLIGHT_RECORDER_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include "capture_writer.h"
+#include <stddef.h>
+
+// NOTE ~> A flight recorder keeps the most recent frames in memory, and only
+//  writes them out to a capture file when something asks for it (a snapshot).
+//  Frames are copied into a circular buffer of a fixed size, and the oldest
+//  ones are dropped to make room (or once they are older than the recorder's
+//  duration, if it has one), so recording a frame costs a memcpy(...) and no
+//  I/O. There are two such buffers: a snapshot swaps them over and hands the
+//  full one to a background thread to be written out, so capture carries on
+//  into the other one in the meantime without waiting on the disk. A snapshot
+//  asked for while the previous one is still being written is skipped.
+
+typedef struct FlightRecorder FlightRecorder;
+
+FlightRecorder* FlightRecorder_new(const char* path, CaptureFileFormat format, size_t size, UINT seconds);
+void FlightRecorder_addInterface(FlightRecorder* o, const char* name);
+void FlightRecorder_record(FlightRecorder* o, const CapturedFrame* frame);
+bool FlightRecorder_snapshot(FlightRecorder* o, const char* reason);
+void FlightRecorder_free(FlightRecorder* o);
+
+#endif
@@ -0,0 +1,574 @@
+#include "flow_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "ethernet_frame.h"
+#include "large_buffer.h"
+#include "logger.h"
+
+#define CACHE_LINE_SIZE         64
+#define NO_ENTRY                0xffffffff
+#define MAX_EXPIRIES_PER_UPDATE 2
+#define NANOSECONDS_PER_SECOND  1000000000ULL
+
+#define TCP_FIN                 0x01
+#define TCP_SYN                 0x02
+#define TCP_RST                 0x04
+
+/**
+ * Which list a flow entry is on.
+ */
+typedef enum EntryList {
+    EL_FREE,
+    EL_ACTIVE,
+    EL_CLOSED
+} EntryList;
+
+/**
+ * The part of a flow that finding it touches: its key, plus the table's
+ * bookkeeping for it. Each entry takes up exactly one cache line, and the flow
+ * itself (counters and all) is kept at the same index of a separate array, so
+ * that probing never has to pull it in.
+ */
+typedef struct FlowEntry {
+    FlowKey key;
+    uint32_t hash;
+
+    /**
+     * Position of the entry's slot in the index.
+     */
+    uint32_t slot;
+
+    /**
+     * Neighbours on the entry's list (least recently seen first).
+     */
+    uint32_t prev;
+    uint32_t next;
+    uint8_t list;
+} __attribute__((aligned(CACHE_LINE_SIZE))) FlowEntry;
+
+/**
+ * A slot of the index. Eight of them fit in a cache line, so probing rarely
+ * touches more than one line, and the (full) hash is checked before the entry
+ * itself is ever looked at.
+ */
+typedef struct FlowSlot {
+    uint32_t hash;
+
+    /**
+     * Index of the entry plus one (zero marks an empty slot).
+     */
+    uint32_t entry;
+} FlowSlot;
+
+/**
+ * A doubly-linked list of entries, threaded through the entries themselves.
+ */
+typedef struct EntryListHead {
+    uint32_t head;
+    uint32_t tail;
+} EntryListHead;
+
+struct FlowTable {
+    FlowEntry* entries;
+    Flow* flows;
+    UINT max_flows;
+    UINT num_flows;
+    UINT peak_flows;
+
+    FlowSlot* slots;
+    uint32_t slot_mask;
+
+    /**
+     * Entries not in use, flows that are still open, and flows that have been
+     * closed (each ordered from least to most recently seen).
+     */
+    EntryListHead free_entries;
+    EntryListHead active;
+    EntryListHead closed;
+
+    uint64_t idle_timeout;
+    uint64_t closed_timeout;
+
+    FlowExportCallback export;
+    void* context;
+};
+
+static FlowEntry* lookup(FlowTable* o, uint32_t hash, const FlowKey* key);
+static FlowEntry* insert(FlowTable* o, uint32_t hash, const FlowKey* key);
+static void expire(FlowTable* o, uint64_t now);
+static void removeFlow(FlowTable* o, FlowEntry* entry, FlowExpiryReason reason);
+static EntryListHead* getList(FlowTable* o, uint8_t list);
+static void pushEntry(FlowTable* o, FlowEntry* entry, uint8_t list);
+static void unlinkEntry(FlowTable* o, FlowEntry* entry);
+static void appendEndpoint(TextBuffer* buff, const Flow* flow, UINT endpoint);
+static void appendDirection(TextBuffer* buff, const Flow* flow, UINT direction);
+
+/**
+ * Allocates a new, empty FlowTable with room for the provided number of flows.
+ * Flows expire after the provided number of seconds without a frame (or the
+ * closed timeout, once they have been closed), at which point they are handed
+ * to the provided callback (along with the provided context).
+ */
+FlowTable* FlowTable_new(UINT max_flows, UINT idle_timeout, UINT closed_timeout, FlowExportCallback export,
+        void* context) {
+    FlowTable* o = (FlowTable*) calloc(1, sizeof(FlowTable));
+    size_t num_slots = 1;
+    UINT i;
+
+    if (o == NULL || max_flows == 0 || max_flows >= NO_ENTRY / 2) {
+        fatal("Failed to allocate a flow table for %u flows.", max_flows);
+    }
+
+    // NOTE ~> The index is kept at most half full so that probe sequences stay
+    //  short.
+    while (num_slots < (size_t) max_flows * 2) {
+        num_slots <<= 1;
+    }
+
+    if ((o->entries = (FlowEntry*) LargeBuffer_alloc(sizeof(FlowEntry) * max_flows, ANY_NODE)) == NULL ||
+            (o->flows = (Flow*) LargeBuffer_alloc(sizeof(Flow) * max_flows, ANY_NODE)) == NULL ||
+            (o->slots = (FlowSlot*) LargeBuffer_alloc(sizeof(FlowSlot) * num_slots, ANY_NODE)) == NULL) {
+        fatal("Failed to allocate a flow table for %u flows.", max_flows);
+    }
+
+    o->max_flows = max_flows;
+    o->slot_mask = num_slots - 1;
+    o->free_entries.head = o->free_entries.tail = NO_ENTRY;
+    o->active.head = o->active.tail = NO_ENTRY;
+    o->closed.head = o->closed.tail = NO_ENTRY;
+    o->idle_timeout = idle_timeout * NANOSECONDS_PER_SECOND;
+    o->closed_timeout = closed_timeout * NANOSECONDS_PER_SECOND;
+    o->export = export;
+    o->context = context;
+
+    for (i = 0; i < max_flows; i++) {
+        pushEntry(o, &o->entries[i], EL_FREE);
+    }
+
+    info("Allocated a flow table for %u flows (%lu bytes).", max_flows,
+            (ULONG) ((sizeof(FlowEntry) + sizeof(Flow)) * max_flows + sizeof(FlowSlot) * num_slots));
+
+    return o;
+}
+
+/**
+ * Accounts for the provided (already decoded) frame in the flow that it belongs
+ * to, creating the flow if it is new, and expires flows that have gone quiet
+ * as of the frame's timestamp. Frames that aren't IP are ignored, and so are
+ * TCP and UDP frames that don't carry the ports (fragments that haven't been
+ * reassembled, or frames cut short before the transport header), as there is
+ * no telling which flow they belong to.
+ */
+void FlowTable_update(FlowTable* o, const FrameDescriptor* frame, const struct timespec* timestamp, UINT wirelen) {
+    uint64_t now = (uint64_t) timestamp->tv_sec * NANOSECONDS_PER_SECOND + timestamp->tv_nsec;
+    FlowEntry* entry;
+    Flow* flow;
+    FlowKey key;
+    uint32_t hash;
+    UINT direction;
+
+    expire(o, now);
+
+    if (!(frame->layers & FL_NETWORK)) {
+        return;
+    }
+
+    if (!(frame->layers & FL_TRANSPORT) && (frame->ip_protocol == IP_TCP || frame->ip_protocol == IP_UDP)) {
+        return;
+    }
+
+    FlowKey_build(frame, &key, &direction);
+    hash = FlowKey_hash(&key);
+
+    if ((entry = lookup(o, hash, &key)) == NULL) {
+        entry = insert(o, hash, &key);
+        flow = &o->flows[entry - o->entries];
+        flow->first_seen = now;
+        flow->initiator = direction;
+    } else {
+        flow = &o->flows[entry - o->entries];
+    }
+
+    flow->packets[direction]++;
+    flow->octets[direction] += wirelen;
+    flow->last_seen = now;
+
+    // A flow that is closed in both directions (or reset) only lingers for the
+    //  closed timeout
+    if (frame->ip_protocol == IP_TCP && (frame->layers & FL_TRANSPORT)) {
+        flow->tcp_flags[direction] |= frame->tcp_flags;
+
+        if ((flow->tcp_flags[0] & flow->tcp_flags[1] & TCP_FIN) ||
+                ((flow->tcp_flags[0] | flow->tcp_flags[1]) & TCP_RST)) {
+            unlinkEntry(o, entry);
+            pushEntry(o, entry, EL_CLOSED);
+
+            return;
+        }
+    }
+
+    // Keep the list ordered by when each flow was last seen
+    unlinkEntry(o, entry);
+    pushEntry(o, entry, entry->list);
+}
+
+/**
+ * Hands every flow in the provided FlowTable to the export callback and
+ * empties the table.
+ */
+void FlowTable_flush(FlowTable* o) {
+    while (o->closed.head != NO_ENTRY) {
+        removeFlow(o, &o->entries[o->closed.head], FE_FLUSHED);
+    }
+
+    while (o->active.head != NO_ENTRY) {
+        removeFlow(o, &o->entries[o->active.head], FE_FLUSHED);
+    }
+}
+
+/**
+ * Returns the number of flows currently in the provided FlowTable.
+ */
+UINT FlowTable_getSize(const FlowTable* o) {
+    return o->num_flows;
+}
+
+/**
+ * Returns the context that the provided FlowTable hands to its export callback.
+ */
+void* FlowTable_getContext(const FlowTable* o) {
+    return o->context;
+}
+
+/**
+ * Logs how full the provided FlowTable ever got and frees it (without
+ * exporting the flows left in it).
+ */
+void FlowTable_free(FlowTable* o) {
+    info("Tracked at most %u of %u flows at once.", o->peak_flows, o->max_flows);
+
+    LargeBuffer_free(o->entries, sizeof(FlowEntry) * o->max_flows);
+    LargeBuffer_free(o->flows, sizeof(Flow) * o->max_flows);
+    LargeBuffer_free(o->slots, sizeof(FlowSlot) * (o->slot_mask + 1));
+    free(o);
+}
+
+/**
+ * Appends a one line summary of the provided flow, which left its table for the
+ * provided reason, to the provided TextBuffer. The endpoint that started the
+ * flow is shown first.
+ */
+void Flow_format(const Flow* flow, FlowExpiryReason reason, TextBuffer* buff) {
+    static const char* reasons[] = { "idle", "closed", "evicted", "flushed" };
+    UINT first = flow->initiator;
+    char protocol[16] = { 0 };
+    uint64_t duration = flow->last_seen - flow->first_seen;
+
+    IpProtocol_toString(flow->key.protocol, protocol, sizeof(protocol));
+
+    TextBuffer_appendString(buff, "[FLOW]\t");
+    TextBuffer_appendString(buff, LC_GREEN);
+    TextBuffer_appendString(buff, protocol);
+    TextBuffer_appendString(buff, "\t");
+    appendEndpoint(buff, flow, first);
+    TextBuffer_appendString(buff, " <-> ");
+    appendEndpoint(buff, flow, 1 - first);
+
+    if (flow->key.vlan != 0) {
+        TextBuffer_appendString(buff, " VLAN ");
+        TextBuffer_appendUnsigned(buff, flow->key.vlan);
+    }
+
+    TextBuffer_appendString(buff, LC_RESET);
+    TextBuffer_appendString(buff, "\t> ");
+    appendDirection(buff, flow, first);
+    TextBuffer_appendString(buff, "\t< ");
+    appendDirection(buff, flow, 1 - first);
+    TextBuffer_appendFormat(buff, "\t%lu.%03lu s\t(%s)\n", (ULONG) (duration / NANOSECONDS_PER_SECOND),
+            (ULONG) ((duration % NANOSECONDS_PER_SECOND) / 1000000), reasons[reason]);
+}
+
+/**
+ * Writes out a one line summary of the provided flow (see Flow_format(...)).
+ * Fits the FlowExportCallback signature, with the TextBuffer that the line is
+ * put together in (which can't be shared between threads) as its context.
+ */
+void Flow_output(const Flow* flow, FlowExpiryReason reason, void* context) {
+    TextBuffer* buff = (TextBuffer*) context;
+
+    Flow_format(flow, reason, buff);
+    TextBuffer_flush(buff, stdout);
+}
+
+/**
+ * Builds the key of the flow that the provided (IP) frame belongs to, and works
+ * out which direction of the flow the frame is going in.
+ */
+void FlowKey_build(const FrameDescriptor* frame, FlowKey* key, UINT* direction) {
+    size_t size = (frame->ethernet_type == ET_IPV4) ? 4 : 16;
+    const OCTET* src = FrameDescriptor_getSourceAddress(frame);
+    const OCTET* dst = FrameDescriptor_getDestinationAddress(frame);
+    uint16_t src_port = 0, dst_port = 0;
+    int order;
+
+    memset(key, 0x00, sizeof(FlowKey));
+
+    if ((frame->layers & FL_TRANSPORT) && (frame->ip_protocol == IP_TCP || frame->ip_protocol == IP_UDP)) {
+        src_port = frame->src_port;
+        dst_port = frame->dst_port;
+    }
+
+    if ((order = memcmp(src, dst, size)) == 0) {
+        order = (int) src_port - (int) dst_port;
+    }
+
+    *direction = (order <= 0) ? 0 : 1;
+
+    memcpy(key->addresses[*direction], src, size);
+    memcpy(key->addresses[1 - *direction], dst, size);
+    key->ports[*direction] = src_port;
+    key->ports[1 - *direction] = dst_port;
+    key->vlan = (frame->num_vlan_tags > 0) ? (frame->vlan_tags[0].tci & 0x0fff) : 0;
+    key->protocol = frame->ip_protocol;
+    key->ip_version = (size == 4) ? 4 : 6;
+}
+
+/**
+ * Hashes the provided FlowKey, eight octets at a time.
+ */
+uint32_t FlowKey_hash(const FlowKey* key) {
+    const OCTET* ptr = (const OCTET*) key;
+    uint64_t hash = 0x9e3779b97f4a7c15ULL, word;
+    size_t i;
+
+    for (i = 0; i + sizeof(word) <= sizeof(FlowKey); i += sizeof(word)) {
+        memcpy(&word, ptr + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+
+    return (uint32_t) hash;
+}
+
+/**
+ * Finds the entry of the flow with the provided key (and hash), or returns
+ * NULL if the flow isn't in the table.
+ */
+static FlowEntry* lookup(FlowTable* o, uint32_t hash, const FlowKey* key) {
+    uint32_t i = hash & o->slot_mask;
+
+    while (o->slots[i].entry != 0) {
+        if (o->slots[i].hash == hash) {
+            FlowEntry* entry = &o->entries[o->slots[i].entry - 1];
+
+            if (memcmp(&entry->key, key, sizeof(FlowKey)) == 0) {
+                return entry;
+            }
+        }
+
+        i = (i + 1) & o->slot_mask;
+    }
+
+    return NULL;
+}
+
+/**
+ * Adds a new, empty flow with the provided key (and hash) to the table and
+ * returns its entry. If the table is full, the least recently seen flow
+ * (preferring those that have been closed) is evicted to make room.
+ */
+static FlowEntry* insert(FlowTable* o, uint32_t hash, const FlowKey* key) {
+    FlowEntry* entry;
+    Flow* flow;
+    uint32_t i;
+
+    if (o->free_entries.head == NO_ENTRY) {
+        removeFlow(o, &o->entries[(o->closed.head != NO_ENTRY) ? o->closed.head : o->active.head], FE_EVICTED);
+    }
+
+    entry = &o->entries[o->free_entries.head];
+    unlinkEntry(o, entry);
+
+    flow = &o->flows[entry - o->entries];
+    memset(flow, 0x00, sizeof(Flow));
+    flow->key = *key;
+    entry->key = *key;
+    entry->hash = hash;
+
+    for (i = hash & o->slot_mask; o->slots[i].entry != 0; i = (i + 1) & o->slot_mask) {
+    }
+
+    o->slots[i].hash = hash;
+    o->slots[i].entry = (uint32_t) (entry - o->entries) + 1;
+    entry->slot = i;
+
+    pushEntry(o, entry, EL_ACTIVE);
+
+    if (++o->num_flows > o->peak_flows) {
+        o->peak_flows = o->num_flows;
+    }
+
+    return entry;
+}
+
+/**
+ * Exports and removes the least recently seen flows if they have gone quiet for
+ * long enough as of the provided time, doing no more than a fixed amount of
+ * work.
+ */
+static void expire(FlowTable* o, uint64_t now) {
+    FlowEntry* entry;
+    int i;
+
+    for (i = 0; i < MAX_EXPIRIES_PER_UPDATE && o->closed.head != NO_ENTRY; i++) {
+        entry = &o->entries[o->closed.head];
+
+        if (now < o->flows[o->closed.head].last_seen + o->closed_timeout) {
+            break;
+        }
+
+        removeFlow(o, entry, FE_CLOSED);
+    }
+
+    for (i = 0; i < MAX_EXPIRIES_PER_UPDATE && o->active.head != NO_ENTRY; i++) {
+        entry = &o->entries[o->active.head];
+
+        if (now < o->flows[o->active.head].last_seen + o->idle_timeout) {
+            break;
+        }
+
+        removeFlow(o, entry, FE_IDLE);
+    }
+}
+
+/**
+ * Exports the flow in the provided entry for the provided reason and then
+ * removes it from the table.
+ *
+ * NOTE ~> Rather than leaving a tombstone behind, the slots after the flow's
+ *  slot are shifted back over it until one is found that is either empty or
+ *  already where it belongs, which keeps every probe sequence intact.
+ */
+static void removeFlow(FlowTable* o, FlowEntry* entry, FlowExpiryReason reason) {
+    uint32_t hole = entry->slot, i, home;
+
+    if (o->export != NULL) {
+        o->export(&o->flows[entry - o->entries], reason, o->context);
+    }
+
+    for (i = (hole + 1) & o->slot_mask; o->slots[i].entry != 0; i = (i + 1) & o->slot_mask) {
+        home = o->slots[i].hash & o->slot_mask;
+
+        // Only move a slot back if the hole lies between its home and itself
+        if (((i - home) & o->slot_mask) >= ((i - hole) & o->slot_mask)) {
+            o->slots[hole] = o->slots[i];
+            o->entries[o->slots[hole].entry - 1].slot = hole;
+            hole = i;
+        }
+    }
+
+    o->slots[hole].entry = 0;
+
+    unlinkEntry(o, entry);
+    pushEntry(o, entry, EL_FREE);
+    o->num_flows--;
+}
+
+/**
+ * Returns the head of the provided list.
+ */
+static EntryListHead* getList(FlowTable* o, uint8_t list) {
+    switch (list) {
+        case EL_ACTIVE:
+            return &o->active;
+
+        case EL_CLOSED:
+            return &o->closed;
+
+        default:
+            return &o->free_entries;
+    }
+}
+
+/**
+ * Appends the provided entry to the end of the provided list.
+ */
+static void pushEntry(FlowTable* o, FlowEntry* entry, uint8_t list) {
+    EntryListHead* head = getList(o, list);
+    uint32_t index = (uint32_t) (entry - o->entries);
+
+    entry->list = list;
+    entry->prev = head->tail;
+    entry->next = NO_ENTRY;
+
+    if (head->tail != NO_ENTRY) {
+        o->entries[head->tail].next = index;
+    } else {
+        head->head = index;
+    }
+
+    head->tail = index;
+}
+
+/**
+ * Takes the provided entry off of whichever list it is on.
+ */
+static void unlinkEntry(FlowTable* o, FlowEntry* entry) {
+    EntryListHead* head = getList(o, entry->list);
+
+    if (entry->prev != NO_ENTRY) {
+        o->entries[entry->prev].next = entry->next;
+    } else {
+        head->head = entry->next;
+    }
+
+    if (entry->next != NO_ENTRY) {
+        o->entries[entry->next].prev = entry->prev;
+    } else {
+        head->tail = entry->prev;
+    }
+}
+
+/**
+ * Appends the address (and port, if there is one) of the provided endpoint of
+ * the provided flow to the provided TextBuffer.
+ */
+static void appendEndpoint(TextBuffer* buff, const Flow* flow, UINT endpoint) {
+    int family = (flow->key.ip_version == 4) ? AF_INET : AF_INET6;
+
+    TextBuffer_appendAddress(buff, family, flow->key.addresses[endpoint]);
+
+    if (flow->key.protocol == IP_TCP || flow->key.protocol == IP_UDP) {
+        TextBuffer_appendString(buff, (family == AF_INET) ? ":" : ".");
+        TextBuffer_appendUnsigned(buff, flow->key.ports[endpoint]);
+    }
+}
+
+/**
+ * Appends the counters (and, for TCP, the flags) of the provided direction of
+ * the provided flow to the provided TextBuffer.
+ */
+static void appendDirection(TextBuffer* buff, const Flow* flow, UINT direction) {
+    static const char flagNames[] = "FSRPAUEC";
+    UINT i;
+
+    TextBuffer_appendUnsigned(buff, flow->packets[direction]);
+    TextBuffer_appendString(buff, " frames ");
+    TextBuffer_appendUnsigned(buff, flow->octets[direction]);
+    TextBuffer_appendString(buff, " bytes");
+
+    if (flow->key.protocol == IP_TCP && flow->tcp_flags[direction] != 0) {
+        TextBuffer_appendString(buff, " [");
+
+        for (i = 0; i < 8; i++) {
+            if (flow->tcp_flags[direction] & (1 << i)) {
+                TextBuffer_append(buff, &flagNames[i], 1);
+            }
+        }
+
+        TextBuffer_appendString(buff, "]");
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef _FLOW_TABLE_H_
+#define _FLOW_TABLE_H_
+
+#include "common.h"
+#include "frame_descriptor.h"
+#include "text_buffer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// NOTE ~> A flow table keeps track of the conversations seen on the link. A
+//  flow is identified by its VLAN, IP protocol, and the addresses and ports of
+//  its two endpoints, in either direction. Every flow lives in one of a fixed
+//  number of preallocated entries, so the table never allocates once created,
+//  and is found through an open-addressing (linear probing) index of compact
+//  slots. Flows age out based on the timestamps of captured frames: each update
+//  expires at most a couple of the least recently seen flows, so the cost of
+//  every frame stays constant. A flow that expires, or that has to make room
+//  for a new one when the table is full, is handed to the table's export
+//  callback.
+
+/**
+ * Why a flow was handed to the export callback.
+ */
+typedef enum FlowExpiryReason {
+    /**
+     * Nothing was seen of it for the idle timeout.
+     */
+    FE_IDLE,
+
+    /**
+     * It was closed (TCP FIN in both directions, or RST) and nothing more was
+     * seen of it for the closed timeout.
+     */
+    FE_CLOSED,
+
+    /**
+     * Its entry was needed for a new flow.
+     */
+    FE_EVICTED,
+
+    /**
+     * The table was flushed (e.g. at shutdown).
+     */
+    FE_FLUSHED
+} FlowExpiryReason;
+
+/**
+ * Identifies a flow. The endpoint that sorts lower always comes first, so both
+ * directions of a flow have the same key. IPv4 addresses only use the first
+ * four octets of their address.
+ */
+typedef struct FlowKey {
+    OCTET addresses[2][16];
+    uint16_t ports[2];
+    uint16_t vlan;
+    uint8_t protocol;
+    uint8_t ip_version;
+} FlowKey;
+
+/**
+ * A single flow and its counters. Direction 0 is from the first endpoint of
+ * the key to the second, and direction 1 the other way around.
+ */
+typedef struct Flow {
+    FlowKey key;
+
+    uint64_t packets[2];
+    uint64_t octets[2];
+
+    /**
+     * Capture timestamps (in nanoseconds) of the first and last frames.
+     */
+    uint64_t first_seen;
+    uint64_t last_seen;
+
+    /**
+     * Every TCP flag seen in each direction, ORed together.
+     */
+    uint8_t tcp_flags[2];
+
+    /**
+     * The endpoint that sent the first frame (usually the client).
+     */
+    uint8_t initiator;
+} Flow;
+
+typedef struct FlowTable FlowTable;
+
+/**
+ * Called with each flow that leaves the table. The flow is only valid for the
+ * duration of the call.
+ */
+typedef void (*FlowExportCallback)(const Flow* flow, FlowExpiryReason reason, void* context);
+
+FlowTable* FlowTable_new(UINT max_flows, UINT idle_timeout, UINT closed_timeout, FlowExportCallback export,
+        void* context);
+void FlowTable_update(FlowTable* o, const FrameDescriptor* frame, const struct timespec* timestamp, UINT wirelen);
+void FlowTable_flush(FlowTable* o);
+UINT FlowTable_getSize(const FlowTable* o);
+void* FlowTable_getContext(const FlowTable* o);
+void FlowTable_free(FlowTable* o);
+void FlowKey_build(const FrameDescriptor* frame, FlowKey* key, UINT* direction);
+uint32_t FlowKey_hash(const FlowKey* key);
+void Flow_format(const Flow* flow, FlowExpiryReason reason, TextBuffer* buff);
+void Flow_output(const Flow* flow, FlowExpiryReason reason, void* context);
+
+#endif
@@ -0,0 +1,383 @@
+#include "frame_descriptor.h"
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "ethernet_frame.h"
+
+#define MAC_ADDRESSES_SIZE          12
+#define ETHER_TYPE_SIZE             2
+#define VLAN_TAG_SIZE               4
+
+#define IPV4_MIN_HEADER_SIZE        20
+#define IPV4_SRC_OFFSET             12
+#define IPV4_DST_OFFSET             16
+#define IPV4_FRAGMENT_OFFSET_MASK   0x1fff
+#define IPV4_MORE_FRAGMENTS         0x2000
+
+#define IPV6_HEADER_SIZE            40
+#define IPV6_SRC_OFFSET             8
+#define IPV6_DST_OFFSET             24
+#define IPV6_FRAGMENT_HEADER_SIZE   8
+#define IPV6_MAX_EXTENSION_HEADERS  8
+
+#define IPV6_EXT_HOP_BY_HOP         0
+#define IPV6_EXT_ROUTING            43
+#define IPV6_EXT_FRAGMENT           44
+#define IPV6_EXT_AUTHENTICATION     51
+#define IPV6_EXT_DESTINATION        60
+
+#define TCP_MIN_HEADER_SIZE         20
+#define UDP_HEADER_SIZE             8
+#define ICMP_HEADER_SIZE            8
+
+static void decodeNetwork(FrameDescriptor* o);
+static void decodeIpv4(FrameDescriptor* o);
+static void decodeIpv6(FrameDescriptor* o);
+static void decodeTransport(FrameDescriptor* o);
+
+/**
+ * Reads a two octet, network byte order integer.
+ */
+static inline uint16_t readUint16(const OCTET* ptr) {
+    return (uint16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+/**
+ * Walks the provided frame once, filling in the provided FrameDescriptor with
+ * everything that could be decoded from it. Decoding simply stops at the first
+ * layer that is unknown or truncated; it never fails.
+ */
+void FrameDescriptor_decode(FrameDescriptor* o, const OCTET* data, UINT caplen) {
+    UINT offset = MAC_ADDRESSES_SIZE;
+    uint16_t type;
+
+    o->data = data;
+    o->caplen = caplen;
+    o->layers = 0;
+    o->num_vlan_tags = 0;
+    o->ethernet_type = 0;
+    o->network_offset = 0;
+    o->network_header_size = 0;
+    o->datagram_end = caplen;
+    o->ip_protocol = 0;
+    o->transport_offset = 0;
+    o->transport_header_size = 0;
+    o->src_port = 0;
+    o->dst_port = 0;
+    o->tcp_flags = 0;
+    o->tcp_seq = 0;
+    o->payload_offset = caplen;
+    o->interface = 0;
+    o->checksums = 0;
+
+    if (caplen < MAC_ADDRESSES_SIZE + ETHER_TYPE_SIZE) {
+        o->layers = FL_TRUNCATED;
+
+        return;
+    }
+
+    // Peel off every VLAN tag in front of the real "EtherType"
+    type = readUint16(data + offset);
+
+    while (type == ET_VLANTAGGED || type == ET_QINQTAGGED) {
+        if (o->num_vlan_tags == FD_MAX_VLAN_TAGS) {
+            o->layers = FL_LINK;
+            o->payload_offset = offset;
+
+            return;
+        }
+
+        if (offset + VLAN_TAG_SIZE + ETHER_TYPE_SIZE > caplen) {
+            o->layers = FL_LINK | FL_TRUNCATED;
+            o->payload_offset = offset;
+
+            return;
+        }
+
+        o->vlan_tags[o->num_vlan_tags].tpid = type;
+        o->vlan_tags[o->num_vlan_tags].tci = readUint16(data + offset + ETHER_TYPE_SIZE);
+        o->num_vlan_tags++;
+
+        offset += VLAN_TAG_SIZE;
+        type = readUint16(data + offset);
+    }
+
+    o->layers = FL_LINK;
+    o->ethernet_type = type;
+    o->network_offset = offset + ETHER_TYPE_SIZE;
+    o->payload_offset = o->network_offset;
+
+    decodeNetwork(o);
+}
+
+/**
+ * Returns a pointer to the source IP address (4 octets for IPv4, 16 for IPv6)
+ * of the described frame, or NULL if it has none.
+ */
+const OCTET* FrameDescriptor_getSourceAddress(const FrameDescriptor* o) {
+    if (!(o->layers & FL_NETWORK)) {
+        return NULL;
+    }
+
+    return o->data + o->network_offset + ((o->ethernet_type == ET_IPV4) ? IPV4_SRC_OFFSET : IPV6_SRC_OFFSET);
+}
+
+/**
+ * Returns a pointer to the destination IP address (4 octets for IPv4, 16 for
+ * IPv6) of the described frame, or NULL if it has none.
+ */
+const OCTET* FrameDescriptor_getDestinationAddress(const FrameDescriptor* o) {
+    if (!(o->layers & FL_NETWORK)) {
+        return NULL;
+    }
+
+    return o->data + o->network_offset + ((o->ethernet_type == ET_IPV4) ? IPV4_DST_OFFSET : IPV6_DST_OFFSET);
+}
+
+/**
+ * Converts an IP protocol number into a string.
+ */
+void IpProtocol_toString(UINT protocol, char* buff, int buff_size) {
+    switch (protocol) {
+        case IP_ICMP:
+            strncpy(buff, "ICMP", buff_size);
+            break;
+
+        case IP_TCP:
+            strncpy(buff, "TCP", buff_size);
+            break;
+
+        case IP_UDP:
+            strncpy(buff, "UDP", buff_size);
+            break;
+
+        case IP_ICMPV6:
+            strncpy(buff, "ICMPv6", buff_size);
+            break;
+
+        default:
+            snprintf(buff, buff_size, "IP proto %u", protocol);
+            break;
+    }
+}
+
+/**
+ * Decodes the network layer header, if it is one that we understand.
+ */
+static void decodeNetwork(FrameDescriptor* o) {
+    switch (o->ethernet_type) {
+        case ET_IPV4:
+            decodeIpv4(o);
+            break;
+
+        case ET_IPV6:
+            decodeIpv6(o);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Decodes an IPv4 header and, unless the frame is a later fragment of its
+ * datagram, the transport layer header that follows it.
+ */
+static void decodeIpv4(FrameDescriptor* o) {
+    const OCTET* header = o->data + o->network_offset;
+    UINT header_size;
+    uint16_t fragment;
+
+    if (o->network_offset + IPV4_MIN_HEADER_SIZE > o->caplen) {
+        o->layers |= FL_TRUNCATED;
+
+        return;
+    }
+
+    header_size = (header[0] & 0x0f) * 4;
+
+    if ((header[0] >> 4) != 4 || header_size < IPV4_MIN_HEADER_SIZE) {
+        return;
+    }
+
+    if (o->network_offset + header_size > o->caplen) {
+        o->layers |= FL_TRUNCATED;
+
+        return;
+    }
+
+    o->layers |= FL_NETWORK;
+    o->network_header_size = header_size;
+    o->datagram_end = o->network_offset + readUint16(header + 2);
+    o->ip_protocol = header[9];
+    o->payload_offset = o->network_offset + header_size;
+
+    if (o->datagram_end < o->payload_offset) {
+        o->datagram_end = o->payload_offset;
+    }
+
+    fragment = readUint16(header + 6);
+
+    if (fragment & (IPV4_FRAGMENT_OFFSET_MASK | IPV4_MORE_FRAGMENTS)) {
+        o->layers |= FL_FRAGMENT;
+
+        if (fragment & IPV4_FRAGMENT_OFFSET_MASK) {
+            return;
+        }
+    }
+
+    decodeTransport(o);
+}
+
+/**
+ * Decodes an IPv6 header, walks any extension headers that follow it, and then
+ * decodes the transport layer header (unless the frame is a later fragment of
+ * its datagram).
+ */
+static void decodeIpv6(FrameDescriptor* o) {
+    const OCTET* header = o->data + o->network_offset;
+    UINT offset = o->network_offset + IPV6_HEADER_SIZE;
+    uint8_t next_header;
+    bool later_fragment = false;
+    int i;
+
+    if (offset > o->caplen) {
+        o->layers |= FL_TRUNCATED;
+
+        return;
+    }
+
+    if ((header[0] >> 4) != 6) {
+        return;
+    }
+
+    o->layers |= FL_NETWORK;
+    next_header = header[6];
+
+    // NOTE ~> A zero payload length means a jumbogram, whose real length is
+    //  in a hop-by-hop option that we don't go looking for.
+    if (readUint16(header + 4) != 0) {
+        o->datagram_end = offset + readUint16(header + 4);
+    }
+
+    for (i = 0; i < IPV6_MAX_EXTENSION_HEADERS; i++) {
+        const OCTET* extension = o->data + offset;
+        UINT size;
+
+        if (next_header != IPV6_EXT_HOP_BY_HOP && next_header != IPV6_EXT_ROUTING &&
+                next_header != IPV6_EXT_FRAGMENT && next_header != IPV6_EXT_AUTHENTICATION &&
+                next_header != IPV6_EXT_DESTINATION) {
+            break;
+        }
+
+        if (offset + 2 > o->caplen) {
+            o->layers |= FL_TRUNCATED;
+            break;
+        }
+
+        // NOTE ~> Every extension header starts with the "Next Header" field,
+        //  but they don't all measure their own length in the same units.
+        if (next_header == IPV6_EXT_FRAGMENT) {
+            size = IPV6_FRAGMENT_HEADER_SIZE;
+        } else if (next_header == IPV6_EXT_AUTHENTICATION) {
+            size = (extension[1] + 2) * 4;
+        } else {
+            size = (extension[1] + 1) * 8;
+        }
+
+        if (offset + size > o->caplen) {
+            o->layers |= FL_TRUNCATED;
+            break;
+        }
+
+        if (next_header == IPV6_EXT_FRAGMENT) {
+            o->layers |= FL_FRAGMENT;
+
+            // Only the first fragment carries the transport header
+            later_fragment = (readUint16(extension + 2) & 0xfff8) != 0;
+        }
+
+        next_header = extension[0];
+        offset += size;
+
+        if (later_fragment) {
+            break;
+        }
+    }
+
+    o->ip_protocol = next_header;
+    o->network_header_size = offset - o->network_offset;
+    o->payload_offset = offset;
+
+    if (o->datagram_end < o->payload_offset) {
+        o->datagram_end = o->payload_offset;
+    }
+
+    if (!(o->layers & FL_TRUNCATED) && !later_fragment) {
+        decodeTransport(o);
+    }
+}
+
+/**
+ * Decodes the TCP, UDP, or ICMP header that follows the network layer header.
+ */
+static void decodeTransport(FrameDescriptor* o) {
+    UINT offset = o->network_offset + o->network_header_size;
+    const OCTET* header = o->data + offset;
+    UINT header_size;
+
+    switch (o->ip_protocol) {
+        case IP_TCP:
+            if (offset + TCP_MIN_HEADER_SIZE > o->caplen) {
+                o->layers |= FL_TRUNCATED;
+
+                return;
+            }
+
+            header_size = (header[12] >> 4) * 4;
+
+            if (header_size < TCP_MIN_HEADER_SIZE) {
+                return;
+            }
+
+            if (offset + header_size > o->caplen) {
+                o->layers |= FL_TRUNCATED;
+                header_size = o->caplen - offset;
+            }
+
+            o->tcp_flags = header[13];
+            o->tcp_seq = ((uint32_t) readUint16(header + 4) << 16) | readUint16(header + 6);
+            break;
+
+        case IP_UDP:
+            header_size = UDP_HEADER_SIZE;
+            break;
+
+        case IP_ICMP:
+        case IP_ICMPV6:
+            header_size = ICMP_HEADER_SIZE;
+            break;
+
+        default:
+            return;
+    }
+
+    if (offset + header_size > o->caplen) {
+        o->layers |= FL_TRUNCATED;
+
+        return;
+    }
+
+    o->layers |= FL_TRANSPORT;
+    o->transport_offset = offset;
+    o->transport_header_size = header_size;
+    o->payload_offset = offset + header_size;
+
+    if (o->ip_protocol == IP_ICMP || o->ip_protocol == IP_ICMPV6) {
+        o->src_port = header[0];
+        o->dst_port = header[1];
+    } else {
+        o->src_port = readUint16(header);
+        o->dst_port = readUint16(header + 2);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+#ifndef _FRAME_DESCRIPTOR_H_
+#define _FRAME_DESCRIPTOR_H_
+
+#include "common.h"
+#include "ethernet_frame.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// NOTE ~> A frame descriptor is filled in by walking a captured frame exactly
+//  once. It records where each layer's header starts and the values that are
+//  needed from them, so that everything downstream of the decoder (printers,
+//  flow tracking, etc.) reads the descriptor rather than re-parsing the frame.
+//  Multi-octet values are stored in host byte order.
+
+/**
+ * Maximum number of stacked 802.1Q/802.1ad tags that are decoded. Frames with
+ * more tags than this are decoded no further than the link layer.
+ */
+#define FD_MAX_VLAN_TAGS 4
+
+/**
+ * Flags describing which layers of a frame were decoded, and how.
+ */
+typedef enum FrameLayers {
+    FL_LINK         = 0x01,
+    FL_NETWORK      = 0x02,
+    FL_TRANSPORT    = 0x04,
+
+    /**
+     * The frame is a fragment of a larger IP datagram. The transport layer is
+     * only decoded for the first fragment.
+     */
+    FL_FRAGMENT     = 0x08,
+
+    /**
+     * The frame ended before one of its headers did.
+     */
+    FL_TRUNCATED    = 0x10
+} FrameLayers;
+
+/**
+ * Well-known values of the IPv4 "Protocol" and IPv6 "Next Header" fields.
+ */
+typedef enum IpProtocol {
+    IP_ICMP         = 1,
+    IP_TCP          = 6,
+    IP_UDP          = 17,
+    IP_ICMPV6       = 58
+} IpProtocol;
+
+/**
+ * A single 802.1Q or 802.1ad tag.
+ */
+typedef struct VlanTag {
+    uint16_t tpid;
+    uint16_t tci;
+} VlanTag;
+
+/**
+ * Describes the layers of a single captured frame.
+ */
+typedef struct FrameDescriptor {
+    /**
+     * The frame itself and the number of octets of it that were captured.
+     */
+    const OCTET* data;
+    UINT caplen;
+
+    /**
+     * Bitmask of FrameLayers flags.
+     */
+    UINT layers;
+
+    /**
+     * The frame's VLAN tags, outermost first.
+     */
+    VlanTag vlan_tags[FD_MAX_VLAN_TAGS];
+    UINT num_vlan_tags;
+
+    /**
+     * The EtherType following the last VLAN tag (i.e. that of the network
+     * layer).
+     */
+    EthernetType ethernet_type;
+
+    /**
+     * Offset and size of the network layer header (including any IPv6
+     * extension headers).
+     */
+    UINT network_offset;
+    UINT network_header_size;
+
+    /**
+     * Offset just past the end of the IP datagram according to its header. It
+     * lies beyond the end of the captured frame if the frame was truncated,
+     * and short of it if the frame was padded.
+     */
+    UINT datagram_end;
+
+    /**
+     * The IP protocol carried by the network layer (after any IPv6 extension
+     * headers).
+     */
+    uint8_t ip_protocol;
+
+    /**
+     * Offset and size of the transport layer header.
+     */
+    UINT transport_offset;
+    UINT transport_header_size;
+
+    /**
+     * TCP/UDP ports, or the ICMP type (source) and code (destination).
+     */
+    uint16_t src_port;
+    uint16_t dst_port;
+
+    /**
+     * The TCP flags octet and sequence number.
+     */
+    uint8_t tcp_flags;
+    uint32_t tcp_seq;
+
+    /**
+     * Offset of whatever follows the deepest decoded header.
+     */
+    UINT payload_offset;
+
+    /**
+     * Index of the interface that the frame was captured on (see
+     * CapturedFrame). Decoding sets it to zero, so it is up to whoever
+     * captured the frame to fill it in.
+     */
+    UINT interface;
+
+    /**
+     * Bitmask of ChecksumFlags, set by Checksum_verify(). Decoding clears it.
+     */
+    UINT checksums;
+} FrameDescriptor;
+
+void FrameDescriptor_decode(FrameDescriptor* o, const OCTET* data, UINT caplen);
+const OCTET* FrameDescriptor_getSourceAddress(const FrameDescriptor* o);
+const OCTET* FrameDescriptor_getDestinationAddress(const FrameDescriptor* o);
+void IpProtocol_toString(UINT protocol, char* buff, int buff_size);
+
+#endif
\ No newline at end of file
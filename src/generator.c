@@ -0,0 +1,702 @@
+#include "generator.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include "common.h"
+#include "ethernet_frame.h"
+#include "injector.h"
+#include "logger.h"
+
+#define MAC_ADDRESS_SIZE            6
+#define ETHER_TYPE_OFFSET           12
+#define VLAN_TCI_OFFSET             14
+#define VLAN_TAG_SIZE               4
+#define MAX_VLAN_ID                 4095
+
+#define IPV4_HEADER_SIZE            20
+#define IPV4_TOTAL_LENGTH_OFFSET    2
+#define IPV4_FLAGS_OFFSET           6
+#define IPV4_TTL_OFFSET             8
+#define IPV4_PROTOCOL_OFFSET        9
+#define IPV4_CHECKSUM_OFFSET        10
+#define IPV4_SRC_OFFSET             12
+#define IPV4_DST_OFFSET             16
+#define IPV4_DONT_FRAGMENT          0x4000
+
+#define IPV6_HEADER_SIZE            40
+#define IPV6_PAYLOAD_LENGTH_OFFSET  4
+#define IPV6_NEXT_HEADER_OFFSET     6
+#define IPV6_HOP_LIMIT_OFFSET       7
+#define IPV6_SRC_OFFSET             8
+#define IPV6_DST_OFFSET             24
+#define IPV6_ADDRESS_SIZE           16
+
+// NOTE ~> Only the last four octets of an address ever change, so that IPv4
+//  and IPv6 addresses can be treated alike (and IPv6 ranges are limited to
+//  addresses that only differ in those).
+#define ADDRESS_FIXED_SIZE          (IPV6_ADDRESS_SIZE - 4)
+
+#define IP_PROTOCOL_TCP             6
+#define IP_PROTOCOL_UDP             17
+
+#define SRC_PORT_OFFSET             0
+#define DST_PORT_OFFSET             2
+#define UDP_HEADER_SIZE             8
+#define UDP_LENGTH_OFFSET           4
+#define UDP_CHECKSUM_OFFSET         6
+#define TCP_HEADER_SIZE             20
+#define TCP_SEQUENCE_OFFSET         4
+#define TCP_DATA_OFFSET_OFFSET      12
+#define TCP_FLAGS_OFFSET            13
+#define TCP_WINDOW_OFFSET           14
+#define TCP_CHECKSUM_OFFSET         16
+#define TCP_HEADER_WORDS            0x50
+#define TCP_FLAGS_PSH_ACK           0x18
+
+#define MIN_FRAME_SIZE              60
+#define DEFAULT_TTL                 64
+#define RANDOM_SEED                 0x9e3779b97f4a7c15ULL
+
+/**
+ * The values that a field of a template takes: a range of them, walked through
+ * in order or picked from at random. A count of zero stands for every value
+ * that fits in 32 bits.
+ */
+typedef struct FieldRange {
+    uint32_t first;
+    uint32_t count;
+    uint32_t next;
+    bool random;
+} FieldRange;
+
+/**
+ * A template that frames are built from.
+ */
+typedef struct Template {
+    /**
+     * The frame (at its largest size), with every field that changes from frame
+     * to frame zeroed out.
+     */
+    OCTET* frame;
+    UINT max_size;
+    bool ipv6;
+    bool tcp;
+
+    /**
+     * Where the VLAN tag's TCI (or zero if untagged), the network and transport
+     * headers, the payload, the last four octets of each address and the
+     * transport checksum are in the frame.
+     */
+    UINT vlan_offset;
+    UINT network_offset;
+    UINT transport_offset;
+    UINT payload_offset;
+    UINT src_offset;
+    UINT dst_offset;
+    UINT checksum_offset;
+
+    /**
+     * The values that the fields which change from frame to frame take.
+     */
+    FieldRange vlan;
+    FieldRange src;
+    FieldRange dst;
+    FieldRange sport;
+    FieldRange dport;
+    FieldRange size;
+
+    /**
+     * Sums (in ones' complement) of everything that never changes in the IPv4
+     * header, and in the transport header and its pseudo-header, and of the
+     * first however many octets of the payload (for every length it can have).
+     */
+    uint32_t network_sum;
+    uint32_t transport_sum;
+    uint16_t* payload_sums;
+} Template;
+
+/**
+ * Builds frames from templates, in turn.
+ */
+struct Generator {
+    Template templates[MAX_TEMPLATES];
+    UINT num_templates;
+    UINT next_template;
+
+    /**
+     * Largest frame that can be built.
+     */
+    UINT max_length;
+
+    /**
+     * Which template each slot that frames are built in holds (or -1 if none
+     * yet).
+     */
+    UINT* slot_templates;
+    UINT num_slots;
+
+    /**
+     * State of the (xorshift) generator that random field values come from.
+     */
+    uint64_t random;
+};
+
+/**
+ * The fields of a template as they were specified (or NULL if they weren't).
+ */
+typedef struct TemplateSpec {
+    char* proto;
+    char* src;
+    char* dst;
+    char* sport;
+    char* dport;
+    char* vlan;
+    char* size;
+    char* ttl;
+    char* smac;
+    char* dmac;
+} TemplateSpec;
+
+static void parseSpec(char* spec, TemplateSpec* fields);
+static void parseRange(char* value, const char* name, uint32_t limit, uint32_t default_value, FieldRange* range);
+static void parseAddressRange(const char* value, const char* name, bool ipv6, OCTET* address, FieldRange* range);
+static void parseMacAddress(const char* value, const char* name, const char* default_value, OCTET* address);
+static bool splitRange(char* value, const char* name, char** last);
+static uint32_t parseNumber(const char* value, const char* name, uint32_t limit);
+static void setRange(FieldRange* range, uint32_t first, uint32_t last, bool random, const char* name);
+static uint32_t sumWords(const OCTET* data, UINT length);
+
+/**
+ * Reads the two octet, network byte order integer at the provided position.
+ */
+static inline uint16_t readUint16(const OCTET* ptr) {
+    return (uint16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+/**
+ * Reads the four octet, network byte order integer at the provided position.
+ */
+static inline uint32_t readUint32(const OCTET* ptr) {
+    return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+/**
+ * Writes the provided integer as two octets, in network byte order, at the
+ * provided position.
+ */
+static inline void writeUint16(OCTET* ptr, uint16_t value) {
+    ptr[0] = (OCTET) (value >> 8);
+    ptr[1] = (OCTET) value;
+}
+
+/**
+ * Writes the provided integer as four octets, in network byte order, at the
+ * provided position.
+ */
+static inline void writeUint32(OCTET* ptr, uint32_t value) {
+    ptr[0] = (OCTET) (value >> 24);
+    ptr[1] = (OCTET) (value >> 16);
+    ptr[2] = (OCTET) (value >> 8);
+    ptr[3] = (OCTET) value;
+}
+
+/**
+ * Folds the carries of the provided ones' complement sum back into it until it
+ * fits in 16 bits.
+ */
+static inline uint16_t fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t) sum;
+}
+
+/**
+ * Returns the next value of the provided field.
+ */
+static inline uint32_t nextValue(Generator* o, FieldRange* range) {
+    uint32_t offset;
+
+    if (range->random) {
+        o->random ^= o->random << 13;
+        o->random ^= o->random >> 7;
+        o->random ^= o->random << 17;
+
+        // NOTE ~> Scaling (rather than taking the remainder of) the upper half
+        //  picks from the range without a division.
+        offset = (uint32_t) (o->random >> 32);
+        if (range->count != 0) {
+            offset = (uint32_t) (((uint64_t) offset * range->count) >> 32);
+        }
+    } else {
+        offset = range->next++;
+        if (range->next == range->count) {
+            range->next = 0;
+        }
+    }
+
+    return range->first + offset;
+}
+
+/**
+ * Allocates and initializes a new Generator, which builds frames of up to the
+ * provided length into the provided number of slots that keep their contents
+ * (or none), prior to returning a pointer to it.
+ */
+Generator* Generator_new(UINT max_length, UINT num_slots) {
+    Generator* generator = (Generator*) calloc(1, sizeof(Generator));
+
+    if (generator == NULL) {
+        fatal("Failed to allocate a generator.");
+    }
+
+    generator->max_length = max_length;
+    generator->num_slots = num_slots;
+    generator->random = RANDOM_SEED;
+
+    if (num_slots > 0) {
+        if ((generator->slot_templates = (UINT*) malloc(num_slots * sizeof(UINT))) == NULL) {
+            fatal("Failed to allocate a generator.");
+        }
+
+        memset(generator->slot_templates, 0xff, num_slots * sizeof(UINT));
+    }
+
+    return generator;
+}
+
+/**
+ * Parses the provided template and builds it for the provided Generator to
+ * build frames from (in turn with any other templates), fataling the program
+ * if it isn't a valid one.
+ */
+void Generator_addTemplate(Generator* o, const char* spec) {
+    Template* t = &o->templates[o->num_templates];
+    TemplateSpec fields;
+    OCTET src[IPV6_ADDRESS_SIZE] = { 0 };
+    OCTET dst[IPV6_ADDRESS_SIZE] = { 0 };
+    OCTET* network;
+    OCTET* transport;
+    char* copy;
+    uint32_t sum;
+    UINT ttl, protocol, i;
+
+    if (o->num_templates == MAX_TEMPLATES) {
+        fatal("Only up to %u templates can be specified.", MAX_TEMPLATES);
+    }
+
+    if ((copy = strdup(spec)) == NULL) {
+        fatal("Failed to allocate a template.");
+    }
+
+    parseSpec(copy, &fields);
+
+    // Work out what the frame is made of
+    if (fields.proto == NULL || strcmp(fields.proto, "udp") == 0) {
+        t->tcp = false;
+    } else if (strcmp(fields.proto, "tcp") == 0) {
+        t->tcp = true;
+    } else {
+        fatal("Invalid template protocol specified (\"%s\"). Expected udp or tcp.", fields.proto);
+    }
+
+    t->ipv6 = (fields.src != NULL && strchr(fields.src, ':') != NULL) ||
+            (fields.dst != NULL && strchr(fields.dst, ':') != NULL);
+    protocol = t->tcp ? IP_PROTOCOL_TCP : IP_PROTOCOL_UDP;
+
+    t->vlan_offset = fields.vlan != NULL ? VLAN_TCI_OFFSET : 0;
+    t->network_offset = ETHER_TYPE_OFFSET + (fields.vlan != NULL ? VLAN_TAG_SIZE : 0) + 2;
+    t->transport_offset = t->network_offset + (t->ipv6 ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE);
+    t->payload_offset = t->transport_offset + (t->tcp ? TCP_HEADER_SIZE : UDP_HEADER_SIZE);
+    t->checksum_offset = t->tcp ? TCP_CHECKSUM_OFFSET : UDP_CHECKSUM_OFFSET;
+
+    // Work out what values the fields that change from frame to frame take
+    parseAddressRange(fields.src != NULL ? fields.src : (t->ipv6 ? "fd00::1" : "10.0.0.1"), "source address",
+            t->ipv6, src, &t->src);
+    parseAddressRange(fields.dst != NULL ? fields.dst : (t->ipv6 ? "fd00::2" : "10.0.0.2"), "destination address",
+            t->ipv6, dst, &t->dst);
+    parseRange(fields.sport, "source port", UINT16_MAX, 1024, &t->sport);
+    parseRange(fields.dport, "destination port", UINT16_MAX, 9, &t->dport);
+    parseRange(fields.vlan, "VLAN ID", MAX_VLAN_ID, 0, &t->vlan);
+    parseRange(fields.size, "frame size", o->max_length,
+            t->payload_offset > MIN_FRAME_SIZE ? t->payload_offset : MIN_FRAME_SIZE, &t->size);
+    ttl = fields.ttl != NULL ? parseNumber(fields.ttl, "TTL", UINT8_MAX) : DEFAULT_TTL;
+
+    if (t->size.first < t->payload_offset) {
+        fatal("The template frame size must be at least %u bytes (to fit its headers).", t->payload_offset);
+    }
+
+    t->max_size = t->size.first + (t->size.count - 1);
+
+    if ((t->frame = (OCTET*) calloc(1, t->max_size)) == NULL ||
+            (t->payload_sums = (uint16_t*) malloc((t->max_size - t->payload_offset + 1) * sizeof(uint16_t))) == NULL) {
+        fatal("Failed to allocate a template.");
+    }
+
+    // Lay down the Ethernet header (and VLAN tag), and make sure that the
+    //  network header is where an EthernetFrame would look for it
+    parseMacAddress(fields.dmac, "destination MAC address", "02:00:00:00:00:02", t->frame);
+    parseMacAddress(fields.smac, "source MAC address", "02:00:00:00:00:01", t->frame + MAC_ADDRESS_SIZE);
+
+    if (t->vlan_offset != 0) {
+        writeUint16(t->frame + ETHER_TYPE_OFFSET, ET_VLANTAGGED);
+    }
+
+    writeUint16(t->frame + t->network_offset - 2, t->ipv6 ? ET_IPV6 : ET_IPV4);
+
+    if (EthernetFrame_getHeaderSize((EthernetFrame*) t->frame) != t->network_offset) {
+        fatal("Failed to lay out the Ethernet header of a template.");
+    }
+
+    // Lay down the network header (leaving out the lengths, checksum and
+    //  whatever changes in the addresses)
+    network = t->frame + t->network_offset;
+
+    if (t->ipv6) {
+        network[0] = 0x60;
+        network[IPV6_NEXT_HEADER_OFFSET] = (OCTET) protocol;
+        network[IPV6_HOP_LIMIT_OFFSET] = (OCTET) ttl;
+        memcpy(network + IPV6_SRC_OFFSET, src, ADDRESS_FIXED_SIZE);
+        memcpy(network + IPV6_DST_OFFSET, dst, ADDRESS_FIXED_SIZE);
+
+        t->src_offset = t->network_offset + IPV6_SRC_OFFSET + ADDRESS_FIXED_SIZE;
+        t->dst_offset = t->network_offset + IPV6_DST_OFFSET + ADDRESS_FIXED_SIZE;
+    } else {
+        network[0] = 0x45;
+        writeUint16(network + IPV4_FLAGS_OFFSET, IPV4_DONT_FRAGMENT);
+        network[IPV4_TTL_OFFSET] = (OCTET) ttl;
+        network[IPV4_PROTOCOL_OFFSET] = (OCTET) protocol;
+
+        t->src_offset = t->network_offset + IPV4_SRC_OFFSET;
+        t->dst_offset = t->network_offset + IPV4_DST_OFFSET;
+        t->network_sum = sumWords(network, IPV4_HEADER_SIZE);
+    }
+
+    // Lay down the transport header (leaving out the ports, length and
+    //  checksum) and the payload
+    transport = t->frame + t->transport_offset;
+
+    if (t->tcp) {
+        writeUint32(transport + TCP_SEQUENCE_OFFSET, 1);
+        transport[TCP_DATA_OFFSET_OFFSET] = TCP_HEADER_WORDS;
+        transport[TCP_FLAGS_OFFSET] = TCP_FLAGS_PSH_ACK;
+        writeUint16(transport + TCP_WINDOW_OFFSET, UINT16_MAX);
+    }
+
+    for (i = t->payload_offset; i < t->max_size; i++) {
+        t->frame[i] = (OCTET) i;
+    }
+
+    // Sum up everything that never changes for the transport checksum: the
+    //  fixed parts of the pseudo-header and transport header, and the payload
+    //  for every length it can be
+    t->transport_sum = protocol + sumWords(transport, t->payload_offset - t->transport_offset);
+
+    if (t->ipv6) {
+        t->transport_sum += sumWords(src, ADDRESS_FIXED_SIZE) + sumWords(dst, ADDRESS_FIXED_SIZE);
+    }
+
+    sum = 0;
+    t->payload_sums[0] = 0;
+
+    for (i = 0; i < t->max_size - t->payload_offset; i++) {
+        sum = fold(sum + ((i & 1) ? t->frame[t->payload_offset + i] : t->frame[t->payload_offset + i] << 8));
+        t->payload_sums[i + 1] = (uint16_t) sum;
+    }
+
+    info("Generating %s/%s frames of %u to %u bytes from template %u (\"%s\").", t->ipv6 ? "IPv6" : "IPv4",
+            t->tcp ? "TCP" : "UDP", t->size.first, t->max_size, o->num_templates + 1, spec);
+
+    o->num_templates++;
+    free(copy);
+}
+
+/**
+ * Builds the next frame (from the next template) at the provided location,
+ * which is in the provided slot (or INJECTOR_NO_SLOT), and returns its length.
+ */
+UINT Generator_build(Generator* o, OCTET* data, UINT slot) {
+    UINT index = o->next_template;
+    Template* t = &o->templates[index];
+    OCTET* network = data + t->network_offset;
+    OCTET* transport = data + t->transport_offset;
+    uint32_t src, dst, sport, dport, sum;
+    UINT size, transport_length;
+    uint16_t checksum;
+
+    if (++o->next_template == o->num_templates) {
+        o->next_template = 0;
+    }
+
+    size = nextValue(o, &t->size);
+    transport_length = size - t->transport_offset;
+
+    // Lay the template down, unless the slot still holds it from the last
+    //  frame that was built in it
+    if (slot == INJECTOR_NO_SLOT) {
+        memcpy(data, t->frame, size);
+    } else if (o->slot_templates[slot] != index) {
+        memcpy(data, t->frame, t->max_size);
+        o->slot_templates[slot] = index;
+    }
+
+    // Store the fields that change from frame to frame
+    src = nextValue(o, &t->src);
+    dst = nextValue(o, &t->dst);
+    sport = nextValue(o, &t->sport);
+    dport = nextValue(o, &t->dport);
+
+    if (t->vlan_offset != 0) {
+        writeUint16(data + t->vlan_offset, (uint16_t) nextValue(o, &t->vlan));
+    }
+
+    writeUint32(data + t->src_offset, src);
+    writeUint32(data + t->dst_offset, dst);
+    writeUint16(transport + SRC_PORT_OFFSET, (uint16_t) sport);
+    writeUint16(transport + DST_PORT_OFFSET, (uint16_t) dport);
+
+    // Add the words that changed into the checksums
+    if (t->ipv6) {
+        writeUint16(network + IPV6_PAYLOAD_LENGTH_OFFSET, (uint16_t) transport_length);
+    } else {
+        sum = t->network_sum + (size - t->network_offset) + (src >> 16) + (src & 0xffff) + (dst >> 16) +
+                (dst & 0xffff);
+
+        writeUint16(network + IPV4_TOTAL_LENGTH_OFFSET, (uint16_t) (size - t->network_offset));
+        writeUint16(network + IPV4_CHECKSUM_OFFSET, (uint16_t) ~fold(sum));
+    }
+
+    sum = t->transport_sum + transport_length + (src >> 16) + (src & 0xffff) + (dst >> 16) + (dst & 0xffff) +
+            sport + dport + t->payload_sums[size - t->payload_offset];
+
+    if (!t->tcp) {
+        writeUint16(transport + UDP_LENGTH_OFFSET, (uint16_t) transport_length);
+        sum += transport_length;
+    }
+
+    // NOTE ~> A UDP checksum of zero means that there is none, so a sum that
+    //  comes out as zero is sent as its other form instead.
+    checksum = (uint16_t) ~fold(sum);
+    if (checksum == 0 && !t->tcp) {
+        checksum = UINT16_MAX;
+    }
+
+    writeUint16(transport + t->checksum_offset, checksum);
+
+    return size;
+}
+
+/**
+ * Frees the provided Generator and everything associated with it.
+ */
+void Generator_free(Generator* o) {
+    UINT i;
+
+    for (i = 0; i < o->num_templates; i++) {
+        free(o->templates[i].frame);
+        free(o->templates[i].payload_sums);
+    }
+
+    free(o->slot_templates);
+    free(o);
+}
+
+/**
+ * Splits the provided (copy of a) template up into its fields.
+ */
+static void parseSpec(char* spec, TemplateSpec* fields) {
+    char* context = NULL;
+    char* field;
+    char* value;
+
+    memset(fields, 0x00, sizeof(TemplateSpec));
+
+    for (field = strtok_r(spec, ",", &context); field != NULL; field = strtok_r(NULL, ",", &context)) {
+        if ((value = strchr(field, '=')) == NULL) {
+            fatal("Invalid template field specified (\"%s\"). Expected name=value.", field);
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(field, "proto") == 0) {
+            fields->proto = value;
+        } else if (strcmp(field, "src") == 0) {
+            fields->src = value;
+        } else if (strcmp(field, "dst") == 0) {
+            fields->dst = value;
+        } else if (strcmp(field, "sport") == 0) {
+            fields->sport = value;
+        } else if (strcmp(field, "dport") == 0) {
+            fields->dport = value;
+        } else if (strcmp(field, "vlan") == 0) {
+            fields->vlan = value;
+        } else if (strcmp(field, "size") == 0) {
+            fields->size = value;
+        } else if (strcmp(field, "ttl") == 0) {
+            fields->ttl = value;
+        } else if (strcmp(field, "smac") == 0) {
+            fields->smac = value;
+        } else if (strcmp(field, "dmac") == 0) {
+            fields->dmac = value;
+        } else {
+            fatal("Unknown template field specified (\"%s\"). Expected proto, src, dst, sport, dport, vlan, size, "
+                    "ttl, smac or dmac.", field);
+        }
+    }
+}
+
+/**
+ * Parses the provided range of numbers of up to the provided limit (or takes
+ * the default value if none was specified) into the provided field.
+ */
+static void parseRange(char* value, const char* name, uint32_t limit, uint32_t default_value, FieldRange* range) {
+    bool random;
+    char* last;
+    uint32_t first;
+
+    if (value == NULL) {
+        setRange(range, default_value, default_value, false, name);
+
+        return;
+    }
+
+    random = splitRange(value, name, &last);
+    first = parseNumber(value, name, limit);
+    setRange(range, first, last != NULL ? parseNumber(last, name, limit) : first, random, name);
+}
+
+/**
+ * Parses the provided range of IPv4 (or IPv6) addresses into the provided
+ * field (for their last four octets) and the first address.
+ */
+static void parseAddressRange(const char* value, const char* name, bool ipv6, OCTET* address, FieldRange* range) {
+    OCTET last_address[IPV6_ADDRESS_SIZE];
+    OCTET* first = ipv6 ? address : address + ADDRESS_FIXED_SIZE;
+    OCTET* last = ipv6 ? last_address : last_address + ADDRESS_FIXED_SIZE;
+    char buffer[INET6_ADDRSTRLEN * 2 + 16] = { 0 };
+    char* last_value;
+    bool random;
+
+    strncpy(buffer, value, sizeof(buffer) - 1);
+    random = splitRange(buffer, name, &last_value);
+    memcpy(last_address, address, IPV6_ADDRESS_SIZE);
+
+    if (inet_pton(ipv6 ? AF_INET6 : AF_INET, buffer, first) != 1 ||
+            (last_value != NULL && inet_pton(ipv6 ? AF_INET6 : AF_INET, last_value, last) != 1)) {
+        fatal("Invalid template %s specified (\"%s\"). Expected %s address (or range of them).", name, value,
+                ipv6 ? "an IPv6" : "an IPv4");
+    }
+
+    if (last_value == NULL) {
+        memcpy(last_address, address, IPV6_ADDRESS_SIZE);
+    } else if (memcmp(address, last_address, ADDRESS_FIXED_SIZE) != 0) {
+        fatal("Invalid template %s specified (\"%s\"). Only the last 32 bits of a range of addresses can differ.",
+                name, value);
+    }
+
+    setRange(range, readUint32(address + ADDRESS_FIXED_SIZE), readUint32(last_address + ADDRESS_FIXED_SIZE), random,
+            name);
+}
+
+/**
+ * Parses the provided MAC address (or the default one if none was specified)
+ * into the provided location.
+ */
+static void parseMacAddress(const char* value, const char* name, const char* default_value, OCTET* address) {
+    UINT octets[MAC_ADDRESS_SIZE];
+    char end;
+    int i;
+
+    if (value == NULL) {
+        value = default_value;
+    }
+
+    if (sscanf(value, "%2x:%2x:%2x:%2x:%2x:%2x%c", &octets[0], &octets[1], &octets[2], &octets[3], &octets[4],
+            &octets[5], &end) != MAC_ADDRESS_SIZE) {
+        fatal("Invalid template %s specified (\"%s\").", name, value);
+    }
+
+    for (i = 0; i < MAC_ADDRESS_SIZE; i++) {
+        address[i] = (OCTET) octets[i];
+    }
+}
+
+/**
+ * Splits the provided range ("first[-last][/seq|/random]") in place into its
+ * first and last (or NULL) values, and returns whether values are to be picked
+ * from it at random.
+ */
+static bool splitRange(char* value, const char* name, char** last) {
+    char* mode = strchr(value, '/');
+
+    if (mode != NULL) {
+        *mode++ = '\0';
+
+        if (strcmp(mode, "random") != 0 && strcmp(mode, "seq") != 0) {
+            fatal("Invalid template %s distribution specified (\"%s\"). Expected seq or random.", name, mode);
+        }
+    }
+
+    if ((*last = strchr(value, '-')) != NULL) {
+        *(*last)++ = '\0';
+    }
+
+    return mode != NULL && strcmp(mode, "random") == 0;
+}
+
+/**
+ * Parses the provided number (in any base that strtoul(...) understands),
+ * fataling the program if it is not one or is larger than the provided limit.
+ */
+static uint32_t parseNumber(const char* value, const char* name, uint32_t limit) {
+    char* end;
+    unsigned long parsed;
+
+    errno = 0;
+    parsed = strtoul(value, &end, 0);
+
+    if (errno != 0 || end == value || *end != '\0' || *value == '-' || parsed > limit) {
+        fatal("Invalid template %s specified (\"%s\"). Expected a number up to %u.", name, value, limit);
+    }
+
+    return (uint32_t) parsed;
+}
+
+/**
+ * Sets the provided field up to take the values from first to last (inclusive).
+ */
+static void setRange(FieldRange* range, uint32_t first, uint32_t last, bool random, const char* name) {
+    if (last < first) {
+        fatal("Invalid template %s range specified. The last value must not come before the first.", name);
+    }
+
+    range->first = first;
+    range->count = last - first + 1;
+    range->next = 0;
+    range->random = random;
+}
+
+/**
+ * Returns the (unfolded) ones' complement sum of the provided octets, taken as
+ * network byte order words (and padded with a zero octet if there's an odd
+ * number of them).
+ */
+static uint32_t sumWords(const OCTET* data, UINT length) {
+    uint32_t sum = 0;
+    UINT i;
+
+    for (i = 0; i + 1 < length; i += 2) {
+        sum += readUint16(data + i);
+    }
+
+    if (length & 1) {
+        sum += (uint32_t) data[length - 1] << 8;
+    }
+
+    return sum;
+}
@@ -0,0 +1,30 @@
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include "common.h"
+
+#define MAX_TEMPLATES 8
+
+// NOTE ~> A generator builds frames from templates rather than reading them
+//  from anywhere. A template is a comma-separated list of fields (e.g.
+//  "proto=udp,src=10.0.0.1-10.0.0.254,dport=53,size=60-1514/random") making up
+//  an Ethernet frame (802.1Q tagged or not) carrying a UDP or TCP segment over
+//  IPv4 or IPv6. The addresses, ports, VLAN ID and frame size can each be a
+//  single value or a range, which is walked through in order or picked from at
+//  random for every frame.
+//  Each template is built once, at its largest size. Building a frame then
+//  means copying the template into the slot that the frame goes in (which only
+//  happens when the slot last held a different template, since slots keep
+//  their contents) and storing the fields that change from frame to frame.
+//  Checksums are never worked out over the whole frame again: the sums of
+//  everything that never changes (including every length of the payload) are
+//  worked out up front, so that only the words that changed are added in.
+
+typedef struct Generator Generator;
+
+Generator* Generator_new(UINT max_length, UINT num_slots);
+void Generator_addTemplate(Generator* o, const char* spec);
+UINT Generator_build(Generator* o, OCTET* data, UINT slot);
+void Generator_free(Generator* o);
+
+#endif
@@ -0,0 +1,204 @@
+#include "injector.h"
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "logger.h"
+
+/**
+ * Wraps the state of a particular kind of injector behind a common set of
+ * operations, and counts what goes through it.
+ */
+struct Injector {
+    /**
+     * Human-readable description of where frames are going (e.g. the name of
+     * the network interface).
+     */
+    char description[MAX_PATH_LENGTH];
+
+    /**
+     * The operations implemented by the kind of injector this is.
+     */
+    const InjectorOps* ops;
+
+    /**
+     * Opaque state owned by the kind of injector this is.
+     */
+    void* state;
+
+    /**
+     * Largest frame that the kind of injector this is can transmit, and the
+     * number of slots it has that keep their contents (zero if they don't).
+     */
+    UINT max_length;
+    UINT num_slots;
+
+    /**
+     * Frames (and octets) queued so far, frames that were too large to be
+     * transmitted, and batches flushed so far.
+     */
+    ULONG frames;
+    ULONG octets;
+    ULONG oversized;
+    ULONG flushes;
+
+    /**
+     * Whether anything has been queued since the last flush.
+     */
+    bool pending;
+};
+
+/**
+ * Allocates and initializes a new Injector around the provided operations and
+ * state (which can transmit frames of up to the provided length, and has the
+ * provided number of slots that keep their contents) prior to returning a
+ * pointer to it.
+ */
+Injector* Injector_new(const char* description, const InjectorOps* ops, void* state, UINT max_length,
+        UINT num_slots) {
+    Injector* injector = (Injector*) calloc(1, sizeof(Injector));
+
+    if (injector == NULL) {
+        fatal("Failed to allocate an injector.");
+    }
+
+    strncpy(injector->description, description, MAX_PATH_LENGTH - 1);
+    injector->ops = ops;
+    injector->state = state;
+    injector->max_length = max_length;
+    injector->num_slots = num_slots;
+
+    return injector;
+}
+
+#if !defined(HAVE_BPF_DEVICE) && !defined(HAVE_PACKET_MMAP)
+/**
+ * Stands in for injection on platforms that do not provide a supported kernel
+ * facility to inject frames with.
+ */
+Injector* Injector_openDevice(const char* interface_name) {
+    fatal("Injecting frames onto \"%s\" is not supported on this platform.", interface_name);
+
+    return NULL;
+}
+#endif
+
+/**
+ * Returns the human-readable description of the provided Injector.
+ */
+const char* Injector_getDescription(Injector* o) {
+    return o->description;
+}
+
+/**
+ * Returns the largest frame that the provided Injector can transmit.
+ */
+UINT Injector_getMaxLength(Injector* o) {
+    return o->max_length;
+}
+
+/**
+ * Returns the number of slots of the provided Injector that keep their
+ * contents from one use to the next (or zero if they don't).
+ */
+UINT Injector_getSlotCount(Injector* o) {
+    return o->num_slots;
+}
+
+/**
+ * Queues the provided frame to be transmitted with the next batch, flushing
+ * the batch first if there is no room left in it. Frames that are too large to
+ * be transmitted are skipped (and counted).
+ */
+void Injector_queue(Injector* o, const OCTET* data, UINT length) {
+    UINT slot;
+
+    if (length > o->max_length) {
+        if (o->oversized++ == 0) {
+            warn("Skipping frames that are too large to inject onto %s (%u > %u bytes).", o->description, length,
+                    o->max_length);
+        }
+
+        return;
+    }
+
+    memcpy(Injector_reserve(o, &slot), data, length);
+    Injector_commit(o, length);
+}
+
+/**
+ * Returns where the next frame (of up to the largest length the provided
+ * Injector can transmit) is to be built, flushing the batch first if there is
+ * no room left in it. The index of the slot that is (or INJECTOR_NO_SLOT) is
+ * placed in the provided location. The frame must be committed before anything
+ * else is done with the Injector.
+ */
+OCTET* Injector_reserve(Injector* o, UINT* slot) {
+    OCTET* data;
+
+    while ((data = o->ops->reserve(o->state, slot)) == NULL) {
+        Injector_flush(o);
+    }
+
+    return data;
+}
+
+/**
+ * Queues the frame (of the provided length) that was built where the last
+ * reserve said to be transmitted with the next batch.
+ */
+void Injector_commit(Injector* o, UINT length) {
+    o->ops->commit(o->state, length);
+
+    o->frames++;
+    o->octets += length;
+    o->pending = true;
+}
+
+/**
+ * Has every queued frame transmitted (in as few system calls as the kind of
+ * injector allows).
+ */
+void Injector_flush(Injector* o) {
+    o->ops->flush(o->state);
+
+    if (o->pending) {
+        o->flushes++;
+        o->pending = false;
+    }
+}
+
+/**
+ * Returns the number of frames that have been queued so far.
+ */
+ULONG Injector_getFrames(Injector* o) {
+    return o->frames;
+}
+
+/**
+ * Returns the number of octets (of frames) that have been queued so far.
+ */
+ULONG Injector_getOctets(Injector* o) {
+    return o->octets;
+}
+
+/**
+ * Returns the number of batches that have been flushed so far.
+ */
+ULONG Injector_getFlushes(Injector* o) {
+    return o->flushes;
+}
+
+/**
+ * Flushes whatever is still queued and then closes the provided Injector and
+ * frees everything associated with it.
+ */
+void Injector_close(Injector* o) {
+    Injector_flush(o);
+
+    if (o->oversized > 0) {
+        warn("Skipped %lu frames that were too large to inject.", o->oversized);
+    }
+
+    o->ops->close(o->state);
+    free(o);
+}
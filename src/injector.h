@@ -0,0 +1,62 @@
+#ifndef _INJECTOR_H_
+#define _INJECTOR_H_
+
+#include "common.h"
+#include <stdbool.h>
+
+// NOTE ~> An injector puts frames onto a network interface. Frames are queued
+//  one at a time and go out in batches when the injector is flushed (or on its
+//  own once it has no room left to queue into), so that one system call can
+//  transmit many frames. On Linux, frames are copied straight into the slots of
+//  a memory-mapped PACKET_TX_RING and a single send(...) has the kernel
+//  transmit every slot that is ready. A BPF device only takes a single frame
+//  per write(...), so there each flush writes the queued frames one by one.
+//  Frames can also be built in place: reserving hands out where the next
+//  frame goes, and where an injector's slots keep their contents from one use
+//  to the next (as ring slots do) it says which slot that is, so that whatever
+//  was built there last time can be reused.
+
+/**
+ * Slot index reported by injectors whose slots don't keep their contents.
+ */
+#define INJECTOR_NO_SLOT ((UINT) -1)
+
+typedef struct Injector Injector;
+
+/**
+ * The operations that each kind of injector must implement.
+ */
+typedef struct InjectorOps {
+    /**
+     * Returns where the next frame (of up to the largest length the injector
+     * takes) can be written, and the index of the slot that is (or
+     * INJECTOR_NO_SLOT), or NULL if there is no room for it until the injector
+     * has been flushed.
+     */
+    OCTET* (*reserve)(void* state, UINT* slot);
+
+    /**
+     * Queues the frame of the provided length that was written where the last
+     * reserve said.
+     */
+    void (*commit)(void* state, UINT length);
+    void (*flush)(void* state);
+    void (*close)(void* state);
+} InjectorOps;
+
+Injector* Injector_new(const char* description, const InjectorOps* ops, void* state, UINT max_length,
+        UINT num_slots);
+Injector* Injector_openDevice(const char* interface_name);
+const char* Injector_getDescription(Injector* o);
+UINT Injector_getMaxLength(Injector* o);
+UINT Injector_getSlotCount(Injector* o);
+void Injector_queue(Injector* o, const OCTET* data, UINT length);
+OCTET* Injector_reserve(Injector* o, UINT* slot);
+void Injector_commit(Injector* o, UINT length);
+void Injector_flush(Injector* o);
+ULONG Injector_getFrames(Injector* o);
+ULONG Injector_getOctets(Injector* o);
+ULONG Injector_getFlushes(Injector* o);
+void Injector_close(Injector* o);
+
+#endif
@@ -0,0 +1,685 @@
+#include "ip_defrag.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "buffer_pool.h"
+#include "ethernet_frame.h"
+#include "logger.h"
+
+#define PIECE_BLOCK_SIZE            2048
+#define MAX_HOLES                   16
+#define MAX_DATAGRAM_SIZE           65535
+#define MAX_EXPIRIES_PER_UPDATE     2
+#define NANOSECONDS_PER_SECOND      1000000000ULL
+
+#define IPV4_TOTAL_LENGTH_OFFSET    2
+#define IPV4_ID_OFFSET              4
+#define IPV4_FRAGMENT_OFFSET        6
+#define IPV4_CHECKSUM_OFFSET        10
+#define IPV4_SRC_OFFSET             12
+#define IPV4_FRAGMENT_OFFSET_MASK   0x1fff
+#define IPV4_MORE_FRAGMENTS         0x2000
+
+#define IPV6_HEADER_SIZE            40
+#define IPV6_PAYLOAD_LENGTH_OFFSET  4
+#define IPV6_NEXT_HEADER_OFFSET     6
+#define IPV6_SRC_OFFSET             8
+#define IPV6_FRAGMENT_HEADER_SIZE   8
+#define IPV6_MAX_EXTENSION_HEADERS  8
+
+#define IPV6_EXT_HOP_BY_HOP         0
+#define IPV6_EXT_ROUTING            43
+#define IPV6_EXT_FRAGMENT           44
+#define IPV6_EXT_AUTHENTICATION     51
+#define IPV6_EXT_DESTINATION        60
+
+/**
+ * Some of a datagram's data (or the headers of its first fragment), stored in
+ * a single block of the pool.
+ */
+typedef struct Piece {
+    struct Piece* next;
+    uint32_t offset;
+    uint32_t length;
+    OCTET data[];
+} Piece;
+
+#define PIECE_CAPACITY              (PIECE_BLOCK_SIZE - sizeof(Piece))
+
+/**
+ * A range of a datagram's data (first and last octet, inclusive) that hasn't
+ * arrived yet.
+ */
+typedef struct Hole {
+    uint32_t first;
+    uint32_t last;
+} Hole;
+
+/**
+ * Identifies a datagram. IPv4 addresses only use the first four octets of
+ * their address.
+ */
+typedef struct DatagramKey {
+    OCTET addresses[2][16];
+    uint32_t id;
+    uint16_t vlan;
+    uint8_t protocol;
+    uint8_t ip_version;
+} DatagramKey;
+
+/**
+ * Everything that a fragment says about itself.
+ */
+typedef struct FragmentInfo {
+    uint32_t id;
+    uint32_t offset;
+    bool more;
+
+    /**
+     * Offsets (in the frame) of the end of the headers that every fragment
+     * repeats, and of the fragment's data.
+     */
+    UINT unfragmentable_end;
+    UINT data_offset;
+
+    /**
+     * For IPv6, the offset (in the frame) of the "Next Header" field that
+     * points at the Fragment header, and the value of the Fragment header's own
+     * "Next Header" field.
+     */
+    UINT next_header_field;
+    uint8_t next_header;
+} FragmentInfo;
+
+/**
+ * A datagram whose fragments are still being collected.
+ */
+typedef struct Datagram {
+    DatagramKey key;
+    uint32_t hash;
+    uint64_t first_seen;
+
+    /**
+     * The link layer and unfragmentable IP headers of the first fragment (once
+     * it has arrived), and the data that has arrived so far.
+     */
+    Piece* headers;
+    Piece* pieces;
+
+    UINT network_offset;
+    UINT next_header_field;
+    uint8_t next_header;
+
+    Hole holes[MAX_HOLES];
+    UINT num_holes;
+
+    /**
+     * Next datagram in the same hash bucket.
+     */
+    struct Datagram* chain;
+
+    /**
+     * Neighbours in order of when datagrams were started (oldest first).
+     * Datagrams that aren't in use are kept on a list of their own through the
+     * same links.
+     */
+    struct Datagram* prev;
+    struct Datagram* next;
+} Datagram;
+
+struct Defragmenter {
+    Datagram* datagrams;
+    Datagram** buckets;
+    uint32_t bucket_mask;
+
+    Datagram* free_datagrams;
+    Datagram* oldest;
+    Datagram* newest;
+
+    BufferPool* pool;
+    uint64_t timeout;
+
+    /**
+     * Where reassembled datagrams are rebuilt. Each one stays there until the
+     * next one is.
+     */
+    OCTET* frame;
+
+    /**
+     * Counters that are logged when the defragmenter is freed.
+     */
+    ULONG num_fragments;
+    ULONG num_reassembled;
+    ULONG num_timed_out;
+    ULONG num_evicted;
+    ULONG num_malformed;
+};
+
+static bool parseFragment(const FrameDescriptor* frame, FragmentInfo* info);
+static uint32_t hashKey(const DatagramKey* key);
+static Datagram* lookup(Defragmenter* o, uint32_t hash, const DatagramKey* key);
+static Datagram* insert(Defragmenter* o, uint32_t hash, const DatagramKey* key, uint64_t now);
+static void dropDatagram(Defragmenter* o, Datagram* datagram);
+static void expire(Defragmenter* o, uint64_t now);
+static bool makeRoom(Defragmenter* o, Datagram* current, size_t blocks);
+static bool fillHoles(Defragmenter* o, Datagram* datagram, uint32_t first, uint32_t last, bool more,
+        const OCTET* data);
+static void storePiece(Defragmenter* o, Piece** list, uint32_t offset, const OCTET* data, size_t length);
+static UINT rebuild(Defragmenter* o, Datagram* datagram);
+
+/**
+ * Reads a two octet, network byte order integer.
+ */
+static inline uint16_t readUint16(const OCTET* ptr) {
+    return (uint16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+/**
+ * Writes a two octet, network byte order integer.
+ */
+static inline void writeUint16(OCTET* ptr, uint16_t value) {
+    ptr[0] = (OCTET) (value >> 8);
+    ptr[1] = (OCTET) value;
+}
+
+/**
+ * Allocates a new Defragmenter that collects up to the provided number of
+ * datagrams at once, buffers no more than (roughly) the provided number of
+ * bytes of fragments across all of them, and gives up on datagrams that aren't
+ * complete within the provided number of seconds.
+ */
+Defragmenter* Defragmenter_new(UINT max_datagrams, size_t max_memory, UINT timeout) {
+    Defragmenter* o = (Defragmenter*) calloc(1, sizeof(Defragmenter));
+    size_t num_buckets = 1;
+    UINT i;
+
+    if (o == NULL || max_datagrams == 0) {
+        fatal("Failed to allocate a defragmenter for %u datagrams.", max_datagrams);
+    }
+
+    while (num_buckets < max_datagrams) {
+        num_buckets <<= 1;
+    }
+
+    o->datagrams = (Datagram*) calloc(max_datagrams, sizeof(Datagram));
+    o->buckets = (Datagram**) calloc(num_buckets, sizeof(Datagram*));
+    o->frame = (OCTET*) malloc(PIECE_CAPACITY + MAX_DATAGRAM_SIZE);
+
+    if (o->datagrams == NULL || o->buckets == NULL || o->frame == NULL) {
+        fatal("Failed to allocate a defragmenter for %u datagrams.", max_datagrams);
+    }
+
+    o->bucket_mask = num_buckets - 1;
+    o->pool = BufferPool_new(PIECE_BLOCK_SIZE, max_memory);
+    o->timeout = timeout * NANOSECONDS_PER_SECOND;
+
+    for (i = max_datagrams; i > 0; i--) {
+        o->datagrams[i - 1].next = o->free_datagrams;
+        o->free_datagrams = &o->datagrams[i - 1];
+    }
+
+    return o;
+}
+
+/**
+ * Takes in the provided (already decoded) frame if it is a fragment, and gives
+ * up on datagrams that have taken too long as of the frame's timestamp. Returns
+ * true if the frame should be processed any further: either it isn't a
+ * fragment that can be reassembled (and is left as it is), or it completed its
+ * datagram (and the provided FrameDescriptor now describes the whole datagram,
+ * which stays valid until the next call). Returns false if the frame was held
+ * on to (or dropped).
+ */
+bool Defragmenter_process(Defragmenter* o, FrameDescriptor* frame, const struct timespec* timestamp) {
+    uint64_t now = (uint64_t) timestamp->tv_sec * NANOSECONDS_PER_SECOND + timestamp->tv_nsec;
+    const OCTET* network = frame->data + frame->network_offset;
+    FragmentInfo info;
+    DatagramKey key;
+    Datagram* datagram;
+    uint32_t hash, last;
+    size_t size = (frame->ethernet_type == ET_IPV4) ? 4 : 16;
+    UINT length;
+
+    expire(o, now);
+
+    if (!(frame->layers & FL_FRAGMENT) || !parseFragment(frame, &info)) {
+        return true;
+    }
+
+    // Fragments that were cut short, or that have no data, can't be used
+    if (frame->datagram_end > frame->caplen || frame->datagram_end <= info.data_offset ||
+            info.unfragmentable_end > PIECE_CAPACITY) {
+        return true;
+    }
+
+    o->num_fragments++;
+    length = frame->datagram_end - info.data_offset;
+    last = info.offset + length - 1;
+
+    if (last >= MAX_DATAGRAM_SIZE) {
+        o->num_malformed++;
+
+        return false;
+    }
+
+    memset(&key, 0x00, sizeof(DatagramKey));
+    memcpy(key.addresses[0], network + ((size == 4) ? IPV4_SRC_OFFSET : IPV6_SRC_OFFSET), size);
+    memcpy(key.addresses[1], network + ((size == 4) ? IPV4_SRC_OFFSET : IPV6_SRC_OFFSET) + size, size);
+    key.id = info.id;
+    key.vlan = (frame->num_vlan_tags > 0) ? (frame->vlan_tags[0].tci & 0x0fff) : 0;
+    key.protocol = (size == 4) ? frame->ip_protocol : 0;
+    key.ip_version = (size == 4) ? 4 : 6;
+    hash = hashKey(&key);
+
+    if ((datagram = lookup(o, hash, &key)) == NULL) {
+        datagram = insert(o, hash, &key, now);
+    }
+
+    // Make sure there is room for the fragment before any of it is stored. It
+    //  takes a block more for each hole it falls into, and one for the headers
+    //  if it is the first fragment.
+    if (!makeRoom(o, datagram, ((length + PIECE_CAPACITY - 1) / PIECE_CAPACITY) + MAX_HOLES + 1)) {
+        dropDatagram(o, datagram);
+        o->num_evicted++;
+
+        return false;
+    }
+
+    if (info.offset == 0 && datagram->headers == NULL) {
+        storePiece(o, &datagram->headers, 0, frame->data, info.unfragmentable_end);
+        datagram->network_offset = frame->network_offset;
+        datagram->next_header_field = info.next_header_field;
+        datagram->next_header = info.next_header;
+    }
+
+    if (!fillHoles(o, datagram, info.offset, last, info.more, frame->data + info.data_offset)) {
+        dropDatagram(o, datagram);
+        o->num_malformed++;
+
+        return false;
+    }
+
+    if (datagram->num_holes > 0 || datagram->headers == NULL) {
+        return false;
+    }
+
+    // The datagram is complete, so rebuild it and describe it instead
+    length = rebuild(o, datagram);
+    dropDatagram(o, datagram);
+
+    if (length == 0) {
+        o->num_malformed++;
+
+        return false;
+    }
+
+    o->num_reassembled++;
+    FrameDescriptor_decode(frame, o->frame, length);
+
+    return true;
+}
+
+/**
+ * Logs what the provided Defragmenter did and frees it.
+ */
+void Defragmenter_free(Defragmenter* o) {
+    info("Reassembled %lu IP datagrams from %lu fragments; gave up on %lu (timed out), %lu (out of room) and %lu "
+            "(malformed).", o->num_reassembled, o->num_fragments, o->num_timed_out, o->num_evicted, o->num_malformed);
+    info("Buffered at most %lu bytes of fragments.", (ULONG) BufferPool_getPeakUsed(o->pool));
+
+    BufferPool_free(o->pool);
+    free(o->datagrams);
+    free(o->buckets);
+    free(o->frame);
+    free(o);
+}
+
+/**
+ * Reads the fragmentation fields of the provided fragment (walking the IPv6
+ * extension headers to find its Fragment header). Returns false if they can't
+ * be found.
+ */
+static bool parseFragment(const FrameDescriptor* frame, FragmentInfo* info) {
+    const OCTET* network = frame->data + frame->network_offset;
+    UINT offset = frame->network_offset + IPV6_HEADER_SIZE;
+    UINT field = frame->network_offset + IPV6_NEXT_HEADER_OFFSET;
+    uint16_t fragment;
+    int i;
+
+    memset(info, 0x00, sizeof(FragmentInfo));
+
+    if (frame->ethernet_type == ET_IPV4) {
+        fragment = readUint16(network + IPV4_FRAGMENT_OFFSET);
+
+        info->id = readUint16(network + IPV4_ID_OFFSET);
+        info->offset = (fragment & IPV4_FRAGMENT_OFFSET_MASK) * 8;
+        info->more = (fragment & IPV4_MORE_FRAGMENTS) != 0;
+        info->unfragmentable_end = frame->network_offset + frame->network_header_size;
+        info->data_offset = info->unfragmentable_end;
+
+        return true;
+    }
+
+    // NOTE ~> The decoder has already checked that every extension header up
+    //  to (and including) the Fragment header was captured.
+    for (i = 0; i < IPV6_MAX_EXTENSION_HEADERS; i++) {
+        const OCTET* extension = frame->data + offset;
+        uint8_t next_header = frame->data[field];
+
+        if (next_header == IPV6_EXT_FRAGMENT) {
+            fragment = readUint16(extension + 2);
+
+            info->id = ((uint32_t) readUint16(extension + 4) << 16) | readUint16(extension + 6);
+            info->offset = fragment & 0xfff8;
+            info->more = (fragment & 0x0001) != 0;
+            info->unfragmentable_end = offset;
+            info->data_offset = offset + IPV6_FRAGMENT_HEADER_SIZE;
+            info->next_header_field = field;
+            info->next_header = extension[0];
+
+            return true;
+        }
+
+        if (next_header == IPV6_EXT_AUTHENTICATION) {
+            field = offset;
+            offset += (extension[1] + 2) * 4;
+        } else if (next_header == IPV6_EXT_HOP_BY_HOP || next_header == IPV6_EXT_ROUTING ||
+                next_header == IPV6_EXT_DESTINATION) {
+            field = offset;
+            offset += (extension[1] + 1) * 8;
+        } else {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Hashes the provided DatagramKey, eight octets at a time.
+ */
+static uint32_t hashKey(const DatagramKey* key) {
+    const OCTET* ptr = (const OCTET*) key;
+    uint64_t hash = 0x9e3779b97f4a7c15ULL, word;
+    size_t i;
+
+    for (i = 0; i + sizeof(word) <= sizeof(DatagramKey); i += sizeof(word)) {
+        memcpy(&word, ptr + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+
+    return (uint32_t) hash;
+}
+
+/**
+ * Finds the datagram with the provided key (and hash), or returns NULL if it
+ * isn't being collected.
+ */
+static Datagram* lookup(Defragmenter* o, uint32_t hash, const DatagramKey* key) {
+    Datagram* datagram;
+
+    for (datagram = o->buckets[hash & o->bucket_mask]; datagram != NULL; datagram = datagram->chain) {
+        if (datagram->hash == hash && memcmp(&datagram->key, key, sizeof(DatagramKey)) == 0) {
+            return datagram;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts collecting a new datagram with the provided key (and hash), of which
+ * nothing has arrived yet. If as many datagrams as possible are already being
+ * collected, the oldest one is given up on to make room.
+ */
+static Datagram* insert(Defragmenter* o, uint32_t hash, const DatagramKey* key, uint64_t now) {
+    Datagram* datagram;
+
+    if (o->free_datagrams == NULL) {
+        dropDatagram(o, o->oldest);
+        o->num_evicted++;
+    }
+
+    datagram = o->free_datagrams;
+    o->free_datagrams = datagram->next;
+
+    memset(datagram, 0x00, sizeof(Datagram));
+    datagram->key = *key;
+    datagram->hash = hash;
+    datagram->first_seen = now;
+    datagram->holes[0].first = 0;
+    datagram->holes[0].last = MAX_DATAGRAM_SIZE - 1;
+    datagram->num_holes = 1;
+
+    datagram->chain = o->buckets[hash & o->bucket_mask];
+    o->buckets[hash & o->bucket_mask] = datagram;
+
+    datagram->prev = o->newest;
+
+    if (o->newest != NULL) {
+        o->newest->next = datagram;
+    } else {
+        o->oldest = datagram;
+    }
+
+    o->newest = datagram;
+
+    return datagram;
+}
+
+/**
+ * Stops collecting the provided datagram, releasing everything that was stored
+ * for it.
+ */
+static void dropDatagram(Defragmenter* o, Datagram* datagram) {
+    Datagram** link = &o->buckets[datagram->hash & o->bucket_mask];
+    Piece* piece;
+
+    while (*link != datagram) {
+        link = &(*link)->chain;
+    }
+
+    *link = datagram->chain;
+
+    while ((piece = datagram->pieces) != NULL) {
+        datagram->pieces = piece->next;
+        BufferPool_release(o->pool, piece);
+    }
+
+    if (datagram->headers != NULL) {
+        BufferPool_release(o->pool, datagram->headers);
+    }
+
+    if (datagram->prev != NULL) {
+        datagram->prev->next = datagram->next;
+    } else {
+        o->oldest = datagram->next;
+    }
+
+    if (datagram->next != NULL) {
+        datagram->next->prev = datagram->prev;
+    } else {
+        o->newest = datagram->prev;
+    }
+
+    datagram->next = o->free_datagrams;
+    o->free_datagrams = datagram;
+}
+
+/**
+ * Gives up on the oldest datagrams if they have taken too long as of the
+ * provided time, doing no more than a fixed amount of work.
+ */
+static void expire(Defragmenter* o, uint64_t now) {
+    int i;
+
+    for (i = 0; i < MAX_EXPIRIES_PER_UPDATE && o->oldest != NULL; i++) {
+        if (now < o->oldest->first_seen + o->timeout) {
+            break;
+        }
+
+        dropDatagram(o, o->oldest);
+        o->num_timed_out++;
+    }
+}
+
+/**
+ * Makes sure that the provided number of blocks can be allocated from the pool
+ * by giving up on the oldest datagrams (other than the provided one). Returns
+ * false if that isn't possible.
+ */
+static bool makeRoom(Defragmenter* o, Datagram* current, size_t blocks) {
+    while (BufferPool_getAvailable(o->pool) < blocks) {
+        Datagram* victim = (o->oldest != current) ? o->oldest : current->next;
+
+        if (victim == NULL) {
+            return false;
+        }
+
+        dropDatagram(o, victim);
+        o->num_evicted++;
+    }
+
+    return true;
+}
+
+/**
+ * Stores whatever part of the provided fragment data (covering the provided
+ * first and last octets of the datagram) falls into the holes of the provided
+ * datagram, and updates its holes accordingly (RFC 815). Returns false if the
+ * datagram would need more holes than it can keep track of.
+ */
+static bool fillHoles(Defragmenter* o, Datagram* datagram, uint32_t first, uint32_t last, bool more,
+        const OCTET* data) {
+    Hole hole;
+    uint32_t start, end;
+    UINT i = 0;
+
+    while (i < datagram->num_holes) {
+        hole = datagram->holes[i];
+
+        // Holes that the fragment doesn't touch are left alone, unless they lie
+        //  beyond the end of the datagram now that the end is known
+        if (first > hole.last || last < hole.first) {
+            if (!more && hole.first > last) {
+                datagram->holes[i] = datagram->holes[--datagram->num_holes];
+            } else {
+                i++;
+            }
+
+            continue;
+        }
+
+        datagram->holes[i] = datagram->holes[--datagram->num_holes];
+
+        start = (first > hole.first) ? first : hole.first;
+        end = (last < hole.last) ? last : hole.last;
+        storePiece(o, &datagram->pieces, start, data + (start - first), end - start + 1);
+
+        if (first > hole.first || (last < hole.last && more)) {
+            if (datagram->num_holes + ((first > hole.first) && (last < hole.last && more)) >= MAX_HOLES) {
+                return false;
+            }
+
+            // NOTE ~> New holes go at the end of the list, which is walked
+            //  past them since the fragment can't overlap them.
+            if (first > hole.first) {
+                datagram->holes[datagram->num_holes].first = hole.first;
+                datagram->holes[datagram->num_holes].last = first - 1;
+                datagram->num_holes++;
+            }
+
+            if (last < hole.last && more) {
+                datagram->holes[datagram->num_holes].first = last + 1;
+                datagram->holes[datagram->num_holes].last = hole.last;
+                datagram->num_holes++;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Copies the provided data, which starts at the provided offset of the
+ * datagram, into as many blocks as it takes and adds them to the provided list.
+ * Room must have been made for them beforehand.
+ */
+static void storePiece(Defragmenter* o, Piece** list, uint32_t offset, const OCTET* data, size_t length) {
+    Piece* piece;
+    size_t size;
+
+    while (length > 0 && (piece = (Piece*) BufferPool_alloc(o->pool)) != NULL) {
+        size = (length < PIECE_CAPACITY) ? length : PIECE_CAPACITY;
+
+        piece->offset = offset;
+        piece->length = size;
+        memcpy(piece->data, data, size);
+        piece->next = *list;
+        *list = piece;
+
+        offset += size;
+        data += size;
+        length -= size;
+    }
+}
+
+/**
+ * Rebuilds the provided (complete) datagram as a single frame in the
+ * defragmenter's frame buffer, fixing up the IP header to describe the whole
+ * datagram. Returns the size of the frame, or zero if the datagram turned out
+ * to be too large to describe.
+ */
+static UINT rebuild(Defragmenter* o, Datagram* datagram) {
+    Piece* headers = datagram->headers;
+    OCTET* network = o->frame + datagram->network_offset;
+    UINT header_size = headers->length - datagram->network_offset;
+    UINT data_size = 0;
+    uint32_t checksum = 0;
+    Piece* piece;
+    UINT i;
+
+    memcpy(o->frame, headers->data, headers->length);
+
+    for (piece = datagram->pieces; piece != NULL; piece = piece->next) {
+        memcpy(o->frame + headers->length + piece->offset, piece->data, piece->length);
+
+        if (piece->offset + piece->length > data_size) {
+            data_size = piece->offset + piece->length;
+        }
+    }
+
+    if (datagram->key.ip_version == 6) {
+        if (header_size - IPV6_HEADER_SIZE + data_size > MAX_DATAGRAM_SIZE) {
+            return 0;
+        }
+
+        writeUint16(network + IPV6_PAYLOAD_LENGTH_OFFSET, header_size - IPV6_HEADER_SIZE + data_size);
+        o->frame[datagram->next_header_field] = datagram->next_header;
+
+        return headers->length + data_size;
+    }
+
+    if (header_size + data_size > MAX_DATAGRAM_SIZE) {
+        return 0;
+    }
+
+    writeUint16(network + IPV4_TOTAL_LENGTH_OFFSET, header_size + data_size);
+    writeUint16(network + IPV4_FRAGMENT_OFFSET,
+            readUint16(network + IPV4_FRAGMENT_OFFSET) & ~(IPV4_FRAGMENT_OFFSET_MASK | IPV4_MORE_FRAGMENTS));
+    writeUint16(network + IPV4_CHECKSUM_OFFSET, 0);
+
+    for (i = 0; i < header_size; i += 2) {
+        checksum += readUint16(network + i);
+    }
+
+    while (checksum >> 16) {
+        checksum = (checksum & 0xffff) + (checksum >> 16);
+    }
+
+    writeUint16(network + IPV4_CHECKSUM_OFFSET, (uint16_t) ~checksum);
+
+    return headers->length + data_size;
+}
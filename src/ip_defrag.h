@@ -0,0 +1,29 @@
+#ifndef _IP_DEFRAG_H_
+#define _IP_DEFRAG_H_
+
+#include "common.h"
+#include "frame_descriptor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// NOTE ~> A defragmenter collects the fragments of IPv4 datagrams, and of IPv6
+//  packets with a Fragment extension header, until each datagram is complete,
+//  and then rebuilds it as a single frame (the link layer and IP headers of
+//  its first fragment, fixed up to describe the whole datagram, followed by
+//  all of its data) so that everything downstream sees it as if it had
+//  arrived whole. Each datagram in progress keeps a fixed number of hole
+//  descriptors (RFC 815); fragments only fill holes, so the first copy of any
+//  octet wins, and a datagram that would need more holes than that is
+//  dropped. Fragment data is kept in blocks from a buffer pool whose size is
+//  capped, and datagrams are dropped (oldest first) when it runs out, when
+//  too many are in progress at once, or when they aren't complete within the
+//  timeout (based on the timestamps of captured frames).
+
+typedef struct Defragmenter Defragmenter;
+
+Defragmenter* Defragmenter_new(UINT max_datagrams, size_t max_memory, UINT timeout);
+bool Defragmenter_process(Defragmenter* o, FrameDescriptor* frame, const struct timespec* timestamp);
+void Defragmenter_free(Defragmenter* o);
+
+#endif
@@ -0,0 +1,267 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "large_buffer.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "logger.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define HUGE_PAGE_SIZE          ((size_t) 2 << 20)
+#define CACHE_LINE_SIZE         64
+#define BYTES_PER_KILOBYTE      1024
+
+// NOTE ~> The memory policy that mbind(...) is asked for (from <numaif.h>,
+//  which only comes with libnuma). Preferring a node rather than binding to it
+//  means that memory still comes from elsewhere once the node runs out.
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/**
+ * How a buffer ended up being mapped.
+ */
+typedef enum MappingKind {
+    MK_HUGE,
+    MK_ALIGNED,
+    MK_ORDINARY
+} MappingKind;
+
+/**
+ * Bytes mapped so far of each kind, bytes mapped right now and the most there
+ * ever were. Buffers may be allocated and freed from any thread.
+ */
+static ULONG mapped[MK_ORDINARY + 1];
+static ULONG mapped_now;
+static ULONG mapped_peak;
+
+static void* allocateSmall(size_t size);
+static size_t getMappedLength(size_t size);
+static void* mapAligned(size_t length);
+static void bindToNode(void* buffer, size_t length, int node);
+
+/**
+ * Allocates a zeroed buffer of (at least) the provided size, on huge pages if it
+ * is large enough and some are available, preferably on the provided NUMA node
+ * (or ANY_NODE), prior to returning a pointer to it. Returns NULL if the buffer
+ * can't be allocated at all.
+ */
+void* LargeBuffer_alloc(size_t size, int node) {
+    size_t length = getMappedLength(size);
+    MappingKind kind = MK_ORDINARY;
+    void* buffer = MAP_FAILED;
+    ULONG now;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size < HUGE_PAGE_SIZE) {
+        return allocateSmall(size);
+    }
+
+    // NOTE ~> Reserved huge pages are only used when the buffer fills them
+    //  exactly, as rounding up to them could waste most of a huge page.
+#ifdef MAP_HUGETLB
+    if (length % HUGE_PAGE_SIZE == 0) {
+        buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        kind = MK_HUGE;
+    }
+#endif
+
+    if (buffer == MAP_FAILED) {
+        buffer = mapAligned(length);
+        kind = MK_ALIGNED;
+    }
+
+    if (buffer == MAP_FAILED) {
+        buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        kind = MK_ORDINARY;
+    }
+
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+
+    bindToNode(buffer, length, node);
+
+    __atomic_add_fetch(&mapped[kind], length, __ATOMIC_RELAXED);
+    now = __atomic_add_fetch(&mapped_now, length, __ATOMIC_RELAXED);
+
+    // NOTE ~> A lost race here only makes the peak a little low, which is good
+    //  enough for a figure that is only ever logged.
+    if (now > __atomic_load_n(&mapped_peak, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&mapped_peak, now, __ATOMIC_RELAXED);
+    }
+
+    return buffer;
+}
+
+/**
+ * Frees the provided buffer, which has to have been allocated with the
+ * provided size.
+ */
+void LargeBuffer_free(void* buffer, size_t size) {
+    size_t length = getMappedLength(size);
+
+    if (buffer == NULL) {
+        return;
+    }
+
+    if (size < HUGE_PAGE_SIZE) {
+        free(buffer);
+
+        return;
+    }
+
+    munmap(buffer, length);
+    __atomic_sub_fetch(&mapped_now, length, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the NUMA node that the provided CPU belongs to, or ANY_NODE if that
+ * can't be told (or the CPU is negative).
+ */
+int LargeBuffer_getCpuNode(int cpu) {
+    int node = ANY_NODE;
+#ifdef __linux__
+    char path[MAX_PATH_LENGTH];
+    struct dirent* entry;
+    DIR* directory;
+
+    if (cpu < 0) {
+        return ANY_NODE;
+    }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    if ((directory = opendir(path)) == NULL) {
+        return ANY_NODE;
+    }
+
+    while (node == ANY_NODE && (entry = readdir(directory)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            node = ANY_NODE;
+        }
+    }
+
+    closedir(directory);
+#else
+    (void) cpu;
+#endif
+
+    return node;
+}
+
+/**
+ * Logs how much has been mapped for large buffers, and how, if anything was.
+ */
+void LargeBuffer_logUsage() {
+    ULONG total = mapped[MK_HUGE] + mapped[MK_ALIGNED] + mapped[MK_ORDINARY];
+
+    if (total == 0) {
+        return;
+    }
+
+    info("Mapped %lu KB of large buffers (at most %lu KB at once): %lu KB on huge pages, %lu KB aligned for "
+            "transparent huge pages, %lu KB on ordinary pages.", total / BYTES_PER_KILOBYTE,
+            mapped_peak / BYTES_PER_KILOBYTE, mapped[MK_HUGE] / BYTES_PER_KILOBYTE,
+            mapped[MK_ALIGNED] / BYTES_PER_KILOBYTE, mapped[MK_ORDINARY] / BYTES_PER_KILOBYTE);
+}
+
+/**
+ * Allocates a zeroed buffer of the provided size (less than a huge page) from
+ * the heap, aligned to an ordinary page if it takes up one or more, and to a
+ * cache line otherwise.
+ */
+static void* allocateSmall(size_t size) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    void* buffer;
+
+    if (posix_memalign(&buffer, (size >= page_size) ? page_size : CACHE_LINE_SIZE, size) != 0) {
+        return NULL;
+    }
+
+    return memset(buffer, 0x00, size);
+}
+
+/**
+ * Returns how many bytes are actually mapped for a buffer of the provided size
+ * (of at least a huge page): whole ordinary pages.
+ */
+static size_t getMappedLength(size_t size) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Maps the provided number of bytes (a multiple of the ordinary page size) at
+ * an address aligned to a huge page, so that the kernel is able to back them with
+ * huge pages of its own accord, and asks it to.
+ */
+static void* mapAligned(size_t length) {
+#ifdef MAP_ALIGNED_SUPER
+    return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_ALIGNED_SUPER, -1, 0);
+#else
+    OCTET* mapping = (OCTET*) mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0);
+    OCTET* start;
+
+    if (mapping == (OCTET*) MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    // Trim the mapping down to the aligned part of it
+    start = (OCTET*) (((uintptr_t) mapping + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+
+    if (start > mapping) {
+        munmap(mapping, start - mapping);
+    }
+
+    munmap(start + length, HUGE_PAGE_SIZE - (start - mapping));
+
+#ifdef MADV_HUGEPAGE
+    madvise(start, length, MADV_HUGEPAGE);
+#endif
+
+    return start;
+#endif
+}
+
+/**
+ * Asks for the pages of the provided buffer to come from the provided NUMA node
+ * when they are first touched, if it is a node at all. Nothing is done where
+ * there is no way to ask for that.
+ */
+static void bindToNode(void* buffer, size_t length, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask;
+
+    if (node < 0 || node >= (int) (sizeof(mask) * 8)) {
+        return;
+    }
+
+    mask = 1UL << node;
+
+    // NOTE ~> The kernel reads one bit less of the mask than it is told to.
+    if (syscall(SYS_mbind, buffer, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) == -1) {
+        trace("Failed to place a large buffer on NUMA node %d. (%i: %s)", node, errno, strerror(errno));
+    }
+#else
+    (void) buffer;
+    (void) length;
+    (void) node;
+#endif
+}
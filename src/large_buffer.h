@@ -0,0 +1,28 @@
+#ifndef _LARGE_BUFFER_H_
+#define _LARGE_BUFFER_H_
+
+#include "common.h"
+#include <stddef.h>
+
+// NOTE ~> Large buffers (capture and output buffers, queues, tables and pool
+//  slabs) of at least a huge page are mapped straight from the kernel rather
+//  than taken from malloc, so that they can be backed by huge pages and placed
+//  on a given NUMA node. A buffer that is a whole number of huge pages is
+//  mapped from the reserved huge pages if there are enough of them left;
+//  otherwise (or if it isn't) it is aligned to a huge page so that the kernel
+//  can back it with transparent huge pages (or superpages) instead. Smaller
+//  buffers gain nothing from either, and simply come from the heap (wherever
+//  it puts them). Either way a buffer comes zeroed. Every buffer has to be
+//  freed with the same size that it was allocated with.
+
+/**
+ * Asks for a buffer to be placed on whichever node the kernel prefers.
+ */
+#define ANY_NODE -1
+
+void* LargeBuffer_alloc(size_t size, int node);
+void LargeBuffer_free(void* buffer, size_t size);
+int LargeBuffer_getCpuNode(int cpu);
+void LargeBuffer_logUsage();
+
+#endif
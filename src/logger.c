@@ -1,8 +1,110 @@
 #include "logger.h"
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+#include "signals.h"
+
+// NOTE ~> The level macros in logger.h would otherwise swallow the definitions
+//  below when some levels are compiled away.
+#undef trace
+#undef info
+#undef warn
+#undef error
+
+#define LOG_MAX_ENTRY_SIZE      4096
+#define LOG_RING_CAPACITY       4096
+#define LOG_RECORD_SIZE         500
+#define LOG_FLUSH_SIZE          65536
+#define LOG_MAX_SPEC_SIZE       48
+#define LOG_IDLE_SLEEP_NS       1000000
+#define LOG_BLOCK_SLEEP_NS      50000
+
+/**
+ * The level that output(...) messages are queued up with, which get neither a
+ * label nor a newline.
+ */
+#define LOG_OUTPUT              -1
+
+/**
+ * A single slot of the asynchronous logger's ring. A producer owns the slot
+ * when its sequence equals the position being written, and the flush thread
+ * owns it when its sequence is one past that. A message that doesn't fit in
+ * one slot takes up as many consecutive ones as it needs, all claimed at once,
+ * and only its first slot's sequence and length are used.
+ */
+typedef struct LogRecord {
+    size_t sequence;
+    size_t length;
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+/**
+ * The start of every message queued up for the flush thread. It is followed by
+ * the values of the message's arguments, with every string copied in whole
+ * (since the caller's may be long gone by the time it is formatted).
+ */
+typedef struct LogEntry {
+    const char* format;
+    const char* color;
+    int level;
+} LogEntry;
+
+/**
+ * Length modifiers of printf(...) conversions.
+ */
+typedef enum LogLengths {
+    LN_NONE,
+    LN_CHAR,
+    LN_SHORT,
+    LN_LONG,
+    LN_LONG_LONG,
+    LN_SIZE,
+    LN_MAX,
+    LN_PTRDIFF,
+    LN_LONG_DOUBLE
+} LogLengths;
+
+/**
+ * A single printf(...) conversion specification, pointing into its format.
+ */
+typedef struct LogConversion {
+    const char* flags;
+    size_t flags_length;
+    const char* width;
+    size_t width_length;
+    const char* precision;
+    size_t precision_length;
+    LogLengths length;
+    char type;
+} LogConversion;
+
+/**
+ * What goes around a message: its color and label, and whatever turns the
+ * color off and ends the line.
+ */
+typedef struct LogAffixes {
+    const char* color;
+    const char* label;
+    const char* reset;
+    const char* newline;
+} LogAffixes;
+
+/**
+ * Formats text into a fixed buffer the way snprintf(...) does, keeping count of
+ * how long the text would have been had it all fit.
+ */
+typedef struct LogWriter {
+    char* out;
+    size_t size;
+    size_t length;
+} LogWriter;
 
 const char* LC_RESET =          "\x1b[0m";
 const char* LC_NORMAL =         "\x1b[0m";
@@ -27,7 +129,44 @@ static int loggerOptions[5] = {
     LO_NOTHING
 };
 
-static void vlog(LoggerLevels level, const char* message, va_list args);
+static const char* LEVEL_LABELS[] = {
+    "TRACE: ",
+    "INFO: ",
+    "WARN: ",
+    "ERROR: ",
+    "FATAL: "
+};
+
+static LogRecord* ring = NULL;
+static size_t enqueuePos = 0;
+static size_t dequeuePos = 0;
+static size_t droppedMessages = 0;
+static bool asyncActive = false;
+static bool stopRequested = false;
+static LoggerOverflowPolicies overflowPolicy = LP_DROP;
+static pthread_t flushThread;
+
+static void vemit(int level, const char* color, const char* format, va_list args);
+static void writeDirect(int level, const char* color, const char* format, va_list args);
+static void getAffixes(int level, const char* color, LogAffixes* affixes);
+static const char* parseConversion(const char* format, LogConversion* conversion);
+static size_t capture(char* entry, int level, const char* color, const char* format, va_list* args);
+static bool captureArgument(char* entry, size_t* length, const LogConversion* conversion, va_list* args);
+static intmax_t captureSigned(LogLengths length, va_list* args);
+static uintmax_t captureUnsigned(LogLengths length, va_list* args);
+static bool put(char* entry, size_t* length, const void* value, size_t size);
+static size_t formatEntry(char* out, size_t size, const char* entry, size_t length);
+static bool formatArgument(LogWriter* writer, const LogConversion* conversion, const char* entry, size_t length,
+        size_t* offset);
+static bool take(const char* entry, size_t length, size_t* offset, void* value, size_t size);
+static void appendSpec(char* spec, size_t* spec_length, const char* text, size_t length);
+static void appendText(LogWriter* writer, const char* text, size_t length);
+static void appendFormatted(LogWriter* writer, const char* format, ...);
+static bool enqueue(const char* entry, size_t length);
+static size_t dequeue(char* out);
+static void* flushLoop(void* arg);
+static void writeBatch(const char* batch, size_t length);
+static void sleepFor(long nanoseconds);
 
 /**
  * Outputs the provided message, in the provided color, to the known descriptor.
@@ -36,16 +175,9 @@ static void vlog(LoggerLevels level, const char* message, va_list args);
  */
 void output(const char* color, const char* message, ...) {
     va_list args;
-    char buffer_char[4096] = { 0 };
-
-    if (color != NULL) {
-        strcat(buffer_char, color);
-    }
-    strcat(buffer_char, message);
-    strcat(buffer_char, LC_RESET);
 
     va_start(args, message);
-    vprintf(buffer_char, args);
+    vemit(LOG_OUTPUT, color, message, args);
     va_end(args);
 }
 
@@ -56,7 +188,7 @@ void trace(const char* message, ...) {
     va_list args;
 
     va_start(args, message);
-    vlog(LL_TRACE, message, args);
+    vemit(LL_TRACE, NULL, message, args);
     va_end(args);
 }
 
@@ -67,7 +199,7 @@ void info(const char* message, ...) {
     va_list args;
 
     va_start(args, message);
-    vlog(LL_INFO, message, args);
+    vemit(LL_INFO, NULL, message, args);
     va_end(args);
 }
 
@@ -78,7 +210,7 @@ void warn(const char* message, ...) {
     va_list args;
 
     va_start(args, message);
-    vlog(LL_WARN, message, args);
+    vemit(LL_WARN, NULL, message, args);
     va_end(args);
 }
 
@@ -89,7 +221,7 @@ void error(const char* message, ...) {
     va_list args;
 
     va_start(args, message);
-    vlog(LL_ERROR, message, args);
+    vemit(LL_ERROR, NULL, message, args);
     va_end(args);
 }
 
@@ -102,79 +234,805 @@ void setLoggerOptions(LoggerLevels level, int options) {
 }
 
 /**
- * Logs the provided fatal-level message and then kills the program.
+ * Starts the background thread that formats and writes out logged messages,
+ * after which logging a message only copies its arguments into the ring. The provided policy decides
+ * what happens to a message when the ring is full. The thread is stopped (and
+ * the ring drained) by stopAsyncLogger(), which also runs at exit.
+ */
+void startAsyncLogger(LoggerOverflowPolicies policy) {
+    size_t i;
+
+    if (asyncActive) {
+        return;
+    }
+
+    if (ring == NULL && (ring = (LogRecord*) malloc(sizeof(LogRecord) * LOG_RING_CAPACITY)) == NULL) {
+        fatal("Failed to allocate the log ring.");
+    }
+
+    for (i = 0; i < LOG_RING_CAPACITY; i++) {
+        ring[i].sequence = i;
+    }
+
+    enqueuePos = 0;
+    dequeuePos = 0;
+    droppedMessages = 0;
+    overflowPolicy = policy;
+    stopRequested = false;
+
+    if (Signals_createThread(&flushThread, flushLoop, NULL) != 0) {
+        fatal("Failed to start the log flush thread.");
+    }
+
+    __atomic_store_n(&asyncActive, true, __ATOMIC_RELEASE);
+    atexit(stopAsyncLogger);
+}
+
+/**
+ * Stops the background thread started by startAsyncLogger(...) once it has
+ * written out everything in the ring. Messages logged afterwards are written
+ * out directly again. Does nothing if the thread isn't running.
+ */
+void stopAsyncLogger() {
+    if (!__atomic_exchange_n(&asyncActive, false, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    __atomic_store_n(&stopRequested, true, __ATOMIC_RELEASE);
+    pthread_join(flushThread, NULL);
+    fflush(stdout);
+}
+
+/**
+ * Logs the provided fatal-level message and then kills the program. Anything
+ * still sitting in the asynchronous logger's ring is written out first.
  */
 void fatal(const char* message, ...) {
     va_list args;
 
+    stopAsyncLogger();
+
     va_start(args, message);
-    vlog(LL_FATAL, message, args);
+    vemit(LL_FATAL, NULL, message, args);
     va_end(args);
 
     exit(1);
 }
 
+
 /**
- * Logs the provided messages as the provided log level. Supports all formatting
- * provided by printf(...) calls. Accepts a varargs list instead of actually
- * supporting varargs.
+ * Writes out the provided message straight away or, if the asynchronous logger
+ * is running, copies its arguments into the ring for the flush thread to format
+ * and write out. A message is either queued up whole or, when the ring is full
+ * and the policy says so, dropped whole.
  */
-static void vlog(LoggerLevels level, const char* message, va_list args) {
-    char buffer_char[4096] = { 0 };
+static void vemit(int level, const char* color, const char* format, va_list args) {
+    char entry[LOG_MAX_ENTRY_SIZE];
+    va_list copy;
+    size_t length;
 
-    // Add color formatters to the begginning of the buffer if necessary
-    if (!(loggerOptions[level] & LO_NOCOLOR)) {
-        switch (level) {
-            case LL_FATAL:
-                strcat(buffer_char, LC_RED_BOLD);
-                break;
-            case LL_ERROR:
-                strcat(buffer_char, LC_RED);
-                break;
-            case LL_WARN:
-                strcat(buffer_char, LC_YELLOW);
-                break;
-            case LL_INFO:
-                strcat(buffer_char, LC_CYAN);
-                break;
-            default:
-                break;
+    if (!__atomic_load_n(&asyncActive, __ATOMIC_ACQUIRE)) {
+        writeDirect(level, color, format, args);
+
+        return;
+    }
+
+    va_copy(copy, args);
+    length = capture(entry, level, color, format, &copy);
+    va_end(copy);
+
+    while (!enqueue(entry, length)) {
+        if (overflowPolicy == LP_DROP) {
+            __atomic_add_fetch(&droppedMessages, 1, __ATOMIC_RELAXED);
+
+            return;
+        }
+
+        // The flush thread may have gone away while we were waiting
+        if (!__atomic_load_n(&asyncActive, __ATOMIC_ACQUIRE)) {
+            writeDirect(level, color, format, args);
+
+            return;
         }
+
+        sleepFor(LOG_BLOCK_SLEEP_NS);
     }
+}
 
-    // Add the name of the log level to the buffer
-    if (!(loggerOptions[level] & LO_NOLABEL)) {
-        switch (level) {
-            case LL_TRACE:
-                strcat(buffer_char, "TRACE: ");
-                break;
-            case LL_INFO:
-                strcat(buffer_char, "INFO: ");
-                break;
-            case LL_WARN:
-                strcat(buffer_char, "WARN: ");
-                break;
-            case LL_ERROR:
-                strcat(buffer_char, "ERROR: ");
-                break;
-            case LL_FATAL:
-                strcat(buffer_char, "FATAL: ");
-                break;
-            default:
+/**
+ * Formats the provided message, along with its color and label, straight to the
+ * known descriptor (holding its lock so that other threads can't cut in).
+ */
+static void writeDirect(int level, const char* color, const char* format, va_list args) {
+    LogAffixes affixes;
+
+    getAffixes(level, color, &affixes);
+
+    flockfile(stdout);
+    fputs(affixes.color, stdout);
+    fputs(affixes.label, stdout);
+    vfprintf(stdout, format, args);
+    fputs(affixes.reset, stdout);
+    fputs(affixes.newline, stdout);
+    funlockfile(stdout);
+}
+
+/**
+ * Works out what goes around a message of the provided level, based on that
+ * level's options (output(...) messages get their own color, if any, and
+ * nothing else).
+ */
+static void getAffixes(int level, const char* color, LogAffixes* affixes) {
+    bool colored;
+
+    if (level == LOG_OUTPUT) {
+        affixes->color = (color != NULL) ? color : "";
+        affixes->label = "";
+        affixes->reset = LC_RESET;
+        affixes->newline = "";
+
+        return;
+    }
+
+    colored = !(loggerOptions[level] & LO_NOCOLOR);
+
+    switch (level) {
+        case LL_FATAL:
+            affixes->color = colored ? LC_RED_BOLD : "";
+            break;
+        case LL_ERROR:
+            affixes->color = colored ? LC_RED : "";
+            break;
+        case LL_WARN:
+            affixes->color = colored ? LC_YELLOW : "";
+            break;
+        case LL_INFO:
+            affixes->color = colored ? LC_CYAN : "";
+            break;
+        default:
+            affixes->color = "";
+            break;
+    }
+
+    affixes->label = (loggerOptions[level] & LO_NOLABEL) ? "" : LEVEL_LABELS[level];
+    affixes->reset = colored ? LC_RESET : "";
+    affixes->newline = "\n";
+}
+
+/**
+ * Parses the printf(...) conversion specification that starts right after a
+ * '%' of a format string, and returns where the format carries on from.
+ */
+static const char* parseConversion(const char* format, LogConversion* conversion) {
+    conversion->flags = format;
+
+    while (*format != '\0' && strchr("-+ #0'", *format) != NULL) {
+        format++;
+    }
+
+    conversion->flags_length = format - conversion->flags;
+    conversion->width = format;
+
+    if (*format == '*') {
+        format++;
+    } else {
+        while (*format >= '0' && *format <= '9') {
+            format++;
+        }
+    }
+
+    conversion->width_length = format - conversion->width;
+    conversion->precision = NULL;
+    conversion->precision_length = 0;
+
+    if (*format == '.') {
+        conversion->precision = ++format;
+
+        if (*format == '*') {
+            format++;
+        } else {
+            while (*format >= '0' && *format <= '9') {
+                format++;
+            }
+        }
+
+        conversion->precision_length = format - conversion->precision;
+    }
+
+    switch (*format) {
+        case 'h':
+            conversion->length = (*(++format) == 'h') ? (format++, LN_CHAR) : LN_SHORT;
+            break;
+        case 'l':
+            conversion->length = (*(++format) == 'l') ? (format++, LN_LONG_LONG) : LN_LONG;
+            break;
+        case 'z':
+            conversion->length = LN_SIZE;
+            format++;
+            break;
+        case 'j':
+            conversion->length = LN_MAX;
+            format++;
+            break;
+        case 't':
+            conversion->length = LN_PTRDIFF;
+            format++;
+            break;
+        case 'L':
+            conversion->length = LN_LONG_DOUBLE;
+            format++;
+            break;
+        default:
+            conversion->length = LN_NONE;
+            break;
+    }
+
+    conversion->type = *format;
+
+    return (*format != '\0') ? format + 1 : format;
+}
+
+/**
+ * Copies the provided message's format, color and level into the provided
+ * entry, followed by the value of every one of its arguments, and returns how
+ * long the entry is. Arguments that don't fit are left out (and so are left
+ * out of the message as well).
+ */
+static size_t capture(char* entry, int level, const char* color, const char* format, va_list* args) {
+    LogEntry header = { format, color, level };
+    LogConversion conversion;
+    size_t length = sizeof(header);
+
+    memcpy(entry, &header, sizeof(header));
+
+    while ((format = strchr(format, '%')) != NULL) {
+        format = parseConversion(format + 1, &conversion);
+
+        if (!captureArgument(entry, &length, &conversion, args)) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Copies the value(s) taken by the provided conversion onto the end of the
+ * provided entry. Returns false if they don't fit.
+ */
+static bool captureArgument(char* entry, size_t* length, const LogConversion* conversion, va_list* args) {
+    intmax_t signed_value;
+    uintmax_t unsigned_value;
+    long double float_value;
+    const char* string;
+    void* pointer;
+    size_t string_length;
+    int value;
+
+    if (conversion->width_length == 1 && *conversion->width == '*') {
+        value = va_arg(*args, int);
+
+        if (!put(entry, length, &value, sizeof(value))) {
+            return false;
+        }
+    }
+
+    if (conversion->precision_length == 1 && *conversion->precision == '*') {
+        value = va_arg(*args, int);
+
+        if (!put(entry, length, &value, sizeof(value))) {
+            return false;
+        }
+    }
+
+    switch (conversion->type) {
+        case 'd':
+        case 'i':
+            signed_value = captureSigned(conversion->length, args);
+            return put(entry, length, &signed_value, sizeof(signed_value));
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            unsigned_value = captureUnsigned(conversion->length, args);
+            return put(entry, length, &unsigned_value, sizeof(unsigned_value));
+        case 'c':
+            value = va_arg(*args, int);
+            return put(entry, length, &value, sizeof(value));
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (conversion->length == LN_LONG_DOUBLE) {
+                float_value = va_arg(*args, long double);
+            } else {
+                float_value = va_arg(*args, double);
+            }
+
+            return put(entry, length, &float_value, sizeof(float_value));
+        case 's':
+            if ((string = va_arg(*args, const char*)) == NULL) {
+                string = "(null)";
+            }
+
+            // NOTE ~> A string too long for what is left of the entry is cut
+            //  short rather than left out.
+            if (*length >= LOG_MAX_ENTRY_SIZE) {
+                return false;
+            }
+
+            string_length = strnlen(string, LOG_MAX_ENTRY_SIZE - *length - 1);
+            memcpy(entry + *length, string, string_length);
+            entry[*length + string_length] = '\0';
+            *length += string_length + 1;
+
+            return true;
+        case 'p':
+            pointer = va_arg(*args, void*);
+            return put(entry, length, &pointer, sizeof(pointer));
+        case 'n':
+            // Nothing is ever written back through it
+            (void) va_arg(*args, void*);
+            return true;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Takes the next argument of a signed conversion with the provided length
+ * modifier, as its own type.
+ */
+static intmax_t captureSigned(LogLengths length, va_list* args) {
+    switch (length) {
+        case LN_CHAR:
+            return (signed char) va_arg(*args, int);
+        case LN_SHORT:
+            return (short) va_arg(*args, int);
+        case LN_LONG:
+            return va_arg(*args, long);
+        case LN_LONG_LONG:
+            return va_arg(*args, long long);
+        case LN_SIZE:
+            return va_arg(*args, ssize_t);
+        case LN_MAX:
+            return va_arg(*args, intmax_t);
+        case LN_PTRDIFF:
+            return va_arg(*args, ptrdiff_t);
+        default:
+            return va_arg(*args, int);
+    }
+}
+
+/**
+ * Takes the next argument of an unsigned conversion with the provided length
+ * modifier, as its own type.
+ */
+static uintmax_t captureUnsigned(LogLengths length, va_list* args) {
+    switch (length) {
+        case LN_CHAR:
+            return (unsigned char) va_arg(*args, unsigned int);
+        case LN_SHORT:
+            return (unsigned short) va_arg(*args, unsigned int);
+        case LN_LONG:
+            return va_arg(*args, unsigned long);
+        case LN_LONG_LONG:
+            return va_arg(*args, unsigned long long);
+        case LN_SIZE:
+            return va_arg(*args, size_t);
+        case LN_MAX:
+            return va_arg(*args, uintmax_t);
+        case LN_PTRDIFF:
+            return (size_t) va_arg(*args, ptrdiff_t);
+        default:
+            return va_arg(*args, unsigned int);
+    }
+}
+
+/**
+ * Copies the provided value onto the end of the provided entry. Returns false
+ * if it doesn't fit.
+ */
+static bool put(char* entry, size_t* length, const void* value, size_t size) {
+    if (*length + size > LOG_MAX_ENTRY_SIZE) {
+        return false;
+    }
+
+    memcpy(entry + *length, value, size);
+    *length += size;
+
+    return true;
+}
+
+/**
+ * Formats the message held by the provided entry, along with its color and
+ * label, into the provided buffer the way snprintf(...) would, returning the
+ * length that all of it takes (which may be more than what fit).
+ */
+static size_t formatEntry(char* out, size_t size, const char* entry, size_t length) {
+    LogWriter writer = { out, size, 0 };
+    LogConversion conversion;
+    LogAffixes affixes;
+    LogEntry header;
+    const char* format;
+    const char* conversion_start;
+    size_t offset = sizeof(header);
+
+    memcpy(&header, entry, sizeof(header));
+    getAffixes(header.level, header.color, &affixes);
+
+    appendText(&writer, affixes.color, strlen(affixes.color));
+    appendText(&writer, affixes.label, strlen(affixes.label));
+
+    for (format = header.format; (conversion_start = strchr(format, '%')) != NULL; ) {
+        appendText(&writer, format, conversion_start - format);
+        format = parseConversion(conversion_start + 1, &conversion);
+
+        // Whatever comes after an argument that didn't fit is left out
+        if (!formatArgument(&writer, &conversion, entry, length, &offset)) {
+            format = "";
+            break;
+        }
+    }
+
+    appendText(&writer, format, strlen(format));
+    appendText(&writer, affixes.reset, strlen(affixes.reset));
+    appendText(&writer, affixes.newline, strlen(affixes.newline));
+
+    return writer.length;
+}
+
+/**
+ * Formats the provided conversion with the value(s) captured for it, which are
+ * read from the provided offset of the entry. Returns false if they aren't
+ * there. Every integer was widened to (u)intmax_t and every floating-point
+ * number to long double, so the length modifier is swapped out to match.
+ */
+static bool formatArgument(LogWriter* writer, const LogConversion* conversion, const char* entry, size_t length,
+        size_t* offset) {
+    char spec[LOG_MAX_SPEC_SIZE];
+    char number[16];
+    size_t spec_length = 0;
+    intmax_t signed_value;
+    uintmax_t unsigned_value;
+    long double float_value;
+    void* pointer;
+    size_t string_length;
+    int value;
+
+    spec[spec_length++] = '%';
+    appendSpec(spec, &spec_length, conversion->flags, conversion->flags_length);
+
+    if (conversion->width_length == 1 && *conversion->width == '*') {
+        if (!take(entry, length, offset, &value, sizeof(value))) {
+            return false;
+        }
+
+        appendSpec(spec, &spec_length, number, snprintf(number, sizeof(number), "%i", value));
+    } else {
+        appendSpec(spec, &spec_length, conversion->width, conversion->width_length);
+    }
+
+    if (conversion->precision_length == 1 && *conversion->precision == '*') {
+        if (!take(entry, length, offset, &value, sizeof(value))) {
+            return false;
+        }
+
+        // A negative precision is taken as if there were none
+        if (value >= 0) {
+            appendSpec(spec, &spec_length, number, snprintf(number, sizeof(number), ".%i", value));
+        }
+    } else if (conversion->precision != NULL) {
+        appendSpec(spec, &spec_length, ".", 1);
+        appendSpec(spec, &spec_length, conversion->precision, conversion->precision_length);
+    }
+
+    switch (conversion->type) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec[spec_length++] = 'j';
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec[spec_length++] = 'L';
+            break;
+        default:
+            break;
+    }
+
+    spec[spec_length++] = conversion->type;
+    spec[spec_length] = '\0';
+
+    switch (conversion->type) {
+        case 'd':
+        case 'i':
+            if (!take(entry, length, offset, &signed_value, sizeof(signed_value))) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, signed_value);
+            return true;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (!take(entry, length, offset, &unsigned_value, sizeof(unsigned_value))) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, unsigned_value);
+            return true;
+        case 'c':
+            if (!take(entry, length, offset, &value, sizeof(value))) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, value);
+            return true;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (!take(entry, length, offset, &float_value, sizeof(float_value))) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, float_value);
+            return true;
+        case 's':
+            if (*offset >= length) {
+                return false;
+            }
+
+            string_length = strnlen(entry + *offset, length - *offset);
+
+            if (*offset + string_length >= length) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, entry + *offset);
+            *offset += string_length + 1;
+            return true;
+        case 'p':
+            if (!take(entry, length, offset, &pointer, sizeof(pointer))) {
+                return false;
+            }
+
+            appendFormatted(writer, spec, pointer);
+            return true;
+        case '%':
+            appendText(writer, "%", 1);
+            return true;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Copies the next value out of the provided entry, from the provided offset.
+ * Returns false if it isn't there.
+ */
+static bool take(const char* entry, size_t length, size_t* offset, void* value, size_t size) {
+    if (*offset + size > length) {
+        return false;
+    }
+
+    memcpy(value, entry + *offset, size);
+    *offset += size;
+
+    return true;
+}
+
+/**
+ * Appends the provided text to a conversion specification being rebuilt,
+ * leaving room for its length modifier, its type and the terminator.
+ */
+static void appendSpec(char* spec, size_t* spec_length, const char* text, size_t length) {
+    size_t room = LOG_MAX_SPEC_SIZE - 3 - *spec_length;
+
+    if (length > room) {
+        length = room;
+    }
+
+    memcpy(spec + *spec_length, text, length);
+    *spec_length += length;
+}
+
+/**
+ * Appends the provided text to the provided writer, as much of it as fits.
+ */
+static void appendText(LogWriter* writer, const char* text, size_t length) {
+    size_t room = (writer->length + 1 < writer->size) ? writer->size - writer->length - 1 : 0;
+
+    memcpy(writer->out + writer->length, text, (length < room) ? length : room);
+    writer->length += length;
+}
+
+/**
+ * Appends the provided printf(...) style format string to the provided writer,
+ * as much of it as fits.
+ */
+static void appendFormatted(LogWriter* writer, const char* format, ...) {
+    size_t start = (writer->length < writer->size) ? writer->length : writer->size;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(writer->out + start, writer->size - start, format, args);
+    va_end(args);
+
+    if (length > 0) {
+        writer->length += length;
+    }
+}
+
+/**
+ * Claims as many consecutive slots of the ring as the provided entry needs, all
+ * at once, and copies the entry into them. Returns false, without waiting and
+ * without claiming any of them, if they aren't all free. Safe to call from any
+ * number of threads at once.
+ */
+static bool enqueue(const char* entry, size_t length) {
+    size_t slots = (length + LOG_RECORD_SIZE - 1) / LOG_RECORD_SIZE;
+    size_t pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+    size_t i, chunk;
+    LogRecord* record;
+
+    // NOTE ~> The flush thread hands slots back in order, so if the last of
+    //  them is free then so are all of the ones before it.
+    while (true) {
+        intptr_t diff;
+
+        record = &ring[(pos + slots - 1) & (LOG_RING_CAPACITY - 1)];
+        diff = (intptr_t) __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - (intptr_t) (pos + slots - 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueuePos, &pos, pos + slots, true, __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
                 break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
         }
     }
 
-    // Add the actual message formatter string
-    strcat(buffer_char, message);
+    for (i = 0; i < slots; i++) {
+        chunk = (length - i * LOG_RECORD_SIZE > LOG_RECORD_SIZE) ? LOG_RECORD_SIZE : length - i * LOG_RECORD_SIZE;
+        memcpy(ring[(pos + i) & (LOG_RING_CAPACITY - 1)].text, entry + i * LOG_RECORD_SIZE, chunk);
+    }
+
+    // Handing over the first slot hands over the rest along with it
+    record = &ring[pos & (LOG_RING_CAPACITY - 1)];
+    record->length = length;
+    __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * Copies the oldest entry in the ring to the provided position and hands its
+ * slots back to the producers. Returns the length of the entry, or 0 if the
+ * ring is empty. Only the flush thread may call this.
+ */
+static size_t dequeue(char* out) {
+    LogRecord* record = &ring[dequeuePos & (LOG_RING_CAPACITY - 1)];
+    size_t length, copied, chunk;
+
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != dequeuePos + 1) {
+        return 0;
+    }
+
+    length = record->length;
+
+    for (copied = 0; copied < length; copied += chunk) {
+        record = &ring[dequeuePos & (LOG_RING_CAPACITY - 1)];
+        chunk = (length - copied > LOG_RECORD_SIZE) ? LOG_RECORD_SIZE : length - copied;
 
-    // Turn off the color if it was turned on previously
-    if (!(loggerOptions[level] & LO_NOCOLOR)) {
-        strcat(buffer_char, LC_RESET);
+        memcpy(out + copied, record->text, chunk);
+        __atomic_store_n(&record->sequence, dequeuePos + LOG_RING_CAPACITY, __ATOMIC_RELEASE);
+        dequeuePos++;
     }
 
-    // Add a newline
-    strcat(buffer_char, "\n");
-    
-    vprintf(buffer_char, args);
-}
\ No newline at end of file
+    return length;
+}
+
+/**
+ * Body of the flush thread. Formats the ring's entries into one large buffer at
+ * a time and writes each buffer out with a single call, sleeping whenever there
+ * is nothing to do. Exits once asked to stop and the ring is empty.
+ */
+static void* flushLoop(void* arg) {
+    char* batch = (char*) malloc(LOG_FLUSH_SIZE);
+    char entry[LOG_MAX_ENTRY_SIZE];
+    size_t length = 0, entry_length, needed, dropped;
+    bool stopping, idle;
+
+    (void) arg;
+
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    while (true) {
+        stopping = __atomic_load_n(&stopRequested, __ATOMIC_ACQUIRE);
+        idle = true;
+
+        while ((entry_length = dequeue(entry)) > 0) {
+            idle = false;
+            needed = formatEntry(batch + length, LOG_FLUSH_SIZE - length, entry, entry_length);
+
+            // Write out what came before if the message didn't fit behind it
+            if (length + needed >= LOG_FLUSH_SIZE && length > 0) {
+                writeBatch(batch, length);
+                length = 0;
+                needed = formatEntry(batch, LOG_FLUSH_SIZE, entry, entry_length);
+            }
+
+            length += (length + needed < LOG_FLUSH_SIZE) ? needed : LOG_FLUSH_SIZE - length - 1;
+
+            if (length >= LOG_FLUSH_SIZE / 2) {
+                writeBatch(batch, length);
+                length = 0;
+                break;
+            }
+        }
+
+        if ((dropped = __atomic_exchange_n(&droppedMessages, 0, __ATOMIC_RELAXED)) > 0) {
+            idle = false;
+            length += snprintf(batch + length, LOG_FLUSH_SIZE - length, "%sWARN: Dropped %lu log messages.%s\n",
+                    LC_YELLOW, (unsigned long) dropped, LC_RESET);
+        }
+
+        if (length > 0) {
+            writeBatch(batch, length);
+            length = 0;
+        }
+
+        if (idle && stopping) {
+            break;
+        } else if (idle) {
+            sleepFor(LOG_IDLE_SLEEP_NS);
+        }
+    }
+
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * Writes out the provided batch of formatted messages with a single call.
+ */
+static void writeBatch(const char* batch, size_t length) {
+    fwrite(batch, 1, length, stdout);
+    fflush(stdout);
+}
+
+/**
+ * Sleeps for the provided number of nanoseconds (less than a second).
+ */
+static void sleepFor(long nanoseconds) {
+    struct timespec duration = { 0, nanoseconds };
+
+    nanosleep(&duration, NULL);
+}
@@ -4,6 +4,21 @@
 // NOTE ~> We aren't building out an "object" for the Logger because it is
 //  effectively a singleton. Right now, there just is no point in
 //  over-engineering it.
+//
+// By default every message is written out by whichever thread logs it. Once
+//  the asynchronous logger has been started, the caller only copies a message's
+//  format pointer and argument values (strings included) into a preallocated
+//  ring, and a background thread formats and writes them out in large batches,
+//  so that neither formatting nor a slow terminal or pipe stalls the caller. A
+//  message is always queued up (or dropped) whole. Format strings must
+//  therefore outlive the call, as string literals do. fatal(...) and program
+//  exit always drain the ring first.
+
+// NOTE ~> This macro may be defined during the build to compile away every
+//  call below the given level (0 = trace, 1 = info, 2 = warn, 3 = error).
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL 0
+#endif
 
 /**
  * Various logger levels.
@@ -26,6 +41,21 @@ typedef enum {
     LO_NOLABEL = 0x0002
 } LoggerOptions;
 
+/**
+ * What the asynchronous logger does with a message when its ring is full.
+ */
+typedef enum {
+    /**
+     * Throw the message away (and later log how many were thrown away).
+     */
+    LP_DROP,
+
+    /**
+     * Wait for the background thread to make room for it.
+     */
+    LP_BLOCK
+} LoggerOverflowPolicies;
+
 extern const char* LC_NORMAL;
 extern const char* LC_RESET;
 extern const char* LC_RED;
@@ -48,5 +78,20 @@ void warn(const char* message, ...);
 void error(const char* message, ...);
 void fatal(const char* message, ...);
 void setLoggerOptions(LoggerLevels level, int options);
+void startAsyncLogger(LoggerOverflowPolicies policy);
+void stopAsyncLogger();
+
+#if LOGGER_MIN_LEVEL > 0
+#define trace(...) ((void) 0)
+#endif
+#if LOGGER_MIN_LEVEL > 1
+#define info(...) ((void) 0)
+#endif
+#if LOGGER_MIN_LEVEL > 2
+#define warn(...) ((void) 0)
+#endif
+#if LOGGER_MIN_LEVEL > 3
+#define error(...) ((void) 0)
+#endif
 
 #endif
\ No newline at end of file
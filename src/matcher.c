@@ -0,0 +1,757 @@
+#include "matcher.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "common.h"
+#include "logger.h"
+
+#define MATCH_FLAG              0x80000000U
+#define STATE_MASK              0x7fffffffU
+#define NO_PATTERN              0xffffffffU
+#define MAX_STATES              STATE_MASK
+#define PREFILTER_SIMD_BYTES    4
+#define MAX_DISPLAY_LENGTH      32
+
+/**
+ * A pattern to look for.
+ */
+typedef struct Pattern {
+    OCTET* data;
+    UINT length;
+
+    /**
+     * The next pattern that ends in the same state of the automaton, or
+     * NO_PATTERN.
+     */
+    UINT next;
+} Pattern;
+
+/**
+ * How far into a direction of a TCP stream the search has got.
+ */
+typedef struct StreamSearch {
+    UINT state;
+    ULONG offset;
+} StreamSearch;
+
+/**
+ * State of a matcher. Nothing in it changes once the patterns are compiled, so
+ * any number of threads can search with it at once.
+ */
+struct Matcher {
+    Pattern* patterns;
+    UINT num_patterns;
+    UINT max_patterns;
+
+    /**
+     * The class of each byte value. Class zero holds every byte that doesn't
+     * appear in any pattern.
+     */
+    uint16_t classes[256];
+    UINT num_classes;
+
+    /**
+     * The state reached from each state on each class of bytes (with
+     * MATCH_FLAG set if some pattern ends there), one row of classes per state.
+     */
+    UINT* transitions;
+    UINT num_states;
+
+    /**
+     * For each state, the first of the patterns that end exactly there (or
+     * NO_PATTERN), and the nearest state along its failure links that some
+     * pattern ends at (or zero), which together list every pattern matched on
+     * reaching it.
+     */
+    UINT* first_pattern;
+    UINT* dictionary;
+
+    /**
+     * Bitmaps of the octets that patterns start with, and of the pairs of
+     * octets that they start with (a pattern of a single octet allows any
+     * octet after it).
+     */
+    uint64_t first_octets[256 / 64];
+    uint64_t* pairs;
+
+    /**
+     * The octets that patterns start with (repeated to fill the array), if
+     * there are few enough of them to scan for with SIMD compares.
+     */
+    OCTET simd_octets[PREFILTER_SIMD_BYTES];
+    bool use_simd;
+};
+
+static void addPattern(Matcher* o, const char* line, size_t length, const char* path, UINT line_number);
+static void compile(Matcher* o, bool ignore_case);
+static void buildTrie(Matcher* o);
+static void linkFailures(Matcher* o);
+static void buildPrefilter(Matcher* o, bool ignore_case);
+static size_t skipAhead(const Matcher* o, const OCTET* data, size_t i, size_t length);
+static size_t scanFirstOctets(const Matcher* o, const OCTET* data, size_t i, size_t length);
+static UINT report(const Matcher* o, UINT state, ULONG end, Match* matches, UINT max_matches, UINT reported);
+static void appendMatches(const Matcher* o, const Match* matches, UINT num_matches, UINT total, TextBuffer* buff);
+static OCTET otherCase(OCTET octet);
+static int hexValue(char digit);
+
+/**
+ * Returns whether the provided bit of the provided bitmap is set.
+ */
+static inline bool testBit(const uint64_t* bitmap, UINT bit) {
+    return (bitmap[bit >> 6] >> (bit & 63)) & 1;
+}
+
+/**
+ * Sets the provided bit of the provided bitmap.
+ */
+static inline void setBit(uint64_t* bitmap, UINT bit) {
+    bitmap[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+}
+
+/**
+ * Reads the patterns from the file at the provided path and compiles them into
+ * a new Matcher, optionally matching letters regardless of their case. Each
+ * non-empty line that doesn't start with '#' is a pattern: "0x" followed by
+ * pairs of hex digits is a sequence of octets, and anything else is text.
+ */
+Matcher* Matcher_load(const char* path, bool ignore_case) {
+    Matcher* o = (Matcher*) calloc(1, sizeof(Matcher));
+    FILE* file = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    UINT line_number = 0;
+
+    if (o == NULL) {
+        fatal("Failed to allocate the matcher.");
+    }
+
+    if (file == NULL) {
+        fatal("Failed to open the pattern file \"%s\". (%i: %s)", path, errno, strerror(errno));
+    }
+
+    while ((length = getline(&line, &capacity, file)) != -1) {
+        line_number++;
+
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            length--;
+        }
+
+        if (length > 0 && line[0] != '#') {
+            addPattern(o, line, length, path, line_number);
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if (o->num_patterns == 0) {
+        fatal("The pattern file \"%s\" has no patterns in it.", path);
+    }
+
+    compile(o, ignore_case);
+
+    info("Compiled %u patterns into %u states over %u byte classes (%lu KB).", o->num_patterns, o->num_states,
+            o->num_classes, (ULONG) (((size_t) o->num_states * o->num_classes * sizeof(UINT)) >> 10));
+
+    return o;
+}
+
+/**
+ * Looks for the patterns in the provided data, starting from (and updating)
+ * the provided state of the automaton, so that a match may span several calls
+ * (start from zero otherwise). Offsets are counted from the provided base.
+ * Up to the provided number of matches are stored, and the total number of
+ * matches is returned; if none are to be stored, the search stops at the first.
+ */
+UINT Matcher_search(const Matcher* o, const OCTET* data, size_t length, UINT* state, ULONG base, Match* matches,
+        UINT max_matches) {
+    const UINT* transitions = o->transitions;
+    UINT num_classes = o->num_classes;
+    UINT current = *state;
+    UINT total = 0;
+    UINT next;
+    size_t i = 0;
+
+    while (i < length) {
+        // NOTE ~> From the initial state, nothing short of the start of some
+        //  pattern can lead anywhere else, so everything up to that is skipped.
+        if (current == 0 && (i = skipAhead(o, data, i, length)) == length) {
+            break;
+        }
+
+        next = transitions[((size_t) current * num_classes) + o->classes[data[i]]];
+        current = next & STATE_MASK;
+
+        if (next & MATCH_FLAG) {
+            total += report(o, current, base + i + 1, matches, max_matches, total);
+
+            if (max_matches == 0) {
+                break;
+            }
+        }
+
+        i++;
+    }
+
+    *state = current;
+
+    return total;
+}
+
+/**
+ * Looks for the patterns in whatever follows the deepest decoded header of the
+ * provided frame (up to the end of the IP datagram, so padding is left out),
+ * with offsets counted from the start of the frame. Returns the total number
+ * of matches (see Matcher_search(...)).
+ */
+UINT Matcher_matchFrame(const Matcher* o, const FrameDescriptor* frame, Match* matches, UINT max_matches) {
+    UINT end = (frame->datagram_end < frame->caplen) ? frame->datagram_end : frame->caplen;
+    UINT state = 0;
+
+    if (frame->payload_offset >= end) {
+        return 0;
+    }
+
+    return Matcher_search(o, frame->data + frame->payload_offset, end - frame->payload_offset, &state,
+            frame->payload_offset, matches, max_matches);
+}
+
+/**
+ * Appends a line listing the provided matches (out of the provided total) to
+ * the provided TextBuffer.
+ */
+void Matcher_formatMatches(const Matcher* o, const Match* matches, UINT num_matches, UINT total, TextBuffer* buff) {
+    TextBuffer_appendString(buff, "[MATCH]\t");
+    appendMatches(o, matches, num_matches, total, buff);
+    TextBuffer_appendString(buff, "\n");
+}
+
+/**
+ * Frees the provided Matcher and everything associated with it.
+ */
+void Matcher_free(Matcher* o) {
+    UINT i;
+
+    for (i = 0; i < o->num_patterns; i++) {
+        free(o->patterns[i].data);
+    }
+
+    free(o->patterns);
+    free(o->transitions);
+    free(o->first_pattern);
+    free(o->dictionary);
+    free(o->pairs);
+    free(o);
+}
+
+/**
+ * Looks for the patterns of the Matcher of the StreamMatchContext provided as
+ * the context in each direction of each reassembled TCP stream, across the
+ * pieces that it is handed over in, and writes out a line for each piece that
+ * completes a match (with offsets counted from the start of the direction's
+ * data). The search starts over after a gap. Fits the TcpStreamCallback
+ * signature.
+ */
+void TcpStream_match(TcpStream* stream, UINT direction, TcpStreamEvent event, const OCTET* data, size_t length,
+        void* context) {
+    const Matcher* o = ((StreamMatchContext*) context)->matcher;
+    TextBuffer* buff = ((StreamMatchContext*) context)->text;
+    StreamSearch* search = (StreamSearch*) stream->user_data[direction];
+    int family = (stream->key.ip_version == 4) ? AF_INET : AF_INET6;
+    Match matches[MAX_REPORTED_MATCHES];
+    UINT total;
+
+    if (event == TSE_END) {
+        free(search);
+        stream->user_data[direction] = NULL;
+        return;
+    }
+
+    if (search == NULL) {
+        if ((search = (StreamSearch*) calloc(1, sizeof(StreamSearch))) == NULL) {
+            fatal("Failed to allocate the search state of a TCP stream.");
+        }
+
+        stream->user_data[direction] = search;
+    }
+
+    if (event == TSE_GAP) {
+        search->state = 0;
+        search->offset += length;
+        return;
+    }
+
+    total = Matcher_search(o, data, length, &search->state, search->offset, matches, MAX_REPORTED_MATCHES);
+    search->offset += length;
+
+    if (total == 0) {
+        return;
+    }
+
+    TextBuffer_appendString(buff, "[MATCH]\t");
+    TextBuffer_appendString(buff, LC_GREEN);
+    TextBuffer_appendString(buff, "TCP\t");
+    TextBuffer_appendAddress(buff, family, stream->key.addresses[direction]);
+    TextBuffer_appendString(buff, (family == AF_INET) ? ":" : ".");
+    TextBuffer_appendUnsigned(buff, stream->key.ports[direction]);
+    TextBuffer_appendString(buff, " > ");
+    TextBuffer_appendAddress(buff, family, stream->key.addresses[1 - direction]);
+    TextBuffer_appendString(buff, (family == AF_INET) ? ":" : ".");
+    TextBuffer_appendUnsigned(buff, stream->key.ports[1 - direction]);
+    TextBuffer_appendString(buff, LC_RESET);
+    TextBuffer_appendString(buff, "\t");
+    appendMatches(o, matches, (total < MAX_REPORTED_MATCHES) ? total : MAX_REPORTED_MATCHES, total, buff);
+    TextBuffer_appendString(buff, "\n");
+    TextBuffer_flush(buff, stdout);
+}
+
+/**
+ * Parses a line of the pattern file at the provided path and adds the pattern
+ * on it.
+ */
+static void addPattern(Matcher* o, const char* line, size_t length, const char* path, UINT line_number) {
+    Pattern* pattern;
+    bool hex = length > 2 && line[0] == '0' && (line[1] == 'x' || line[1] == 'X');
+    size_t i;
+
+    if (o->num_patterns == o->max_patterns) {
+        o->max_patterns = (o->max_patterns == 0) ? 64 : o->max_patterns * 2;
+
+        if ((o->patterns = (Pattern*) realloc(o->patterns, o->max_patterns * sizeof(Pattern))) == NULL) {
+            fatal("Failed to allocate the patterns.");
+        }
+    }
+
+    pattern = &o->patterns[o->num_patterns];
+
+    if ((pattern->data = (OCTET*) malloc(length)) == NULL) {
+        fatal("Failed to allocate a pattern.");
+    }
+
+    if (hex) {
+        if ((length % 2) != 0) {
+            fatal("The hex pattern on line %u of \"%s\" has an odd number of digits.", line_number, path);
+        }
+
+        for (i = 2; i < length; i += 2) {
+            if (hexValue(line[i]) < 0 || hexValue(line[i + 1]) < 0) {
+                fatal("The hex pattern on line %u of \"%s\" has a character that isn't a hex digit in it.",
+                        line_number, path);
+            }
+
+            pattern->data[(i - 2) / 2] = (OCTET) ((hexValue(line[i]) << 4) | hexValue(line[i + 1]));
+        }
+
+        pattern->length = (length - 2) / 2;
+    } else {
+        memcpy(pattern->data, line, length);
+        pattern->length = length;
+    }
+
+    pattern->next = NO_PATTERN;
+    o->num_patterns++;
+}
+
+/**
+ * Builds the automaton and the prefilter from the patterns.
+ */
+static void compile(Matcher* o, bool ignore_case) {
+    bool used[256] = { false };
+    ULONG total_length = 0;
+    UINT i, j;
+
+    // Give each octet that appears in a pattern a class of its own (shared
+    //  with the other case of a letter if case doesn't matter), leaving class
+    //  zero for all of the others
+    for (i = 0; i < o->num_patterns; i++) {
+        for (j = 0; j < o->patterns[i].length; j++) {
+            used[o->patterns[i].data[j]] = true;
+        }
+
+        total_length += o->patterns[i].length;
+    }
+
+    o->num_classes = 1;
+
+    for (i = 0; i < 256; i++) {
+        if (used[i] && o->classes[i] == 0) {
+            o->classes[i] = (uint16_t) o->num_classes;
+
+            if (ignore_case) {
+                o->classes[otherCase((OCTET) i)] = (uint16_t) o->num_classes;
+            }
+
+            o->num_classes++;
+        }
+    }
+
+    if (total_length + 1 > MAX_STATES) {
+        fatal("The patterns are too long to compile (%lu octets in all).", total_length);
+    }
+
+    o->transitions = (UINT*) calloc((size_t) (total_length + 1) * o->num_classes, sizeof(UINT));
+    o->first_pattern = (UINT*) malloc((total_length + 1) * sizeof(UINT));
+    o->dictionary = (UINT*) calloc(total_length + 1, sizeof(UINT));
+
+    if (o->transitions == NULL || o->first_pattern == NULL || o->dictionary == NULL) {
+        fatal("Failed to allocate an automaton for the patterns (%lu states of %u classes).", total_length + 1,
+                o->num_classes);
+    }
+
+    for (i = 0; i <= total_length; i++) {
+        o->first_pattern[i] = NO_PATTERN;
+    }
+
+    buildTrie(o);
+    linkFailures(o);
+    buildPrefilter(o, ignore_case);
+}
+
+/**
+ * Adds every pattern to the trie that the automaton starts out as, in which
+ * state zero is the root.
+ */
+static void buildTrie(Matcher* o) {
+    UINT i, j, state;
+    UINT* transition;
+
+    o->num_states = 1;
+
+    for (i = 0; i < o->num_patterns; i++) {
+        state = 0;
+
+        for (j = 0; j < o->patterns[i].length; j++) {
+            transition = &o->transitions[((size_t) state * o->num_classes) + o->classes[o->patterns[i].data[j]]];
+
+            if (*transition == 0) {
+                *transition = o->num_states++;
+            }
+
+            state = *transition;
+        }
+
+        o->patterns[i].next = o->first_pattern[state];
+        o->first_pattern[state] = i;
+    }
+}
+
+/**
+ * Turns the trie into a complete automaton, breadth first: every missing
+ * transition of a state takes the transition of the state its failure link
+ * points to (the longest proper suffix of it that is also in the trie), whose
+ * row is complete by then. Transitions into states where some pattern ends are
+ * flagged at the end.
+ */
+static void linkFailures(Matcher* o) {
+    UINT* failures = (UINT*) calloc(o->num_states, sizeof(UINT));
+    UINT* queue = (UINT*) malloc(o->num_states * sizeof(UINT));
+    UINT head = 0, tail = 0;
+    UINT state, child, failure, c;
+    size_t i;
+
+    if (failures == NULL || queue == NULL) {
+        fatal("Failed to allocate the failure links of the automaton.");
+    }
+
+    // The children of the root fail back to it, and its missing transitions
+    //  already lead back to it
+    for (c = 0; c < o->num_classes; c++) {
+        if ((child = o->transitions[c]) != 0) {
+            queue[tail++] = child;
+        }
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+
+        for (c = 0; c < o->num_classes; c++) {
+            child = o->transitions[((size_t) state * o->num_classes) + c];
+            failure = o->transitions[((size_t) failures[state] * o->num_classes) + c];
+
+            if (child == 0) {
+                o->transitions[((size_t) state * o->num_classes) + c] = failure;
+                continue;
+            }
+
+            failures[child] = failure;
+            o->dictionary[child] = (o->first_pattern[failure] != NO_PATTERN) ? failure : o->dictionary[failure];
+            queue[tail++] = child;
+        }
+    }
+
+    for (i = 0; i < (size_t) o->num_states * o->num_classes; i++) {
+        state = o->transitions[i];
+
+        if (o->first_pattern[state] != NO_PATTERN || o->dictionary[state] != 0) {
+            o->transitions[i] |= MATCH_FLAG;
+        }
+    }
+
+    free(failures);
+    free(queue);
+}
+
+/**
+ * Works out which octets and pairs of octets patterns can start with, and
+ * whether there are few enough different first octets to scan for with SIMD.
+ */
+static void buildPrefilter(Matcher* o, bool ignore_case) {
+    UINT num_first = 0;
+    UINT i, j, k;
+    OCTET first[2], second[2];
+
+    if ((o->pairs = (uint64_t*) calloc(65536 / 64, sizeof(uint64_t))) == NULL) {
+        fatal("Failed to allocate the prefilter of the matcher.");
+    }
+
+    for (i = 0; i < o->num_patterns; i++) {
+        first[0] = o->patterns[i].data[0];
+        first[1] = ignore_case ? otherCase(first[0]) : first[0];
+
+        for (j = 0; j < 2; j++) {
+            setBit(o->first_octets, first[j]);
+
+            if (o->patterns[i].length == 1) {
+                for (k = 0; k < 256; k++) {
+                    setBit(o->pairs, ((UINT) first[j] << 8) | k);
+                }
+
+                continue;
+            }
+
+            second[0] = o->patterns[i].data[1];
+            second[1] = ignore_case ? otherCase(second[0]) : second[0];
+
+            for (k = 0; k < 2; k++) {
+                setBit(o->pairs, ((UINT) first[j] << 8) | second[k]);
+            }
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (testBit(o->first_octets, i)) {
+            if (num_first == PREFILTER_SIMD_BYTES) {
+                return;
+            }
+
+            o->simd_octets[num_first++] = (OCTET) i;
+        }
+    }
+
+    for (i = num_first; i < PREFILTER_SIMD_BYTES; i++) {
+        o->simd_octets[i] = o->simd_octets[0];
+    }
+
+    o->use_simd = true;
+}
+
+/**
+ * Returns the first position from the provided one on where a pattern could
+ * start (i.e. where the pair of octets is one that some pattern starts with),
+ * or the provided length if there is none. The last octet only needs to be one
+ * that a pattern starts with, since the rest of the pattern may follow in the
+ * next piece of a stream.
+ */
+static size_t skipAhead(const Matcher* o, const OCTET* data, size_t i, size_t length) {
+    while (i < length) {
+        if (o->use_simd && (i = scanFirstOctets(o, data, i, length)) == length) {
+            return length;
+        }
+
+        if (i + 1 < length) {
+            if (testBit(o->pairs, ((UINT) data[i] << 8) | data[i + 1])) {
+                return i;
+            }
+        } else if (testBit(o->first_octets, data[i])) {
+            return i;
+        }
+
+        i++;
+    }
+
+    return length;
+}
+
+#if defined(__SSE2__)
+/**
+ * Returns the first position from the provided one on that holds an octet that
+ * some pattern starts with, or the provided length if there is none, comparing
+ * 16 octets at a time against each of the (few) first octets.
+ */
+static size_t scanFirstOctets(const Matcher* o, const OCTET* data, size_t i, size_t length) {
+    __m128i first0 = _mm_set1_epi8((char) o->simd_octets[0]);
+    __m128i first1 = _mm_set1_epi8((char) o->simd_octets[1]);
+    __m128i first2 = _mm_set1_epi8((char) o->simd_octets[2]);
+    __m128i first3 = _mm_set1_epi8((char) o->simd_octets[3]);
+    __m128i block, hits;
+    int mask;
+
+    for (; i + 16 <= length; i += 16) {
+        block = _mm_loadu_si128((const __m128i*) (data + i));
+        hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, first0), _mm_cmpeq_epi8(block, first1)),
+                _mm_or_si128(_mm_cmpeq_epi8(block, first2), _mm_cmpeq_epi8(block, first3)));
+
+        if ((mask = _mm_movemask_epi8(hits)) != 0) {
+            return i + __builtin_ctz((UINT) mask);
+        }
+    }
+
+    while (i < length && !testBit(o->first_octets, data[i])) {
+        i++;
+    }
+
+    return i;
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+/**
+ * Returns the first position from the provided one on that holds an octet that
+ * some pattern starts with, or the provided length if there is none, comparing
+ * 16 octets at a time against each of the (few) first octets.
+ */
+static size_t scanFirstOctets(const Matcher* o, const OCTET* data, size_t i, size_t length) {
+    uint8x16_t first0 = vdupq_n_u8(o->simd_octets[0]);
+    uint8x16_t first1 = vdupq_n_u8(o->simd_octets[1]);
+    uint8x16_t first2 = vdupq_n_u8(o->simd_octets[2]);
+    uint8x16_t first3 = vdupq_n_u8(o->simd_octets[3]);
+    uint8x16_t block, hits;
+
+    for (; i + 16 <= length; i += 16) {
+        block = vld1q_u8(data + i);
+        hits = vorrq_u8(vorrq_u8(vceqq_u8(block, first0), vceqq_u8(block, first1)),
+                vorrq_u8(vceqq_u8(block, first2), vceqq_u8(block, first3)));
+
+        if (vmaxvq_u8(hits) != 0) {
+            break;
+        }
+    }
+
+    while (i < length && !testBit(o->first_octets, data[i])) {
+        i++;
+    }
+
+    return i;
+}
+#else
+/**
+ * Returns the first position from the provided one on that holds an octet that
+ * some pattern starts with, or the provided length if there is none.
+ */
+static size_t scanFirstOctets(const Matcher* o, const OCTET* data, size_t i, size_t length) {
+    while (i < length && !testBit(o->first_octets, data[i])) {
+        i++;
+    }
+
+    return i;
+}
+#endif
+
+/**
+ * Stores every pattern that ends at the provided state (which was reached on
+ * the octet before the provided end offset), after the provided number already
+ * reported and as far as there is room. Returns how many there were.
+ */
+static UINT report(const Matcher* o, UINT state, ULONG end, Match* matches, UINT max_matches, UINT reported) {
+    UINT count = 0;
+    UINT pattern;
+
+    for (; state != 0; state = o->dictionary[state]) {
+        for (pattern = o->first_pattern[state]; pattern != NO_PATTERN; pattern = o->patterns[pattern].next) {
+            if (reported + count < max_matches) {
+                matches[reported + count].pattern = pattern;
+                matches[reported + count].offset = end - o->patterns[pattern].length;
+            }
+
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Appends each of the provided matches (a pattern, shown as text if it is all
+ * printable and as hex otherwise, and its offset), and how many more of the
+ * provided total there were, to the provided TextBuffer.
+ */
+static void appendMatches(const Matcher* o, const Match* matches, UINT num_matches, UINT total, TextBuffer* buff) {
+    const Pattern* pattern;
+    UINT length;
+    bool printable;
+    UINT i, j;
+
+    for (i = 0; i < num_matches; i++) {
+        pattern = &o->patterns[matches[i].pattern];
+        length = (pattern->length > MAX_DISPLAY_LENGTH) ? MAX_DISPLAY_LENGTH : pattern->length;
+        printable = true;
+
+        for (j = 0; j < length && printable; j++) {
+            printable = pattern->data[j] >= 0x20 && pattern->data[j] < 0x7f && pattern->data[j] != '"';
+        }
+
+        TextBuffer_appendString(buff, (i == 0) ? "" : ", ");
+        TextBuffer_appendString(buff, LC_YELLOW);
+
+        if (printable) {
+            TextBuffer_appendString(buff, "\"");
+            TextBuffer_append(buff, (const char*) pattern->data, length);
+            TextBuffer_appendString(buff, "\"");
+        } else {
+            TextBuffer_appendString(buff, "0x");
+            TextBuffer_appendHex(buff, pattern->data, length, 0, 0);
+        }
+
+        TextBuffer_appendString(buff, (length < pattern->length) ? "..." : "");
+        TextBuffer_appendString(buff, LC_RESET);
+        TextBuffer_appendString(buff, " at ");
+        TextBuffer_appendUnsigned(buff, matches[i].offset);
+    }
+
+    if (total > num_matches) {
+        TextBuffer_appendFormat(buff, " (and %u more)", total - num_matches);
+    }
+}
+
+/**
+ * Returns the other case of the provided octet if it is an ASCII letter, and
+ * the octet itself otherwise.
+ */
+static OCTET otherCase(OCTET octet) {
+    if (octet >= 'a' && octet <= 'z') {
+        return octet - ('a' - 'A');
+    }
+
+    if (octet >= 'A' && octet <= 'Z') {
+        return octet + ('a' - 'A');
+    }
+
+    return octet;
+}
+
+/**
+ * Returns the value of the provided hex digit, or -1 if it isn't one.
+ */
+static int hexValue(char digit) {
+    if (digit >= '0' && digit <= '9') {
+        return digit - '0';
+    }
+
+    if (digit >= 'a' && digit <= 'f') {
+        return digit - 'a' + 10;
+    }
+
+    if (digit >= 'A' && digit <= 'F') {
+        return digit - 'A' + 10;
+    }
+
+    return -1;
+}
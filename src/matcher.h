@@ -0,0 +1,61 @@
+#ifndef _MATCHER_H_
+#define _MATCHER_H_
+
+#include "common.h"
+#include "frame_descriptor.h"
+#include "tcp_reassembly.h"
+#include "text_buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// NOTE ~> A matcher looks for any of a set of patterns (read from a file, one
+//  per line, as text or as "0x"-prefixed hex bytes) in a single pass over the
+//  data, however many patterns there are. The patterns are compiled into an
+//  Aho-Corasick automaton laid out as a table with a row for each state and a
+//  column for each class of bytes (bytes that no pattern tells apart share a
+//  class, which keeps the table small), so each byte costs one lookup. Since
+//  most of the data usually doesn't even start a pattern, the automaton is
+//  skipped over it: from its initial state, the search jumps ahead to the next
+//  pair of bytes that some pattern starts with, scanning for the first bytes
+//  of the patterns with SIMD compares where there are only a few of them.
+
+/**
+ * The most matches that are reported for a single frame (or piece of a stream).
+ */
+#define MAX_REPORTED_MATCHES 16
+
+/**
+ * Where one of the patterns was found.
+ */
+typedef struct Match {
+    UINT pattern;
+
+    /**
+     * Offset of the first octet of the match, from wherever the search counts
+     * offsets from.
+     */
+    ULONG offset;
+} Match;
+
+typedef struct Matcher Matcher;
+
+/**
+ * What TcpStream_match(...) has to be handed as its context: the Matcher to
+ * look for patterns with, and the TextBuffer that each line is put together in
+ * before being written out (which can't be shared between threads).
+ */
+typedef struct StreamMatchContext {
+    const Matcher* matcher;
+    TextBuffer* text;
+} StreamMatchContext;
+
+Matcher* Matcher_load(const char* path, bool ignore_case);
+UINT Matcher_search(const Matcher* o, const OCTET* data, size_t length, UINT* state, ULONG base, Match* matches,
+        UINT max_matches);
+UINT Matcher_matchFrame(const Matcher* o, const FrameDescriptor* frame, Match* matches, UINT max_matches);
+void Matcher_formatMatches(const Matcher* o, const Match* matches, UINT num_matches, UINT total, TextBuffer* buff);
+void Matcher_free(Matcher* o);
+void TcpStream_match(TcpStream* stream, UINT direction, TcpStreamEvent event, const OCTET* data, size_t length,
+        void* context);
+
+#endif
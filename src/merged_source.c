@@ -0,0 +1,743 @@
+#include "capture_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(HAVE_PACKET_MMAP)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#elif defined(HAVE_BPF_DEVICE)
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#include "common.h"
+#include "large_buffer.h"
+#include "logger.h"
+
+#define MERGE_BUFFER_SIZE       (16 << 20)
+#define MERGE_RECORD_ALIGNMENT  8
+#define MERGE_WRAP              0xffffffffU
+#define NANOS_PER_MILLI         1000000ULL
+#define NANOS_PER_SECOND        1000000000ULL
+
+// NOTE ~> Every source hands out its own frames in the order that they were
+//  captured, so merging them means repeatedly taking the earliest of the
+//  frames at the front of each one (which a heap of the sources, keyed by the
+//  timestamp of their earliest frame, finds in O(log k)). The catch is that a
+//  source with nothing to give right now may still come up with a frame that
+//  is earlier than everything the others have, so frames are held back until
+//  either every source has something to give or the reorder window has passed
+//  (going by the latest timestamp seen on any source, or by how long the frame
+//  has been held if nothing more turns up). Frames that turn up even later than
+//  that are handed out as soon as possible, out of order, and counted.
+//  Sources only lend their frames until the batch they came from is released,
+//  which rules out holding them back in place for any length of time. Each
+//  frame is instead copied into a buffer of the source's own as soon as it is
+//  seen (so that batches go straight back to the kernel), and is handed out
+//  from there. Since a source's frames are handed out in the order that they
+//  were copied in, each buffer is a simple FIFO that is only ever appended to
+//  at one end and freed up at the other. Should a buffer fill up anyway, its
+//  frames are handed out regardless of the window to make room.
+
+/**
+ * A frame held in the buffer of the source that it came from, followed by its
+ * data (padded out to the record alignment).
+ */
+typedef struct MergeRecord {
+    /**
+     * The number of octets of the frame that were captured, or MERGE_WRAP if
+     * the rest of the buffer was skipped and the next record is at its start.
+     */
+    UINT caplen;
+    UINT wirelen;
+
+    /**
+     * When the frame was captured, in nanoseconds since the epoch.
+     */
+    uint64_t timestamp;
+
+    /**
+     * When the frame was copied into the buffer, in nanoseconds on the
+     * monotonic clock.
+     */
+    uint64_t arrival;
+
+    OCTET data[];
+} MergeRecord;
+
+/**
+ * One of the sources being merged, along with the frames of it that have been
+ * copied out but not handed out yet.
+ */
+typedef struct MergeInput {
+    CaptureSource* source;
+
+    /**
+     * Circular buffer of records, the number of octets of it that are in use
+     * (including records handed out since the last release, and any space
+     * skipped at the end), and where the next record will be read from and
+     * written to.
+     */
+    OCTET* buffer;
+    size_t used;
+    size_t read;
+    size_t write;
+
+    /**
+     * Number of octets that have been read since the last release (which can
+     * be reused once the frames in them are released).
+     */
+    size_t handed;
+
+    /**
+     * Number of records that have not been handed out yet, and the timestamp
+     * of the first of them.
+     */
+    ULONG buffered;
+    uint64_t head;
+
+    /**
+     * The latest timestamp seen on the source.
+     */
+    uint64_t newest;
+
+    /**
+     * Whether a batch of the source is being copied out, and the frame from it
+     * that did not fit in the buffer, if there is one.
+     */
+    bool open;
+    bool has_pending;
+    CapturedFrame pending;
+
+    /**
+     * Whether the source has nothing left to give.
+     */
+    bool ended;
+} MergeInput;
+
+/**
+ * State of a capture source that merges several others.
+ */
+typedef struct MergedSource {
+    MergeInput inputs[MAX_INTERFACES];
+    UINT num_inputs;
+
+    /**
+     * Min-heap of the indices of the inputs that have buffered records, keyed
+     * by the timestamp of their first one.
+     */
+    UINT heap[MAX_INTERFACES];
+    UINT heap_size;
+
+    /**
+     * Number of inputs that have not ended, and how many of them have nothing
+     * buffered (frames are held back until that's none of them, or until the
+     * window has passed).
+     */
+    UINT live;
+    UINT waiting;
+
+    /**
+     * The reorder window, the latest timestamp seen on any input, the time of
+     * the last fill (on the monotonic clock), and the timestamp up to which
+     * frames have to be handed out to make room in a buffer that is full, all
+     * in nanoseconds.
+     */
+    uint64_t window;
+    uint64_t newest;
+    uint64_t now;
+    uint64_t forced_until;
+
+    /**
+     * The timestamp of the latest frame handed out, and the number of frames
+     * that turned up too late to be handed out in order.
+     */
+    uint64_t last_handed;
+    ULONG late;
+
+    /**
+     * A descriptor that becomes readable when any of the inputs does, or -1,
+     * and a timer (where the platform needs one of its own) that makes it
+     * readable once the window of the frames being held back has passed.
+     */
+    int descriptor;
+    int timer;
+    bool timer_armed;
+} MergedSource;
+
+static int MergedSource_fill(void* state);
+static bool MergedSource_next(void* state, CapturedFrame* frame);
+static void MergedSource_release(void* state);
+static void MergedSource_close(void* state);
+static int MergedSource_getDescriptor(void* state);
+static ULONG MergedSource_getDrops(void* state);
+static void pullFrames(MergedSource* o, UINT index);
+static bool storeFrame(MergedSource* o, UINT index, const CapturedFrame* frame);
+static MergeRecord* headRecord(MergeInput* in);
+static bool mayHandOut(const MergedSource* o, const MergeRecord* record);
+static void pushInput(MergedSource* o, UINT index);
+static void popInput(MergedSource* o);
+static void siftDown(MergedSource* o, UINT position);
+static int watchDescriptors(MergedSource* o);
+static void armTimer(MergedSource* o, uint64_t delay);
+static void clearTimer(MergedSource* o);
+static size_t recordSize(UINT caplen);
+
+static const CaptureSourceOps mergedSourceOps = {
+    .fill = MergedSource_fill,
+    .next = MergedSource_next,
+    .release = MergedSource_release,
+    .close = MergedSource_close,
+    .getDescriptor = MergedSource_getDescriptor,
+    .getDrops = MergedSource_getDrops,
+    .rewind = NULL
+};
+
+/**
+ * Opens a capture source that hands out the frames of all of the provided
+ * sources (which it takes over, and closes when it is closed) in the order of
+ * their timestamps, tagging each one with the index of the source that it came
+ * from. Frames are held back for up to the provided number of milliseconds
+ * waiting for the other sources to catch up.
+ */
+CaptureSource* CaptureSource_openMerged(CaptureSource** sources, UINT count, UINT window) {
+    MergedSource* o = (MergedSource*) calloc(1, sizeof(MergedSource));
+    char description[MAX_PATH_LENGTH] = { 0 };
+    size_t length = 0;
+    UINT i;
+
+    if (o == NULL) {
+        fatal("Failed to allocate a merged capture source.");
+    }
+
+    if (count > MAX_INTERFACES) {
+        fatal("No more than %u sources can be merged (not %u).", MAX_INTERFACES, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        o->inputs[i].source = sources[i];
+
+        if ((o->inputs[i].buffer = (OCTET*) LargeBuffer_alloc(MERGE_BUFFER_SIZE, ANY_NODE)) == NULL) {
+            fatal("Failed to allocate the buffer of merged source \"%s\".", CaptureSource_getDescription(sources[i]));
+        }
+
+        if (length < sizeof(description) - 1) {
+            length += snprintf(description + length, sizeof(description) - length, (i == 0) ? "%s" : " + %s",
+                    CaptureSource_getDescription(sources[i]));
+        }
+    }
+
+    o->num_inputs = count;
+    o->live = count;
+    o->waiting = count;
+    o->window = (uint64_t) window * NANOS_PER_MILLI;
+    o->timer = -1;
+    o->descriptor = watchDescriptors(o);
+
+    return CaptureSource_new(description, &mergedSourceOps, o);
+}
+
+/**
+ * Copies whatever each of the inputs has to give into its buffer. Returns a
+ * positive value if the earliest frame can be handed out, zero if there is
+ * nothing to hand out yet, or CS_END once every input has ended and every
+ * frame has been handed out.
+ */
+static int MergedSource_fill(void* state) {
+    MergedSource* o = (MergedSource*) state;
+    MergeRecord* record;
+    struct timespec now;
+    UINT i;
+
+    if (o->timer_armed) {
+        clearTimer(o);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    o->now = ((uint64_t) now.tv_sec * NANOS_PER_SECOND) + now.tv_nsec;
+    o->forced_until = 0;
+
+    for (i = 0; i < o->num_inputs; i++) {
+        pullFrames(o, i);
+
+        // An input whose buffer is full holds up everything up to its latest
+        //  frame, so that has to go before it can take any more
+        if (o->inputs[i].has_pending && o->inputs[i].newest > o->forced_until) {
+            o->forced_until = o->inputs[i].newest;
+        }
+    }
+
+    if (o->heap_size > 0) {
+        if (mayHandOut(o, (record = headRecord(&o->inputs[o->heap[0]])))) {
+            return 1;
+        }
+
+        // Wake up once the earliest frame has been held back for the whole
+        //  window, should nothing turn up before then
+        armTimer(o, record->arrival + o->window - o->now);
+
+        return 0;
+    }
+
+    return (o->live == 0) ? CS_END : 0;
+}
+
+/**
+ * Describes the earliest frame held in the provided CapturedFrame, unless it
+ * has to be held back for longer. Returns false once nothing more can be
+ * handed out.
+ */
+static bool MergedSource_next(void* state, CapturedFrame* frame) {
+    MergedSource* o = (MergedSource*) state;
+    MergeInput* in;
+    MergeRecord* record;
+    size_t size;
+    UINT index;
+
+    if (o->heap_size == 0) {
+        return false;
+    }
+
+    index = o->heap[0];
+    in = &o->inputs[index];
+    record = headRecord(in);
+
+    if (!mayHandOut(o, record)) {
+        return false;
+    }
+
+    frame->timestamp.tv_sec = (time_t) (record->timestamp / NANOS_PER_SECOND);
+    frame->timestamp.tv_nsec = (long) (record->timestamp % NANOS_PER_SECOND);
+    frame->caplen = record->caplen;
+    frame->wirelen = record->wirelen;
+    frame->data = record->data;
+    frame->interface = index;
+
+    if (record->timestamp < o->last_handed) {
+        o->late++;
+    } else {
+        o->last_handed = record->timestamp;
+    }
+
+    // NOTE ~> The record's space is only reused once the batch is released.
+    size = recordSize(record->caplen);
+    in->read = (in->read + size == MERGE_BUFFER_SIZE) ? 0 : in->read + size;
+    in->handed += size;
+
+    if (--in->buffered == 0) {
+        popInput(o);
+
+        if (!in->ended) {
+            o->waiting++;
+        }
+    } else {
+        in->head = headRecord(in)->timestamp;
+        siftDown(o, 0);
+    }
+
+    return true;
+}
+
+/**
+ * Frees up the space taken by every frame that has been handed out.
+ */
+static void MergedSource_release(void* state) {
+    MergedSource* o = (MergedSource*) state;
+    UINT i;
+
+    for (i = 0; i < o->num_inputs; i++) {
+        o->inputs[i].used -= o->inputs[i].handed;
+        o->inputs[i].handed = 0;
+    }
+}
+
+/**
+ * Closes every input and frees everything associated with the merged source.
+ */
+static void MergedSource_close(void* state) {
+    MergedSource* o = (MergedSource*) state;
+    UINT i;
+
+    if (o->late > 0) {
+        warn("%lu frames turned up too late to be merged in order (the reorder window is %lu ms).", o->late,
+                (ULONG) (o->window / NANOS_PER_MILLI));
+    }
+
+    for (i = 0; i < o->num_inputs; i++) {
+        if (o->inputs[i].open) {
+            CaptureSource_release(o->inputs[i].source);
+        }
+
+        CaptureSource_close(o->inputs[i].source);
+        LargeBuffer_free(o->inputs[i].buffer, MERGE_BUFFER_SIZE);
+    }
+
+    if (o->descriptor != -1) {
+        close(o->descriptor);
+    }
+
+    if (o->timer != -1) {
+        close(o->timer);
+    }
+
+    free(o);
+}
+
+/**
+ * Returns the descriptor that becomes readable when any of the inputs does.
+ */
+static int MergedSource_getDescriptor(void* state) {
+    return ((MergedSource*) state)->descriptor;
+}
+
+/**
+ * Returns the number of frames that the kernel has dropped on all of the
+ * inputs put together.
+ */
+static ULONG MergedSource_getDrops(void* state) {
+    MergedSource* o = (MergedSource*) state;
+    ULONG drops = 0;
+    UINT i;
+
+    for (i = 0; i < o->num_inputs; i++) {
+        drops += CaptureSource_getDrops(o->inputs[i].source);
+    }
+
+    return drops;
+}
+
+/**
+ * Copies every frame that the input with the provided index has to give into
+ * its buffer (filling a new batch first if it has none), until its buffer is
+ * full. Batches are released as soon as all of their frames are copied.
+ */
+static void pullFrames(MergedSource* o, UINT index) {
+    MergeInput* in = &o->inputs[index];
+    int filled;
+
+    if (in->ended) {
+        return;
+    }
+
+    if (!in->open) {
+        if ((filled = CaptureSource_fill(in->source)) == CS_END) {
+            in->ended = true;
+            o->live--;
+
+            if (in->buffered == 0) {
+                o->waiting--;
+            }
+
+            return;
+        } else if (filled == 0) {
+            return;
+        }
+
+        in->open = true;
+    }
+
+    while (in->has_pending || CaptureSource_next(in->source, &in->pending)) {
+        if (!storeFrame(o, index, &in->pending)) {
+            in->has_pending = true;
+            return;
+        }
+
+        in->has_pending = false;
+    }
+
+    CaptureSource_release(in->source);
+    in->open = false;
+}
+
+/**
+ * Copies the provided frame to the end of the buffer of the input with the
+ * provided index. Returns false if there is no room for it.
+ */
+static bool storeFrame(MergedSource* o, UINT index, const CapturedFrame* frame) {
+    MergeInput* in = &o->inputs[index];
+    size_t size = recordSize(frame->caplen);
+    size_t skipped = 0;
+    MergeRecord* record;
+
+    // NOTE ~> Records never wrap around the end of the buffer. If one doesn't
+    //  fit before the end, whatever is left there is skipped.
+    if (in->write + size > MERGE_BUFFER_SIZE) {
+        skipped = MERGE_BUFFER_SIZE - in->write;
+    }
+
+    if (in->used + skipped + size > MERGE_BUFFER_SIZE) {
+        return false;
+    }
+
+    if (skipped > 0) {
+        ((MergeRecord*) (in->buffer + in->write))->caplen = MERGE_WRAP;
+        in->used += skipped;
+        in->write = 0;
+    }
+
+    record = (MergeRecord*) (in->buffer + in->write);
+    record->caplen = frame->caplen;
+    record->wirelen = frame->wirelen;
+    record->timestamp = ((uint64_t) frame->timestamp.tv_sec * NANOS_PER_SECOND) + frame->timestamp.tv_nsec;
+    record->arrival = o->now;
+    memcpy(record->data, frame->data, frame->caplen);
+
+    in->write = (in->write + size == MERGE_BUFFER_SIZE) ? 0 : in->write + size;
+    in->used += size;
+
+    if (record->timestamp > in->newest) {
+        in->newest = record->timestamp;
+
+        if (in->newest > o->newest) {
+            o->newest = in->newest;
+        }
+    }
+
+    if (in->buffered++ == 0) {
+        in->head = headRecord(in)->timestamp;
+        o->waiting--;
+        pushInput(o, index);
+    }
+
+    return true;
+}
+
+/**
+ * Returns the first record of the provided input that hasn't been handed out
+ * yet (which there must be), skipping over the end of the buffer if that's
+ * where it left off.
+ */
+static MergeRecord* headRecord(MergeInput* in) {
+    MergeRecord* record = (MergeRecord*) (in->buffer + in->read);
+
+    if (record->caplen == MERGE_WRAP) {
+        in->handed += MERGE_BUFFER_SIZE - in->read;
+        in->read = 0;
+        record = (MergeRecord*) in->buffer;
+    }
+
+    return record;
+}
+
+/**
+ * Determines whether the provided record, the earliest one held, can be handed
+ * out: when every input that may still come up with frames has some buffered
+ * (so none of them can come up with an earlier one), when the window has
+ * passed since, or when it is in the way of a full buffer.
+ */
+static bool mayHandOut(const MergedSource* o, const MergeRecord* record) {
+    return o->waiting == 0 || record->timestamp <= o->forced_until || record->timestamp + o->window <= o->newest ||
+            record->arrival + o->window <= o->now;
+}
+
+/**
+ * Adds the input with the provided index to the heap.
+ */
+static void pushInput(MergedSource* o, UINT index) {
+    UINT position = o->heap_size++;
+    UINT parent;
+
+    while (position > 0) {
+        parent = (position - 1) / 2;
+
+        if (o->inputs[o->heap[parent]].head <= o->inputs[index].head) {
+            break;
+        }
+
+        o->heap[position] = o->heap[parent];
+        position = parent;
+    }
+
+    o->heap[position] = index;
+}
+
+/**
+ * Removes the input with the earliest record from the heap.
+ */
+static void popInput(MergedSource* o) {
+    if (--o->heap_size > 0) {
+        o->heap[0] = o->heap[o->heap_size];
+        siftDown(o, 0);
+    }
+}
+
+/**
+ * Moves the input at the provided position of the heap down for as long as one
+ * of its children has an earlier record.
+ */
+static void siftDown(MergedSource* o, UINT position) {
+    UINT index = o->heap[position];
+    UINT child;
+
+    while ((child = (position * 2) + 1) < o->heap_size) {
+        if (child + 1 < o->heap_size && o->inputs[o->heap[child + 1]].head < o->inputs[o->heap[child]].head) {
+            child++;
+        }
+
+        if (o->inputs[index].head <= o->inputs[o->heap[child]].head) {
+            break;
+        }
+
+        o->heap[position] = o->heap[child];
+        position = child;
+    }
+
+    o->heap[position] = index;
+}
+
+#if defined(HAVE_PACKET_MMAP)
+/**
+ * Returns an epoll descriptor watching the descriptor of every input, as well
+ * as a timer that goes off once held back frames are due.
+ */
+static int watchDescriptors(MergedSource* o) {
+    struct epoll_event event;
+    int descriptor = epoll_create1(EPOLL_CLOEXEC);
+    int watched;
+    UINT i;
+
+    if (descriptor == -1) {
+        fatal("Failed to create an epoll descriptor for the merged sources. (%i: %s)", errno, strerror(errno));
+    }
+
+    if ((o->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        fatal("Failed to create the reorder window timer. (%i: %s)", errno, strerror(errno));
+    }
+
+    for (i = 0; i <= o->num_inputs; i++) {
+        watched = (i < o->num_inputs) ? CaptureSource_getDescriptor(o->inputs[i].source) : o->timer;
+
+        if (watched == -1) {
+            continue;
+        }
+
+        memset(&event, 0x00, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = watched;
+
+        if (epoll_ctl(descriptor, EPOLL_CTL_ADD, watched, &event) == -1) {
+            fatal("Failed to watch the merged sources for frames. (%i: %s)", errno, strerror(errno));
+        }
+    }
+
+    return descriptor;
+}
+
+/**
+ * Makes the descriptor of the merged source readable once the provided number
+ * of nanoseconds has passed.
+ */
+static void armTimer(MergedSource* o, uint64_t delay) {
+    struct itimerspec due;
+
+    memset(&due, 0x00, sizeof(due));
+    due.it_value.tv_sec = (time_t) (delay / NANOS_PER_SECOND);
+    due.it_value.tv_nsec = (long) (delay % NANOS_PER_SECOND);
+
+    if (timerfd_settime(o->timer, 0, &due, NULL) == 0) {
+        o->timer_armed = true;
+    }
+}
+
+/**
+ * Stops the timer from keeping the descriptor of the merged source readable
+ * (whether or not it has gone off).
+ */
+static void clearTimer(MergedSource* o) {
+    struct itimerspec off;
+    uint64_t expirations;
+
+    memset(&off, 0x00, sizeof(off));
+    timerfd_settime(o->timer, 0, &off, NULL);
+
+    if (read(o->timer, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        warn("Failed to clear the reorder window timer. (%i: %s)", errno, strerror(errno));
+    }
+
+    o->timer_armed = false;
+}
+#elif defined(HAVE_BPF_DEVICE)
+/**
+ * Returns a kqueue descriptor watching the descriptor of every input (the
+ * timer that goes off once held back frames are due is added when needed).
+ */
+static int watchDescriptors(MergedSource* o) {
+    struct kevent event;
+    int descriptor = kqueue();
+    int watched;
+    UINT i;
+
+    if (descriptor == -1) {
+        fatal("Failed to create a kqueue for the merged sources. (%i: %s)", errno, strerror(errno));
+    }
+
+    for (i = 0; i < o->num_inputs; i++) {
+        if ((watched = CaptureSource_getDescriptor(o->inputs[i].source)) == -1) {
+            continue;
+        }
+
+        EV_SET(&event, watched, EVFILT_READ, EV_ADD, 0, 0, NULL);
+
+        if (kevent(descriptor, &event, 1, NULL, 0, NULL) == -1) {
+            fatal("Failed to watch \"%s\" for frames. (%i: %s)", CaptureSource_getDescription(o->inputs[i].source),
+                    errno, strerror(errno));
+        }
+    }
+
+    return descriptor;
+}
+
+/**
+ * Makes the descriptor of the merged source readable once the provided number
+ * of nanoseconds (rounded up to whole milliseconds) has passed.
+ */
+static void armTimer(MergedSource* o, uint64_t delay) {
+    struct kevent event;
+
+    EV_SET(&event, 0, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, (intptr_t) ((delay + NANOS_PER_MILLI - 1) /
+            NANOS_PER_MILLI), NULL);
+
+    if (kevent(o->descriptor, &event, 1, NULL, 0, NULL) == 0) {
+        o->timer_armed = true;
+    }
+}
+
+/**
+ * Stops the timer from keeping the descriptor of the merged source readable
+ * (whether or not it has gone off), by taking whatever is pending off it.
+ */
+static void clearTimer(MergedSource* o) {
+    struct kevent events[MAX_INTERFACES + 1];
+    struct timespec immediately = { 0, 0 };
+
+    kevent(o->descriptor, NULL, 0, events, MAX_INTERFACES + 1, &immediately);
+    o->timer_armed = false;
+}
+#else
+/**
+ * Stands in for watching the inputs on platforms without live capture, where
+ * none of them has a descriptor to watch (so held back frames are only looked
+ * at again once the read timeout passes).
+ */
+static int watchDescriptors(MergedSource* o) {
+    return -1;
+}
+
+static void armTimer(MergedSource* o, uint64_t delay) {
+}
+
+static void clearTimer(MergedSource* o) {
+    o->timer_armed = false;
+}
+#endif
+
+/**
+ * Returns the size of a record holding the provided number of octets of a frame.
+ */
+static size_t recordSize(UINT caplen) {
+    return (sizeof(MergeRecord) + caplen + MERGE_RECORD_ALIGNMENT - 1) & ~((size_t) MERGE_RECORD_ALIGNMENT - 1);
+}
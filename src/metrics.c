@@ -0,0 +1,491 @@
+#include "metrics.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "common.h"
+#include "logger.h"
+#include "signals.h"
+#include "text_buffer.h"
+
+#define MAX_THREADS             128
+#define HISTORY_SIZE            61
+#define SNAPSHOT_BUFFER_SIZE    16384
+#define REQUEST_TIMEOUT         100
+#define MILLISECONDS_PER_SECOND 1000
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Totals across all threads at a particular tick.
+ */
+typedef struct Sample {
+    uint64_t frames;
+    uint64_t octets;
+    uint64_t drops;
+} Sample;
+
+static const char* etherTypeNames[ME_COUNT] = { "ipv4", "ipv6", "arp", "vlan", "other" };
+static const UINT rateWindows[] = { 1, 10, 60 };
+
+static MetricsCounters* registered[MAX_THREADS];
+static UINT numRegistered = 0;
+
+static pthread_t thread;
+static bool running = false;
+static int wakePipe[2] = { -1, -1 };
+static int listenDescriptor = -1;
+static char socketPath[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+static UINT summaryInterval = 0;
+
+/**
+ * Totals sampled once a second, oldest first (as a ring).
+ */
+static Sample history[HISTORY_SIZE];
+static UINT historyCount = 0;
+static UINT historyNext = 0;
+
+static void* metricsLoop(void* arg);
+static void takeSample();
+static double getRate(UINT window, size_t field);
+static void logSummary(Sample* last_summary);
+static void serveSnapshot();
+static void formatSnapshot(TextBuffer* buff);
+static void appendCounter(TextBuffer* buff, const char* name, const char* help, size_t field);
+static uint64_t readField(const MetricsCounters* counters, size_t field);
+static uint64_t getMonotonicMillis();
+
+/**
+ * Allocates a set of counters for the calling thread (under the provided name,
+ * which labels them in snapshots) and registers them, so that they are counted
+ * in every summary and snapshot from here on. Counters are never freed.
+ */
+MetricsCounters* Metrics_register(const char* name) {
+    MetricsCounters* counters = NULL;
+    UINT index;
+
+    if (posix_memalign((void**) &counters, 64, sizeof(MetricsCounters)) != 0) {
+        fatal("Failed to allocate metrics counters.");
+    }
+
+    memset(counters, 0x00, sizeof(MetricsCounters));
+    strncpy(counters->name, name, sizeof(counters->name) - 1);
+
+    if ((index = __atomic_fetch_add(&numRegistered, 1, __ATOMIC_ACQ_REL)) >= MAX_THREADS) {
+        fatal("No more than %u sets of metrics counters can be registered.", MAX_THREADS);
+    }
+
+    __atomic_store_n(&registered[index], counters, __ATOMIC_RELEASE);
+
+    return counters;
+}
+
+/**
+ * Starts the metrics thread, which logs a summary every provided number of
+ * seconds (unless zero) and serves snapshots on a Unix domain socket at the
+ * provided path (unless empty). Does nothing if neither is asked for.
+ */
+void Metrics_start(UINT interval, const char* socket_path) {
+    struct sockaddr_un address;
+
+    if (interval == 0 && !*socket_path) {
+        return;
+    }
+
+    summaryInterval = interval;
+
+    if (pipe(wakePipe) == -1) {
+        fatal("Failed to create the metrics wake pipe. (%i: %s)", errno, strerror(errno));
+    }
+
+    if (*socket_path) {
+        if (strlen(socket_path) >= sizeof(address.sun_path)) {
+            fatal("The stats socket path is too long (the limit is %lu characters).",
+                    (ULONG) sizeof(address.sun_path) - 1);
+        }
+
+        memset(&address, 0x00, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+        strncpy(socketPath, socket_path, sizeof(socketPath) - 1);
+
+        // NOTE ~> A socket left behind by an earlier run would make bind(...)
+        //  fail.
+        unlink(socket_path);
+
+        if ((listenDescriptor = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+                bind(listenDescriptor, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+                listen(listenDescriptor, 8) == -1) {
+            fatal("Failed to listen on the stats socket \"%s\". (%i: %s)", socket_path, errno, strerror(errno));
+        }
+
+        info("Serving stats on %s.", socket_path);
+    }
+
+    if (Signals_createThread(&thread, metricsLoop, NULL) != 0) {
+        fatal("Failed to start the metrics thread.");
+    }
+
+    running = true;
+}
+
+/**
+ * Stops the metrics thread (if it was started) and removes its socket.
+ */
+void Metrics_stop() {
+    OCTET wake = 0;
+
+    if (!running) {
+        return;
+    }
+
+    if (write(wakePipe[1], &wake, 1) == -1) {
+        fatal("Failed to wake the metrics thread. (%i: %s)", errno, strerror(errno));
+    }
+
+    pthread_join(thread, NULL);
+    running = false;
+
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+
+    if (listenDescriptor != -1) {
+        close(listenDescriptor);
+        unlink(socketPath);
+    }
+}
+
+/**
+ * Adds the provided counters to the provided totals.
+ */
+void Metrics_sum(MetricsCounters* total, const MetricsCounters* counters) {
+    size_t field;
+
+    for (field = offsetof(MetricsCounters, frames); field < sizeof(MetricsCounters); field += sizeof(uint64_t)) {
+        *(uint64_t*) ((OCTET*) total + field) += readField(counters, field);
+    }
+}
+
+/**
+ * Body of the metrics thread. Samples the counters once a second, logs a
+ * summary every so often, and serves snapshots in between, until woken up to
+ * stop.
+ */
+static void* metricsLoop(void* arg) {
+    struct pollfd descriptors[2];
+    uint64_t next_tick = getMonotonicMillis() + MILLISECONDS_PER_SECOND;
+    uint64_t now;
+    Sample last_summary = { 0, 0, 0 };
+    UINT ticks = 0;
+
+    (void) arg;
+
+    descriptors[0].fd = wakePipe[0];
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = listenDescriptor;
+    descriptors[1].events = POLLIN;
+
+    // Rates are worked out between samples, so there has to be one to start
+    // from
+    takeSample();
+
+    while (true) {
+        now = getMonotonicMillis();
+
+        if (poll(descriptors, (listenDescriptor != -1) ? 2 : 1, (now < next_tick) ? (int) (next_tick - now) : 0) ==
+                -1 && errno != EINTR) {
+            fatal("Failed to wait for stats requests. (%i: %s)", errno, strerror(errno));
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            break;
+        }
+
+        if (listenDescriptor != -1 && (descriptors[1].revents & POLLIN)) {
+            serveSnapshot();
+        }
+
+        if (getMonotonicMillis() >= next_tick) {
+            next_tick += MILLISECONDS_PER_SECOND;
+            takeSample();
+
+            if (summaryInterval > 0 && ++ticks % summaryInterval == 0) {
+                logSummary(&last_summary);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Adds the current totals across all threads to the history.
+ */
+static void takeSample() {
+    UINT count = __atomic_load_n(&numRegistered, __ATOMIC_ACQUIRE);
+    Sample* sample = &history[historyNext];
+    const MetricsCounters* counters;
+    UINT i;
+
+    memset(sample, 0x00, sizeof(Sample));
+
+    for (i = 0; i < count && i < MAX_THREADS; i++) {
+        if ((counters = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+
+        sample->frames += readField(counters, offsetof(MetricsCounters, frames));
+        sample->octets += readField(counters, offsetof(MetricsCounters, octets));
+        sample->drops += readField(counters, offsetof(MetricsCounters, drops));
+    }
+
+    historyNext = (historyNext + 1) % HISTORY_SIZE;
+
+    if (historyCount < HISTORY_SIZE) {
+        historyCount++;
+    }
+}
+
+/**
+ * Returns the average rate (per second) at which the provided field of the
+ * samples grew over the provided number of seconds (or as many as there are
+ * samples for, if fewer).
+ */
+static double getRate(UINT window, size_t field) {
+    UINT latest = (historyNext + HISTORY_SIZE - 1) % HISTORY_SIZE;
+    UINT earliest;
+
+    if (historyCount < 2) {
+        return 0.0;
+    }
+
+    if (window > historyCount - 1) {
+        window = historyCount - 1;
+    }
+
+    earliest = (latest + HISTORY_SIZE - window) % HISTORY_SIZE;
+
+    return (double) (*(uint64_t*) ((OCTET*) &history[latest] + field) -
+            *(uint64_t*) ((OCTET*) &history[earliest] + field)) / window;
+}
+
+/**
+ * Logs a summary line of what was captured since the last one. Drops are logged
+ * as a warning so that they stand out.
+ */
+static void logSummary(Sample* last_summary) {
+    Sample* latest = &history[(historyNext + HISTORY_SIZE - 1) % HISTORY_SIZE];
+    UINT window = (summaryInterval < HISTORY_SIZE - 1) ? summaryInterval : HISTORY_SIZE - 1;
+    ULONG new_drops = latest->drops - last_summary->drops;
+
+    if (new_drops > 0) {
+        warn("Stats: %lu frames (%.0f fps, %.2f Mbps), %lu dropped by the kernel in the last %u seconds (%lu in "
+                "total).", (ULONG) (latest->frames - last_summary->frames), getRate(window, offsetof(Sample, frames)),
+                getRate(window, offsetof(Sample, octets)) * 8 / 1000000, new_drops, summaryInterval,
+                (ULONG) latest->drops);
+    } else {
+        info("Stats: %lu frames (%.0f fps, %.2f Mbps), none dropped by the kernel in the last %u seconds.",
+                (ULONG) (latest->frames - last_summary->frames), getRate(window, offsetof(Sample, frames)),
+                getRate(window, offsetof(Sample, octets)) * 8 / 1000000, summaryInterval);
+    }
+
+    *last_summary = *latest;
+}
+
+/**
+ * Accepts a connection on the stats socket and writes a snapshot to it. If the
+ * client sends an HTTP request first, the snapshot is sent as an HTTP response.
+ * If it sends "dump" instead, a dump of the flight recorder is asked for (just
+ * as if SIGUSR1 had been received) and only that is acknowledged.
+ */
+static void serveSnapshot() {
+    static TextBuffer* buff = NULL;
+    struct pollfd descriptor;
+    struct timeval timeout = { 1, 0 };
+    char request[512];
+    const char* http = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+    ssize_t received = 0, sent;
+    size_t offset = 0;
+    int client;
+
+    if ((client = accept(listenDescriptor, NULL, NULL)) == -1) {
+        return;
+    }
+
+    if (buff == NULL) {
+        buff = TextBuffer_new(SNAPSHOT_BUFFER_SIZE);
+    }
+
+    // NOTE ~> Clients that don't speak HTTP (e.g. socat) don't send anything,
+    //  so the request is only waited on briefly.
+    descriptor.fd = client;
+    descriptor.events = POLLIN;
+
+    if (poll(&descriptor, 1, REQUEST_TIMEOUT) > 0) {
+        received = recv(client, request, sizeof(request) - 1, 0);
+    }
+
+    TextBuffer_clear(buff);
+
+    if (received >= 4 && strncmp(request, "dump", 4) == 0) {
+        Signals_requestDump();
+        TextBuffer_appendString(buff, "Dump requested.\n");
+    } else {
+        if (received >= 4 && strncmp(request, "GET ", 4) == 0) {
+            TextBuffer_appendString(buff, http);
+        }
+
+        formatSnapshot(buff);
+    }
+
+    // A client that stops reading can't hold the thread up for long
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    while (offset < buff->length && (sent = send(client, buff->data + offset, buff->length - offset,
+            MSG_NOSIGNAL)) > 0) {
+        offset += sent;
+    }
+
+    close(client);
+}
+
+/**
+ * Appends a snapshot of every registered thread's counters, and of the rates
+ * across all of them, to the provided TextBuffer in the Prometheus text format.
+ */
+static void formatSnapshot(TextBuffer* buff) {
+    UINT count = __atomic_load_n(&numRegistered, __ATOMIC_ACQUIRE);
+    const MetricsCounters* counters;
+    uint64_t cumulative;
+    UINT i, j, w;
+
+    appendCounter(buff, APP_NAME "_frames_total", "Frames captured.", offsetof(MetricsCounters, frames));
+    appendCounter(buff, APP_NAME "_bytes_total", "Bytes captured (as seen on the wire).",
+            offsetof(MetricsCounters, octets));
+    appendCounter(buff, APP_NAME "_kernel_drops_total", "Frames dropped by the kernel.",
+            offsetof(MetricsCounters, drops));
+    appendCounter(buff, APP_NAME "_filtered_frames_total", "Frames rejected by the filter in user space.",
+            offsetof(MetricsCounters, filtered));
+    appendCounter(buff, APP_NAME "_checksum_verified_frames_total", "Frames whose checksums were verified.",
+            offsetof(MetricsCounters, verified));
+    appendCounter(buff, APP_NAME "_bad_ip_checksums_total", "Frames with a bad IPv4 header checksum.",
+            offsetof(MetricsCounters, bad_network_checksums));
+    appendCounter(buff, APP_NAME "_bad_transport_checksums_total", "Frames with a bad TCP, UDP or ICMP checksum.",
+            offsetof(MetricsCounters, bad_transport_checksums));
+
+    TextBuffer_appendString(buff, "# HELP " APP_NAME "_ether_type_frames_total Frames captured by outer EtherType.\n"
+            "# TYPE " APP_NAME "_ether_type_frames_total counter\n");
+
+    for (i = 0; i < count && i < MAX_THREADS; i++) {
+        if ((counters = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+
+        for (j = 0; j < ME_COUNT; j++) {
+            TextBuffer_appendFormat(buff, APP_NAME "_ether_type_frames_total{thread=\"%s\",ether_type=\"%s\"} %lu\n",
+                    counters->name, etherTypeNames[j],
+                    (ULONG) readField(counters, offsetof(MetricsCounters, ether_types) + j * sizeof(uint64_t)));
+        }
+    }
+
+    TextBuffer_appendString(buff, "# HELP " APP_NAME "_read_batch_frames Frames handed over per read batch.\n"
+            "# TYPE " APP_NAME "_read_batch_frames histogram\n");
+
+    for (i = 0; i < count && i < MAX_THREADS; i++) {
+        if ((counters = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+
+        for (j = 0, cumulative = 0; j < METRICS_BATCH_BUCKETS; j++) {
+            cumulative += readField(counters, offsetof(MetricsCounters, batches) + j * sizeof(uint64_t));
+
+            if (j < METRICS_BATCH_BUCKETS - 1) {
+                TextBuffer_appendFormat(buff, APP_NAME "_read_batch_frames_bucket{thread=\"%s\",le=\"%u\"} %lu\n",
+                        counters->name, (1U << j) - 1, (ULONG) cumulative);
+            } else {
+                TextBuffer_appendFormat(buff, APP_NAME "_read_batch_frames_bucket{thread=\"%s\",le=\"+Inf\"} %lu\n",
+                        counters->name, (ULONG) cumulative);
+            }
+        }
+
+        TextBuffer_appendFormat(buff, APP_NAME "_read_batch_frames_sum{thread=\"%s\"} %lu\n", counters->name,
+                (ULONG) readField(counters, offsetof(MetricsCounters, batch_frames)));
+        TextBuffer_appendFormat(buff, APP_NAME "_read_batch_frames_count{thread=\"%s\"} %lu\n", counters->name,
+                (ULONG) cumulative);
+    }
+
+    TextBuffer_appendString(buff, "# HELP " APP_NAME "_frame_rate Frames captured per second, across all threads.\n"
+            "# TYPE " APP_NAME "_frame_rate gauge\n");
+
+    for (w = 0; w < sizeof(rateWindows) / sizeof(rateWindows[0]); w++) {
+        TextBuffer_appendFormat(buff, APP_NAME "_frame_rate{window=\"%us\"} %.1f\n", rateWindows[w],
+                getRate(rateWindows[w], offsetof(Sample, frames)));
+    }
+
+    TextBuffer_appendString(buff, "# HELP " APP_NAME "_bit_rate Bits captured per second, across all threads.\n"
+            "# TYPE " APP_NAME "_bit_rate gauge\n");
+
+    for (w = 0; w < sizeof(rateWindows) / sizeof(rateWindows[0]); w++) {
+        TextBuffer_appendFormat(buff, APP_NAME "_bit_rate{window=\"%us\"} %.1f\n", rateWindows[w],
+                getRate(rateWindows[w], offsetof(Sample, octets)) * 8);
+    }
+
+    TextBuffer_appendString(buff, "# HELP " APP_NAME "_drop_rate Frames dropped by the kernel per second, across "
+            "all threads.\n# TYPE " APP_NAME "_drop_rate gauge\n");
+
+    for (w = 0; w < sizeof(rateWindows) / sizeof(rateWindows[0]); w++) {
+        TextBuffer_appendFormat(buff, APP_NAME "_drop_rate{window=\"%us\"} %.1f\n", rateWindows[w],
+                getRate(rateWindows[w], offsetof(Sample, drops)));
+    }
+}
+
+/**
+ * Appends the provided field of every registered thread's counters, as a
+ * counter with the provided name and help text, to the provided TextBuffer.
+ */
+static void appendCounter(TextBuffer* buff, const char* name, const char* help, size_t field) {
+    UINT count = __atomic_load_n(&numRegistered, __ATOMIC_ACQUIRE);
+    const MetricsCounters* counters;
+    UINT i;
+
+    TextBuffer_appendFormat(buff, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+
+    for (i = 0; i < count && i < MAX_THREADS; i++) {
+        if ((counters = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+
+        TextBuffer_appendFormat(buff, "%s{thread=\"%s\"} %lu\n", name, counters->name,
+                (ULONG) readField(counters, field));
+    }
+}
+
+/**
+ * Reads the counter at the provided offset of the provided counters (which
+ * another thread may be writing to).
+ */
+static uint64_t readField(const MetricsCounters* counters, size_t field) {
+    return __atomic_load_n((const uint64_t*) ((const OCTET*) counters + field), __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the time (in milliseconds) on a clock that only ever moves forward.
+ */
+static uint64_t getMonotonicMillis() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * MILLISECONDS_PER_SECOND + now.tv_nsec / 1000000;
+}
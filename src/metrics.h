@@ -0,0 +1,144 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "common.h"
+#include "checksum.h"
+#include "ethernet_frame.h"
+#include <stdint.h>
+
+// NOTE ~> Metrics is a singleton hidden away behind this interface. Every
+//  capture thread registers a set of counters of its own and is the only one
+//  that ever writes to them, so counting is just a relaxed atomic store (no
+//  locks, and no cache lines bouncing between threads). Once started, a
+//  background thread sums all registered counters up once a second, keeps
+//  rolling rates over the last minute, logs a summary line every so often, and
+//  serves a snapshot in the Prometheus text format to anyone who connects to
+//  its Unix domain socket (e.g. "curl --unix-socket path http://localhost/").
+
+/**
+ * Outer EtherTypes that frames are counted by.
+ */
+typedef enum MetricsEtherType {
+    ME_IPV4,
+    ME_IPV6,
+    ME_ARP,
+    ME_VLAN,
+    ME_OTHER,
+    ME_COUNT
+} MetricsEtherType;
+
+/**
+ * Number of read batch size buckets. Bucket n counts batches of fewer than 2^n
+ * frames, and the last one counts every batch that is larger.
+ */
+#define METRICS_BATCH_BUCKETS 12
+
+/**
+ * The counters of a single capture thread.
+ */
+typedef struct MetricsCounters {
+    char name[32];
+
+    uint64_t frames;
+    uint64_t octets;
+
+    /**
+     * Frames that the kernel dropped, and frames that the filter rejected in
+     * user space (frames rejected by a filter in the kernel are never seen).
+     */
+    uint64_t drops;
+    uint64_t filtered;
+
+    /**
+     * Frames whose checksums were verified (if they are being verified at
+     * all), and how many of those had a bad IPv4 header checksum or a bad TCP,
+     * UDP or ICMP(v6) checksum.
+     */
+    uint64_t verified;
+    uint64_t bad_network_checksums;
+    uint64_t bad_transport_checksums;
+
+    uint64_t ether_types[ME_COUNT];
+
+    uint64_t batches[METRICS_BATCH_BUCKETS];
+    uint64_t batch_frames;
+} __attribute__((aligned(64))) MetricsCounters;
+
+MetricsCounters* Metrics_register(const char* name);
+void Metrics_start(UINT interval, const char* socket_path);
+void Metrics_stop();
+void Metrics_sum(MetricsCounters* total, const MetricsCounters* counters);
+
+/**
+ * Adds the provided value to the provided counter, which only the calling
+ * thread ever writes to.
+ */
+static inline void Metrics_add(uint64_t* counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets the provided counter, which only the calling thread ever writes to.
+ */
+static inline void Metrics_set(uint64_t* counter, uint64_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Counts the provided captured frame (of the provided captured and original
+ * sizes) by its outer EtherType.
+ */
+static inline void Metrics_countFrame(MetricsCounters* o, const OCTET* data, UINT caplen, UINT wirelen) {
+    UINT type = (caplen >= 14) ? ((data[12] << 8) | data[13]) : 0;
+    MetricsEtherType bucket;
+
+    if (type == ET_IPV4) {
+        bucket = ME_IPV4;
+    } else if (type == ET_IPV6) {
+        bucket = ME_IPV6;
+    } else if (type == ET_ARP) {
+        bucket = ME_ARP;
+    } else if (type == ET_VLANTAGGED || type == ET_QINQTAGGED) {
+        bucket = ME_VLAN;
+    } else {
+        bucket = ME_OTHER;
+    }
+
+    Metrics_add(&o->frames, 1);
+    Metrics_add(&o->octets, wirelen);
+    Metrics_add(&o->ether_types[bucket], 1);
+}
+
+/**
+ * Counts the outcome of verifying the checksums of a frame (as a bitmask of
+ * ChecksumFlags).
+ */
+static inline void Metrics_countChecksums(MetricsCounters* o, UINT checksums) {
+    if (checksums & (CS_NETWORK_VERIFIED | CS_TRANSPORT_VERIFIED)) {
+        Metrics_add(&o->verified, 1);
+    }
+
+    if (checksums & CS_NETWORK_BAD) {
+        Metrics_add(&o->bad_network_checksums, 1);
+    }
+
+    if (checksums & CS_TRANSPORT_BAD) {
+        Metrics_add(&o->bad_transport_checksums, 1);
+    }
+}
+
+/**
+ * Counts a read batch of the provided number of frames.
+ */
+static inline void Metrics_countBatch(MetricsCounters* o, UINT frames) {
+    UINT bucket = 0;
+
+    while (bucket < METRICS_BATCH_BUCKETS - 1 && frames >= (1U << bucket)) {
+        bucket++;
+    }
+
+    Metrics_add(&o->batches[bucket], 1);
+    Metrics_add(&o->batch_frames, frames);
+}
+
+#endif
@@ -1,39 +1,885 @@
-#include "common.h"
+#include "options.h"
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include "common.h"
+#include "checksum.h"
 #include "logger.h"
 
+#define DEFAULT_RING_BLOCK_SIZE     (1 << 20)
+#define DEFAULT_RING_BLOCK_COUNT    64
+#define DEFAULT_READ_TIMEOUT        1000
+#define DEFAULT_MERGE_WINDOW        10
+#define LATENCY_RING_BLOCK_TIMEOUT  1
+#define BATCH_RING_BLOCK_TIMEOUT    64
+#define MAX_FILTER_LENGTH           1024
+#define MAX_QUERY_LENGTH            1024
+#define BYTES_PER_MEGABYTE          1000000UL
+#define DEFAULT_QUEUE_SIZE          (4 << 20)
+#define MIN_QUEUE_SIZE              (64 << 10)
+#define MAX_FANOUT_SOCKETS          64
+#define DEFAULT_FLOW_LIMIT          65536
+#define DEFAULT_FLOW_TIMEOUT        60
+#define DEFAULT_SKETCH_MEMORY       256
+#define DEFAULT_SKETCH_INTERVAL     10
+#define DEFAULT_TOP_COUNT           10
+#define MAX_TOP_COUNT               1000
+#define DEFAULT_REASSEMBLY_MEMORY   64
+#define DEFAULT_STREAM_LIMIT        1024
+#define DEFAULT_DEFRAG_MEMORY       16
+#define DEFAULT_DEFRAG_TIMEOUT      30
+#define DEFAULT_RECORDER_SIZE       64
+#define DEFAULT_ENCODERS            2
+
 typedef struct {
     char output_file[MAX_PATH_LENGTH];
-    char interface_name[MAX_PATH_LENGTH];
+    char interface_names[MAX_INTERFACES][MAX_PATH_LENGTH];
+    UINT num_interfaces;
+    UINT merge_window;
+    char input_file[MAX_PATH_LENGTH];
+    char query[MAX_QUERY_LENGTH];
+    UINT ring_block_size;
+    UINT ring_block_count;
+    UINT ring_block_timeout;
+    UINT read_timeout;
+    CaptureMode capture_mode;
+    char filter_expression[MAX_FILTER_LENGTH];
+    bool dump_filter;
+    DumpFormat dump_format;
+    CaptureFileFormat output_format;
+    CaptureWriterLimits writer_limits;
+    PipelineConfig pipeline;
+    UINT fanout_count;
+    FanoutMode fanout_mode;
+    bool flows;
+    UINT flow_limit;
+    UINT flow_timeout;
+    bool sketches;
+    UINT sketch_memory;
+    UINT sketch_interval;
+    UINT top_count;
+    char match_file[MAX_PATH_LENGTH];
+    bool match_ignore_case;
+    bool match_streams;
+    char reassembly_directory[MAX_PATH_LENGTH];
+    UINT reassembly_memory;
+    UINT stream_limit;
+    bool defragment;
+    UINT defrag_memory;
+    UINT defrag_timeout;
+    bool verify_checksums;
+    char recorder_file[MAX_PATH_LENGTH];
+    UINT recorder_size;
+    UINT recorder_seconds;
+    char trigger_expression[MAX_FILTER_LENGTH];
+    UINT stats_interval;
+    char stats_socket[MAX_PATH_LENGTH];
+    char inject_interface[MAX_PATH_LENGTH];
+    ReplayPace replay_pace;
+    bool replay_pace_set;
+    UINT loop_count;
+    char templates[MAX_TEMPLATES][MAX_PATH_LENGTH];
+    UINT num_templates;
+    UINT generate_count;
+    LogMode log_mode;
+    LoggerOverflowPolicies log_overflow;
 } Options;
 
 static Options o = {
     .output_file = { 0 },
-    .interface_name = { 0 }
+    .interface_names = { { 0 } },
+    .num_interfaces = 0,
+    .merge_window = DEFAULT_MERGE_WINDOW,
+    .input_file = { 0 },
+    .query = { 0 },
+    .ring_block_size = DEFAULT_RING_BLOCK_SIZE,
+    .ring_block_count = DEFAULT_RING_BLOCK_COUNT,
+    .ring_block_timeout = 0,
+    .read_timeout = DEFAULT_READ_TIMEOUT,
+    .capture_mode = CM_LATENCY,
+    .filter_expression = { 0 },
+    .dump_filter = false,
+    .dump_format = DF_HEX,
+    .output_format = CFF_PCAP,
+    .writer_limits = { 0, 0, 0, DEFAULT_ENCODERS, false },
+    .pipeline = { .num_workers = 0, .queue_size = DEFAULT_QUEUE_SIZE, .num_cpus = 0 },
+    .fanout_count = 0,
+    .fanout_mode = FM_HASH,
+    .flows = false,
+    .flow_limit = DEFAULT_FLOW_LIMIT,
+    .flow_timeout = DEFAULT_FLOW_TIMEOUT,
+    .sketches = false,
+    .sketch_memory = DEFAULT_SKETCH_MEMORY,
+    .sketch_interval = DEFAULT_SKETCH_INTERVAL,
+    .top_count = DEFAULT_TOP_COUNT,
+    .match_file = { 0 },
+    .match_ignore_case = false,
+    .match_streams = false,
+    .reassembly_directory = { 0 },
+    .reassembly_memory = DEFAULT_REASSEMBLY_MEMORY,
+    .stream_limit = DEFAULT_STREAM_LIMIT,
+    .defragment = false,
+    .defrag_memory = DEFAULT_DEFRAG_MEMORY,
+    .defrag_timeout = DEFAULT_DEFRAG_TIMEOUT,
+    .verify_checksums = false,
+    .recorder_file = { 0 },
+    .recorder_size = DEFAULT_RECORDER_SIZE,
+    .recorder_seconds = 0,
+    .trigger_expression = { 0 },
+    .stats_interval = 0,
+    .stats_socket = { 0 },
+    .inject_interface = { 0 },
+    .replay_pace = { .mode = RM_ORIGINAL, .speed = 1.0, .rate = 0 },
+    .replay_pace_set = false,
+    .loop_count = 1,
+    .templates = { { 0 } },
+    .num_templates = 0,
+    .generate_count = 0,
+    .log_mode = LM_SYNC,
+    .log_overflow = LP_DROP
 };
 
+static UINT parseUnsigned(const char* value, const char* name);
+static void setReplayPace(ReplayMode mode);
+
 void Options_setOutputFile(char* file) {
-    strncpy(o.output_file, file, MAX_PATH_LENGTH);
+    strncpy(o.output_file, file, sizeof(o.output_file) - 1);
+    o.output_file[sizeof(o.output_file) - 1] = '\0';
 }
 
 char* Options_getOutputFile() {
     return o.output_file;
 }
 
-void Options_setInterfaceName(char* name) {
-    strncpy(o.interface_name, name, MAX_PATH_LENGTH);
+void Options_addInterfaceName(char* name) {
+    if (o.num_interfaces == MAX_INTERFACES) {
+        fatal("No more than %u interfaces can be captured at once.", MAX_INTERFACES);
+    }
+
+    strncpy(o.interface_names[o.num_interfaces++], name, MAX_PATH_LENGTH - 1);
+}
+
+UINT Options_getInterfaceCount() {
+    return o.num_interfaces;
+}
+
+char* Options_getInterfaceName(UINT index) {
+    return o.interface_names[index];
+}
+
+void Options_setMergeWindow(char* milliseconds) {
+    o.merge_window = parseUnsigned(milliseconds, "merge window");
+}
+
+UINT Options_getMergeWindow() {
+    return o.merge_window;
+}
+
+void Options_setInputFile(char* file) {
+    strncpy(o.input_file, file, sizeof(o.input_file) - 1);
+    o.input_file[sizeof(o.input_file) - 1] = '\0';
+}
+
+char* Options_getInputFile() {
+    return o.input_file;
+}
+
+void Options_setQuery(char* query) {
+    if (strlen(query) >= MAX_QUERY_LENGTH) {
+        fatal("The query is too long (the limit is %d characters).", MAX_QUERY_LENGTH - 1);
+    }
+
+    strncpy(o.query, query, sizeof(o.query) - 1);
+    o.query[sizeof(o.query) - 1] = '\0';
+}
+
+char* Options_getQuery() {
+    return o.query;
+}
+
+void Options_setRingBlockSize(char* size) {
+    o.ring_block_size = parseUnsigned(size, "ring block size");
+}
+
+UINT Options_getRingBlockSize() {
+    return o.ring_block_size;
+}
+
+void Options_setRingBlockCount(char* count) {
+    o.ring_block_count = parseUnsigned(count, "ring block count");
+}
+
+UINT Options_getRingBlockCount() {
+    return o.ring_block_count;
+}
+
+void Options_setRingBlockTimeout(char* timeout) {
+    o.ring_block_timeout = parseUnsigned(timeout, "ring block timeout");
+}
+
+/**
+ * Returns the ring block timeout, which defaults to something suitable for the
+ * capture mode unless it has been set explicitly.
+ */
+UINT Options_getRingBlockTimeout() {
+    if (o.ring_block_timeout == 0) {
+        return (o.capture_mode == CM_LATENCY) ? LATENCY_RING_BLOCK_TIMEOUT : BATCH_RING_BLOCK_TIMEOUT;
+    }
+
+    return o.ring_block_timeout;
+}
+
+void Options_setReadTimeout(char* timeout) {
+    o.read_timeout = parseUnsigned(timeout, "read timeout");
+}
+
+UINT Options_getReadTimeout() {
+    return o.read_timeout;
+}
+
+void Options_setCaptureMode(char* mode) {
+    if (strcmp(mode, "latency") == 0) {
+        o.capture_mode = CM_LATENCY;
+    } else if (strcmp(mode, "batch") == 0) {
+        o.capture_mode = CM_BATCH;
+    } else {
+        fatal("Invalid capture mode specified (\"%s\"). Expected \"latency\" or \"batch\".", mode);
+    }
+}
+
+CaptureMode Options_getCaptureMode() {
+    return o.capture_mode;
+}
+
+void Options_setFilterExpression(char* expression) {
+    if (strlen(expression) >= MAX_FILTER_LENGTH) {
+        fatal("The filter expression is too long (the limit is %d characters).", MAX_FILTER_LENGTH - 1);
+    }
+
+    strncpy(o.filter_expression, expression, sizeof(o.filter_expression) - 1);
+    o.filter_expression[sizeof(o.filter_expression) - 1] = '\0';
+}
+
+char* Options_getFilterExpression() {
+    return o.filter_expression;
+}
+
+void Options_setDumpFilter(bool dump) {
+    o.dump_filter = dump;
+}
+
+bool Options_getDumpFilter() {
+    return o.dump_filter;
+}
+
+void Options_setDumpFormat(char* format) {
+    if (strcmp(format, "hex") == 0) {
+        o.dump_format = DF_HEX;
+    } else if (strcmp(format, "hex-ascii") == 0) {
+        o.dump_format = DF_HEX_ASCII;
+    } else if (strcmp(format, "none") == 0) {
+        o.dump_format = DF_NONE;
+    } else {
+        fatal("Invalid dump format specified (\"%s\"). Expected \"hex\", \"hex-ascii\" or \"none\".", format);
+    }
+}
+
+DumpFormat Options_getDumpFormat() {
+    return o.dump_format;
+}
+
+void Options_setOutputFormat(char* format) {
+    if (strcmp(format, "pcap") == 0) {
+        o.output_format = CFF_PCAP;
+    } else if (strcmp(format, "pcapng") == 0) {
+        o.output_format = CFF_PCAPNG;
+    } else if (strcmp(format, "compact") == 0) {
+        o.output_format = CFF_COMPACT;
+    } else {
+        fatal("Invalid output format specified (\"%s\"). Expected \"pcap\", \"pcapng\" or \"compact\".", format);
+    }
+}
+
+CaptureFileFormat Options_getOutputFormat() {
+    return o.output_format;
+}
+
+void Options_setRotateSize(char* megabytes) {
+    o.writer_limits.rotate_size = parseUnsigned(megabytes, "output file size") * BYTES_PER_MEGABYTE;
+}
+
+void Options_setRotateSeconds(char* seconds) {
+    o.writer_limits.rotate_seconds = parseUnsigned(seconds, "output file rotation interval");
+}
+
+void Options_setPreallocateSize(char* megabytes) {
+    o.writer_limits.preallocate_size = parseUnsigned(megabytes, "output file preallocation size") * BYTES_PER_MEGABYTE;
+}
+
+void Options_setEncoders(char* count) {
+    o.writer_limits.encoders = parseUnsigned(count, "number of encoder threads");
+}
+
+void Options_setIndex(bool index) {
+    o.writer_limits.index = index;
+}
+
+bool Options_getIndex() {
+    return o.writer_limits.index;
+}
+
+const CaptureWriterLimits* Options_getWriterLimits() {
+    return &o.writer_limits;
+}
+
+void Options_setWorkers(char* count) {
+    o.pipeline.num_workers = parseUnsigned(count, "number of decode workers");
+}
+
+void Options_setQueueSize(char* size) {
+    o.pipeline.queue_size = parseUnsigned(size, "queue size");
+}
+
+void Options_setCpuAffinity(char* cpus) {
+    char* cpu;
+
+    o.pipeline.num_cpus = 0;
+
+    for (cpu = strtok(cpus, ","); cpu != NULL; cpu = strtok(NULL, ",")) {
+        if (o.pipeline.num_cpus == PIPELINE_MAX_CPUS) {
+            fatal("No more than %u CPUs can be specified.", PIPELINE_MAX_CPUS);
+        }
+
+        o.pipeline.cpus[o.pipeline.num_cpus++] = (int) parseUnsigned(cpu, "CPU");
+    }
+}
+
+const PipelineConfig* Options_getPipelineConfig() {
+    return &o.pipeline;
+}
+
+void Options_setFanoutCount(char* count) {
+    o.fanout_count = parseUnsigned(count, "number of fanout sockets");
+}
+
+UINT Options_getFanoutCount() {
+    return o.fanout_count;
+}
+
+void Options_setFanoutMode(char* mode) {
+    if (strcmp(mode, "hash") == 0) {
+        o.fanout_mode = FM_HASH;
+    } else if (strcmp(mode, "cpu") == 0) {
+        o.fanout_mode = FM_CPU;
+    } else if (strcmp(mode, "rollover") == 0) {
+        o.fanout_mode = FM_ROLLOVER;
+    } else {
+        fatal("Invalid fanout mode specified (\"%s\"). Expected \"hash\", \"cpu\" or \"rollover\".", mode);
+    }
+}
+
+FanoutMode Options_getFanoutMode() {
+    return o.fanout_mode;
+}
+
+void Options_setFlows(bool flows) {
+    o.flows = flows;
+}
+
+bool Options_getFlows() {
+    return o.flows;
+}
+
+void Options_setFlowLimit(char* count) {
+    o.flow_limit = parseUnsigned(count, "flow limit");
+}
+
+UINT Options_getFlowLimit() {
+    return o.flow_limit;
+}
+
+void Options_setFlowTimeout(char* seconds) {
+    o.flow_timeout = parseUnsigned(seconds, "flow timeout");
+}
+
+UINT Options_getFlowTimeout() {
+    return o.flow_timeout;
+}
+
+void Options_setSketches(bool sketches) {
+    o.sketches = sketches;
+}
+
+bool Options_getSketches() {
+    return o.sketches;
+}
+
+void Options_setSketchMemory(char* kilobytes) {
+    o.sketch_memory = parseUnsigned(kilobytes, "sketch memory");
+}
+
+UINT Options_getSketchMemory() {
+    return o.sketch_memory;
+}
+
+void Options_setSketchInterval(char* seconds) {
+    o.sketch_interval = parseUnsigned(seconds, "sketch interval");
+}
+
+UINT Options_getSketchInterval() {
+    return o.sketch_interval;
+}
+
+void Options_setTopCount(char* count) {
+    o.top_count = parseUnsigned(count, "top count");
+}
+
+UINT Options_getTopCount() {
+    return o.top_count;
+}
+
+void Options_setMatchFile(char* path) {
+    strncpy(o.match_file, path, MAX_PATH_LENGTH - 1);
+}
+
+char* Options_getMatchFile() {
+    return o.match_file;
+}
+
+void Options_setMatchIgnoreCase(bool ignore_case) {
+    o.match_ignore_case = ignore_case;
+}
+
+bool Options_getMatchIgnoreCase() {
+    return o.match_ignore_case;
+}
+
+void Options_setMatchStreams(bool streams) {
+    o.match_streams = streams;
+}
+
+bool Options_getMatchStreams() {
+    return o.match_streams;
+}
+
+void Options_setReassemblyDirectory(char* directory) {
+    strncpy(o.reassembly_directory, directory, sizeof(o.reassembly_directory) - 1);
+    o.reassembly_directory[sizeof(o.reassembly_directory) - 1] = '\0';
+}
+
+char* Options_getReassemblyDirectory() {
+    return o.reassembly_directory;
+}
+
+void Options_setReassemblyMemory(char* megabytes) {
+    o.reassembly_memory = parseUnsigned(megabytes, "reassembly memory");
+}
+
+/**
+ * Returns the most memory (in bytes) that TCP reassembly may buffer
+ * out-of-order data in.
+ */
+size_t Options_getReassemblyMemory() {
+    return (size_t) o.reassembly_memory * BYTES_PER_MEGABYTE;
+}
+
+void Options_setStreamLimit(char* count) {
+    o.stream_limit = parseUnsigned(count, "stream limit");
+}
+
+UINT Options_getStreamLimit() {
+    return o.stream_limit;
+}
+
+void Options_setDefragment(bool defragment) {
+    o.defragment = defragment;
+}
+
+bool Options_getDefragment() {
+    return o.defragment;
+}
+
+void Options_setDefragMemory(char* megabytes) {
+    o.defrag_memory = parseUnsigned(megabytes, "defragmentation memory");
+}
+
+/**
+ * Returns the most memory (in bytes) that fragments may be buffered in.
+ */
+size_t Options_getDefragMemory() {
+    return (size_t) o.defrag_memory * BYTES_PER_MEGABYTE;
+}
+
+void Options_setDefragTimeout(char* seconds) {
+    o.defrag_timeout = parseUnsigned(seconds, "defragmentation timeout");
+}
+
+UINT Options_getDefragTimeout() {
+    return o.defrag_timeout;
+}
+
+void Options_setVerifyChecksums(bool verify) {
+    o.verify_checksums = verify;
+}
+
+bool Options_getVerifyChecksums() {
+    return o.verify_checksums;
+}
+
+void Options_setRecorderFile(char* file) {
+    strncpy(o.recorder_file, file, MAX_PATH_LENGTH - 1);
+}
+
+char* Options_getRecorderFile() {
+    return o.recorder_file;
 }
 
-char* Options_getInterfaceName() {
-    return o.interface_name;
+void Options_setRecorderSize(char* megabytes) {
+    o.recorder_size = parseUnsigned(megabytes, "flight recorder size");
+}
+
+/**
+ * Returns how many bytes of frames the flight recorder holds on to.
+ */
+size_t Options_getRecorderSize() {
+    return (size_t) o.recorder_size * BYTES_PER_MEGABYTE;
+}
+
+void Options_setRecorderSeconds(char* seconds) {
+    o.recorder_seconds = parseUnsigned(seconds, "flight recorder duration");
+}
+
+UINT Options_getRecorderSeconds() {
+    return o.recorder_seconds;
+}
+
+void Options_setTriggerExpression(char* expression) {
+    if (strlen(expression) >= MAX_FILTER_LENGTH) {
+        fatal("The trigger expression is too long (the limit is %d characters).", MAX_FILTER_LENGTH - 1);
+    }
+
+    strncpy(o.trigger_expression, expression, sizeof(o.trigger_expression) - 1);
+    o.trigger_expression[sizeof(o.trigger_expression) - 1] = '\0';
+}
+
+char* Options_getTriggerExpression() {
+    return o.trigger_expression;
+}
+
+void Options_setStatsInterval(char* seconds) {
+    o.stats_interval = parseUnsigned(seconds, "stats interval");
+}
+
+UINT Options_getStatsInterval() {
+    return o.stats_interval;
+}
+
+void Options_setStatsSocket(char* path) {
+    strncpy(o.stats_socket, path, MAX_PATH_LENGTH - 1);
+}
+
+char* Options_getStatsSocket() {
+    return o.stats_socket;
+}
+
+void Options_setInjectInterface(char* name) {
+    strncpy(o.inject_interface, name, MAX_PATH_LENGTH - 1);
+}
+
+char* Options_getInjectInterface() {
+    return o.inject_interface;
+}
+
+void Options_setReplaySpeed(char* multiplier) {
+    char* end;
+
+    setReplayPace(RM_ORIGINAL);
+    o.replay_pace.speed = strtod(multiplier, &end);
+
+    if (end == multiplier || *end != '\0' || !(o.replay_pace.speed > 0.0)) {
+        fatal("Invalid replay speed specified (\"%s\"). Expected a multiplier greater than zero.", multiplier);
+    }
+}
+
+void Options_setReplayRate(char* rate) {
+    setReplayPace(RM_RATE);
+    o.replay_pace.rate = parseUnsigned(rate, "replay rate");
+}
+
+void Options_setReplayTopSpeed() {
+    setReplayPace(RM_TOP_SPEED);
+}
+
+const ReplayPace* Options_getReplayPace() {
+    return &o.replay_pace;
+}
+
+void Options_setLoopCount(char* count) {
+    o.loop_count = parseUnsigned(count, "loop count");
+}
+
+UINT Options_getLoopCount() {
+    return o.loop_count;
+}
+
+void Options_addTemplate(char* spec) {
+    if (o.num_templates == MAX_TEMPLATES) {
+        fatal("No more than %u templates can be specified.", MAX_TEMPLATES);
+    }
+
+    strncpy(o.templates[o.num_templates++], spec, MAX_PATH_LENGTH - 1);
+}
+
+UINT Options_getTemplateCount() {
+    return o.num_templates;
+}
+
+char* Options_getTemplate(UINT index) {
+    return o.templates[index];
+}
+
+void Options_setGenerateCount(char* count) {
+    o.generate_count = parseUnsigned(count, "frame count");
+}
+
+UINT Options_getGenerateCount() {
+    return o.generate_count;
+}
+
+void Options_setLogMode(char* mode) {
+    if (strcmp(mode, "sync") == 0) {
+        o.log_mode = LM_SYNC;
+    } else if (strcmp(mode, "async") == 0) {
+        o.log_mode = LM_ASYNC;
+    } else {
+        fatal("Invalid log mode specified (\"%s\"). Expected \"sync\" or \"async\".", mode);
+    }
+}
+
+LogMode Options_getLogMode() {
+    return o.log_mode;
+}
+
+void Options_setLogOverflow(char* policy) {
+    if (strcmp(policy, "drop") == 0) {
+        o.log_overflow = LP_DROP;
+    } else if (strcmp(policy, "block") == 0) {
+        o.log_overflow = LP_BLOCK;
+    } else {
+        fatal("Invalid log overflow policy specified (\"%s\"). Expected \"drop\" or \"block\".", policy);
+    }
+}
+
+LoggerOverflowPolicies Options_getLogOverflow() {
+    return o.log_overflow;
 }
 
 /**
  * Verifies that required options are specified, otherwise fatals the program.
  */
 void Options_checkForRequiredOptions() {
-    if (!*o.interface_name) {
-        fatal("A network interface name must be specified.");
+    if (o.dump_filter) {
+        if (!*o.filter_expression) {
+            fatal("A filter expression must be specified for it to be dumped.");
+        }
+
+        // NOTE ~> Dumping the filter doesn't capture anything, so it doesn't
+        //  need anything to capture from.
+        return;
+    }
+
+    if (o.num_templates > 0) {
+        if (!*o.inject_interface) {
+            fatal("Generated frames can only be injected (so an interface to inject them onto must be specified).");
+        }
+
+        if (*o.input_file) {
+            fatal("Frames cannot be both generated and read from an input file.");
+        }
+
+        if (*o.filter_expression) {
+            fatal("Generated frames cannot be filtered.");
+        }
+
+        if (o.replay_pace_set && o.replay_pace.mode == RM_ORIGINAL) {
+            fatal("Generated frames can only be paced at a fixed rate or as fast as possible.");
+        }
+
+        if (o.loop_count != 1) {
+            fatal("The loop count only applies when replaying an input file.");
+        }
+
+        // Generated frames go out as fast as possible unless a rate was asked
+        //  for
+        if (!o.replay_pace_set) {
+            o.replay_pace.mode = RM_TOP_SPEED;
+        }
+    } else if (o.generate_count > 0) {
+        fatal("The frame count only applies when generating frames.");
+    }
+
+    if (*o.inject_interface) {
+        if ((!*o.input_file && o.num_templates == 0) || o.num_interfaces > 0) {
+            fatal("Frames can only be injected from an input file (or the standard input) or generated.");
+        }
+
+        if (*o.output_file || o.pipeline.num_workers > 0 || o.fanout_count > 0 || o.flows || o.sketches ||
+                *o.match_file || *o.reassembly_directory || o.defragment || o.verify_checksums || *o.recorder_file) {
+            fatal("Injecting frames cannot be combined with writing, decoding, verifying, matching or tracking "
+                    "them.");
+        }
+
+        if (o.loop_count == 0) {
+            fatal("The loop count must be at least one.");
+        }
+
+        if (o.replay_pace.mode == RM_RATE && o.replay_pace.rate == 0) {
+            fatal("The replay rate must be at least one frame per second.");
+        }
+    } else if (o.replay_pace_set || o.loop_count != 1) {
+        fatal("The replay speed, rate and loop count only apply when injecting frames.");
+    }
+
+    if (o.num_interfaces == 0 && !*o.input_file && o.num_templates == 0) {
+        fatal("Either a network interface name or an input file must be specified.");
+    }
+
+    if (o.num_interfaces > 0 && *o.input_file) {
+        fatal("A network interface name and an input file cannot both be specified.");
+    }
+
+    if (o.ring_block_size == 0 || (o.ring_block_size & (o.ring_block_size - 1)) != 0) {
+        fatal("The ring block size must be a power of two (not %u).", o.ring_block_size);
+    }
+
+    if (o.ring_block_count == 0) {
+        fatal("The ring must have at least one block.");
+    }
+
+    if (o.read_timeout == 0) {
+        fatal("The read timeout must be at least one millisecond.");
+    }
+
+    if (!*o.output_file && (o.writer_limits.rotate_size > 0 || o.writer_limits.rotate_seconds > 0 ||
+            o.writer_limits.preallocate_size > 0)) {
+        fatal("Output files can only be rotated or preallocated when an output file is specified.");
+    }
+
+    if (o.writer_limits.index && !*o.output_file) {
+        if (!*o.input_file || strcmp(o.input_file, "-") == 0) {
+            fatal("Only output files and input files (other than the standard input) can be indexed.");
+        }
+
+        if (*o.query || *o.inject_interface || *o.filter_expression || o.pipeline.num_workers > 0 || o.flows ||
+                o.sketches || *o.match_file || *o.reassembly_directory || o.defragment || o.verify_checksums ||
+                *o.recorder_file) {
+            fatal("Indexing an input file cannot be combined with querying, filtering, injecting, decoding, "
+                    "verifying, matching or tracking frames.");
+        }
+    }
+
+    if (*o.query && !*o.input_file) {
+        fatal("A query only applies when reading an input file.");
+    }
+
+    if (o.writer_limits.encoders == 0 || o.writer_limits.encoders > WRITER_MAX_ENCODERS) {
+        fatal("Between 1 and %u encoder threads can be used (not %u).", WRITER_MAX_ENCODERS,
+                o.writer_limits.encoders);
+    }
+
+    if (o.pipeline.num_workers > PIPELINE_MAX_WORKERS) {
+        fatal("No more than %u decode workers can be used (not %u).", PIPELINE_MAX_WORKERS, o.pipeline.num_workers);
+    }
+
+    if (o.pipeline.num_workers > 0 && *o.output_file) {
+        fatal("Decode workers only apply to printed frames, not to those written to an output file.");
+    }
+
+    if (o.fanout_count > MAX_FANOUT_SOCKETS) {
+        fatal("No more than %u fanout sockets can be used (not %u).", MAX_FANOUT_SOCKETS, o.fanout_count);
+    }
+
+    if (o.fanout_count > 0 && o.num_interfaces > 1) {
+        fatal("Fanout sockets can only be used on a single interface.");
+    }
+
+    if (o.fanout_count > 0 && (*o.input_file || *o.output_file || o.pipeline.num_workers > 0)) {
+        fatal("Fanout sockets can only be used to print frames captured live (without an output file or decode "
+                "workers).");
+    }
+
+    if (o.flows && (*o.output_file || o.pipeline.num_workers > 0)) {
+        fatal("Flows can only be tracked when frames are not written to an output file or handed to decode "
+                "workers.");
+    }
+
+    if (*o.reassembly_directory && (*o.output_file || o.pipeline.num_workers > 0)) {
+        fatal("TCP streams can only be reassembled when frames are not written to an output file or handed to "
+                "decode workers.");
+    }
+
+    if (o.reassembly_memory == 0 || o.stream_limit == 0) {
+        fatal("The reassembly memory and stream limit must both be at least one.");
+    }
+
+    if (o.defragment && (*o.output_file || o.pipeline.num_workers > 0 || o.fanout_count > 0)) {
+        fatal("IP fragments can only be reassembled when frames are not written to an output file or spread over "
+                "decode workers or fanout sockets.");
+    }
+
+    if (o.defrag_memory == 0 || o.defrag_timeout == 0) {
+        fatal("The defragmentation memory and timeout must both be at least one.");
+    }
+
+    if (o.sketches && (*o.output_file || o.pipeline.num_workers > 0 || o.fanout_count > 0)) {
+        fatal("Sketches can only be kept when frames are not written to an output file or spread over decode "
+                "workers or fanout sockets.");
+    }
+
+    if ((o.match_ignore_case || o.match_streams) && !*o.match_file) {
+        fatal("A pattern file must be specified for matches to ignore case or span TCP streams.");
+    }
+
+    if (*o.match_file && *o.reassembly_directory) {
+        fatal("Patterns cannot be matched while TCP streams are reassembled into files (use --match-streams to "
+                "match across reassembled streams instead).");
+    }
+
+    if (o.match_streams && (*o.output_file || o.pipeline.num_workers > 0)) {
+        fatal("Patterns can only be matched across TCP streams when frames are not written to an output file or "
+                "handed to decode workers.");
+    }
+
+    if (!*o.recorder_file && (o.recorder_size != DEFAULT_RECORDER_SIZE || o.recorder_seconds > 0 ||
+            *o.trigger_expression)) {
+        fatal("The flight recorder's size, duration and trigger only apply when a flight recorder file is "
+                "specified.");
+    }
+
+    if (*o.recorder_file && (*o.output_file || o.pipeline.num_workers > 0 || o.fanout_count > 0 || o.flows ||
+            o.sketches || *o.match_file || *o.reassembly_directory || o.defragment)) {
+        fatal("The flight recorder cannot be combined with writing, decoding, matching or tracking frames.");
+    }
+
+    if (o.recorder_size == 0) {
+        fatal("The flight recorder size must be at least one megabyte.");
+    }
+
+    if (o.sketch_memory == 0 || o.sketch_interval == 0 || o.top_count == 0) {
+        fatal("The sketch memory, sketch interval and top count must all be at least one.");
+    }
+
+    if (o.top_count > MAX_TOP_COUNT) {
+        fatal("No more than the top %u values can be kept (not %u).", MAX_TOP_COUNT, o.top_count);
+    }
+
+    if (o.flow_limit == 0 || o.flow_timeout == 0) {
+        fatal("The flow limit and flow timeout must both be at least one.");
+    }
+
+    if (o.pipeline.queue_size < MIN_QUEUE_SIZE || (o.pipeline.queue_size & (o.pipeline.queue_size - 1)) != 0) {
+        fatal("The queue size must be a power of two of at least %u bytes (not %lu).", MIN_QUEUE_SIZE,
+                (ULONG) o.pipeline.queue_size);
     }
 }
 
@@ -41,8 +887,122 @@ void Options_checkForRequiredOptions() {
  * Outputs options (only required & specified) to the log.
  */
 void Options_logOptions() {
-    info("Interface set to %s.", Options_getInterfaceName());
+    UINT i;
+
+    for (i = 0; i < o.num_interfaces; i++) {
+        info("Interface set to %s.", o.interface_names[i]);
+    }
+    if (o.num_interfaces > 1) {
+        info("Interfaces merged with a reorder window of %u ms.", o.merge_window);
+    }
+    if (*o.input_file) {
+        info("Input file set to %s.", Options_getInputFile());
+    }
+    if (*o.query) {
+        info("Query set to \"%s\".", o.query);
+    }
     if (*o.output_file) {
         info("Output file set to %s.", Options_getOutputFile());
     }
-}
\ No newline at end of file
+    if (o.writer_limits.rotate_size > 0) {
+        info("Output files rotated every %lu bytes.", o.writer_limits.rotate_size);
+    }
+    if (o.writer_limits.rotate_seconds > 0) {
+        info("Output files rotated every %u seconds.", o.writer_limits.rotate_seconds);
+    }
+    if (o.writer_limits.index) {
+        info("%s indexed.", *o.output_file ? "Output files" : "Input file");
+    }
+    if (o.output_format == CFF_COMPACT && (*o.output_file || *o.recorder_file)) {
+        info("Output files encoded in the compact format by %u thread(s).", o.writer_limits.encoders);
+    }
+    if (o.sketches) {
+        info("Reporting the top %u values of every field every %u seconds (in %u KB).", o.top_count,
+                o.sketch_interval, o.sketch_memory);
+    }
+    if (o.flows) {
+        info("Tracking up to %u flows (idle for at most %u seconds).", o.flow_limit, o.flow_timeout);
+    }
+    if (*o.match_file) {
+        info("Matching the patterns in %s%s%s.", o.match_file, o.match_ignore_case ? " regardless of case" : "",
+                o.match_streams ? " across TCP streams" : "");
+    }
+    if (*o.reassembly_directory) {
+        info("Reassembling up to %u TCP streams into %s (buffering at most %u MB).", o.stream_limit,
+                o.reassembly_directory, o.reassembly_memory);
+    }
+    if (o.defragment) {
+        info("Reassembling IP fragments (buffering at most %u MB, for at most %u seconds).", o.defrag_memory,
+                o.defrag_timeout);
+    }
+    if (o.verify_checksums) {
+        info("Verifying IPv4, TCP, UDP and ICMP checksums (with %s sums).", Checksum_getImplementation());
+    }
+    if (*o.recorder_file) {
+        if (o.recorder_seconds > 0) {
+            info("Keeping the last %u MB (and at most %u seconds) of frames for %s.", o.recorder_size,
+                    o.recorder_seconds, o.recorder_file);
+        } else {
+            info("Keeping the last %u MB of frames for %s.", o.recorder_size, o.recorder_file);
+        }
+    }
+    if (*o.trigger_expression) {
+        info("Trigger set to \"%s\".", o.trigger_expression);
+    }
+    if (o.stats_interval > 0) {
+        info("Logging capture stats every %u seconds.", o.stats_interval);
+    }
+    if (*o.inject_interface) {
+        if (o.replay_pace.mode == RM_RATE) {
+            info("Injecting onto %s at %u frames per second.", o.inject_interface, o.replay_pace.rate);
+        } else if (o.replay_pace.mode == RM_TOP_SPEED) {
+            info("Injecting onto %s as fast as possible.", o.inject_interface);
+        } else {
+            info("Injecting onto %s at %g times the original pace.", o.inject_interface, o.replay_pace.speed);
+        }
+    }
+    if (o.loop_count > 1) {
+        info("Replaying the input file %u times.", o.loop_count);
+    }
+    if (o.num_templates > 0) {
+        if (o.generate_count > 0) {
+            info("Generating %u frames from %u templates.", o.generate_count, o.num_templates);
+        } else {
+            info("Generating frames from %u templates until stopped.", o.num_templates);
+        }
+    }
+    if (*o.filter_expression) {
+        info("Filter set to \"%s\".", Options_getFilterExpression());
+    }
+}
+
+/**
+ * Parses the provided option value as an unsigned integer (in any base that
+ * strtoul(...) understands), fataling the program if it is not one.
+ */
+static UINT parseUnsigned(const char* value, const char* name) {
+    char* end;
+    unsigned long parsed;
+
+    errno = 0;
+    parsed = strtoul(value, &end, 0);
+
+    if (errno != 0 || end == value || *end != '\0' || *value == '-' || parsed > (UINT) -1) {
+        fatal("Invalid %s specified (\"%s\").", name, value);
+    }
+
+    return (UINT) parsed;
+}
+
+/**
+ * Switches to the provided way of pacing injected frames, fataling the
+ * program if a different one has already been asked for.
+ */
+static void setReplayPace(ReplayMode mode) {
+    if (o.replay_pace_set) {
+        fatal("Only one of --speed, --pps and --top-speed can be specified.");
+    }
+
+    o.replay_pace.mode = mode;
+    o.replay_pace_set = true;
+}
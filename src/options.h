@@ -5,10 +5,140 @@
 //  where these functions are called in the program, they will always be
 //  interacting with the same structure of option variables.
 
+#include "common.h"
+#include "capture_source.h"
+#include "capture_writer.h"
+#include "logger.h"
+#include "pipeline.h"
+#include "replay.h"
+#include "text_buffer.h"
+#include <stdbool.h>
+
+/**
+ * Whether live capture should favor handing frames over as soon as possible or
+ * handing them over in as large batches as possible.
+ */
+typedef enum CaptureMode {
+    CM_LATENCY,
+    CM_BATCH
+} CaptureMode;
+
+/**
+ * Whether log messages are written out by whoever logs them or handed to a
+ * background thread to be written out in batches.
+ */
+typedef enum LogMode {
+    LM_SYNC,
+    LM_ASYNC
+} LogMode;
+
 void Options_setOutputFile(char* file);
 char* Options_getOutputFile();
-void Options_setInterfaceName(char* name);
-char* Options_getInterfaceName();
+void Options_addInterfaceName(char* name);
+UINT Options_getInterfaceCount();
+char* Options_getInterfaceName(UINT index);
+void Options_setMergeWindow(char* milliseconds);
+UINT Options_getMergeWindow();
+void Options_setInputFile(char* file);
+char* Options_getInputFile();
+void Options_setQuery(char* query);
+char* Options_getQuery();
+void Options_setRingBlockSize(char* size);
+UINT Options_getRingBlockSize();
+void Options_setRingBlockCount(char* count);
+UINT Options_getRingBlockCount();
+void Options_setRingBlockTimeout(char* timeout);
+UINT Options_getRingBlockTimeout();
+void Options_setReadTimeout(char* timeout);
+UINT Options_getReadTimeout();
+void Options_setCaptureMode(char* mode);
+CaptureMode Options_getCaptureMode();
+void Options_setFilterExpression(char* expression);
+char* Options_getFilterExpression();
+void Options_setDumpFilter(bool dump);
+bool Options_getDumpFilter();
+void Options_setDumpFormat(char* format);
+DumpFormat Options_getDumpFormat();
+void Options_setOutputFormat(char* format);
+CaptureFileFormat Options_getOutputFormat();
+void Options_setRotateSize(char* megabytes);
+void Options_setRotateSeconds(char* seconds);
+void Options_setPreallocateSize(char* megabytes);
+void Options_setEncoders(char* count);
+void Options_setIndex(bool index);
+bool Options_getIndex();
+const CaptureWriterLimits* Options_getWriterLimits();
+void Options_setWorkers(char* count);
+void Options_setQueueSize(char* size);
+void Options_setCpuAffinity(char* cpus);
+const PipelineConfig* Options_getPipelineConfig();
+void Options_setFanoutCount(char* count);
+UINT Options_getFanoutCount();
+void Options_setFanoutMode(char* mode);
+FanoutMode Options_getFanoutMode();
+void Options_setFlows(bool flows);
+bool Options_getFlows();
+void Options_setFlowLimit(char* count);
+UINT Options_getFlowLimit();
+void Options_setFlowTimeout(char* seconds);
+UINT Options_getFlowTimeout();
+void Options_setSketches(bool sketches);
+bool Options_getSketches();
+void Options_setSketchMemory(char* kilobytes);
+UINT Options_getSketchMemory();
+void Options_setSketchInterval(char* seconds);
+UINT Options_getSketchInterval();
+void Options_setTopCount(char* count);
+UINT Options_getTopCount();
+void Options_setMatchFile(char* path);
+char* Options_getMatchFile();
+void Options_setMatchIgnoreCase(bool ignore_case);
+bool Options_getMatchIgnoreCase();
+void Options_setMatchStreams(bool streams);
+bool Options_getMatchStreams();
+void Options_setReassemblyDirectory(char* directory);
+char* Options_getReassemblyDirectory();
+void Options_setReassemblyMemory(char* megabytes);
+size_t Options_getReassemblyMemory();
+void Options_setStreamLimit(char* count);
+UINT Options_getStreamLimit();
+void Options_setDefragment(bool defragment);
+bool Options_getDefragment();
+void Options_setDefragMemory(char* megabytes);
+size_t Options_getDefragMemory();
+void Options_setDefragTimeout(char* seconds);
+UINT Options_getDefragTimeout();
+void Options_setVerifyChecksums(bool verify);
+bool Options_getVerifyChecksums();
+void Options_setRecorderFile(char* file);
+char* Options_getRecorderFile();
+void Options_setRecorderSize(char* megabytes);
+size_t Options_getRecorderSize();
+void Options_setRecorderSeconds(char* seconds);
+UINT Options_getRecorderSeconds();
+void Options_setTriggerExpression(char* expression);
+char* Options_getTriggerExpression();
+void Options_setStatsInterval(char* seconds);
+UINT Options_getStatsInterval();
+void Options_setStatsSocket(char* path);
+char* Options_getStatsSocket();
+void Options_setInjectInterface(char* name);
+char* Options_getInjectInterface();
+void Options_setReplaySpeed(char* multiplier);
+void Options_setReplayRate(char* rate);
+void Options_setReplayTopSpeed();
+const ReplayPace* Options_getReplayPace();
+void Options_setLoopCount(char* count);
+UINT Options_getLoopCount();
+void Options_addTemplate(char* spec);
+UINT Options_getTemplateCount();
+char* Options_getTemplate(UINT index);
+void Options_setGenerateCount(char* count);
+UINT Options_getGenerateCount();
+void Options_setLogMode(char* mode);
+LogMode Options_getLogMode();
+void Options_setLogOverflow(char* policy);
+LoggerOverflowPolicies Options_getLogOverflow();
 void Options_checkForRequiredOptions();
 void Options_logOptions();
 
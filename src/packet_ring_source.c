@@ -0,0 +1,501 @@
+#include "capture_source.h"
+#include "common.h"
+
+#ifdef HAVE_PACKET_MMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include "logger.h"
+#include "options.h"
+
+#define VLAN_TPID           0x8100
+#define VLAN_TAG_SIZE       4
+#define MAC_ADDRESSES_SIZE  12
+
+// NOTE ~> With TPACKET_V3 frames are packed into blocks back-to-back, so the
+//  frame size only matters to the kernel's sanity checks of the ring request.
+#define RING_FRAME_SIZE     TPACKET_ALIGN(2048)
+
+/**
+ * State of a capture source that reads from a Linux AF_PACKET socket's
+ * memory-mapped TPACKET_V3 receive ring.
+ */
+typedef struct PacketRingSource {
+    /**
+     * Descriptor of the AF_PACKET socket.
+     */
+    int descriptor;
+
+    /**
+     * The ring shared with the kernel and its geometry.
+     */
+    OCTET* ring;
+    size_t ring_size;
+    UINT block_size;
+    UINT block_count;
+
+    /**
+     * Index of the block that is (or will next be) handed to the sniffer.
+     */
+    UINT current_block;
+
+    /**
+     * Walk state within the current block: the next frame header and the
+     * number of frames in the block that have not been walked yet.
+     */
+    OCTET* next_frame;
+    UINT frames_remaining;
+
+    /**
+     * Frames dropped by the kernel so far (reading the kernel's counters
+     * resets them).
+     */
+    ULONG drops;
+
+    /**
+     * Whether frames sent by this host have to be skipped as they are walked,
+     * since the socket sees them twice (see openRing(...)).
+     */
+    bool skip_outgoing;
+} PacketRingSource;
+
+static int PacketRingSource_fill(void* state);
+static bool PacketRingSource_next(void* state, CapturedFrame* frame);
+static void PacketRingSource_release(void* state);
+static void PacketRingSource_close(void* state);
+static int PacketRingSource_getDescriptor(void* state);
+static ULONG PacketRingSource_getDrops(void* state);
+
+static const CaptureSourceOps packetRingSourceOps = {
+    .fill = PacketRingSource_fill,
+    .next = PacketRingSource_next,
+    .release = PacketRingSource_release,
+    .close = PacketRingSource_close,
+    .getDescriptor = PacketRingSource_getDescriptor,
+    .getDrops = PacketRingSource_getDrops,
+    .rewind = NULL
+};
+
+static CaptureSource* openRing(const char* interface_name, const Filter* filter, UINT fanout, int* group);
+static void attachFilter(int descriptor, const Filter* filter);
+static void joinFanout(PacketRingSource* source, UINT fanout, int* group);
+static bool isLoopback(int descriptor, const char* interface_name);
+
+/**
+ * Opens an AF_PACKET socket on the provided network interface, sets up a
+ * TPACKET_V3 receive ring shared with the kernel according to the ring options,
+ * attaches the provided Filter (if any) to the socket, and wraps it in a
+ * CaptureSource.
+ */
+CaptureSource* CaptureSource_openDevice(const char* interface_name, const Filter* filter) {
+    return openRing(interface_name, filter, 0, NULL);
+}
+
+/**
+ * Does the same as CaptureSource_openDevice(...), but also has the socket join
+ * the PACKET_FANOUT group with the provided ID, or, if that is FANOUT_NEW_GROUP,
+ * create a new group (whose ID is stored in its place). The kernel spreads the
+ * interface's frames over all of the sockets in a group according to the
+ * provided mode (each frame going to exactly one of them), so that each socket
+ * can be drained by a thread of its own.
+ */
+CaptureSource* CaptureSource_openDeviceFanout(const char* interface_name, const Filter* filter, FanoutMode mode,
+        int* group) {
+    UINT fanout;
+
+    switch (mode) {
+        case FM_CPU:
+            fanout = PACKET_FANOUT_CPU;
+            break;
+
+        case FM_ROLLOVER:
+            fanout = PACKET_FANOUT_ROLLOVER;
+            break;
+
+        default:
+            // NOTE ~> Fragments carry no ports, so have the kernel put
+            //  datagrams back together before hashing them.
+            fanout = PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+            break;
+    }
+
+    return openRing(interface_name, filter, fanout, group);
+}
+
+/**
+ * Does the actual work of opening an AF_PACKET socket with a receive ring (see
+ * CaptureSource_openDevice(...)). A group (unless NULL) also has the socket join
+ * a fanout group (see CaptureSource_openDeviceFanout(...)) with the provided
+ * mode and flags.
+ */
+static CaptureSource* openRing(const char* interface_name, const Filter* filter, UINT fanout, int* group) {
+    int descriptor, version, reserve;
+    UINT interface_index;
+    struct tpacket_req3 request;
+    struct sockaddr_ll address;
+    PacketRingSource* source;
+
+    // Open a raw socket
+    // NOTE ~> The socket is opened for no protocol at all so that it doesn't
+    //  see anything (from any interface) until it is bound further down, by
+    //  which point the filter is in place.
+    if ((descriptor = socket(AF_PACKET, SOCK_RAW, 0)) == -1) {
+        if (errno == EPERM) {
+            fatal("The system is denying permission to open packet sockets. Make sure propper permissions are being "
+                    "used (e.g. root or CAP_NET_RAW).");
+        }
+
+        fatal("Failed to open an AF_PACKET socket. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Opened an AF_PACKET socket (file descriptor = %d).", descriptor);
+    }
+
+    // Switch to version 3 of the ring format so that frames are packed into
+    //  variable-length slots within large blocks
+    version = TPACKET_V3;
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        fatal("Failed to switch the AF_PACKET socket to TPACKET_V3. (%i: %s)", errno, strerror(errno));
+    }
+
+    // Reserve headroom in front of each frame
+    // NOTE ~> The kernel strips the outermost 802.1Q tag off of frames and hands
+    //  it over separately. The headroom lets us put the tag back in place (see
+    //  PacketRingSource_next(...)) so that frames look the same as they would
+    //  coming from any other source.
+    reserve = VLAN_TAG_SIZE;
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) == -1) {
+        fatal("Failed to reserve headroom in the AF_PACKET ring. (%i: %s)", errno, strerror(errno));
+    }
+
+    // Request the ring
+    source = (PacketRingSource*) calloc(1, sizeof(PacketRingSource));
+
+    if (source == NULL) {
+        fatal("Failed to allocate the AF_PACKET capture source.");
+    }
+
+    source->descriptor = descriptor;
+    source->block_size = Options_getRingBlockSize();
+    source->block_count = Options_getRingBlockCount();
+    source->ring_size = (size_t) source->block_size * source->block_count;
+
+    if (source->block_size % getpagesize() != 0 || source->block_size < RING_FRAME_SIZE) {
+        fatal("The ring block size (%u bytes) must be a multiple of the page size (%d bytes).", source->block_size,
+                getpagesize());
+    }
+
+    memset(&request, 0x00, sizeof(request));
+    request.tp_block_size = source->block_size;
+    request.tp_block_nr = source->block_count;
+    request.tp_frame_size = RING_FRAME_SIZE;
+    request.tp_frame_nr = (source->block_size / RING_FRAME_SIZE) * source->block_count;
+    request.tp_retire_blk_tov = Options_getRingBlockTimeout();
+    request.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) == -1) {
+        fatal("Failed to set up a %u x %u byte AF_PACKET receive ring. (%i: %s)", source->block_count,
+                source->block_size, errno, strerror(errno));
+    }
+
+    source->ring = (OCTET*) mmap(NULL, source->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+            descriptor, 0);
+
+    // NOTE ~> Locking the ring into memory is only an optimization, so try
+    //  again without it if we aren't allowed to.
+    if (source->ring == MAP_FAILED) {
+        source->ring = (OCTET*) mmap(NULL, source->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+
+    if (source->ring == MAP_FAILED) {
+        fatal("Failed to map the AF_PACKET receive ring into memory. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Mapped a %u x %u byte AF_PACKET receive ring (block timeout = %u ms).", source->block_count,
+                source->block_size, Options_getRingBlockTimeout());
+    }
+
+    // Have the kernel drop frames that don't match the filter before they ever
+    //  reach the ring
+    if (filter != NULL) {
+        attachFilter(descriptor, filter);
+    }
+
+    // Associate with a particular network interface, seeing every protocol on it
+    if ((interface_index = if_nametoindex(interface_name)) == 0) {
+        fatal("Failed to find the network interface \"%s\". (%i: %s)", interface_name, errno, strerror(errno));
+    }
+
+    memset(&address, 0x00, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = interface_index;
+
+    if (bind(descriptor, (struct sockaddr*) &address, sizeof(address)) == -1) {
+        fatal("Failed to bind the AF_PACKET socket to the network interface \"%s\". (%i: %s)", interface_name, errno,
+                strerror(errno));
+    }
+    else {
+        info("Bound the AF_PACKET socket to the network interface \"%s\".", interface_name);
+    }
+
+    // Ignore frames on their way out of a loopback interface
+    // NOTE ~> Everything sent over a loopback interface comes straight back in
+    //  on it, so a socket bound to one sees every frame twice. The kernel can
+    //  be told not to hand outgoing frames over at all (since Linux 4.20),
+    //  and otherwise they are skipped as the ring is walked. Frames reach the
+    //  sockets of a fanout group through the group, which only heeds its own
+    //  flag for this.
+    if (isLoopback(descriptor, interface_name) && group != NULL) {
+#ifdef PACKET_FANOUT_FLAG_IGNORE_OUTGOING
+        fanout |= PACKET_FANOUT_FLAG_IGNORE_OUTGOING;
+#else
+        source->skip_outgoing = true;
+#endif
+    } else if (isLoopback(descriptor, interface_name)) {
+#ifdef PACKET_IGNORE_OUTGOING
+        int ignore = 1;
+
+        if (setsockopt(descriptor, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore)) == -1) {
+            source->skip_outgoing = true;
+        }
+#else
+        source->skip_outgoing = true;
+#endif
+    }
+
+    // Join the fanout group (which the kernel only allows for bound sockets)
+    if (group != NULL) {
+        joinFanout(source, fanout, group);
+    }
+
+    return CaptureSource_new(interface_name, &packetRingSourceOps, source);
+}
+
+/**
+ * Attaches the provided Filter's program to the provided AF_PACKET socket.
+ */
+static void attachFilter(int descriptor, const Filter* filter) {
+    struct sock_fprog program;
+
+    // NOTE ~> A FilterInstruction is laid out exactly like a sock_filter.
+    program.len = Filter_getLength(filter);
+    program.filter = (struct sock_filter*) Filter_getInstructions(filter);
+
+    if (setsockopt(descriptor, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1) {
+        fatal("Failed to attach the filter to the AF_PACKET socket. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Attached a %u instruction filter to the AF_PACKET socket.", program.len);
+    }
+}
+
+/**
+ * Has the provided source's socket join the fanout group with the provided ID
+ * (or create a new one, storing its ID in its place) with the provided mode and
+ * flags.
+ */
+static void joinFanout(PacketRingSource* source, UINT fanout, int* group) {
+    socklen_t length = sizeof(int);
+    UINT id = (UINT) *group & 0xffff;
+    int argument;
+
+    // NOTE ~> A new group is given an ID that no other group has by the kernel,
+    //  so that it can't be mixed up with the group of another process on the
+    //  same interface (which would split both processes' traffic between them).
+    if (*group == FANOUT_NEW_GROUP) {
+        fanout |= PACKET_FANOUT_FLAG_UNIQUEID;
+        id = 0;
+    }
+
+    argument = (int) (id | (fanout << 16));
+
+    if (setsockopt(source->descriptor, SOL_PACKET, PACKET_FANOUT, &argument, sizeof(argument)) == -1) {
+#ifdef PACKET_FANOUT_FLAG_IGNORE_OUTGOING
+        // NOTE ~> Kernels older than 4.20 refuse the flag, in which case
+        //  outgoing frames are skipped as the ring is walked instead.
+        if (errno == EINVAL && (fanout & PACKET_FANOUT_FLAG_IGNORE_OUTGOING)) {
+            source->skip_outgoing = true;
+            joinFanout(source, fanout & ~PACKET_FANOUT_FLAG_UNIQUEID & ~PACKET_FANOUT_FLAG_IGNORE_OUTGOING, group);
+
+            return;
+        }
+#endif
+        fatal("Failed to join the AF_PACKET socket to a fanout group. (%i: %s)", errno, strerror(errno));
+    }
+
+    if (*group == FANOUT_NEW_GROUP) {
+        if (getsockopt(source->descriptor, SOL_PACKET, PACKET_FANOUT, &argument, &length) == -1) {
+            fatal("Failed to get the ID of the new fanout group. (%i: %s)", errno, strerror(errno));
+        }
+
+        *group = argument & 0xffff;
+    }
+
+    info("Joined the AF_PACKET socket to fanout group %d.", *group);
+}
+
+/**
+ * Returns whether the provided network interface is a loopback interface
+ * (asking through the provided socket).
+ */
+static bool isLoopback(int descriptor, const char* interface_name) {
+    struct ifreq request;
+
+    memset(&request, 0x00, sizeof(request));
+    strncpy(request.ifr_name, interface_name, sizeof(request.ifr_name) - 1);
+
+    if (ioctl(descriptor, SIOCGIFFLAGS, &request) == -1) {
+        fatal("Failed to get the flags of the network interface \"%s\". (%i: %s)", interface_name, errno,
+                strerror(errno));
+    }
+
+    return (request.ifr_flags & IFF_LOOPBACK) != 0;
+}
+
+/**
+ * Checks whether the kernel has handed the current block of the ring over to
+ * us and, if so, starts walking it.
+ */
+static int PacketRingSource_fill(void* state) {
+    PacketRingSource* o = (PacketRingSource*) state;
+    struct tpacket_block_desc* block;
+
+    block = (struct tpacket_block_desc*) (o->ring + ((size_t) o->current_block * o->block_size));
+
+    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        o->frames_remaining = 0;
+
+        return 0;
+    }
+
+    o->next_frame = (OCTET*) block + block->hdr.bh1.offset_to_first_pkt;
+    o->frames_remaining = block->hdr.bh1.num_pkts;
+
+    return o->frames_remaining;
+}
+
+/**
+ * Walks to the next frame header in the current block and describes the
+ * Ethernet Frame that follows it, straight out of the ring.
+ */
+static bool PacketRingSource_next(void* state, CapturedFrame* frame) {
+    PacketRingSource* o = (PacketRingSource*) state;
+    struct tpacket3_hdr* header;
+    struct sockaddr_ll* address;
+
+    // Skip over frames on their way out, if they have to be
+    while (true) {
+        if (o->frames_remaining == 0) {
+            return false;
+        }
+
+        header = (struct tpacket3_hdr*) o->next_frame;
+        address = (struct sockaddr_ll*) (o->next_frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+        if (!o->skip_outgoing || address->sll_pkttype != PACKET_OUTGOING) {
+            break;
+        }
+
+        o->next_frame += header->tp_next_offset;
+        o->frames_remaining--;
+    }
+
+    frame->timestamp.tv_sec = header->tp_sec;
+    frame->timestamp.tv_nsec = header->tp_nsec;
+    frame->caplen = header->tp_snaplen;
+    frame->wirelen = header->tp_len;
+    frame->data = o->next_frame + header->tp_mac;
+
+    // Put back the 802.1Q tag that the kernel stripped off of the frame by
+    // sliding the MAC addresses into the reserved headroom and writing the tag
+    // into the gap that this leaves
+    if (header->tp_status & TP_STATUS_VLAN_VALID) {
+        UINT tpid = (header->tp_status & TP_STATUS_VLAN_TPID_VALID) ? header->hv1.tp_vlan_tpid : VLAN_TPID;
+        UINT tci = header->hv1.tp_vlan_tci;
+
+        memmove(frame->data - VLAN_TAG_SIZE, frame->data, MAC_ADDRESSES_SIZE);
+        frame->data -= VLAN_TAG_SIZE;
+        frame->data[MAC_ADDRESSES_SIZE] = (tpid >> 8) & 0xff;
+        frame->data[MAC_ADDRESSES_SIZE + 1] = tpid & 0xff;
+        frame->data[MAC_ADDRESSES_SIZE + 2] = (tci >> 8) & 0xff;
+        frame->data[MAC_ADDRESSES_SIZE + 3] = tci & 0xff;
+        frame->caplen += VLAN_TAG_SIZE;
+        frame->wirelen += VLAN_TAG_SIZE;
+    }
+
+    o->next_frame += header->tp_next_offset;
+    o->frames_remaining--;
+
+    return true;
+}
+
+/**
+ * Hands the current block back to the kernel and moves on to the next one.
+ */
+static void PacketRingSource_release(void* state) {
+    PacketRingSource* o = (PacketRingSource*) state;
+    struct tpacket_block_desc* block;
+
+    block = (struct tpacket_block_desc*) (o->ring + ((size_t) o->current_block * o->block_size));
+
+    // Only blocks that we actually own can be handed back
+    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        return;
+    }
+
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    o->current_block = (o->current_block + 1) % o->block_count;
+    o->frames_remaining = 0;
+}
+
+/**
+ * Unmaps the receive ring and closes the AF_PACKET socket.
+ */
+static void PacketRingSource_close(void* state) {
+    PacketRingSource* o = (PacketRingSource*) state;
+
+    munmap(o->ring, o->ring_size);
+    close(o->descriptor);
+    info("Closed AF_PACKET socket with file descriptor %d", o->descriptor);
+
+    free(o);
+}
+
+/**
+ * Returns the AF_PACKET socket, which polls as readable once the kernel has
+ * handed a block of the ring over to us.
+ */
+static int PacketRingSource_getDescriptor(void* state) {
+    return ((PacketRingSource*) state)->descriptor;
+}
+
+/**
+ * Returns the number of frames that the kernel has dropped because the ring
+ * was full.
+ */
+static ULONG PacketRingSource_getDrops(void* state) {
+    PacketRingSource* o = (PacketRingSource*) state;
+    struct tpacket_stats_v3 stats;
+    socklen_t size = sizeof(stats);
+
+    if (getsockopt(o->descriptor, SOL_PACKET, PACKET_STATISTICS, &stats, &size) == 0) {
+        o->drops += stats.tp_drops;
+    }
+
+    return o->drops;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,314 @@
+#include "injector.h"
+#include "common.h"
+
+#ifdef HAVE_PACKET_MMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include "logger.h"
+#include "options.h"
+
+#define TX_FRAME_SIZE       TPACKET_ALIGN(2048)
+#define VLAN_TAG_SIZE       4
+#define SLOT_WAIT_TIMEOUT   10
+
+// NOTE ~> The kernel expects a frame to start this far into its slot (unless
+//  told otherwise).
+#define TX_DATA_OFFSET      (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+/**
+ * State of an injector that writes into a Linux AF_PACKET socket's
+ * memory-mapped TPACKET_V2 transmit ring.
+ */
+typedef struct PacketTxInjector {
+    /**
+     * Descriptor of the AF_PACKET socket.
+     */
+    int descriptor;
+
+    /**
+     * The ring shared with the kernel and its geometry.
+     */
+    OCTET* ring;
+    size_t ring_size;
+    UINT frame_count;
+
+    /**
+     * Index of the slot that the next frame is queued into, and the number of
+     * frames queued since the last flush.
+     */
+    UINT next_frame;
+    UINT queued;
+
+    /**
+     * Number of frames that the kernel refused to transmit.
+     */
+    ULONG rejected;
+} PacketTxInjector;
+
+static OCTET* PacketTxInjector_reserve(void* state, UINT* slot);
+static void PacketTxInjector_commit(void* state, UINT length);
+static void PacketTxInjector_flush(void* state);
+static void PacketTxInjector_close(void* state);
+static struct tpacket2_hdr* getSlot(PacketTxInjector* o, UINT index);
+
+static const InjectorOps packetTxInjectorOps = {
+    .reserve = PacketTxInjector_reserve,
+    .commit = PacketTxInjector_commit,
+    .flush = PacketTxInjector_flush,
+    .close = PacketTxInjector_close
+};
+
+/**
+ * Opens an AF_PACKET socket on the provided network interface, sets up a
+ * TPACKET_V2 transmit ring shared with the kernel according to the ring
+ * options, and wraps it in an Injector.
+ */
+Injector* Injector_openDevice(const char* interface_name) {
+    int descriptor, version, option;
+    UINT interface_index, block_size, block_count, max_length;
+    struct tpacket_req request;
+    struct sockaddr_ll address;
+    struct ifreq interface;
+    PacketTxInjector* injector;
+
+    // Open a raw socket
+    // NOTE ~> The socket is opened (and bound) for no protocol at all, so that
+    //  it never has frames queued up to be received that nobody reads.
+    if ((descriptor = socket(AF_PACKET, SOCK_RAW, 0)) == -1) {
+        if (errno == EPERM) {
+            fatal("The system is denying permission to open packet sockets. Make sure propper permissions are being "
+                    "used (e.g. root or CAP_NET_RAW).");
+        }
+
+        fatal("Failed to open an AF_PACKET socket. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Opened an AF_PACKET socket for injection (file descriptor = %d).", descriptor);
+    }
+
+    // Switch to version 2 of the ring format (version 3 adds nothing for
+    //  transmit rings but variable-sized slots)
+    version = TPACKET_V2;
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        fatal("Failed to switch the AF_PACKET socket to TPACKET_V2. (%i: %s)", errno, strerror(errno));
+    }
+
+    // Have the kernel skip frames that it can't transmit (marking their slots)
+    //  rather than fail the whole batch over them
+    option = 1;
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_LOSS, &option, sizeof(option)) == -1) {
+        fatal("Failed to have the AF_PACKET socket skip malformed frames. (%i: %s)", errno, strerror(errno));
+    }
+
+    // Hand frames straight to the driver instead of going through the
+    //  interface's queueing discipline
+    // NOTE ~> This is only an optimization (and older kernels don't have it),
+    //  so carry on without it if it can't be had.
+    option = 1;
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_QDISC_BYPASS, &option, sizeof(option)) == -1) {
+        info("Injecting through the queueing discipline of \"%s\".", interface_name);
+    }
+
+    // Request the ring
+    block_size = Options_getRingBlockSize();
+    block_count = Options_getRingBlockCount();
+
+    if (block_size % getpagesize() != 0 || block_size < TX_FRAME_SIZE) {
+        fatal("The ring block size (%u bytes) must be a multiple of the page size (%d bytes).", block_size,
+                getpagesize());
+    }
+
+    injector = (PacketTxInjector*) calloc(1, sizeof(PacketTxInjector));
+
+    if (injector == NULL) {
+        fatal("Failed to allocate the AF_PACKET injector.");
+    }
+
+    injector->descriptor = descriptor;
+    injector->ring_size = (size_t) block_size * block_count;
+    injector->frame_count = (block_size / TX_FRAME_SIZE) * block_count;
+
+    memset(&request, 0x00, sizeof(request));
+    request.tp_block_size = block_size;
+    request.tp_block_nr = block_count;
+    request.tp_frame_size = TX_FRAME_SIZE;
+    request.tp_frame_nr = injector->frame_count;
+
+    if (setsockopt(descriptor, SOL_PACKET, PACKET_TX_RING, &request, sizeof(request)) == -1) {
+        fatal("Failed to set up a %u x %u byte AF_PACKET transmit ring. (%i: %s)", block_count, block_size, errno,
+                strerror(errno));
+    }
+
+    injector->ring = (OCTET*) mmap(NULL, injector->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+            descriptor, 0);
+
+    // NOTE ~> Locking the ring into memory is only an optimization, so try
+    //  again without it if we aren't allowed to.
+    if (injector->ring == MAP_FAILED) {
+        injector->ring = (OCTET*) mmap(NULL, injector->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+
+    if (injector->ring == MAP_FAILED) {
+        fatal("Failed to map the AF_PACKET transmit ring into memory. (%i: %s)", errno, strerror(errno));
+    }
+    else {
+        info("Mapped a %u x %u byte AF_PACKET transmit ring (%u frames).", block_count, block_size,
+                injector->frame_count);
+    }
+
+    // Associate with a particular network interface
+    if ((interface_index = if_nametoindex(interface_name)) == 0) {
+        fatal("Failed to find the network interface \"%s\". (%i: %s)", interface_name, errno, strerror(errno));
+    }
+
+    memset(&address, 0x00, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = 0;
+    address.sll_ifindex = interface_index;
+
+    if (bind(descriptor, (struct sockaddr*) &address, sizeof(address)) == -1) {
+        fatal("Failed to bind the AF_PACKET socket to the network interface \"%s\". (%i: %s)", interface_name, errno,
+                strerror(errno));
+    }
+    else {
+        info("Bound the AF_PACKET injection socket to the network interface \"%s\".", interface_name);
+    }
+
+    // Frames can be as large as the interface's MTU allows (plus room for an
+    //  802.1Q tag), or as the ring's slots allow, whichever is smaller
+    max_length = TX_FRAME_SIZE - TX_DATA_OFFSET;
+
+    memset(&interface, 0x00, sizeof(interface));
+    strncpy(interface.ifr_name, interface_name, sizeof(interface.ifr_name) - 1);
+
+    if (ioctl(descriptor, SIOCGIFMTU, &interface) == 0 &&
+            (UINT) interface.ifr_mtu + ETH_HLEN + VLAN_TAG_SIZE < max_length) {
+        max_length = interface.ifr_mtu + ETH_HLEN + VLAN_TAG_SIZE;
+    }
+
+    // NOTE ~> The kernel never touches a frame's octets in its slot, so each
+    //  slot still holds the last frame queued into it when it comes around
+    //  again.
+    return Injector_new(interface_name, &packetTxInjectorOps, injector, max_length, injector->frame_count);
+}
+
+/**
+ * Returns where the frame in the next slot of the ring goes, unless the slot is
+ * still waiting to be transmitted itself.
+ */
+static OCTET* PacketTxInjector_reserve(void* state, UINT* slot) {
+    PacketTxInjector* o = (PacketTxInjector*) state;
+    struct tpacket2_hdr* header = getSlot(o, o->next_frame);
+    UINT status = __atomic_load_n(&header->tp_status, __ATOMIC_ACQUIRE);
+
+    if (status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        return NULL;
+    }
+
+    if (status & TP_STATUS_WRONG_FORMAT) {
+        o->rejected++;
+        header->tp_status = TP_STATUS_AVAILABLE;
+    }
+
+    *slot = o->next_frame;
+
+    return (OCTET*) header + TX_DATA_OFFSET;
+}
+
+/**
+ * Marks the next slot of the ring (holding a frame of the provided length) as
+ * ready to be transmitted.
+ */
+static void PacketTxInjector_commit(void* state, UINT length) {
+    PacketTxInjector* o = (PacketTxInjector*) state;
+    struct tpacket2_hdr* header = getSlot(o, o->next_frame);
+
+    header->tp_len = length;
+    __atomic_store_n(&header->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    o->next_frame = (o->next_frame + 1) % o->frame_count;
+    o->queued++;
+}
+
+/**
+ * Has the kernel transmit every slot of the ring that is ready to go with a
+ * single system call, and waits until the next slot is free again.
+ */
+static void PacketTxInjector_flush(void* state) {
+    PacketTxInjector* o = (PacketTxInjector*) state;
+    struct pollfd descriptor;
+
+    // NOTE ~> Without MSG_DONTWAIT, send(...) only returns once the kernel is
+    //  done with every slot (or the interface pushes back).
+    while (o->queued > 0 && send(o->descriptor, NULL, 0, 0) == -1) {
+        if (errno != EINTR && errno != EAGAIN && errno != ENOBUFS) {
+            fatal("Failed to transmit frames from the AF_PACKET transmit ring. (%i: %s)", errno, strerror(errno));
+        }
+
+        // The interface's queue is full, so give it a moment to drain
+        descriptor.fd = o->descriptor;
+        descriptor.events = POLLOUT;
+        poll(&descriptor, 1, SLOT_WAIT_TIMEOUT);
+    }
+
+    o->queued = 0;
+
+    while (__atomic_load_n(&getSlot(o, o->next_frame)->tp_status, __ATOMIC_ACQUIRE) &
+            (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        descriptor.fd = o->descriptor;
+        descriptor.events = POLLOUT;
+        poll(&descriptor, 1, SLOT_WAIT_TIMEOUT);
+
+        if (send(o->descriptor, NULL, 0, MSG_DONTWAIT) == -1 && errno != EAGAIN && errno != ENOBUFS &&
+                errno != EINTR) {
+            fatal("Failed to transmit frames from the AF_PACKET transmit ring. (%i: %s)", errno, strerror(errno));
+        }
+    }
+}
+
+/**
+ * Unmaps the transmit ring and closes the AF_PACKET socket.
+ */
+static void PacketTxInjector_close(void* state) {
+    PacketTxInjector* o = (PacketTxInjector*) state;
+    UINT i;
+
+    // Count the frames of the last batch that were refused as well
+    for (i = 0; i < o->frame_count; i++) {
+        if (getSlot(o, i)->tp_status & TP_STATUS_WRONG_FORMAT) {
+            o->rejected++;
+        }
+    }
+
+    if (o->rejected > 0) {
+        warn("The kernel refused to transmit %lu frames.", o->rejected);
+    }
+
+    munmap(o->ring, o->ring_size);
+    close(o->descriptor);
+    info("Closed AF_PACKET injection socket with file descriptor %d", o->descriptor);
+
+    free(o);
+}
+
+/**
+ * Returns the header of the slot of the ring with the provided index.
+ */
+static struct tpacket2_hdr* getSlot(PacketTxInjector* o, UINT index) {
+    // NOTE ~> Slots never straddle blocks, and blocks are a whole number of
+    //  slots, so the ring can be walked as one long array of slots.
+    return (struct tpacket2_hdr*) (o->ring + (size_t) index * TX_FRAME_SIZE);
+}
+
+#endif
@@ -0,0 +1,916 @@
+#include "capture_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "capture_index.h"
+#include "compact_format.h"
+#include "logger.h"
+
+#define PCAP_MAGIC_USEC             0xa1b2c3d4
+#define PCAP_MAGIC_NSEC             0xa1b23c4d
+#define PCAP_GLOBAL_HEADER_SIZE     24
+#define PCAP_RECORD_HEADER_SIZE     16
+
+#define PCAPNG_BLOCK_SHB            0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB            0x00000001
+#define PCAPNG_BLOCK_PB             0x00000002
+#define PCAPNG_BLOCK_SPB            0x00000003
+#define PCAPNG_BLOCK_EPB            0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1a2b3c4d
+#define PCAPNG_OPTION_END           0
+#define PCAPNG_OPTION_IF_TSRESOL    9
+#define PCAPNG_MAX_INTERFACES       64
+
+#define LINKTYPE_ETHERNET           1
+
+#define STREAM_READ_SIZE            (1 << 20)
+
+// NOTE ~> Frames are handed out in batches so that the sniffer gets a chance to
+//  notice that it has been asked to stop while working through large files.
+#define FILE_BATCH_FRAMES           1024
+
+/**
+ * The capture file formats that can be read.
+ */
+typedef enum FileFormat {
+    FF_PCAP,
+    FF_PCAPNG,
+    FF_COMPACT
+} FileFormat;
+
+/**
+ * What we need to remember about each interface described by a pcapng file's
+ * "Interface Description Blocks".
+ */
+typedef struct PcapngInterface {
+    UINT link_type;
+    UINT snaplen;
+    uint64_t units_per_second;
+} PcapngInterface;
+
+/**
+ * State of a capture source that reads from a memory-mapped capture file.
+ */
+typedef struct PcapFileSource {
+    /**
+     * The whole capture file, mapped into memory.
+     */
+    OCTET* map;
+    size_t map_size;
+
+    /**
+     * Whether the file was read into memory (because it could not be mapped,
+     * e.g. when it is a pipe) rather than mapped.
+     */
+    bool read_into_memory;
+
+    /**
+     * Position of the next unprocessed record (pcap) or block (pcapng) and the
+     * end of the mapping.
+     */
+    OCTET* ptr;
+    OCTET* end;
+
+    /**
+     * Position of the first record or block (where a rewind goes back to).
+     */
+    OCTET* first;
+
+    /**
+     * Position of the record or block that the last frame came from.
+     */
+    OCTET* record;
+
+    FileFormat format;
+
+    /**
+     * Whether or not the file (or, for pcapng, the current section) was written
+     * with the opposite byte order of this machine.
+     */
+    bool swapped;
+
+    /**
+     * Whether the timestamps of a classic pcap file are in nanoseconds rather
+     * than microseconds.
+     */
+    bool nanosecond_timestamps;
+
+    /**
+     * The interfaces described so far by the current pcapng section.
+     */
+    PcapngInterface interfaces[PCAPNG_MAX_INTERFACES];
+    UINT num_interfaces;
+
+    /**
+     * What puts the frames of a compact file's blocks back together.
+     */
+    CompactDecoder* decoder;
+
+    /**
+     * The query that frames have to match (if any), and the runs of blocks
+     * that may hold frames that match it, going by the file's index (or NULL
+     * if it has none, in which case the whole file is read), along with the
+     * next of them to read.
+     */
+    IndexQuery* query;
+    IndexRange* ranges;
+    UINT num_ranges;
+    UINT next_range;
+
+    /**
+     * Number of frames that may still be handed out from the current batch.
+     */
+    UINT batch_remaining;
+
+    /**
+     * Whether or not the end of the file (or an unreadable portion of it) has
+     * been reached.
+     */
+    bool exhausted;
+
+    /**
+     * Whether or not frames from non-Ethernet interfaces have been skipped
+     * (so that we only warn about it once).
+     */
+    bool warned_link_type;
+} PcapFileSource;
+
+static int PcapFileSource_fill(void* state);
+static bool PcapFileSource_next(void* state, CapturedFrame* frame);
+static void PcapFileSource_close(void* state);
+static bool PcapFileSource_rewind(void* state);
+static PcapFileSource* mapFile(const char* path);
+static void selectBlocks(PcapFileSource* o, const char* path, const char* query);
+static bool nextRange(PcapFileSource* o);
+static bool nextFrame(PcapFileSource* o, CapturedFrame* frame);
+static bool nextPcapRecord(PcapFileSource* o, CapturedFrame* frame);
+static bool nextPcapngBlock(PcapFileSource* o, CapturedFrame* frame);
+static bool nextCompactBlock(PcapFileSource* o);
+static void readPcapngInterface(PcapFileSource* o, OCTET* body, size_t body_size);
+static void setPcapngTimestamp(PcapngInterface* interface, uint64_t units, CapturedFrame* frame);
+static void readStream(PcapFileSource* o, int descriptor, const char* path);
+static uint16_t readUint16(const OCTET* ptr, bool swapped);
+static uint32_t readUint32(const OCTET* ptr, bool swapped);
+
+static const CaptureSourceOps pcapFileSourceOps = {
+    .fill = PcapFileSource_fill,
+    .next = PcapFileSource_next,
+    .release = NULL,
+    .close = PcapFileSource_close,
+    .getDescriptor = NULL,
+    .getDrops = NULL,
+    .rewind = PcapFileSource_rewind
+};
+
+/**
+ * Maps the pcap, pcapng or compact capture file at the provided path into
+ * memory and wraps it in a CaptureSource. Frames are handed out directly from
+ * the mapping, so no per-frame reads or copies are ever made (except from
+ * compact files, whose blocks are decoded one per batch). A path of "-" stands
+ * for the standard input, which is read into memory first if it can't be
+ * mapped (e.g. when it is a pipe). If a Filter is provided, it is run over each
+ * frame in user space.
+ */
+CaptureSource* CaptureSource_openFile(const char* path, const Filter* filter) {
+    return CaptureSource_queryFile(path, filter, NULL);
+}
+
+/**
+ * Like CaptureSource_openFile(...), but only hands out the frames that match
+ * the provided query (see IndexQuery_parse(...)), if there is one. If the file
+ * has an index, only the parts of it that the index says may hold such frames
+ * are read (and the rest are never even paged in), and otherwise every frame
+ * is checked.
+ */
+CaptureSource* CaptureSource_queryFile(const char* path, const Filter* filter, const char* query) {
+    PcapFileSource* source = mapFile(path);
+    CaptureSource* captureSource;
+
+    if (query != NULL) {
+        selectBlocks(source, path, query);
+    }
+
+    captureSource = CaptureSource_new((strcmp(path, "-") == 0) ? "standard input" : path, &pcapFileSourceOps,
+            source);
+
+    if (filter != NULL) {
+        CaptureSource_setFilter(captureSource, filter);
+    }
+
+    return captureSource;
+}
+
+/**
+ * Builds the index (see capture_index.h) of the capture file at the provided
+ * path, after the fact. Compact files are described block by block, and pcap
+ * and pcapng files in blocks of about INDEX_BLOCK_SIZE bytes.
+ */
+void CaptureSource_indexFile(const char* path) {
+    PcapFileSource* o = mapFile(path);
+    IndexWriter* index = IndexWriter_open(path);
+    IndexBlock block;
+    CapturedFrame frame;
+    OCTET* start = NULL;
+    ULONG frames = 0;
+    size_t size;
+
+    IndexBlock_init(&block);
+
+    if (o->format == FF_COMPACT) {
+        while (o->ptr < o->end && (size = CompactDecoder_load(o->decoder, o->ptr, o->end - o->ptr)) > 0) {
+            while (CompactDecoder_next(o->decoder, &frame)) {
+                IndexBlock_add(&block, &frame);
+            }
+
+            if (block.num_frames > 0) {
+                frames += block.num_frames;
+                IndexWriter_append(index, &block, o->ptr - o->map, size);
+                IndexBlock_reset(&block);
+            }
+
+            o->ptr += size;
+        }
+
+        if (o->ptr != o->end) {
+            warn("The capture file is truncated or contains a malformed block.");
+        }
+    } else {
+        // NOTE ~> Every block starts where the previous one ended, so that any
+        //  pcapng blocks in between frames (e.g. describing interfaces) are
+        //  read along with the frames that follow them. Only the first starts
+        //  at its first frame, as whatever comes before it is read regardless.
+        while (o->format == FF_PCAP ? nextPcapRecord(o, &frame) : nextPcapngBlock(o, &frame)) {
+            if (start == NULL) {
+                start = o->record;
+            }
+
+            IndexBlock_add(&block, &frame);
+
+            if ((ULONG) (o->ptr - start) >= INDEX_BLOCK_SIZE) {
+                frames += block.num_frames;
+                IndexWriter_append(index, &block, start - o->map, o->ptr - start);
+                IndexBlock_reset(&block);
+                start = o->ptr;
+            }
+        }
+
+        if (block.num_frames > 0) {
+            frames += block.num_frames;
+            IndexWriter_append(index, &block, start - o->map, o->ptr - start);
+        }
+    }
+
+    IndexWriter_close(index, o->map_size);
+    info("Indexed %lu frames of the capture file \"%s\".", frames, path);
+
+    IndexBlock_destroy(&block);
+    PcapFileSource_close(o);
+}
+
+/**
+ * Maps the capture file at the provided path (or reads it into memory) and
+ * works out which format it is in.
+ */
+static PcapFileSource* mapFile(const char* path) {
+    int descriptor;
+    struct stat file_stat;
+    uint32_t magic;
+    PcapFileSource* source;
+    // Open and map the whole file
+    if (strcmp(path, "-") == 0) {
+        descriptor = STDIN_FILENO;
+        path = "standard input";
+    } else if ((descriptor = open(path, O_RDONLY)) == -1) {
+        fatal("Failed to open the capture file \"%s\". (%i: %s)", path, errno, strerror(errno));
+    }
+
+    if (fstat(descriptor, &file_stat) == -1) {
+        fatal("Failed to determine the size of the capture file \"%s\". (%i: %s)", path, errno, strerror(errno));
+    }
+
+    source = (PcapFileSource*) calloc(1, sizeof(PcapFileSource));
+
+    if (source == NULL) {
+        fatal("Failed to allocate the capture file source.");
+    }
+
+    if (S_ISREG(file_stat.st_mode)) {
+        source->map_size = file_stat.st_size;
+
+        if (source->map_size < PCAP_GLOBAL_HEADER_SIZE) {
+            fatal("The capture file \"%s\" is too small to be a pcap or pcapng file.", path);
+        }
+
+        source->map = (OCTET*) mmap(NULL, source->map_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+        if (source->map == MAP_FAILED) {
+            fatal("Failed to map the capture file \"%s\" into memory. (%i: %s)", path, errno, strerror(errno));
+        }
+
+        // Let the kernel know that we will be reading straight through the file
+        //  so that it can read ahead aggressively
+        madvise(source->map, source->map_size, MADV_SEQUENTIAL);
+    } else {
+        readStream(source, descriptor, path);
+    }
+
+    // NOTE ~> A mapping keeps its own reference to the file, so the descriptor
+    //  is no longer needed either way.
+    close(descriptor);
+
+    source->ptr = source->map;
+    source->end = source->map + source->map_size;
+
+    // Figure out which format the file is in from its leading magic number
+    memcpy(&magic, source->map, sizeof(magic));
+
+    if (magic == PCAP_MAGIC_USEC || readUint32(source->map, true) == PCAP_MAGIC_USEC) {
+        source->format = FF_PCAP;
+        source->swapped = (magic != PCAP_MAGIC_USEC);
+    } else if (magic == PCAP_MAGIC_NSEC || readUint32(source->map, true) == PCAP_MAGIC_NSEC) {
+        source->format = FF_PCAP;
+        source->swapped = (magic != PCAP_MAGIC_NSEC);
+        source->nanosecond_timestamps = true;
+    } else if (magic == PCAPNG_BLOCK_SHB) {
+        source->format = FF_PCAPNG;
+    } else if (CompactFormat_checkFileHeader(source->map, source->map_size)) {
+        source->format = FF_COMPACT;
+        source->decoder = CompactDecoder_new();
+        source->ptr += COMPACT_FILE_HEADER_SIZE;
+    } else {
+        fatal("The capture file \"%s\" is not a pcap, pcapng or compact file (magic number 0x%08x).", path, magic);
+    }
+
+    // A classic pcap file describes its single link type up front
+    if (source->format == FF_PCAP) {
+        UINT link_type = readUint32(source->map + 20, source->swapped);
+
+        if (link_type != LINKTYPE_ETHERNET) {
+            fatal("The capture file \"%s\" has link type %u, but only Ethernet (%u) is supported.", path, link_type,
+                    LINKTYPE_ETHERNET);
+        }
+
+        source->ptr += PCAP_GLOBAL_HEADER_SIZE;
+    }
+
+    source->first = source->ptr;
+
+    info("%s the %s capture file \"%s\" (%lu bytes).", source->read_into_memory ? "Read" : "Mapped",
+            (source->format == FF_PCAP) ? "pcap" : (source->format == FF_PCAPNG) ? "pcapng" : "compact", path,
+            (ULONG) source->map_size);
+
+    return source;
+}
+
+/**
+ * Parses the provided query and looks up the runs of blocks of the capture
+ * file at the provided path (mapped by the provided source) that may hold
+ * frames that match it in the file's index, if it has one.
+ */
+static void selectBlocks(PcapFileSource* o, const char* path, const char* query) {
+    CapturedFrame frame;
+    ULONG selected = 0;
+    UINT num_blocks, i;
+
+    o->query = IndexQuery_parse(query);
+
+    if (o->read_into_memory) {
+        warn("The standard input has no index, so every frame of it has to be checked against the query.");
+
+        return;
+    }
+
+    if ((o->ranges = CaptureIndex_find(path, o->map_size, o->query, &o->num_ranges, &num_blocks)) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < o->num_ranges; i++) {
+        selected += o->ranges[i].size;
+    }
+
+    info("The index narrows the query down to %lu of %lu bytes (in %u run(s), out of %u blocks).", selected,
+            (ULONG) o->map_size, o->num_ranges, num_blocks);
+
+    // The blocks are read out of order now, and the kernel is told about
+    //  each run of them as it comes up
+    madvise(o->map, o->map_size, MADV_RANDOM);
+
+    // NOTE ~> The interfaces of a pcapng file are described before its first
+    //  frame, which is also where its first block starts.
+    if (o->format == FF_PCAPNG && o->num_ranges > 0) {
+        o->end = o->map + o->ranges[0].offset;
+
+        while (nextPcapngBlock(o, &frame)) {
+        }
+    }
+
+    o->end = o->ptr;
+}
+
+/**
+ * Starts a new batch of frames, or reports the end of the file. A batch of a
+ * compact file is (at most) the rest of the block that it decodes.
+ */
+static int PcapFileSource_fill(void* state) {
+    PcapFileSource* o = (PcapFileSource*) state;
+
+    if (o->exhausted) {
+        return CS_END;
+    }
+
+    // NOTE ~> Once a query has been through a run of blocks, the next one
+    //  comes up here (compact files do so as they move on to their next
+    //  block).
+    if (o->format == FF_COMPACT ? !nextCompactBlock(o) : (o->ranges != NULL && o->ptr == o->end && !nextRange(o))) {
+        o->exhausted = true;
+
+        return CS_END;
+    }
+
+    o->batch_remaining = FILE_BATCH_FRAMES;
+
+    return 1;
+}
+
+/**
+ * Describes the next frame in the file (that matches the query, if there is
+ * one), straight out of the mapping.
+ *
+ * NOTE ~> Frames that don't match the query count towards the batch all the
+ *  same, so that the sniffer still gets to notice that it has been asked to
+ *  stop while a query is going through frames that it skips.
+ */
+static bool PcapFileSource_next(void* state, CapturedFrame* frame) {
+    PcapFileSource* o = (PcapFileSource*) state;
+
+    while (!o->exhausted && o->batch_remaining > 0) {
+        if (!nextFrame(o, frame)) {
+            return false;
+        }
+
+        o->batch_remaining--;
+
+        if (o->query == NULL || IndexQuery_matches(o->query, frame)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Unmaps the capture file and frees the source's state.
+ */
+static void PcapFileSource_close(void* state) {
+    PcapFileSource* o = (PcapFileSource*) state;
+
+    if (o->read_into_memory) {
+        free(o->map);
+    } else {
+        munmap(o->map, o->map_size);
+    }
+
+    if (o->decoder != NULL) {
+        CompactDecoder_free(o->decoder);
+    }
+
+    if (o->query != NULL) {
+        IndexQuery_free(o->query);
+    }
+
+    free(o->ranges);
+    free(o);
+}
+
+/**
+ * Goes back to the first frame of the file.
+ */
+static bool PcapFileSource_rewind(void* state) {
+    PcapFileSource* o = (PcapFileSource*) state;
+
+    o->ptr = o->first;
+    o->batch_remaining = 0;
+    o->exhausted = false;
+
+    if (o->ranges != NULL) {
+        o->end = o->ptr;
+        o->next_range = 0;
+    }
+
+    if (o->decoder != NULL) {
+        CompactDecoder_reset(o->decoder);
+    }
+
+    return true;
+}
+
+/**
+ * Moves on to the next run of blocks that the query selected, if there is one
+ * left.
+ */
+static bool nextRange(PcapFileSource* o) {
+    IndexRange* range;
+    ULONG aligned;
+
+    if (o->ranges == NULL || o->next_range == o->num_ranges) {
+        return false;
+    }
+
+    range = &o->ranges[o->next_range++];
+    o->ptr = o->map + range->offset;
+    o->end = o->ptr + range->size;
+
+    // Have the kernel start reading the whole run in right away
+    aligned = range->offset - range->offset % (ULONG) sysconf(_SC_PAGESIZE);
+    madvise(o->map + aligned, range->offset + range->size - aligned, MADV_WILLNEED);
+
+    return true;
+}
+
+/**
+ * Describes the next frame of the current batch, or returns false if there
+ * are no more.
+ */
+static bool nextFrame(PcapFileSource* o, CapturedFrame* frame) {
+    // NOTE ~> Running out of a compact file's block, or of a run of blocks,
+    //  only ends the batch.
+    if (o->format == FF_COMPACT) {
+        return CompactDecoder_next(o->decoder, frame);
+    }
+
+    if (o->format == FF_PCAP ? nextPcapRecord(o, frame) : nextPcapngBlock(o, frame)) {
+        return true;
+    }
+
+    if (o->ranges != NULL) {
+        o->ptr = o->end;
+    } else {
+        o->exhausted = true;
+    }
+
+    return false;
+}
+
+/**
+ * Reads everything from the provided descriptor (which can't be mapped) into
+ * memory, in place of a mapping.
+ */
+static void readStream(PcapFileSource* o, int descriptor, const char* path) {
+    size_t capacity = 0;
+    ssize_t received;
+
+    o->read_into_memory = true;
+
+    while (true) {
+        if (o->map_size + STREAM_READ_SIZE > capacity) {
+            capacity = (capacity > 0) ? capacity * 2 : STREAM_READ_SIZE;
+
+            if ((o->map = (OCTET*) realloc(o->map, capacity)) == NULL) {
+                fatal("Failed to allocate %lu bytes to read the capture file \"%s\" into.", (ULONG) capacity, path);
+            }
+        }
+
+        if ((received = read(descriptor, o->map + o->map_size, STREAM_READ_SIZE)) == 0) {
+            break;
+        } else if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fatal("Failed to read the capture file \"%s\". (%i: %s)", path, errno, strerror(errno));
+        }
+
+        o->map_size += received;
+    }
+
+    if (o->map_size < PCAP_GLOBAL_HEADER_SIZE) {
+        fatal("The capture file \"%s\" is too small to be a pcap or pcapng file.", path);
+    }
+}
+
+/**
+ * Describes the classic pcap record at the current position and moves past it.
+ * Returns false at the end of the file.
+ */
+static bool nextPcapRecord(PcapFileSource* o, CapturedFrame* frame) {
+    UINT caplen;
+
+    if (o->ptr + PCAP_RECORD_HEADER_SIZE > o->end) {
+        if (o->ptr != o->end) {
+            warn("Ignoring %lu trailing bytes of the capture file.", (ULONG) (o->end - o->ptr));
+        }
+
+        return false;
+    }
+
+    caplen = readUint32(o->ptr + 8, o->swapped);
+
+    if (o->ptr + PCAP_RECORD_HEADER_SIZE + caplen > o->end) {
+        warn("The capture file is truncated in the middle of a record.");
+
+        return false;
+    }
+
+    frame->timestamp.tv_sec = readUint32(o->ptr, o->swapped);
+    frame->timestamp.tv_nsec = readUint32(o->ptr + 4, o->swapped);
+    if (!o->nanosecond_timestamps) {
+        frame->timestamp.tv_nsec *= 1000;
+    }
+    frame->caplen = caplen;
+    frame->wirelen = readUint32(o->ptr + 12, o->swapped);
+    frame->data = o->ptr + PCAP_RECORD_HEADER_SIZE;
+
+    o->record = o->ptr;
+    o->ptr += PCAP_RECORD_HEADER_SIZE + caplen;
+
+    return true;
+}
+
+/**
+ * Walks pcapng blocks from the current position until one containing an
+ * Ethernet Frame is found, describes that frame, and moves past its block.
+ * Returns false at the end of the file.
+ *
+ * NOTE ~> Every pcapng block starts with its type and total length and ends
+ *  with a repeat of the total length, so blocks that we don't care about can
+ *  simply be skipped over.
+ */
+static bool nextPcapngBlock(PcapFileSource* o, CapturedFrame* frame) {
+    while (o->ptr + 12 <= o->end) {
+        uint32_t type, length;
+        OCTET* body;
+        size_t body_size;
+
+        // A section header block determines the byte order of everything after
+        //  it, so it has to be inspected before the length can be trusted
+        memcpy(&type, o->ptr, sizeof(type));
+
+        if (type == PCAPNG_BLOCK_SHB) {
+            uint32_t byte_order_magic;
+
+            memcpy(&byte_order_magic, o->ptr + 8, sizeof(byte_order_magic));
+
+            if (byte_order_magic == PCAPNG_BYTE_ORDER_MAGIC) {
+                o->swapped = false;
+            } else if (readUint32(o->ptr + 8, true) == PCAPNG_BYTE_ORDER_MAGIC) {
+                o->swapped = true;
+            } else {
+                warn("The capture file contains a section header with an invalid byte order magic.");
+
+                return false;
+            }
+
+            // Interfaces are scoped to the section that describes them
+            o->num_interfaces = 0;
+        }
+
+        type = readUint32(o->ptr, o->swapped);
+        length = readUint32(o->ptr + 4, o->swapped);
+
+        if (length < 12 || (length % 4) != 0 || o->ptr + length > o->end) {
+            warn("The capture file is truncated or contains a malformed block (type 0x%08x, %u bytes).", type, length);
+
+            return false;
+        }
+
+        body = o->ptr + 8;
+        body_size = length - 12;
+        o->record = o->ptr;
+        o->ptr += length;
+
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                readPcapngInterface(o, body, body_size);
+                break;
+
+            case PCAPNG_BLOCK_EPB:
+            case PCAPNG_BLOCK_PB: {
+                PcapngInterface* interface;
+                UINT interface_id, caplen;
+                uint64_t units;
+
+                if (body_size < 20) {
+                    break;
+                }
+
+                // NOTE ~> The obsolete "Packet Block" is laid out like an
+                //  "Enhanced Packet Block" except that its interface ID is only
+                //  two octets (followed by a two octet drop count).
+                if (type == PCAPNG_BLOCK_EPB) {
+                    interface_id = readUint32(body, o->swapped);
+                } else {
+                    interface_id = readUint16(body, o->swapped);
+                }
+
+                caplen = readUint32(body + 12, o->swapped);
+
+                if (interface_id >= o->num_interfaces || caplen > body_size - 20) {
+                    break;
+                }
+
+                interface = &o->interfaces[interface_id];
+
+                if (interface->link_type != LINKTYPE_ETHERNET) {
+                    if (!o->warned_link_type) {
+                        warn("Skipping frames from an interface with non-Ethernet link type %u.",
+                                interface->link_type);
+                        o->warned_link_type = true;
+                    }
+
+                    break;
+                }
+
+                units = ((uint64_t) readUint32(body + 4, o->swapped) << 32) | readUint32(body + 8, o->swapped);
+                setPcapngTimestamp(interface, units, frame);
+                frame->caplen = caplen;
+                frame->wirelen = readUint32(body + 16, o->swapped);
+                frame->data = body + 20;
+
+                return true;
+            }
+
+            case PCAPNG_BLOCK_SPB: {
+                PcapngInterface* interface;
+                UINT caplen;
+
+                // NOTE ~> "Simple Packet Blocks" always belong to the first
+                //  interface and carry no timestamp.
+                if (body_size < 4 || o->num_interfaces == 0) {
+                    break;
+                }
+
+                interface = &o->interfaces[0];
+
+                if (interface->link_type != LINKTYPE_ETHERNET) {
+                    break;
+                }
+
+                frame->wirelen = readUint32(body, o->swapped);
+                caplen = frame->wirelen;
+                if (interface->snaplen != 0 && caplen > interface->snaplen) {
+                    caplen = interface->snaplen;
+                }
+                if (caplen > body_size - 4) {
+                    caplen = body_size - 4;
+                }
+
+                frame->timestamp.tv_sec = 0;
+                frame->timestamp.tv_nsec = 0;
+                frame->caplen = caplen;
+                frame->data = body + 4;
+
+                return true;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    if (o->ptr != o->end) {
+        warn("Ignoring %lu trailing bytes of the capture file.", (ULONG) (o->end - o->ptr));
+    }
+
+    return false;
+}
+
+/**
+ * Makes sure that there are frames left to hand out from the current block of
+ * a compact file, decoding the next block if there are not. Returns false at
+ * the end of the file.
+ */
+static bool nextCompactBlock(PcapFileSource* o) {
+    size_t size;
+
+    while (CompactDecoder_getRemaining(o->decoder) == 0) {
+        if (o->ptr == o->end && !nextRange(o)) {
+            return false;
+        }
+
+        if ((size = CompactDecoder_load(o->decoder, o->ptr, o->end - o->ptr)) == 0) {
+            warn("The capture file is truncated or contains a malformed block.");
+
+            return false;
+        }
+
+        o->ptr += size;
+    }
+
+    return true;
+}
+
+/**
+ * Records the link type, snapshot length, and timestamp resolution of the
+ * interface described by the provided pcapng "Interface Description Block"
+ * body.
+ */
+static void readPcapngInterface(PcapFileSource* o, OCTET* body, size_t body_size) {
+    PcapngInterface* interface;
+    OCTET* option;
+
+    if (body_size < 8) {
+        return;
+    }
+
+    if (o->num_interfaces == PCAPNG_MAX_INTERFACES) {
+        fatal("The capture file describes more than %d interfaces in a single section.", PCAPNG_MAX_INTERFACES);
+    }
+
+    interface = &o->interfaces[o->num_interfaces++];
+    interface->link_type = readUint16(body, o->swapped);
+    interface->snaplen = readUint32(body + 4, o->swapped);
+    interface->units_per_second = 1000000;
+
+    // Look through the options for a timestamp resolution
+    option = body + 8;
+
+    while (option + 4 <= body + body_size) {
+        uint16_t code = readUint16(option, o->swapped);
+        uint16_t length = readUint16(option + 2, o->swapped);
+
+        if (code == PCAPNG_OPTION_END || option + 4 + length > body + body_size) {
+            break;
+        }
+
+        if (code == PCAPNG_OPTION_IF_TSRESOL && length >= 1) {
+            OCTET resolution = option[4];
+            OCTET exponent = resolution & 0x7f;
+            uint64_t units = 1;
+
+            // NOTE ~> The high bit selects between negative powers of two and
+            //  negative powers of ten.
+            if (resolution & 0x80) {
+                units = (exponent < 64) ? ((uint64_t) 1 << exponent) : 0;
+            } else {
+                while (exponent-- > 0 && units <= UINT64_MAX / 10) {
+                    units *= 10;
+                }
+            }
+
+            if (units != 0) {
+                interface->units_per_second = units;
+            }
+        }
+
+        // Options are padded out to 32 bits
+        option += 4 + ((length + 3) & ~3);
+    }
+}
+
+/**
+ * Converts a pcapng timestamp (in the provided interface's units) to the
+ * provided frame's timestamp.
+ */
+static void setPcapngTimestamp(PcapngInterface* interface, uint64_t units, CapturedFrame* frame) {
+    uint64_t per_second = interface->units_per_second;
+    uint64_t remainder = units % per_second;
+
+    frame->timestamp.tv_sec = units / per_second;
+
+    // NOTE ~> Microsecond and nanosecond resolutions cover virtually every file
+    //  out there, so they avoid the general (and slower) conversion.
+    if (per_second == 1000000) {
+        frame->timestamp.tv_nsec = remainder * 1000;
+    } else if (per_second == 1000000000) {
+        frame->timestamp.tv_nsec = remainder;
+    } else {
+        frame->timestamp.tv_nsec = (long) (((long double) remainder * 1000000000.0L) / per_second);
+    }
+}
+
+/**
+ * Reads a two octet integer from the provided (possibly unaligned) position,
+ * swapping its byte order if necessary.
+ */
+static uint16_t readUint16(const OCTET* ptr, bool swapped) {
+    uint16_t value;
+
+    memcpy(&value, ptr, sizeof(value));
+
+    return swapped ? (uint16_t) ((value >> 8) | (value << 8)) : value;
+}
+
+/**
+ * Reads a four octet integer from the provided (possibly unaligned) position,
+ * swapping its byte order if necessary.
+ */
+static uint32_t readUint32(const OCTET* ptr, bool swapped) {
+    uint32_t value;
+
+    memcpy(&value, ptr, sizeof(value));
+
+    if (swapped) {
+        value = ((value >> 24) & 0x000000ff) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000) |
+                ((value << 24) & 0xff000000);
+    }
+
+    return value;
+}
\ No newline at end of file
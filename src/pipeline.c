@@ -0,0 +1,501 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "pipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "common.h"
+#include "ethernet_frame.h"
+#include "frame_descriptor.h"
+#include "large_buffer.h"
+#include "logger.h"
+#include "signals.h"
+#include "spsc_ring.h"
+#include "text_buffer.h"
+
+#define FORMAT_BUFFER_SIZE      8192
+#define OUTPUT_BATCH_SIZE       65536
+#define IDLE_SPINS              16
+#define IDLE_SHORT_SLEEPS       64
+#define IDLE_SHORT_SLEEP_NS     50000
+#define IDLE_LONG_SLEEP_NS      1000000
+
+#define MAC_ADDRESSES_SIZE      12
+#define VLAN_TAG_SIZE           4
+#define IPV4_MIN_HEADER_SIZE    20
+#define IPV6_HEADER_SIZE        40
+
+/**
+ * A captured frame on its way to a worker.
+ */
+typedef struct FrameRecord {
+    uint64_t sequence;
+    UINT caplen;
+    UINT wirelen;
+    UINT interface;
+
+    /**
+     * What the capturing thread found when it verified the frame's checksums
+     * (see ChecksumFlags), since the workers only decode frames to format them.
+     */
+    UINT checksums;
+    OCTET data[];
+} FrameRecord;
+
+/**
+ * A formatted frame on its way to the output thread.
+ */
+typedef struct TextRecord {
+    uint64_t sequence;
+    char text[];
+} TextRecord;
+
+/**
+ * Counters kept for each stage of the pipeline. They are only written by the
+ * thread feeding the stage and only read once everything has stopped.
+ */
+typedef struct StageStats {
+    ULONG frames;
+    ULONG waits;
+    size_t peak_depth;
+} StageStats;
+
+/**
+ * State of a single decode worker.
+ */
+typedef struct Worker {
+    pthread_t thread;
+
+    /**
+     * Frames from the capturing thread and text for the output thread.
+     */
+    SpscRing* frames;
+    SpscRing* texts;
+
+    StageStats frame_stats;
+    StageStats text_stats;
+} Worker;
+
+struct Pipeline {
+    PipelineConfig config;
+    Worker workers[PIPELINE_MAX_WORKERS];
+    pthread_t output_thread;
+    uint64_t next_sequence;
+    size_t max_frame_size;
+    ULONG truncated;
+};
+
+static void* workerLoop(void* arg);
+static void* outputLoop(void* arg);
+static bool takeNextText(Pipeline* o, uint64_t sequence, TextBuffer* batch, UINT* hint);
+static void* reserveWaiting(SpscRing* ring, size_t size, StageStats* stats);
+static void idle(UINT* idle_count);
+static uint32_t hashFlow(const OCTET* data, UINT caplen);
+static void pinThread(pthread_t thread, int cpu, const char* name);
+static int getCpu(const PipelineConfig* config, UINT index);
+
+/**
+ * Builds a pipeline as described by the provided config, starts its output and
+ * worker threads, and pins every thread (including the calling one, which is
+ * expected to be the capturing thread) to its CPU.
+ */
+Pipeline* Pipeline_start(const PipelineConfig* config) {
+    Pipeline* o = (Pipeline*) calloc(1, sizeof(Pipeline));
+    UINT i;
+
+    if (o == NULL) {
+        fatal("Failed to allocate the pipeline.");
+    }
+
+    o->config = *config;
+
+    // NOTE ~> Both of a worker's queues go on the node of the CPU it is pinned
+    //  to, as it is the one thread that works on both of them.
+    for (i = 0; i < config->num_workers; i++) {
+        int node = LargeBuffer_getCpuNode(getCpu(config, i + 2));
+
+        o->workers[i].frames = SpscRing_new(config->queue_size, node);
+        o->workers[i].texts = SpscRing_new(config->queue_size, node);
+    }
+
+    o->max_frame_size = SpscRing_getMaxRecordSize(o->workers[0].frames) - sizeof(FrameRecord);
+
+    if (Signals_createThread(&o->output_thread, outputLoop, o) != 0) {
+        fatal("Failed to start the output thread.");
+    }
+
+    for (i = 0; i < config->num_workers; i++) {
+        if (Signals_createThread(&o->workers[i].thread, workerLoop, &o->workers[i]) != 0) {
+            fatal("Failed to start decode worker %u.", i);
+        }
+    }
+
+    pinThread(pthread_self(), getCpu(config, 0), "capture thread");
+    pinThread(o->output_thread, getCpu(config, 1), "output thread");
+
+    for (i = 0; i < config->num_workers; i++) {
+        pinThread(o->workers[i].thread, getCpu(config, i + 2), "decode worker");
+    }
+
+    info("Started a pipeline with %u decode worker(s) and %lu byte queues.", config->num_workers,
+            (ULONG) config->queue_size);
+
+    return o;
+}
+
+/**
+ * Copies the provided frame (along with what was found when its checksums were
+ * verified, if they were, as a bitmask of ChecksumFlags) into the queue of the
+ * worker responsible for its flow, waiting for room if the worker has fallen
+ * behind. Only the capturing thread may call this.
+ */
+void Pipeline_push(Pipeline* o, const CapturedFrame* frame, UINT checksums) {
+    Worker* worker = &o->workers[hashFlow(frame->data, frame->caplen) % o->config.num_workers];
+    UINT caplen = frame->caplen;
+    FrameRecord* record;
+    size_t depth;
+
+    if (caplen > o->max_frame_size) {
+        caplen = o->max_frame_size;
+        o->truncated++;
+    }
+
+    record = (FrameRecord*) reserveWaiting(worker->frames, sizeof(FrameRecord) + caplen, &worker->frame_stats);
+    record->sequence = o->next_sequence++;
+    record->caplen = caplen;
+    record->wirelen = frame->wirelen;
+    record->interface = frame->interface;
+    record->checksums = checksums;
+    memcpy(record->data, frame->data, caplen);
+    SpscRing_commit(worker->frames, sizeof(FrameRecord) + caplen);
+
+    worker->frame_stats.frames++;
+
+    if ((depth = SpscRing_getDepth(worker->frames)) > worker->frame_stats.peak_depth) {
+        worker->frame_stats.peak_depth = depth;
+    }
+}
+
+/**
+ * Lets every stage finish whatever it has queued up, waits for all of the
+ * threads to exit, logs how each stage fared, and frees the provided Pipeline.
+ */
+void Pipeline_stop(Pipeline* o) {
+    UINT i;
+
+    for (i = 0; i < o->config.num_workers; i++) {
+        SpscRing_close(o->workers[i].frames);
+    }
+
+    for (i = 0; i < o->config.num_workers; i++) {
+        pthread_join(o->workers[i].thread, NULL);
+    }
+
+    pthread_join(o->output_thread, NULL);
+
+    for (i = 0; i < o->config.num_workers; i++) {
+        Worker* worker = &o->workers[i];
+
+        info("Decode worker %u: %lu frames (peak queue %lu bytes, %lu waits), %lu formatted (peak queue %lu bytes, "
+                "%lu waits).", i, worker->frame_stats.frames, (ULONG) worker->frame_stats.peak_depth,
+                worker->frame_stats.waits, worker->text_stats.frames, (ULONG) worker->text_stats.peak_depth,
+                worker->text_stats.waits);
+
+        SpscRing_free(worker->frames);
+        SpscRing_free(worker->texts);
+    }
+
+    if (o->truncated > 0) {
+        warn("Truncated %lu frames that were too large for the pipeline's queues.", o->truncated);
+    }
+
+    free(o);
+}
+
+/**
+ * Body of a decode worker. Decodes and formats each frame from the worker's
+ * queue and passes the text along to the output thread, until the capturing
+ * thread is done and the queue is empty.
+ */
+static void* workerLoop(void* arg) {
+    Worker* o = (Worker*) arg;
+    TextBuffer* text = TextBuffer_new(FORMAT_BUFFER_SIZE);
+    size_t max_text_size = SpscRing_getMaxRecordSize(o->texts) - sizeof(TextRecord);
+    FrameDescriptor descriptor;
+    FrameRecord* frame;
+    TextRecord* record;
+    size_t size, length;
+    UINT idle_count = 0;
+
+    while (true) {
+        if ((frame = (FrameRecord*) SpscRing_peek(o->frames, &size)) == NULL) {
+            // NOTE ~> The queue has to be checked once more after seeing it
+            //  closed, as frames may have been queued just before it was.
+            if (SpscRing_isClosed(o->frames) && (frame = (FrameRecord*) SpscRing_peek(o->frames, &size)) == NULL) {
+                break;
+            }
+
+            if (frame == NULL) {
+                idle(&idle_count);
+                continue;
+            }
+        }
+
+        idle_count = 0;
+
+        TextBuffer_clear(text);
+        FrameDescriptor_decode(&descriptor, frame->data, frame->caplen);
+        descriptor.interface = frame->interface;
+        descriptor.checksums = frame->checksums;
+        EthernetFrame_format(&descriptor, text);
+
+        length = (text->length > max_text_size) ? max_text_size : text->length;
+        record = (TextRecord*) reserveWaiting(o->texts, sizeof(TextRecord) + length, &o->text_stats);
+        record->sequence = frame->sequence;
+        memcpy(record->text, text->data, length);
+        SpscRing_commit(o->texts, sizeof(TextRecord) + length);
+
+        SpscRing_consume(o->frames);
+
+        o->text_stats.frames++;
+
+        if ((size = SpscRing_getDepth(o->texts)) > o->text_stats.peak_depth) {
+            o->text_stats.peak_depth = size;
+        }
+    }
+
+    SpscRing_close(o->texts);
+    TextBuffer_free(text);
+
+    return NULL;
+}
+
+/**
+ * Body of the output thread. Collects the workers' text in capture order and
+ * writes it out in large batches, until every worker is done.
+ */
+static void* outputLoop(void* arg) {
+    Pipeline* o = (Pipeline*) arg;
+    TextBuffer* batch = TextBuffer_new(OUTPUT_BATCH_SIZE * 2);
+    uint64_t sequence = 0;
+    UINT hint = 0, idle_count = 0, i;
+    bool done;
+
+    while (true) {
+        // NOTE ~> This has to be checked before looking for text, so that text
+        //  queued just before the last worker finished isn't missed.
+        done = true;
+
+        for (i = 0; i < o->config.num_workers && done; i++) {
+            done = SpscRing_isClosed(o->workers[i].texts);
+        }
+
+        if (takeNextText(o, sequence, batch, &hint)) {
+            sequence++;
+            idle_count = 0;
+
+            if (batch->length >= OUTPUT_BATCH_SIZE) {
+                TextBuffer_flush(batch, stdout);
+            }
+
+            continue;
+        }
+
+        if (done) {
+            break;
+        }
+
+        // Nothing to do right now, so get what we have out of the door
+        if (batch->length > 0) {
+            TextBuffer_flush(batch, stdout);
+            fflush(stdout);
+        }
+
+        idle(&idle_count);
+    }
+
+    TextBuffer_flush(batch, stdout);
+    fflush(stdout);
+    TextBuffer_free(batch);
+
+    return NULL;
+}
+
+/**
+ * Appends the text of the frame with the provided sequence number to the
+ * provided batch, if whichever worker handled it has finished with it. The
+ * worker that provided the previous frame is tried first.
+ */
+static bool takeNextText(Pipeline* o, uint64_t sequence, TextBuffer* batch, UINT* hint) {
+    UINT num_workers = o->config.num_workers;
+    TextRecord* record;
+    size_t size;
+    UINT i;
+
+    for (i = 0; i < num_workers; i++) {
+        UINT index = (*hint + i) % num_workers;
+        SpscRing* texts = o->workers[index].texts;
+
+        if ((record = (TextRecord*) SpscRing_peek(texts, &size)) != NULL && record->sequence == sequence) {
+            TextBuffer_append(batch, record->text, size - sizeof(TextRecord));
+            SpscRing_consume(texts);
+            *hint = index;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Reserves room for a record of the provided size in the provided ring,
+ * waiting for the consumer to make room if it has to (and counting the wait in
+ * the provided stats).
+ */
+static void* reserveWaiting(SpscRing* ring, size_t size, StageStats* stats) {
+    UINT idle_count = 0;
+    void* record;
+
+    if ((record = SpscRing_reserve(ring, size)) != NULL) {
+        return record;
+    }
+
+    stats->waits++;
+
+    while ((record = SpscRing_reserve(ring, size)) == NULL) {
+        idle(&idle_count);
+    }
+
+    return record;
+}
+
+/**
+ * Backs off after finding nothing to do: first by yielding the CPU, then by
+ * sleeping for a little while, and eventually by sleeping for a millisecond at
+ * a time (so that an idle pipeline uses next to no CPU).
+ */
+static void idle(UINT* idle_count) {
+    struct timespec duration = { 0, IDLE_LONG_SLEEP_NS };
+
+    if (++(*idle_count) <= IDLE_SPINS) {
+        sched_yield();
+
+        return;
+    }
+
+    if (*idle_count <= IDLE_SPINS + IDLE_SHORT_SLEEPS) {
+        duration.tv_nsec = IDLE_SHORT_SLEEP_NS;
+    }
+
+    nanosleep(&duration, NULL);
+}
+
+/**
+ * Hashes the addresses (and, where there are any, ports) of the provided
+ * frame's flow without decoding the whole thing. Both directions of a flow
+ * hash the same. Frames that aren't IP are hashed by their MAC addresses.
+ */
+static uint32_t hashFlow(const OCTET* data, UINT caplen) {
+    UINT offset = MAC_ADDRESSES_SIZE;
+    uint32_t hash = 0, a, b;
+    uint16_t type;
+    UINT i, header_size, protocol;
+
+    if (caplen < MAC_ADDRESSES_SIZE + 2) {
+        return 0;
+    }
+
+    type = (data[offset] << 8) | data[offset + 1];
+
+    while ((type == ET_VLANTAGGED || type == ET_QINQTAGGED) && offset + VLAN_TAG_SIZE + 2 <= caplen) {
+        offset += VLAN_TAG_SIZE;
+        type = (data[offset] << 8) | data[offset + 1];
+    }
+
+    offset += 2;
+
+    if (type == ET_IPV4 && offset + IPV4_MIN_HEADER_SIZE <= caplen) {
+        memcpy(&a, data + offset + 12, 4);
+        memcpy(&b, data + offset + 16, 4);
+        hash = a + b;
+        protocol = data[offset + 9];
+        header_size = (data[offset] & 0x0f) * 4;
+
+        // Later fragments have no ports, so the first one can't use them either
+        if ((data[offset + 6] & 0x3f) != 0 || data[offset + 7] != 0) {
+            protocol = 0;
+        }
+    } else if (type == ET_IPV6 && offset + IPV6_HEADER_SIZE <= caplen) {
+        for (i = 8; i < IPV6_HEADER_SIZE; i += 4) {
+            memcpy(&a, data + offset + i, 4);
+            hash += a;
+        }
+
+        protocol = data[offset + 6];
+        header_size = IPV6_HEADER_SIZE;
+    } else {
+        for (i = 0; i < MAC_ADDRESSES_SIZE / 2; i++) {
+            hash += (uint32_t) (data[i] + data[i + (MAC_ADDRESSES_SIZE / 2)]) << ((i % 4) * 8);
+        }
+
+        protocol = 0;
+        header_size = 0;
+    }
+
+    if ((protocol == 6 || protocol == 17) && offset + header_size + 4 <= caplen) {
+        hash += ((data[offset + header_size] << 8) | data[offset + header_size + 1]) +
+                ((data[offset + header_size + 2] << 8) | data[offset + header_size + 3]);
+    }
+
+    // NOTE ~> Sums of addresses cluster badly, so the bits are mixed up
+    //  before the hash is used to pick a worker.
+    hash ^= protocol;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/**
+ * Pins the provided thread to the provided CPU (or leaves it alone if the CPU
+ * is negative).
+ */
+static void pinThread(pthread_t thread, int cpu, const char* name) {
+    if (cpu < 0) {
+        return;
+    }
+
+#ifdef __linux__
+    cpu_set_t set;
+    int result;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if ((result = pthread_setaffinity_np(thread, sizeof(set), &set)) != 0) {
+        warn("Failed to pin the %s to CPU %i. (%i: %s)", name, cpu, result, strerror(result));
+    }
+#else
+    warn("Pinning the %s to CPU %i is not supported on this platform.", name, cpu);
+#endif
+}
+
+/**
+ * Returns the CPU that the thread at the provided position of the configured
+ * list should be pinned to, or -1 if it shouldn't be pinned.
+ */
+static int getCpu(const PipelineConfig* config, UINT index) {
+    return (index < config->num_cpus) ? config->cpus[index] : -1;
+}
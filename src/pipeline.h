@@ -0,0 +1,53 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "common.h"
+#include "capture_source.h"
+
+// NOTE ~> A pipeline spreads the work of printing captured frames over several
+//  threads. The capturing thread only walks the capture source's buffers,
+//  copying each frame into the queue of one of the decode workers. Workers are
+//  picked by a hash of the frame's flow (the same in both directions), so all
+//  frames of a flow are handled by the same worker, in order. Each worker
+//  decodes and formats its frames and queues the text up for a single output
+//  thread, which prints it in exactly the order the frames were captured in.
+//  Every queue is a lock-free single-producer/single-consumer ring (see
+//  spsc_ring.h).
+
+/**
+ * Maximum number of decode workers, and of CPUs that threads can be pinned to.
+ */
+#define PIPELINE_MAX_WORKERS    64
+#define PIPELINE_MAX_CPUS       (PIPELINE_MAX_WORKERS + 2)
+
+/**
+ * How a pipeline is put together.
+ */
+typedef struct PipelineConfig {
+    /**
+     * Number of decode workers (zero means frames are handled without a
+     * pipeline).
+     */
+    UINT num_workers;
+
+    /**
+     * Size in bytes (a power of two) of each queue between two stages.
+     */
+    size_t queue_size;
+
+    /**
+     * CPUs to pin the capturing thread, the output thread and then each of the
+     * workers to, in that order. Threads beyond the end of the list are left
+     * to the scheduler.
+     */
+    int cpus[PIPELINE_MAX_CPUS];
+    UINT num_cpus;
+} PipelineConfig;
+
+typedef struct Pipeline Pipeline;
+
+Pipeline* Pipeline_start(const PipelineConfig* config);
+void Pipeline_push(Pipeline* o, const CapturedFrame* frame, UINT checksums);
+void Pipeline_stop(Pipeline* o);
+
+#endif
@@ -0,0 +1,277 @@
+#include "replay.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "common.h"
+#include "logger.h"
+#include "signals.h"
+
+#define NANOSECONDS_PER_SECOND  1000000000ULL
+#define BATCH_WINDOW            50000
+#define SPIN_TIME               100000
+#define MAX_BATCH_FRAMES        512
+
+/**
+ * Paces the frames of capture sources onto an injector.
+ */
+struct Replayer {
+    Injector* injector;
+    ReplayPace pace;
+
+    /**
+     * When (on the monotonic clock, in nanoseconds) the first frame was
+     * queued, and whether that has happened yet.
+     */
+    uint64_t start;
+    bool started;
+
+    /**
+     * When (relative to the start) the current pass over a source started, the
+     * original timestamp of its first frame, and whether it has one yet.
+     */
+    uint64_t pass_offset;
+    uint64_t pass_first_timestamp;
+    bool pass_started;
+
+    /**
+     * When (relative to the start) the most recent frame was due.
+     */
+    uint64_t last_due;
+
+    /**
+     * Frames queued so far and since the last flush.
+     */
+    ULONG frames;
+    UINT batched;
+
+    /**
+     * How late (in nanoseconds) the latest frame was queued.
+     */
+    uint64_t max_lateness;
+};
+
+static uint64_t getDueTime(Replayer* o, const CapturedFrame* frame);
+static bool waitForFrame(Replayer* o, uint64_t due);
+static void countFrame(Replayer* o);
+static bool waitUntil(uint64_t time);
+static uint64_t getMonotonicNanos();
+
+/**
+ * Allocates and initializes a new Replayer, which hands frames to the provided
+ * Injector at the provided pace, prior to returning a pointer to it.
+ */
+Replayer* Replayer_new(Injector* injector, const ReplayPace* pace) {
+    Replayer* replayer = (Replayer*) calloc(1, sizeof(Replayer));
+
+    if (replayer == NULL) {
+        fatal("Failed to allocate a replayer.");
+    }
+
+    replayer->injector = injector;
+    replayer->pace = *pace;
+
+    return replayer;
+}
+
+/**
+ * Replays every frame of the provided CaptureSource (or as many as there are
+ * before a stop is requested). A Replayer can replay any number of sources one
+ * after the other, and each one picks up where the last one left off.
+ */
+void Replayer_run(Replayer* o, CaptureSource* source) {
+    CapturedFrame frame;
+    int filled;
+
+    o->pass_started = false;
+    o->pass_offset = o->last_due;
+
+    while (!Signals_stopRequested()) {
+        if ((filled = CaptureSource_fill(source)) == CS_END) {
+            break;
+        } else if (filled == 0) {
+            continue;
+        }
+
+        while (CaptureSource_next(source, &frame)) {
+            if (!waitForFrame(o, getDueTime(o, &frame))) {
+                break;
+            }
+
+            Injector_queue(o->injector, frame.data, frame.caplen);
+            countFrame(o);
+        }
+
+        CaptureSource_release(source);
+    }
+
+    Injector_flush(o->injector);
+    o->batched = 0;
+}
+
+/**
+ * Generates the provided number of frames (or as many as there are before a
+ * stop is requested, if zero) with the provided Generator, building each one
+ * right where the Injector transmits it from.
+ * NOTE ~> Generated frames have no timestamps, so they can only be paced at a
+ *  fixed rate or as fast as possible.
+ */
+void Replayer_generate(Replayer* o, Generator* generator, ULONG count) {
+    OCTET* data;
+    ULONG generated;
+    UINT slot;
+
+    for (generated = 0; (count == 0 || generated < count) && !Signals_stopRequested(); generated++) {
+        if (!waitForFrame(o, getDueTime(o, NULL))) {
+            break;
+        }
+
+        data = Injector_reserve(o->injector, &slot);
+        Injector_commit(o->injector, Generator_build(generator, data, slot));
+        countFrame(o);
+    }
+
+    Injector_flush(o->injector);
+    o->batched = 0;
+}
+
+/**
+ * Logs how the replay went and frees the provided Replayer (but not its
+ * Injector).
+ */
+void Replayer_free(Replayer* o) {
+    double seconds = o->started ? (double) (getMonotonicNanos() - o->start) / NANOSECONDS_PER_SECOND : 0.0;
+    ULONG flushes = Injector_getFlushes(o->injector);
+
+    if (seconds <= 0.0) {
+        seconds = 1.0 / NANOSECONDS_PER_SECOND;
+    }
+
+    info("Injected %lu frames (%lu bytes) in %.3f seconds (%.0f frames/s, %.2f Mbps) in %lu batches.",
+            Injector_getFrames(o->injector), Injector_getOctets(o->injector), seconds,
+            Injector_getFrames(o->injector) / seconds, Injector_getOctets(o->injector) * 8 / seconds / 1000000,
+            flushes);
+
+    if (o->pace.mode != RM_TOP_SPEED) {
+        info("Frames were queued at most %.1f microseconds late.", (double) o->max_lateness / 1000);
+    }
+
+    free(o);
+}
+
+/**
+ * Works out when (on the monotonic clock, in nanoseconds) the provided frame
+ * (which is only looked at when frames are paced as they originally were) is
+ * due to be queued.
+ */
+static uint64_t getDueTime(Replayer* o, const CapturedFrame* frame) {
+    uint64_t timestamp;
+
+    if (!o->started) {
+        o->start = getMonotonicNanos();
+        o->started = true;
+    }
+
+    switch (o->pace.mode) {
+        case RM_ORIGINAL:
+            timestamp = (uint64_t) frame->timestamp.tv_sec * NANOSECONDS_PER_SECOND + frame->timestamp.tv_nsec;
+
+            if (!o->pass_started) {
+                o->pass_first_timestamp = timestamp;
+                o->pass_started = true;
+            }
+
+            // NOTE ~> Frames that are out of order in the file go out right
+            //  away rather than ever waiting for time to run backwards.
+            if (timestamp > o->pass_first_timestamp &&
+                    o->pass_offset + (uint64_t) ((timestamp - o->pass_first_timestamp) / o->pace.speed) > o->last_due) {
+                o->last_due = o->pass_offset + (uint64_t) ((timestamp - o->pass_first_timestamp) / o->pace.speed);
+            }
+            break;
+
+        case RM_RATE:
+            o->last_due = (uint64_t) ((double) o->frames * NANOSECONDS_PER_SECOND / o->pace.rate);
+            break;
+
+        default:
+            return 0;
+    }
+
+    return o->start + o->last_due;
+}
+
+/**
+ * Hands over what has been queued so far and waits for the next frame if it
+ * isn't due (at the provided time) within the batch window, or notes how late
+ * it is otherwise. Returns false if a stop was requested in the meantime.
+ */
+static bool waitForFrame(Replayer* o, uint64_t due) {
+    uint64_t now;
+
+    if (o->pace.mode == RM_TOP_SPEED) {
+        return true;
+    }
+
+    now = getMonotonicNanos();
+
+    if (due > now + BATCH_WINDOW) {
+        Injector_flush(o->injector);
+        o->batched = 0;
+
+        return waitUntil(due);
+    } else if (now > due && now - due > o->max_lateness) {
+        o->max_lateness = now - due;
+    }
+
+    return true;
+}
+
+/**
+ * Counts a frame that was just queued, and hands the batch over once it has
+ * grown large enough.
+ */
+static void countFrame(Replayer* o) {
+    o->frames++;
+
+    if (++o->batched >= MAX_BATCH_FRAMES) {
+        Injector_flush(o->injector);
+        o->batched = 0;
+    }
+}
+
+/**
+ * Sleeps (and then spins, for the last stretch) until the provided time on the
+ * monotonic clock. Returns false if a stop was requested in the meantime.
+ */
+static bool waitUntil(uint64_t time) {
+    struct timespec delay;
+    uint64_t now;
+
+    while ((now = getMonotonicNanos()) < time) {
+        if (Signals_stopRequested()) {
+            return false;
+        }
+
+        // NOTE ~> Waking up from a sleep takes a while (and how long varies), so
+        //  only sleep until shortly before the time and spin from there.
+        if (time - now > SPIN_TIME) {
+            delay.tv_sec = (time - now - SPIN_TIME) / NANOSECONDS_PER_SECOND;
+            delay.tv_nsec = (time - now - SPIN_TIME) % NANOSECONDS_PER_SECOND;
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns the time (in nanoseconds) on a clock that only ever moves forward.
+ */
+static uint64_t getMonotonicNanos() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
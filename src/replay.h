@@ -0,0 +1,57 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include "generator.h"
+#include "injector.h"
+
+// NOTE ~> A replayer hands the frames of capture sources to an injector at a
+//  controlled pace. Every frame gets a time at which it is due (going by its
+//  original timestamp, a fixed rate, or right away), and frames that are due
+//  within a short window are queued together and go out in one batch, so
+//  high rates don't cost a system call per frame while the rate over any
+//  stretch longer than the window stays exact. In between batches the
+//  replayer sleeps, and spins for the last stretch so that it wakes up on time.
+//  Pacing runs off a monotonic clock and never drifts, since every due time is
+//  worked out from where the replay started rather than from the last frame.
+//  Frames can also come from a generator instead, which builds each one right
+//  where the injector transmits it from.
+
+/**
+ * How frames are paced.
+ */
+typedef enum ReplayMode {
+    /**
+     * As far apart as they originally were (divided by the speed).
+     */
+    RM_ORIGINAL,
+
+    /**
+     * At a fixed number of frames per second.
+     */
+    RM_RATE,
+
+    /**
+     * As fast as the interface takes them.
+     */
+    RM_TOP_SPEED
+} ReplayMode;
+
+/**
+ * How a replay is paced.
+ */
+typedef struct ReplayPace {
+    ReplayMode mode;
+    double speed;
+    UINT rate;
+} ReplayPace;
+
+typedef struct Replayer Replayer;
+
+Replayer* Replayer_new(Injector* injector, const ReplayPace* pace);
+void Replayer_run(Replayer* o, CaptureSource* source);
+void Replayer_generate(Replayer* o, Generator* generator, ULONG count);
+void Replayer_free(Replayer* o);
+
+#endif
@@ -0,0 +1,149 @@
+#include "signals.h"
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "logger.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t dumpRequested = 0;
+static int wakePipe[2] = { -1, -1 };
+
+static void signalHandler(int sig_num);
+static void wake();
+
+/**
+ * Sets up the wake pipe and installs handlers for the signals that this
+ * program cares about (like those sent when Ctrl+C is pressed).
+ */
+void Signals_install() {
+    struct sigaction action;
+    int i;
+
+    if (pipe(wakePipe) == -1) {
+        fatal("Failed to create the signal wake pipe. (%i: %s)", errno, strerror(errno));
+    }
+
+    // NOTE ~> Neither end of the pipe may ever block. If it fills up then there
+    //  is already a pending wake up, so dropping further writes is harmless.
+    for (i = 0; i < 2; i++) {
+        fcntl(wakePipe[i], F_SETFL, fcntl(wakePipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wakePipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    // NOTE ~> SA_RESTART is deliberately left off so that blocking calls return
+    //  with EINTR when a signal arrives.
+    memset(&action, 0x00, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+/**
+ * Returns whether or not the program has been asked to stop.
+ */
+bool Signals_stopRequested() {
+    return stopRequested != 0;
+}
+
+/**
+ * Returns the descriptor that becomes readable whenever a handled signal
+ * arrives.
+ */
+int Signals_getWakeDescriptor() {
+    return wakePipe[0];
+}
+
+/**
+ * Empties the wake pipe, so that waiting on it blocks again until the next
+ * signal arrives.
+ */
+void Signals_clearWake() {
+    char buff[64];
+
+    while (read(wakePipe[0], buff, sizeof(buff)) > 0) {
+        // Nothing to do but keep reading
+    }
+}
+
+/**
+ * Asks the program to stop, exactly as if SIGINT had been received.
+ */
+void Signals_requestStop() {
+    stopRequested = 1;
+    wake();
+}
+
+/**
+ * Returns whether or not a dump has been asked for since the last time this
+ * was called.
+ */
+bool Signals_takeDumpRequest() {
+    return __atomic_exchange_n(&dumpRequested, 0, __ATOMIC_ACQ_REL) != 0;
+}
+
+/**
+ * Asks for a dump to be taken, exactly as if SIGUSR1 had been received.
+ */
+void Signals_requestDump() {
+    __atomic_store_n(&dumpRequested, 1, __ATOMIC_RELEASE);
+    wake();
+}
+
+/**
+ * Starts a thread running the provided function with every signal blocked, so
+ * that signals are always handled by the main thread (where they interrupt
+ * the wait for frames). Returns zero on success, like pthread_create(...).
+ */
+int Signals_createThread(pthread_t* thread, void* (*body)(void*), void* arg) {
+    sigset_t all, previous;
+    int result;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    result = pthread_create(thread, NULL, body, arg);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    return result;
+}
+
+/**
+ * Provides overriden signal handling specific to this program's use cases for
+ * registered signals.
+ */
+static void signalHandler(int sig_num) {
+    switch (sig_num) {
+        case SIGINT:
+        case SIGTERM:
+            stopRequested = 1;
+            break;
+
+        case SIGUSR1:
+            dumpRequested = 1;
+            break;
+
+        default:
+            break;
+    }
+
+    wake();
+}
+
+/**
+ * Wakes up anything waiting on the wake descriptor.
+ */
+static void wake() {
+    int saved_errno = errno;
+    char byte = 0;
+
+    if (wakePipe[1] != -1) {
+        (void) !write(wakePipe[1], &byte, 1);
+    }
+
+    errno = saved_errno;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef _SIGNALS_H_
+#define _SIGNALS_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+// NOTE ~> Signal handling is a singleton hidden away behind this interface. The
+//  handlers only ever touch a sig_atomic_t flag and write to a pipe, both of
+//  which are async-signal-safe. The read end of the pipe can be waited on
+//  alongside capture descriptors so that a signal wakes up a blocked loop
+//  immediately. SIGUSR1 doesn't stop anything, it only asks for a dump (of the
+//  flight recorder) to be taken.
+
+void Signals_install();
+bool Signals_stopRequested();
+int Signals_getWakeDescriptor();
+void Signals_clearWake();
+void Signals_requestStop();
+bool Signals_takeDumpRequest();
+void Signals_requestDump();
+int Signals_createThread(pthread_t* thread, void* (*body)(void*), void* arg);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,647 @@
+#include "sketches.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "logger.h"
+#include "text_buffer.h"
+
+#define NANOSECONDS_PER_SECOND  1000000000ULL
+#define OUTPUT_BUFFER_SIZE      4096
+#define MAC_ADDRESS_SIZE        6
+#define SKETCH_DEPTH            4
+#define MIN_SKETCH_WIDTH        256
+#define MIN_HLL_PRECISION       4
+#define MAX_HLL_PRECISION       16
+#define EULER                   2.718281828459045
+
+/**
+ * The fields of frames that are sketched.
+ */
+typedef enum SketchField {
+    SF_SRC_MAC,
+    SF_DST_MAC,
+    SF_SRC_IP,
+    SF_DST_IP,
+    SF_SRC_PORT,
+    SF_DST_PORT,
+    SF_COUNT
+} SketchField;
+
+static const char* fieldNames[SF_COUNT] = { "src mac", "dst mac", "src ip", "dst ip", "src port", "dst port" };
+
+/**
+ * A value of one of the fields (a MAC or IP address, or a port followed by the
+ * IP protocol), padded with zeros.
+ */
+typedef struct SketchKey {
+    OCTET data[16];
+    uint8_t length;
+} SketchKey;
+
+/**
+ * One of the values with the highest estimates, along with its hash, its
+ * estimate and the slot of the heap's index that it is found through.
+ */
+typedef struct HeavyHitter {
+    SketchKey key;
+    uint64_t hash;
+    uint32_t count;
+    UINT slot;
+} HeavyHitter;
+
+/**
+ * Everything that is kept about a single field.
+ */
+typedef struct Sketch {
+    /**
+     * The Count-Min sketch (SKETCH_DEPTH rows of counters), and the
+     * HyperLogLog's registers.
+     */
+    uint32_t* counters;
+    uint8_t* registers;
+
+    /**
+     * The heavy hitters as a min-heap (by estimate), and an open-addressing
+     * (linear probing) index of them by hash that holds each one's position in
+     * the heap plus one (or zero for an empty slot).
+     */
+    HeavyHitter* top;
+    UINT num_top;
+    UINT* index;
+} Sketch;
+
+/**
+ * Sketches of every field over the current interval.
+ */
+struct Sketches {
+    Sketch sketches[SF_COUNT];
+
+    /**
+     * Geometry shared by the sketches of every field: the width of each
+     * Count-Min row, the number of bits of a hash that pick a HyperLogLog
+     * register, the number of heavy hitters kept and the size of their index
+     * (both powers of two, save for the number of heavy hitters).
+     */
+    UINT width;
+    UINT precision;
+    UINT top_count;
+    UINT index_size;
+
+    /**
+     * Length of an interval and when (in capture time, in nanoseconds) the
+     * current one started, and whether a frame has been seen yet.
+     */
+    uint64_t interval;
+    uint64_t interval_start;
+    bool started;
+
+    /**
+     * Frames (and octets) seen in the current interval.
+     */
+    ULONG frames;
+    ULONG octets;
+
+    /**
+     * Where the heavy hitters are sorted and the report is put together.
+     */
+    HeavyHitter* sorted;
+    TextBuffer* buff;
+};
+
+static void updateSketch(Sketches* o, Sketch* sketch, const SketchKey* key);
+static void updateTop(Sketches* o, Sketch* sketch, const SketchKey* key, uint64_t hash, uint32_t estimate);
+static UINT findSlot(const Sketches* o, const Sketch* sketch, const SketchKey* key, uint64_t hash);
+static void removeSlot(Sketches* o, Sketch* sketch, UINT slot);
+static void siftUp(Sketch* sketch, UINT position);
+static void siftDown(Sketch* sketch, UINT position);
+static void swapHitters(Sketch* sketch, UINT a, UINT b);
+static uint64_t hashKey(const SketchKey* key);
+static double estimateDistinct(const Sketches* o, const Sketch* sketch);
+static void report(Sketches* o);
+static void appendKey(TextBuffer* buff, SketchField field, const SketchKey* key);
+static void reset(Sketches* o);
+static int compareHitters(const void* a, const void* b);
+
+/**
+ * Allocates and initializes new Sketches, which take up about the provided
+ * number of kilobytes between them, keep the provided number of heavy hitters
+ * of each field, and are reported on (and started over) every interval of the
+ * provided number of seconds, prior to returning a pointer to them.
+ */
+Sketches* Sketches_new(UINT memory_kb, UINT top_count, UINT interval) {
+    Sketches* sketches = (Sketches*) calloc(1, sizeof(Sketches));
+    size_t budget = (size_t) memory_kb * 1024 / SF_COUNT;
+    size_t fixed, rest;
+    UINT i;
+
+    if (sketches == NULL) {
+        fatal("Failed to allocate the sketches.");
+    }
+
+    // Every field gets an equal share of the memory. The heavy hitters (and
+    //  their index, which is kept at most half full) come off the top, an
+    //  eighth of what is left goes to the HyperLogLog and the rest to the
+    //  Count-Min sketch.
+    sketches->top_count = top_count;
+    sketches->index_size = 1;
+
+    while (sketches->index_size < top_count * 2) {
+        sketches->index_size *= 2;
+    }
+
+    fixed = top_count * sizeof(HeavyHitter) + sketches->index_size * sizeof(UINT);
+    rest = (budget > fixed) ? budget - fixed : 0;
+
+    sketches->precision = MIN_HLL_PRECISION;
+
+    while (sketches->precision < MAX_HLL_PRECISION && ((size_t) 2 << sketches->precision) <= rest / 8) {
+        sketches->precision++;
+    }
+
+    sketches->width = MIN_SKETCH_WIDTH;
+
+    while ((size_t) SKETCH_DEPTH * (sketches->width * 2) * sizeof(uint32_t) + ((size_t) 1 << sketches->precision) <=
+            rest) {
+        sketches->width *= 2;
+    }
+
+    if ((size_t) SKETCH_DEPTH * sketches->width * sizeof(uint32_t) + ((size_t) 1 << sketches->precision) > rest) {
+        fatal("%u KB is too little memory to keep the top %u values of every field in.", memory_kb, top_count);
+    }
+
+    for (i = 0; i < SF_COUNT; i++) {
+        Sketch* sketch = &sketches->sketches[i];
+
+        sketch->counters = (uint32_t*) calloc((size_t) SKETCH_DEPTH * sketches->width, sizeof(uint32_t));
+        sketch->registers = (uint8_t*) calloc((size_t) 1 << sketches->precision, sizeof(uint8_t));
+        sketch->top = (HeavyHitter*) calloc(top_count, sizeof(HeavyHitter));
+        sketch->index = (UINT*) calloc(sketches->index_size, sizeof(UINT));
+
+        if (sketch->counters == NULL || sketch->registers == NULL || sketch->top == NULL || sketch->index == NULL) {
+            fatal("Failed to allocate the sketches.");
+        }
+    }
+
+    if ((sketches->sorted = (HeavyHitter*) malloc(top_count * sizeof(HeavyHitter))) == NULL) {
+        fatal("Failed to allocate the sketches.");
+    }
+
+    sketches->buff = TextBuffer_new(OUTPUT_BUFFER_SIZE);
+    sketches->interval = (uint64_t) interval * NANOSECONDS_PER_SECOND;
+
+    info("Sketching every field with %u x %u counters and %u registers (top %u, every %u seconds).", SKETCH_DEPTH,
+            sketches->width, 1 << sketches->precision, top_count, interval);
+
+    return sketches;
+}
+
+/**
+ * Accounts for the provided (decoded) frame, captured at the provided time and
+ * of the provided length on the wire, in the provided Sketches, reporting on
+ * (and starting over) the interval first if the frame comes after it.
+ */
+void Sketches_update(Sketches* o, const FrameDescriptor* frame, const struct timespec* timestamp, UINT wirelen) {
+    uint64_t now = (uint64_t) timestamp->tv_sec * NANOSECONDS_PER_SECOND + timestamp->tv_nsec;
+    SketchKey key;
+    size_t size;
+
+    // NOTE ~> Intervals line up with the clock (e.g. on the minute), and
+    //  frames that are out of order count for whichever interval is current.
+    if (!o->started || now >= o->interval_start + o->interval) {
+        if (o->started) {
+            report(o);
+            reset(o);
+        }
+
+        o->interval_start = now - now % o->interval;
+        o->started = true;
+    }
+
+    o->frames++;
+    o->octets += wirelen;
+
+    if (!(frame->layers & FL_LINK)) {
+        return;
+    }
+
+    memset(&key, 0x00, sizeof(key));
+    key.length = MAC_ADDRESS_SIZE;
+    memcpy(key.data, frame->data + MAC_ADDRESS_SIZE, MAC_ADDRESS_SIZE);
+    updateSketch(o, &o->sketches[SF_SRC_MAC], &key);
+    memcpy(key.data, frame->data, MAC_ADDRESS_SIZE);
+    updateSketch(o, &o->sketches[SF_DST_MAC], &key);
+
+    if (!(frame->layers & FL_NETWORK)) {
+        return;
+    }
+
+    size = (frame->ethernet_type == ET_IPV4) ? 4 : 16;
+    key.length = (uint8_t) size;
+    memcpy(key.data, FrameDescriptor_getSourceAddress(frame), size);
+    updateSketch(o, &o->sketches[SF_SRC_IP], &key);
+    memcpy(key.data, FrameDescriptor_getDestinationAddress(frame), size);
+    updateSketch(o, &o->sketches[SF_DST_IP], &key);
+
+    if (!(frame->layers & FL_TRANSPORT) || (frame->ip_protocol != IP_TCP && frame->ip_protocol != IP_UDP)) {
+        return;
+    }
+
+    memset(&key, 0x00, sizeof(key));
+    key.length = 3;
+    key.data[0] = (OCTET) (frame->src_port >> 8);
+    key.data[1] = (OCTET) frame->src_port;
+    key.data[2] = frame->ip_protocol;
+    updateSketch(o, &o->sketches[SF_SRC_PORT], &key);
+    key.data[0] = (OCTET) (frame->dst_port >> 8);
+    key.data[1] = (OCTET) frame->dst_port;
+    updateSketch(o, &o->sketches[SF_DST_PORT], &key);
+}
+
+/**
+ * Reports on the current interval of the provided Sketches (e.g. at shutdown),
+ * if anything was seen in it, and starts over.
+ */
+void Sketches_flush(Sketches* o) {
+    if (o->frames > 0) {
+        report(o);
+    }
+
+    reset(o);
+    o->started = false;
+}
+
+/**
+ * Frees the provided Sketches and everything associated with them.
+ */
+void Sketches_free(Sketches* o) {
+    UINT i;
+
+    for (i = 0; i < SF_COUNT; i++) {
+        free(o->sketches[i].counters);
+        free(o->sketches[i].registers);
+        free(o->sketches[i].top);
+        free(o->sketches[i].index);
+    }
+
+    free(o->sorted);
+    TextBuffer_free(o->buff);
+    free(o);
+}
+
+/**
+ * Accounts for the provided value in the Count-Min sketch, HyperLogLog and
+ * heavy hitters of its field.
+ */
+static void updateSketch(Sketches* o, Sketch* sketch, const SketchKey* key) {
+    uint64_t hash = hashKey(key);
+    uint32_t h1 = (uint32_t) hash, h2 = (uint32_t) (hash >> 32) | 1;
+    uint32_t estimate = UINT32_MAX;
+    UINT cells[SKETCH_DEPTH];
+    uint64_t rest = hash << o->precision;
+    UINT i, rank;
+
+    // Count the value in one counter of every row, the rows being picked
+    //  between by double hashing, and take the smallest of them as its estimate
+    // NOTE ~> Only the counters that are below the new estimate are raised
+    //  (conservative update), which keeps the estimates much closer to the
+    //  truth without ever letting them fall under it.
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        cells[i] = i * o->width + ((h1 + i * h2) & (o->width - 1));
+
+        if (sketch->counters[cells[i]] < estimate) {
+            estimate = sketch->counters[cells[i]];
+        }
+    }
+
+    estimate++;
+
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        if (sketch->counters[cells[i]] < estimate) {
+            sketch->counters[cells[i]] = estimate;
+        }
+    }
+
+    // The top bits of the hash pick a register, which keeps the longest run of
+    //  leading zeros (plus one) seen in the rest of them
+    rank = (rest == 0) ? 64 - o->precision + 1 : (UINT) __builtin_clzll(rest) + 1;
+
+    if (rank > sketch->registers[hash >> (64 - o->precision)]) {
+        sketch->registers[hash >> (64 - o->precision)] = (uint8_t) rank;
+    }
+
+    updateTop(o, sketch, key, hash, estimate);
+}
+
+/**
+ * Keeps the provided value (with the provided hash and new estimate) among the
+ * heavy hitters of its field if it is one.
+ */
+static void updateTop(Sketches* o, Sketch* sketch, const SketchKey* key, uint64_t hash, uint32_t estimate) {
+    UINT slot, position;
+
+    // NOTE ~> Estimates only ever grow, so a value that is estimated below the
+    //  smallest heavy hitter can't be one of them, and most values are turned
+    //  away right here without looking them up.
+    if (sketch->num_top == o->top_count && estimate < sketch->top[0].count) {
+        return;
+    }
+
+    slot = findSlot(o, sketch, key, hash);
+
+    if (sketch->index[slot] != 0) {
+        position = sketch->index[slot] - 1;
+        sketch->top[position].count = estimate;
+        siftDown(sketch, position);
+
+        return;
+    }
+
+    if (sketch->num_top < o->top_count) {
+        position = sketch->num_top++;
+    } else if (estimate > sketch->top[0].count) {
+        // Make room by dropping the smallest heavy hitter
+        position = 0;
+        removeSlot(o, sketch, sketch->top[0].slot);
+        slot = findSlot(o, sketch, key, hash);
+    } else {
+        return;
+    }
+
+    sketch->top[position].key = *key;
+    sketch->top[position].hash = hash;
+    sketch->top[position].count = estimate;
+    sketch->top[position].slot = slot;
+    sketch->index[slot] = position + 1;
+
+    siftUp(sketch, position);
+    siftDown(sketch, position);
+}
+
+/**
+ * Returns the slot of the index of the provided field's heavy hitters that
+ * holds the provided value (with the provided hash), or the empty slot that it
+ * would go in if it isn't one of them.
+ */
+static UINT findSlot(const Sketches* o, const Sketch* sketch, const SketchKey* key, uint64_t hash) {
+    UINT mask = o->index_size - 1;
+    UINT slot = (UINT) hash & mask;
+    const HeavyHitter* hitter;
+
+    while (sketch->index[slot] != 0) {
+        hitter = &sketch->top[sketch->index[slot] - 1];
+
+        if (hitter->hash == hash && hitter->key.length == key->length &&
+                memcmp(hitter->key.data, key->data, key->length) == 0) {
+            break;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Empties the provided slot of the index of the provided field's heavy hitters,
+ * shifting the slots that follow it back so that none of them become
+ * unreachable.
+ */
+static void removeSlot(Sketches* o, Sketch* sketch, UINT slot) {
+    UINT mask = o->index_size - 1;
+    UINT next = slot, home;
+
+    sketch->index[slot] = 0;
+
+    while (sketch->index[next = (next + 1) & mask] != 0) {
+        home = (UINT) sketch->top[sketch->index[next] - 1].hash & mask;
+
+        // Move the entry into the hole unless its home lies (cyclically)
+        //  after the hole and up to where it is
+        if ((next > slot && (home <= slot || home > next)) || (next < slot && home <= slot && home > next)) {
+            sketch->index[slot] = sketch->index[next];
+            sketch->top[sketch->index[slot] - 1].slot = slot;
+            sketch->index[next] = 0;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * Moves the heavy hitter at the provided position of the heap up for as long as
+ * its estimate is smaller than its parent's.
+ */
+static void siftUp(Sketch* sketch, UINT position) {
+    while (position > 0 && sketch->top[position].count < sketch->top[(position - 1) / 2].count) {
+        swapHitters(sketch, position, (position - 1) / 2);
+        position = (position - 1) / 2;
+    }
+}
+
+/**
+ * Moves the heavy hitter at the provided position of the heap down for as long
+ * as its estimate is larger than either of its children's.
+ */
+static void siftDown(Sketch* sketch, UINT position) {
+    UINT smallest, child;
+
+    for (;;) {
+        smallest = position;
+        child = position * 2 + 1;
+
+        if (child < sketch->num_top && sketch->top[child].count < sketch->top[smallest].count) {
+            smallest = child;
+        }
+
+        if (child + 1 < sketch->num_top && sketch->top[child + 1].count < sketch->top[smallest].count) {
+            smallest = child + 1;
+        }
+
+        if (smallest == position) {
+            return;
+        }
+
+        swapHitters(sketch, position, smallest);
+        position = smallest;
+    }
+}
+
+/**
+ * Swaps the heavy hitters at the provided positions of the heap, keeping the
+ * index pointed at both.
+ */
+static void swapHitters(Sketch* sketch, UINT a, UINT b) {
+    HeavyHitter swap = sketch->top[a];
+
+    sketch->top[a] = sketch->top[b];
+    sketch->top[b] = swap;
+    sketch->index[sketch->top[a].slot] = a + 1;
+    sketch->index[sketch->top[b].slot] = b + 1;
+}
+
+/**
+ * Hashes the provided value, eight octets at a time, and mixes the result so
+ * that every bit of it can be relied on.
+ */
+static uint64_t hashKey(const SketchKey* key) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ key->length, word;
+    size_t i;
+
+    for (i = 0; i < sizeof(key->data); i += sizeof(word)) {
+        memcpy(&word, key->data + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * Returns the HyperLogLog estimate of the number of distinct values of the
+ * provided field, falling back to linear counting while it is small.
+ */
+static double estimateDistinct(const Sketches* o, const Sketch* sketch) {
+    UINT num_registers = 1 << o->precision, zeros = 0, i;
+    double sum = 0.0, alpha, estimate;
+
+    for (i = 0; i < num_registers; i++) {
+        sum += 1.0 / (double) (1ULL << sketch->registers[i]);
+
+        if (sketch->registers[i] == 0) {
+            zeros++;
+        }
+    }
+
+    switch (num_registers) {
+        case 16:
+            alpha = 0.673;
+            break;
+
+        case 32:
+            alpha = 0.697;
+            break;
+
+        case 64:
+            alpha = 0.709;
+            break;
+
+        default:
+            alpha = 0.7213 / (1.0 + 1.079 / num_registers);
+            break;
+    }
+
+    estimate = alpha * num_registers * num_registers / sum;
+
+    if (estimate <= 2.5 * num_registers && zeros > 0) {
+        estimate = num_registers * log((double) num_registers / zeros);
+    }
+
+    return estimate;
+}
+
+/**
+ * Prints what was seen over the current interval: how much, how many distinct
+ * values of each field, and which of them were seen the most.
+ */
+static void report(Sketches* o) {
+    TextBuffer* buff = o->buff;
+    time_t start = (time_t) (o->interval_start / NANOSECONDS_PER_SECOND);
+    char time_string[32] = { 0 };
+    struct tm local;
+    Sketch* sketch;
+    UINT i, j;
+
+    strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M:%S", localtime_r(&start, &local));
+
+    // NOTE ~> Each estimate is over by at most e / width of the frames seen,
+    //  but for a chance of e ^ -depth.
+    TextBuffer_appendFormat(buff, "[SKETCH]\t%s%s%s\t%lu s\t%lu frames\t%lu bytes\t(counts over by at most %lu)\n",
+            LC_GREEN, time_string, LC_RESET, (ULONG) (o->interval / NANOSECONDS_PER_SECOND), o->frames, o->octets,
+            (ULONG) (EULER * o->frames / o->width));
+
+    for (i = 0; i < SF_COUNT; i++) {
+        sketch = &o->sketches[i];
+
+        memcpy(o->sorted, sketch->top, sketch->num_top * sizeof(HeavyHitter));
+        qsort(o->sorted, sketch->num_top, sizeof(HeavyHitter), compareHitters);
+
+        TextBuffer_appendFormat(buff, "[SKETCH]\t%s\t~%.0f distinct\t", fieldNames[i], estimateDistinct(o, sketch));
+
+        for (j = 0; j < sketch->num_top; j++) {
+            if (j > 0) {
+                TextBuffer_appendString(buff, ", ");
+            }
+
+            TextBuffer_appendString(buff, LC_GREEN);
+            appendKey(buff, (SketchField) i, &o->sorted[j].key);
+            TextBuffer_appendString(buff, LC_RESET);
+            TextBuffer_appendFormat(buff, " %u", o->sorted[j].count);
+        }
+
+        TextBuffer_appendString(buff, "\n");
+    }
+
+    TextBuffer_flush(buff, stdout);
+}
+
+/**
+ * Appends the provided value of the provided field to the provided TextBuffer.
+ */
+static void appendKey(TextBuffer* buff, SketchField field, const SketchKey* key) {
+    char protocol[16] = { 0 };
+
+    switch (field) {
+        case SF_SRC_MAC:
+        case SF_DST_MAC:
+            TextBuffer_appendHex(buff, key->data, MAC_ADDRESS_SIZE, '-', 2);
+            break;
+
+        case SF_SRC_IP:
+        case SF_DST_IP:
+            TextBuffer_appendAddress(buff, (key->length == 4) ? AF_INET : AF_INET6, key->data);
+            break;
+
+        default:
+            IpProtocol_toString(key->data[2], protocol, sizeof(protocol));
+            TextBuffer_appendFormat(buff, "%u/%s", (key->data[0] << 8) | key->data[1], protocol);
+            break;
+    }
+}
+
+/**
+ * Empties every sketch for the next interval.
+ */
+static void reset(Sketches* o) {
+    Sketch* sketch;
+    UINT i;
+
+    for (i = 0; i < SF_COUNT; i++) {
+        sketch = &o->sketches[i];
+
+        memset(sketch->counters, 0x00, (size_t) SKETCH_DEPTH * o->width * sizeof(uint32_t));
+        memset(sketch->registers, 0x00, (size_t) 1 << o->precision);
+        memset(sketch->index, 0x00, o->index_size * sizeof(UINT));
+        sketch->num_top = 0;
+    }
+
+    o->frames = 0;
+    o->octets = 0;
+}
+
+/**
+ * Orders heavy hitters from the largest estimate to the smallest (for
+ * qsort(...)).
+ */
+static int compareHitters(const void* a, const void* b) {
+    uint32_t first = ((const HeavyHitter*) a)->count, second = ((const HeavyHitter*) b)->count;
+
+    return (first < second) - (first > second);
+}
@@ -0,0 +1,27 @@
+#ifndef _SKETCHES_H_
+#define _SKETCHES_H_
+
+#include "common.h"
+#include "frame_descriptor.h"
+#include <time.h>
+
+// NOTE ~> Sketches summarize the traffic on the link in a fixed amount of
+//  memory, no matter how many hosts or flows there are. For each of the source
+//  and destination MAC addresses, IP addresses and ports, every frame updates
+//  a Count-Min sketch (which estimates how many frames each value was seen in,
+//  possibly over but never under), a small min-heap of the values with the
+//  highest estimates (the heavy hitters), and a HyperLogLog (which estimates
+//  how many distinct values were seen). Each of them takes a single hash of the
+//  value, so a frame costs six hashes and a handful of counter updates. The
+//  sketches cover fixed intervals of capture time: once a frame from the next
+//  interval comes along, the top values and distinct counts of the one that
+//  just ended are printed and every sketch starts over.
+
+typedef struct Sketches Sketches;
+
+Sketches* Sketches_new(UINT memory_kb, UINT top_count, UINT interval);
+void Sketches_update(Sketches* o, const FrameDescriptor* frame, const struct timespec* timestamp, UINT wirelen);
+void Sketches_flush(Sketches* o);
+void Sketches_free(Sketches* o);
+
+#endif
@@ -0,0 +1,237 @@
+#include "sniffer.h"
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "common.h"
+#include "checksum.h"
+#include "options.h"
+#include "signals.h"
+#include "ethernet_frame.h"
+#include "frame_descriptor.h"
+#include "logger.h"
+
+#define OUTPUT_BUFFER_SIZE      8192
+
+static void decodeFrame(SniffContext* context, FrameDescriptor* descriptor, const CapturedFrame* frame);
+static void pollDrops(SniffContext* context, time_t* next_poll);
+static void waitForFrames(CaptureSource* source);
+
+/**
+ * Actually sniffs and logs packets from the source of the provided
+ * SniffContext, counting them in its MetricsCounters. If the context calls for
+ * it, the checksums of every frame are verified (before any fragments are put
+ * back together) and counted, and those that are logged are flagged if any
+ * were bad. If the context has a Matcher, frames whose payload contains none
+ * of its patterns are skipped (those that are logged are followed by where the
+ * patterns were found). If the context has a FlightRecorder, frames are kept
+ * in it instead of being logged, and it takes a snapshot whenever a frame
+ * matches the trigger or one is asked for. If it has a CaptureWriter, frames
+ * are recorded with it instead, if it has a Pipeline they are handed to it to
+ * be logged by its threads. Otherwise they are decoded, put back together
+ * first if they are IP fragments and the context has a Defragmenter, and if it
+ * has a FlowTable, a TcpReassembler or Sketches they are accounted for in
+ * their flows, streams or sketches instead of being logged.
+ */
+void Sniffer_run(SniffContext* context) {
+    CaptureSource* source = context->source;
+    MetricsCounters* counters = context->counters;
+    CapturedFrame frame;
+    FrameDescriptor descriptor;
+    Match matches[MAX_REPORTED_MATCHES];
+    UINT num_matches = 0;
+    time_t next_poll = 0;
+    int filled;
+
+    context->text = TextBuffer_new(OUTPUT_BUFFER_SIZE);
+
+    while (!Signals_stopRequested()) {
+        // Take a snapshot with the flight recorder if one has been asked for
+        //  since the last batch
+        if (context->recorder != NULL && Signals_takeDumpRequest() &&
+                !FlightRecorder_snapshot(context->recorder, "requested")) {
+            warn("Skipped the requested snapshot, as nothing has been recorded since the last one or it is still "
+                    "being written.");
+        }
+
+        // Grab the next batch of frames from the source, stopping if it has
+        //  nothing left to give and sleeping until it does if it has nothing to
+        //  give right now
+        if ((filled = CaptureSource_fill(source)) == CS_END) {
+            break;
+        } else if (filled == 0) {
+            waitForFrames(source);
+            pollDrops(context, &next_poll);
+            continue;
+        }
+
+        filled = 0;
+
+        // While there are still unproccessed Ethernet Frames in the batch...
+        while (CaptureSource_next(source, &frame)) {
+            Metrics_countFrame(counters, frame.data, frame.caplen, frame.wirelen);
+            filled++;
+
+            // Skip the Ethernet Frame unless its payload (or that of the
+            //  datagram it completes) contains one of the patterns, if there
+            //  are any, only working out where they all are if it is going to
+            //  be logged right here
+            if (context->matcher != NULL) {
+                decodeFrame(context, &descriptor, &frame);
+
+                if (context->fragments != NULL &&
+                        !Defragmenter_process(context->fragments, &descriptor, &frame.timestamp)) {
+                    continue;
+                }
+
+                if ((num_matches = Matcher_matchFrame(context->matcher, &descriptor, matches,
+                        (context->writer != NULL || context->pipeline != NULL) ? 0 : MAX_REPORTED_MATCHES)) == 0) {
+                    continue;
+                }
+            }
+
+            // Decode the Ethernet Frame (once) right here if its checksums are
+            //  to be verified, as they are whatever happens to it next
+            if (context->matcher == NULL && context->verify_checksums) {
+                decodeFrame(context, &descriptor, &frame);
+            }
+
+            // Keep the Ethernet Frame in the flight recorder if there is one,
+            //  taking a snapshot right away if it is one that triggers them
+            if (context->recorder != NULL) {
+                FlightRecorder_record(context->recorder, &frame);
+
+                if (context->trigger != NULL &&
+                        Filter_matches(context->trigger, frame.data, frame.caplen, frame.wirelen)) {
+                    FlightRecorder_snapshot(context->recorder, "triggered");
+                }
+
+                continue;
+            }
+
+            // Or record it as is if there is somewhere to record it to
+            if (context->writer != NULL) {
+                CaptureWriter_write(context->writer, &frame);
+                continue;
+            }
+
+            // Or hand it to the pipeline's workers if there are any
+            if (context->pipeline != NULL) {
+                Pipeline_push(context->pipeline, &frame, context->verify_checksums ? descriptor.checksums : 0);
+                continue;
+            }
+
+            // Otherwise decode the Ethernet Frame (once), hold on to it if it is
+            //  a fragment of a datagram that isn't complete yet, and then either
+            //  account for it in its flow, stream and sketches or output it
+            if (context->matcher == NULL) {
+                if (!context->verify_checksums) {
+                    decodeFrame(context, &descriptor, &frame);
+                }
+
+                if (context->fragments != NULL &&
+                        !Defragmenter_process(context->fragments, &descriptor, &frame.timestamp)) {
+                    continue;
+                }
+            }
+
+            if (context->flows != NULL || context->streams != NULL || context->sketches != NULL) {
+                // NOTE ~> A reassembled datagram counts for all of its
+                //  fragments.
+                if (context->flows != NULL) {
+                    FlowTable_update(context->flows, &descriptor, &frame.timestamp,
+                            (descriptor.data == frame.data) ? frame.wirelen : descriptor.caplen);
+                }
+
+                if (context->sketches != NULL) {
+                    Sketches_update(context->sketches, &descriptor, &frame.timestamp,
+                            (descriptor.data == frame.data) ? frame.wirelen : descriptor.caplen);
+                }
+
+                if (context->streams != NULL) {
+                    TcpReassembler_update(context->streams, &descriptor, &frame.timestamp);
+                }
+
+                continue;
+            }
+
+            descriptor.interface = frame.interface;
+            EthernetFrame_format(&descriptor, context->text);
+
+            if (context->matcher != NULL) {
+                Matcher_formatMatches(context->matcher, matches,
+                        (num_matches < MAX_REPORTED_MATCHES) ? num_matches : MAX_REPORTED_MATCHES, num_matches,
+                        context->text);
+            }
+
+            TextBuffer_flush(context->text, stdout);
+        }
+
+        // Hand the batch back to the source now that we are done with it
+        CaptureSource_release(source);
+
+        Metrics_countBatch(counters, filled);
+        Metrics_set(&counters->filtered, CaptureSource_getFiltered(source));
+        pollDrops(context, &next_poll);
+    }
+
+    Metrics_set(&counters->drops, CaptureSource_getDrops(source));
+
+    TextBuffer_free(context->text);
+    context->text = NULL;
+}
+
+/**
+ * Decodes the provided frame into the provided FrameDescriptor, verifying its
+ * checksums and counting how that went if the provided SniffContext calls for
+ * it.
+ */
+static void decodeFrame(SniffContext* context, FrameDescriptor* descriptor, const CapturedFrame* frame) {
+    FrameDescriptor_decode(descriptor, frame->data, frame->caplen);
+
+    if (context->verify_checksums) {
+        Metrics_countChecksums(context->counters, Checksum_verify(descriptor));
+    }
+}
+
+/**
+ * Copies the number of frames that the kernel has dropped from the source of
+ * the provided SniffContext into its MetricsCounters, at most once a second
+ * (going by the provided time at which it is next due, which is updated).
+ */
+static void pollDrops(SniffContext* context, time_t* next_poll) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (now.tv_sec >= *next_poll) {
+        Metrics_set(&context->counters->drops, CaptureSource_getDrops(context->source));
+        *next_poll = now.tv_sec + 1;
+    }
+}
+
+/**
+ * Sleeps until the provided CaptureSource has frames to give, a signal arrives,
+ * or the read timeout passes (whichever happens first).
+ */
+static void waitForFrames(CaptureSource* source) {
+    struct pollfd descriptors[2];
+    int ready;
+
+    descriptors[0].fd = CaptureSource_getDescriptor(source);
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = Signals_getWakeDescriptor();
+    descriptors[1].events = POLLIN;
+
+    if ((ready = poll(descriptors, 2, Options_getReadTimeout())) == -1 && errno != EINTR) {
+        fatal("Failed to wait for frames from \"%s\". (%i: %s)", CaptureSource_getDescription(source), errno,
+                strerror(errno));
+    }
+
+    // NOTE ~> Signals that don't stop the loop (e.g. asking for a dump) would
+    //  otherwise keep the wait from ever blocking again. A stop is left in the
+    //  pipe, so that every other capture thread waiting on it wakes up too.
+    if (ready > 0 && (descriptors[1].revents & POLLIN) && !Signals_stopRequested()) {
+        Signals_clearWake();
+    }
+}
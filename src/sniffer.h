@@ -0,0 +1,78 @@
+#ifndef _SNIFFER_H_
+#define _SNIFFER_H_
+
+#include "common.h"
+#include "capture_source.h"
+#include "capture_writer.h"
+#include "flight_recorder.h"
+#include "filter.h"
+#include "pipeline.h"
+#include "flow_table.h"
+#include "tcp_reassembly.h"
+#include "ip_defrag.h"
+#include "sketches.h"
+#include "matcher.h"
+#include "metrics.h"
+#include "text_buffer.h"
+#include <stdbool.h>
+
+// NOTE ~> The sniffer is the capture loop that every capture thread runs. It
+//  drains its source batch by batch, sleeping on the source's descriptor
+//  whenever there is nothing to fill, until the source runs out or a stop is
+//  requested, and hands each frame to whatever its SniffContext calls for.
+
+/**
+ * Everything that a single capture loop hands its frames to, along with the
+ * counters it keeps.
+ */
+typedef struct SniffContext {
+    CaptureSource* source;
+
+    /**
+     * Where frames go instead of being decoded (any of these may be NULL).
+     */
+    CaptureWriter* writer;
+    Pipeline* pipeline;
+    FlightRecorder* recorder;
+
+    /**
+     * Frames that make the flight recorder take a snapshot as soon as they have
+     * been recorded (may be NULL).
+     */
+    const Filter* trigger;
+
+    /**
+     * What decoded frames go through (any of these may be NULL).
+     */
+    Defragmenter* fragments;
+    FlowTable* flows;
+    TcpReassembler* streams;
+    Sketches* sketches;
+
+    /**
+     * Patterns that the payload of a frame has to contain for the frame to go
+     * anywhere at all (may be NULL).
+     */
+    const Matcher* matcher;
+
+    /**
+     * Whether the checksums of every frame are verified, to be counted and
+     * flagged on those that are logged.
+     */
+    bool verify_checksums;
+
+    /**
+     * Counters of the thread that runs the capture loop.
+     */
+    MetricsCounters* counters;
+
+    /**
+     * Where each logged frame (and the patterns found in it) is put together
+     * before being written out. Created and freed by Sniffer_run(...).
+     */
+    TextBuffer* text;
+} SniffContext;
+
+void Sniffer_run(SniffContext* context);
+
+#endif
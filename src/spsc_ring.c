@@ -0,0 +1,213 @@
+#include "spsc_ring.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "large_buffer.h"
+#include "logger.h"
+
+#define CACHE_LINE_SIZE     64
+#define RECORD_ALIGNMENT    8
+#define RECORD_HEADER_SIZE  8
+#define RECORD_PADDING      0xffffffff
+
+/**
+ * Header in front of every record. Padding records fill the space at the end
+ * of the ring that was too small for the record that came after them.
+ */
+typedef struct RecordHeader {
+    uint32_t size;
+    uint32_t padding;
+} RecordHeader;
+
+/**
+ * State of a ring. Positions only ever grow (the offset into the ring is the
+ * position modulo the capacity). Each side keeps its own position, plus a
+ * possibly stale copy of the other side's, on its own cache line so that the
+ * two threads only ever share a line when one actually has to look at the
+ * other's progress.
+ */
+struct SpscRing {
+    OCTET* data;
+    size_t capacity;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+
+    size_t head;
+    size_t cached_tail;
+    size_t reserved;
+    char pad1[CACHE_LINE_SIZE];
+
+    size_t tail;
+    size_t cached_head;
+    size_t peeked;
+    char pad2[CACHE_LINE_SIZE];
+
+    bool closed;
+};
+
+/**
+ * Returns the number of bytes that a record of the provided size takes up in a
+ * ring (including its header).
+ */
+static inline size_t recordSpan(size_t size) {
+    return (RECORD_HEADER_SIZE + size + RECORD_ALIGNMENT - 1) & ~((size_t) RECORD_ALIGNMENT - 1);
+}
+
+/**
+ * Allocates a new, empty SpscRing that holds the provided number of bytes
+ * (which must be a power of two), preferably on the provided NUMA node (or
+ * ANY_NODE), prior to returning a pointer to it.
+ */
+SpscRing* SpscRing_new(size_t capacity, int node) {
+    SpscRing* o = NULL;
+
+    if (capacity < 4096 || (capacity & (capacity - 1)) != 0) {
+        fatal("A ring's capacity must be a power of two of at least 4096 bytes (not %lu).", (ULONG) capacity);
+    }
+
+    if (posix_memalign((void**) &o, CACHE_LINE_SIZE, sizeof(SpscRing)) != 0) {
+        fatal("Failed to allocate a ring.");
+    }
+
+    memset(o, 0x00, sizeof(SpscRing));
+
+    if ((o->data = (OCTET*) LargeBuffer_alloc(capacity, node)) == NULL) {
+        fatal("Failed to allocate a %lu byte ring.", (ULONG) capacity);
+    }
+
+    o->capacity = capacity;
+    o->mask = capacity - 1;
+
+    return o;
+}
+
+/**
+ * Returns the size of the largest record that the provided SpscRing is
+ * guaranteed to be able to hold.
+ */
+size_t SpscRing_getMaxRecordSize(const SpscRing* o) {
+    // NOTE ~> A record may need padding in front of it as large as itself.
+    return (o->capacity / 2) - RECORD_HEADER_SIZE;
+}
+
+/**
+ * Reserves room for a record of the provided size at the end of the provided
+ * SpscRing and returns a pointer to it, or NULL if there is not enough room
+ * right now. The record only becomes visible to the consumer once it has been
+ * committed. Only the producer may call this.
+ */
+void* SpscRing_reserve(SpscRing* o, size_t size) {
+    size_t span = recordSpan(size);
+    size_t offset = o->head & o->mask;
+    size_t padding = (offset + span > o->capacity) ? o->capacity - offset : 0;
+    RecordHeader* header;
+
+    if (o->head + padding + span - o->cached_tail > o->capacity) {
+        o->cached_tail = __atomic_load_n(&o->tail, __ATOMIC_ACQUIRE);
+
+        if (o->head + padding + span - o->cached_tail > o->capacity) {
+            return NULL;
+        }
+    }
+
+    // Mark the leftover space at the end of the ring as padding, but don't
+    //  publish it until the record itself is committed
+    if (padding > 0) {
+        header = (RecordHeader*) (o->data + offset);
+        header->size = RECORD_PADDING;
+        header->padding = (uint32_t) padding;
+        offset = 0;
+    }
+
+    o->reserved = padding;
+
+    return o->data + offset + RECORD_HEADER_SIZE;
+}
+
+/**
+ * Publishes the record previously reserved in the provided SpscRing, which must
+ * be no larger than it was reserved as.
+ */
+void SpscRing_commit(SpscRing* o, size_t size) {
+    RecordHeader* header = (RecordHeader*) (o->data + ((o->head + o->reserved) & o->mask));
+
+    header->size = (uint32_t) size;
+    header->padding = 0;
+
+    __atomic_store_n(&o->head, o->head + o->reserved + recordSpan(size), __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns a pointer to the oldest record in the provided SpscRing (storing its
+ * size at the provided location), or NULL if the ring is empty. The record
+ * stays put until it is consumed. Only the consumer may call this.
+ */
+void* SpscRing_peek(SpscRing* o, size_t* size) {
+    RecordHeader* header;
+
+    while (true) {
+        if (o->tail == o->cached_head) {
+            o->cached_head = __atomic_load_n(&o->head, __ATOMIC_ACQUIRE);
+
+            if (o->tail == o->cached_head) {
+                return NULL;
+            }
+        }
+
+        header = (RecordHeader*) (o->data + (o->tail & o->mask));
+
+        if (header->size != RECORD_PADDING) {
+            break;
+        }
+
+        __atomic_store_n(&o->tail, o->tail + header->padding, __ATOMIC_RELEASE);
+    }
+
+    *size = header->size;
+    o->peeked = recordSpan(header->size);
+
+    return (OCTET*) header + RECORD_HEADER_SIZE;
+}
+
+/**
+ * Hands the space of the record last returned by SpscRing_peek(...) back to
+ * the producer.
+ */
+void SpscRing_consume(SpscRing* o) {
+    __atomic_store_n(&o->tail, o->tail + o->peeked, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns the number of bytes currently queued up in the provided SpscRing.
+ * Either side may call this, but the answer may be out of date by the time it
+ * is returned.
+ */
+size_t SpscRing_getDepth(const SpscRing* o) {
+    return __atomic_load_n(&o->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&o->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Lets the consumer of the provided SpscRing know that the producer will not be
+ * committing anything more.
+ */
+void SpscRing_close(SpscRing* o) {
+    __atomic_store_n(&o->closed, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Determines whether the producer of the provided SpscRing has closed it. Once
+ * this returns true, everything that will ever be committed to the ring can
+ * be peeked at.
+ */
+bool SpscRing_isClosed(const SpscRing* o) {
+    return __atomic_load_n(&o->closed, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Frees the provided SpscRing.
+ */
+void SpscRing_free(SpscRing* o) {
+    LargeBuffer_free(o->data, o->capacity);
+    free(o);
+}
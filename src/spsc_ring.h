@@ -0,0 +1,27 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include "common.h"
+#include <stdbool.h>
+
+// NOTE ~> A single-producer/single-consumer ring of variable-length records,
+//  used to hand work from one thread to another without taking any locks.
+//  Exactly one thread may reserve and commit records and exactly one (other)
+//  thread may peek at and consume them. Records are stored contiguously (a
+//  record never wraps around the end of the ring), so both sides work on them
+//  in place.
+
+typedef struct SpscRing SpscRing;
+
+SpscRing* SpscRing_new(size_t capacity, int node);
+size_t SpscRing_getMaxRecordSize(const SpscRing* o);
+void* SpscRing_reserve(SpscRing* o, size_t size);
+void SpscRing_commit(SpscRing* o, size_t size);
+void* SpscRing_peek(SpscRing* o, size_t* size);
+void SpscRing_consume(SpscRing* o);
+size_t SpscRing_getDepth(const SpscRing* o);
+void SpscRing_close(SpscRing* o);
+bool SpscRing_isClosed(const SpscRing* o);
+void SpscRing_free(SpscRing* o);
+
+#endif
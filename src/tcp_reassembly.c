@@ -0,0 +1,763 @@
+#include "tcp_reassembly.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "common.h"
+#include "buffer_pool.h"
+#include "logger.h"
+
+#define SEGMENT_BLOCK_SIZE          2048
+#define MAX_QUEUED_PER_DIRECTION    (1 << 20)
+#define MAX_EXPIRIES_PER_UPDATE     2
+#define NANOSECONDS_PER_SECOND      1000000000ULL
+
+#define TCP_FIN                     0x01
+#define TCP_SYN                     0x02
+#define TCP_RST                     0x04
+#define TCP_DATA_OFFSET_OFFSET      12
+
+/**
+ * A piece of out-of-order data, stored in a single block of the pool.
+ */
+typedef struct Segment {
+    struct Segment* next;
+    uint32_t seq;
+    uint32_t length;
+    OCTET data[];
+} Segment;
+
+#define SEGMENT_CAPACITY            (SEGMENT_BLOCK_SIZE - sizeof(Segment))
+
+/**
+ * The reassembly state of one direction of a stream.
+ */
+typedef struct HalfStream {
+    /**
+     * Out-of-order data, sorted by sequence number and never overlapping.
+     */
+    Segment* head;
+    Segment* tail;
+    size_t queued;
+
+    /**
+     * The sequence number of the next octet to hand over, and that of the FIN
+     * (if one has been seen).
+     */
+    uint32_t next_seq;
+    uint32_t fin_seq;
+
+    bool started;
+    bool has_fin;
+    bool ended;
+} HalfStream;
+
+/**
+ * A stream plus the reassembler's bookkeeping for it.
+ */
+typedef struct StreamEntry {
+    TcpStream stream;
+    HalfStream halves[2];
+    uint64_t last_seen;
+    uint32_t hash;
+
+    /**
+     * Next entry in the same hash bucket.
+     */
+    struct StreamEntry* chain;
+
+    /**
+     * Neighbours in order of when streams were last seen (least recently seen
+     * first). Entries that aren't in use are kept on a list of their own
+     * through the same links.
+     */
+    struct StreamEntry* prev;
+    struct StreamEntry* next;
+} StreamEntry;
+
+struct TcpReassembler {
+    StreamEntry* entries;
+    UINT max_streams;
+    UINT num_streams;
+
+    StreamEntry** buckets;
+    uint32_t bucket_mask;
+
+    StreamEntry* free_entries;
+    StreamEntry* oldest;
+    StreamEntry* newest;
+
+    BufferPool* pool;
+    uint64_t idle_timeout;
+
+    TcpStreamCallback callback;
+    void* context;
+
+    /**
+     * Counters that are logged when the reassembler is freed.
+     */
+    ULONG num_opened;
+    ULONG num_evicted;
+    ULONG delivered;
+    ULONG missing;
+    ULONG duplicate;
+    ULONG dropped;
+    ULONG memory_evictions;
+};
+
+static inline int32_t seqDiff(uint32_t a, uint32_t b);
+static StreamEntry* lookup(TcpReassembler* o, uint32_t hash, const FlowKey* key);
+static StreamEntry* insert(TcpReassembler* o, uint32_t hash, const FlowKey* key, UINT direction);
+static void removeStream(TcpReassembler* o, StreamEntry* entry);
+static void closeStream(TcpReassembler* o, StreamEntry* entry);
+static void expire(TcpReassembler* o, uint64_t now);
+static void touch(TcpReassembler* o, StreamEntry* entry);
+static void addData(TcpReassembler* o, StreamEntry* entry, UINT direction, uint32_t seq, const OCTET* data,
+        size_t captured, size_t length);
+static void queueData(TcpReassembler* o, StreamEntry* entry, UINT direction, uint32_t seq, const OCTET* data,
+        size_t length);
+static void makeRoom(TcpReassembler* o, StreamEntry* current, size_t blocks);
+static void drain(TcpReassembler* o, StreamEntry* entry, UINT direction);
+static void skipHole(TcpReassembler* o, StreamEntry* entry, UINT direction);
+static void endHalf(TcpReassembler* o, StreamEntry* entry, UINT direction);
+static void finishIfDone(TcpReassembler* o, StreamEntry* entry);
+static void deliver(TcpReassembler* o, StreamEntry* entry, UINT direction, TcpStreamEvent event,
+        const OCTET* data, size_t length);
+
+/**
+ * Allocates a new TcpReassembler that follows up to the provided number of
+ * streams at once, buffers no more than (roughly) the provided number of bytes
+ * of out-of-order data across all of them, and ends streams after the provided
+ * number of seconds without a segment. Reassembled data is handed to the
+ * provided callback (along with the provided context).
+ */
+TcpReassembler* TcpReassembler_new(UINT max_streams, size_t max_memory, UINT idle_timeout,
+        TcpStreamCallback callback, void* context) {
+    TcpReassembler* o = (TcpReassembler*) calloc(1, sizeof(TcpReassembler));
+    size_t num_buckets = 1;
+    UINT i;
+
+    if (o == NULL || max_streams == 0) {
+        fatal("Failed to allocate a TCP reassembler for %u streams.", max_streams);
+    }
+
+    while (num_buckets < max_streams) {
+        num_buckets <<= 1;
+    }
+
+    o->entries = (StreamEntry*) calloc(max_streams, sizeof(StreamEntry));
+    o->buckets = (StreamEntry**) calloc(num_buckets, sizeof(StreamEntry*));
+
+    if (o->entries == NULL || o->buckets == NULL) {
+        fatal("Failed to allocate a TCP reassembler for %u streams.", max_streams);
+    }
+
+    o->max_streams = max_streams;
+    o->bucket_mask = num_buckets - 1;
+    o->pool = BufferPool_new(SEGMENT_BLOCK_SIZE, max_memory);
+    o->idle_timeout = idle_timeout * NANOSECONDS_PER_SECOND;
+    o->callback = callback;
+    o->context = context;
+
+    for (i = max_streams; i > 0; i--) {
+        o->entries[i - 1].next = o->free_entries;
+        o->free_entries = &o->entries[i - 1];
+    }
+
+    return o;
+}
+
+/**
+ * Feeds the provided (already decoded) frame to the stream that it belongs to,
+ * if it is a TCP segment, and ends streams that have gone quiet as of the
+ * frame's timestamp. Streams are only started by segments that open a
+ * connection or carry data.
+ */
+void TcpReassembler_update(TcpReassembler* o, const FrameDescriptor* frame, const struct timespec* timestamp) {
+    uint64_t now = (uint64_t) timestamp->tv_sec * NANOSECONDS_PER_SECOND + timestamp->tv_nsec;
+    StreamEntry* entry;
+    HalfStream* half;
+    FlowKey key;
+    uint32_t hash, seq = frame->tcp_seq;
+    UINT direction, data_offset;
+    size_t length = 0, captured = 0;
+
+    expire(o, now);
+
+    // NOTE ~> Fragments are left alone, since only the first one has a TCP
+    //  header and none of them has all of the segment's data.
+    if (!(frame->layers & FL_TRANSPORT) || frame->ip_protocol != IP_TCP || (frame->layers & FL_FRAGMENT)) {
+        return;
+    }
+
+    // Work out how much data the segment carries (on the wire) and how much of
+    //  it was captured, from the header's own idea of its size (it may have
+    //  been cut short)
+    data_offset = frame->transport_offset + (frame->data[frame->transport_offset + TCP_DATA_OFFSET_OFFSET] >> 4) * 4;
+
+    if (frame->datagram_end > data_offset) {
+        length = frame->datagram_end - data_offset;
+    }
+
+    if (length > 0 && frame->caplen > data_offset) {
+        captured = ((frame->caplen < frame->datagram_end) ? frame->caplen : frame->datagram_end) - data_offset;
+    }
+
+    FlowKey_build(frame, &key, &direction);
+    hash = FlowKey_hash(&key);
+
+    if ((entry = lookup(o, hash, &key)) == NULL) {
+        if ((frame->tcp_flags & TCP_RST) || (!(frame->tcp_flags & TCP_SYN) && length == 0)) {
+            return;
+        }
+
+        entry = insert(o, hash, &key, direction);
+    }
+
+    entry->last_seen = now;
+    touch(o, entry);
+
+    if (frame->tcp_flags & TCP_RST) {
+        closeStream(o, entry);
+
+        return;
+    }
+
+    half = &entry->halves[direction];
+
+    if (half->ended) {
+        return;
+    }
+
+    // NOTE ~> A SYN takes up a sequence number of its own, so data (if any)
+    //  starts right after it. A direction that wasn't seen being opened is
+    //  picked up wherever its first segment starts.
+    if (frame->tcp_flags & TCP_SYN) {
+        seq++;
+    }
+
+    if (!half->started) {
+        half->started = true;
+        half->next_seq = seq;
+    }
+
+    if ((frame->tcp_flags & TCP_FIN) && !half->has_fin) {
+        half->has_fin = true;
+        half->fin_seq = seq + (uint32_t) length;
+    }
+
+    if (length > 0) {
+        addData(o, entry, direction, seq, frame->data + data_offset, captured, length);
+    }
+
+    finishIfDone(o, entry);
+}
+
+/**
+ * Ends every stream of the provided TcpReassembler, handing over whatever data
+ * it still has buffered (skipping any holes).
+ */
+void TcpReassembler_flush(TcpReassembler* o) {
+    while (o->oldest != NULL) {
+        closeStream(o, o->oldest);
+    }
+}
+
+/**
+ * Returns the context that the provided TcpReassembler hands to its callback.
+ */
+void* TcpReassembler_getContext(const TcpReassembler* o) {
+    return o->context;
+}
+
+/**
+ * Logs what the provided TcpReassembler did and frees it (without ending the
+ * streams left in it).
+ */
+void TcpReassembler_free(TcpReassembler* o) {
+    info("Reassembled %lu TCP streams (%lu evicted): %lu bytes delivered, %lu missing, %lu duplicate.",
+            o->num_opened, o->num_evicted, o->delivered, o->missing, o->duplicate);
+    info("Buffered at most %lu bytes of out-of-order data, gave up on %lu holes for memory, dropped %lu bytes.",
+            (ULONG) BufferPool_getPeakUsed(o->pool), o->memory_evictions, o->dropped);
+
+    BufferPool_free(o->pool);
+    free(o->entries);
+    free(o->buckets);
+    free(o);
+}
+
+/**
+ * A TcpStreamCallback that appends each direction of each stream to a file of
+ * its own, named after the sending and receiving endpoints, in the directory
+ * provided as the context.
+ */
+void TcpStream_writeFiles(TcpStream* stream, UINT direction, TcpStreamEvent event, const OCTET* data,
+        size_t length, void* context) {
+    static __thread bool warned = false;
+    FILE* file = (FILE*) stream->user_data[direction];
+    int family = (stream->key.ip_version == 4) ? AF_INET : AF_INET6;
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    char path[MAX_PATH_LENGTH + 128];
+
+    switch (event) {
+        case TSE_DATA:
+            if (file == NULL) {
+                inet_ntop(family, stream->key.addresses[direction], src, sizeof(src));
+                inet_ntop(family, stream->key.addresses[1 - direction], dst, sizeof(dst));
+                snprintf(path, sizeof(path), "%s/%s.%u-%s.%u", (const char*) context, src,
+                        stream->key.ports[direction], dst, stream->key.ports[1 - direction]);
+
+                if ((file = fopen(path, "ab")) == NULL) {
+                    // NOTE ~> Running out of descriptors would otherwise log
+                    //  something for every segment.
+                    if (!warned) {
+                        warn("Failed to open stream file \"%s\". Its data is being discarded. (%i: %s)", path, errno,
+                                strerror(errno));
+                        warned = true;
+                    }
+
+                    return;
+                }
+
+                stream->user_data[direction] = file;
+            }
+
+            fwrite(data, 1, length, file);
+            break;
+
+        case TSE_END:
+            if (file != NULL) {
+                fclose(file);
+                stream->user_data[direction] = NULL;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Returns how far the provided sequence number is ahead of (or, if negative,
+ * behind) the other, taking wrap-around into account.
+ */
+static inline int32_t seqDiff(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b);
+}
+
+/**
+ * Finds the entry of the stream with the provided key (and hash), or returns
+ * NULL if the stream isn't being followed.
+ */
+static StreamEntry* lookup(TcpReassembler* o, uint32_t hash, const FlowKey* key) {
+    StreamEntry* entry;
+
+    for (entry = o->buckets[hash & o->bucket_mask]; entry != NULL; entry = entry->chain) {
+        if (entry->hash == hash && memcmp(&entry->stream.key, key, sizeof(FlowKey)) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts following a new stream with the provided key (and hash), opened in the
+ * provided direction, and returns its entry. If the reassembler is already
+ * following as many streams as it can, the least recently seen one is ended to
+ * make room.
+ */
+static StreamEntry* insert(TcpReassembler* o, uint32_t hash, const FlowKey* key, UINT direction) {
+    StreamEntry* entry;
+
+    if (o->free_entries == NULL) {
+        closeStream(o, o->oldest);
+        o->num_evicted++;
+    }
+
+    entry = o->free_entries;
+    o->free_entries = entry->next;
+
+    memset(entry, 0x00, sizeof(StreamEntry));
+    entry->stream.key = *key;
+    entry->stream.initiator = direction;
+    entry->hash = hash;
+
+    entry->chain = o->buckets[hash & o->bucket_mask];
+    o->buckets[hash & o->bucket_mask] = entry;
+
+    entry->prev = o->newest;
+
+    if (o->newest != NULL) {
+        o->newest->next = entry;
+    } else {
+        o->oldest = entry;
+    }
+
+    o->newest = entry;
+    o->num_streams++;
+    o->num_opened++;
+
+    return entry;
+}
+
+/**
+ * Stops following the stream in the provided entry (whose directions must
+ * already have been ended) and frees the entry up.
+ */
+static void removeStream(TcpReassembler* o, StreamEntry* entry) {
+    StreamEntry** link = &o->buckets[entry->hash & o->bucket_mask];
+
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+
+    *link = entry->chain;
+
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        o->oldest = entry->next;
+    }
+
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        o->newest = entry->prev;
+    }
+
+    entry->next = o->free_entries;
+    o->free_entries = entry;
+    o->num_streams--;
+}
+
+/**
+ * Ends both directions of the stream in the provided entry, handing over
+ * whatever data is still buffered for them, and stops following it.
+ */
+static void closeStream(TcpReassembler* o, StreamEntry* entry) {
+    UINT direction;
+
+    for (direction = 0; direction < 2; direction++) {
+        if (entry->halves[direction].started && !entry->halves[direction].ended) {
+            endHalf(o, entry, direction);
+        }
+    }
+
+    removeStream(o, entry);
+}
+
+/**
+ * Ends the least recently seen streams if they have gone quiet for long enough
+ * as of the provided time, doing no more than a fixed amount of work.
+ */
+static void expire(TcpReassembler* o, uint64_t now) {
+    int i;
+
+    for (i = 0; i < MAX_EXPIRIES_PER_UPDATE && o->oldest != NULL; i++) {
+        if (now < o->oldest->last_seen + o->idle_timeout) {
+            break;
+        }
+
+        closeStream(o, o->oldest);
+    }
+}
+
+/**
+ * Moves the provided entry to the most recently seen end of the list.
+ */
+static void touch(TcpReassembler* o, StreamEntry* entry) {
+    if (o->newest == entry) {
+        return;
+    }
+
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        o->oldest = entry->next;
+    }
+
+    entry->next->prev = entry->prev;
+
+    entry->prev = o->newest;
+    entry->next = NULL;
+    o->newest->next = entry;
+    o->newest = entry;
+}
+
+/**
+ * Adds the provided data, of which the provided number of octets were captured
+ * out of the provided length, starting at the provided sequence number, to the
+ * provided direction of the provided stream.
+ */
+static void addData(TcpReassembler* o, StreamEntry* entry, UINT direction, uint32_t seq, const OCTET* data,
+        size_t captured, size_t length) {
+    HalfStream* half = &entry->halves[direction];
+    int32_t behind = seqDiff(half->next_seq, seq);
+
+    // Drop whatever has already been handed over
+    if (behind > 0) {
+        if ((size_t) behind >= length) {
+            o->duplicate += length;
+
+            return;
+        }
+
+        o->duplicate += behind;
+        seq += behind;
+        length -= behind;
+        data += behind;
+        captured = (captured > (size_t) behind) ? captured - behind : 0;
+    }
+
+    // Hand data that is next in line straight over, and then whatever it
+    //  lets through from the buffer
+    if (seq == half->next_seq) {
+        if (captured > 0) {
+            deliver(o, entry, direction, TSE_DATA, data, captured);
+        }
+
+        if (length > captured) {
+            deliver(o, entry, direction, TSE_GAP, NULL, length - captured);
+        }
+
+        half->next_seq += (uint32_t) length;
+        drain(o, entry, direction);
+
+        return;
+    }
+
+    // Otherwise hold on to it until the hole in front of it is filled (or
+    //  given up on)
+    queueData(o, entry, direction, seq, data, captured);
+
+    if (half->queued > MAX_QUEUED_PER_DIRECTION) {
+        skipHole(o, entry, direction);
+    }
+}
+
+/**
+ * Buffers the provided out-of-order data in the provided direction of the
+ * provided stream, keeping whatever was buffered first wherever it overlaps
+ * data that is already buffered.
+ */
+static void queueData(TcpReassembler* o, StreamEntry* entry, UINT direction, uint32_t seq, const OCTET* data,
+        size_t length) {
+    HalfStream* half = &entry->halves[direction];
+    Segment* prev = NULL;
+    Segment* cur = half->head;
+    Segment* segment;
+    size_t piece;
+
+    makeRoom(o, entry, (length + SEGMENT_CAPACITY - 1) / SEGMENT_CAPACITY);
+
+    // Find the first buffered segment that ends after the data starts (data
+    //  usually goes right at the end)
+    if (half->tail != NULL && seqDiff(seq, half->tail->seq + half->tail->length) >= 0) {
+        prev = half->tail;
+        cur = NULL;
+    } else {
+        while (cur != NULL && seqDiff(cur->seq + cur->length, seq) <= 0) {
+            prev = cur;
+            cur = cur->next;
+        }
+    }
+
+    while (length > 0) {
+        // Skip over whatever part of the data is already buffered
+        if (cur != NULL && seqDiff(cur->seq, seq) <= 0) {
+            piece = seqDiff(cur->seq + cur->length, seq);
+
+            if (piece >= length) {
+                o->duplicate += length;
+
+                return;
+            }
+
+            o->duplicate += piece;
+            seq += piece;
+            data += piece;
+            length -= piece;
+            prev = cur;
+            cur = cur->next;
+
+            continue;
+        }
+
+        // Fill the space in front of the next buffered segment
+        piece = (length < SEGMENT_CAPACITY) ? length : SEGMENT_CAPACITY;
+
+        if (cur != NULL && (size_t) seqDiff(cur->seq, seq) < piece) {
+            piece = seqDiff(cur->seq, seq);
+        }
+
+        if ((segment = (Segment*) BufferPool_alloc(o->pool)) == NULL) {
+            o->dropped += length;
+
+            return;
+        }
+
+        segment->seq = seq;
+        segment->length = piece;
+        memcpy(segment->data, data, piece);
+
+        segment->next = cur;
+
+        if (prev != NULL) {
+            prev->next = segment;
+        } else {
+            half->head = segment;
+        }
+
+        if (cur == NULL) {
+            half->tail = segment;
+        }
+
+        half->queued += piece;
+        prev = segment;
+        seq += piece;
+        data += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * Makes sure that the provided number of blocks can be allocated from the pool,
+ * if at all possible, by giving up on the holes of the least recently seen
+ * streams (other than the provided one) that have data buffered.
+ */
+static void makeRoom(TcpReassembler* o, StreamEntry* current, size_t blocks) {
+    StreamEntry* entry = o->oldest;
+    StreamEntry* next;
+    UINT direction;
+
+    while (BufferPool_getAvailable(o->pool) < blocks && entry != NULL) {
+        // NOTE ~> Handing the data over may finish the stream off (and free
+        //  its entry), so hang on to the next one first.
+        next = entry->next;
+
+        if (entry != current) {
+            for (direction = 0; direction < 2; direction++) {
+                if (entry->halves[direction].head == NULL) {
+                    continue;
+                }
+
+                while (entry->halves[direction].head != NULL) {
+                    skipHole(o, entry, direction);
+                }
+
+                o->memory_evictions++;
+            }
+
+            finishIfDone(o, entry);
+        }
+
+        entry = next;
+    }
+}
+
+/**
+ * Hands over as much buffered data of the provided direction of the provided
+ * stream as is now next in line.
+ */
+static void drain(TcpReassembler* o, StreamEntry* entry, UINT direction) {
+    HalfStream* half = &entry->halves[direction];
+    Segment* segment;
+    uint32_t end;
+
+    while ((segment = half->head) != NULL && seqDiff(segment->seq, half->next_seq) <= 0) {
+        end = segment->seq + segment->length;
+
+        if (seqDiff(end, half->next_seq) > 0) {
+            deliver(o, entry, direction, TSE_DATA, segment->data + (half->next_seq - segment->seq),
+                    seqDiff(end, half->next_seq));
+            half->next_seq = end;
+        }
+
+        half->head = segment->next;
+        half->queued -= segment->length;
+
+        if (half->head == NULL) {
+            half->tail = NULL;
+        }
+
+        BufferPool_release(o->pool, segment);
+    }
+}
+
+/**
+ * Gives up on the hole in front of the buffered data of the provided direction
+ * of the provided stream, reporting it as a gap, and hands over whatever data
+ * that lets through.
+ */
+static void skipHole(TcpReassembler* o, StreamEntry* entry, UINT direction) {
+    HalfStream* half = &entry->halves[direction];
+
+    if (half->head == NULL) {
+        return;
+    }
+
+    deliver(o, entry, direction, TSE_GAP, NULL, seqDiff(half->head->seq, half->next_seq));
+    half->next_seq = half->head->seq;
+    drain(o, entry, direction);
+}
+
+/**
+ * Ends the provided direction of the provided stream, first handing over
+ * whatever data is still buffered for it (and reporting any holes left).
+ */
+static void endHalf(TcpReassembler* o, StreamEntry* entry, UINT direction) {
+    HalfStream* half = &entry->halves[direction];
+
+    while (half->head != NULL) {
+        skipHole(o, entry, direction);
+    }
+
+    // Whatever never showed up between the last data and the FIN is missing too
+    if (half->has_fin && seqDiff(half->fin_seq, half->next_seq) > 0) {
+        deliver(o, entry, direction, TSE_GAP, NULL, seqDiff(half->fin_seq, half->next_seq));
+        half->next_seq = half->fin_seq;
+    }
+
+    half->ended = true;
+    deliver(o, entry, direction, TSE_END, NULL, 0);
+}
+
+/**
+ * Ends each direction of the provided stream that has had everything up to its
+ * FIN handed over, and stops following the stream once both of its directions
+ * have ended.
+ */
+static void finishIfDone(TcpReassembler* o, StreamEntry* entry) {
+    UINT direction;
+
+    for (direction = 0; direction < 2; direction++) {
+        HalfStream* half = &entry->halves[direction];
+
+        if (!half->ended && half->has_fin && half->next_seq == half->fin_seq) {
+            endHalf(o, entry, direction);
+        }
+    }
+
+    if (entry->halves[0].ended && entry->halves[1].ended) {
+        removeStream(o, entry);
+    }
+}
+
+/**
+ * Hands an event for the provided direction of the provided stream to the
+ * callback, and counts it.
+ */
+static void deliver(TcpReassembler* o, StreamEntry* entry, UINT direction, TcpStreamEvent event,
+        const OCTET* data, size_t length) {
+    if (event == TSE_DATA) {
+        o->delivered += length;
+    } else if (event == TSE_GAP) {
+        o->missing += length;
+    }
+
+    o->callback(&entry->stream, direction, event, data, length, o->context);
+}
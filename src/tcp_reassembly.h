@@ -0,0 +1,84 @@
+#ifndef _TCP_REASSEMBLY_H_
+#define _TCP_REASSEMBLY_H_
+
+#include "common.h"
+#include "flow_table.h"
+#include "frame_descriptor.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// NOTE ~> A TCP reassembler turns the segments of each TCP connection back into
+//  the two byte streams that its endpoints sent each other, and hands them to
+//  a callback in order. Segments that arrive in order are handed over straight
+//  from the captured frame without being copied; only those that arrive ahead
+//  of a hole are buffered, in fixed-size blocks from a buffer pool whose size
+//  is capped for the whole reassembler. Retransmitted and overlapping data is
+//  dropped (the first copy of any byte wins). A hole is given up on, and
+//  reported as a gap, once too much data has piled up behind it, once the pool
+//  runs out and the stream is the least recently active one with data
+//  buffered, or once the stream ends. Streams end when both directions have
+//  been closed by FIN, are reset, go idle, are evicted to make room for a new
+//  one, or are flushed. Streams age out based on the timestamps of captured
+//  frames, just like flows.
+
+/**
+ * What a call to a TcpStreamCallback is about.
+ */
+typedef enum TcpStreamEvent {
+    /**
+     * The next contiguous piece of the direction's data.
+     */
+    TSE_DATA,
+
+    /**
+     * The next piece of the direction's data was never seen (because it wasn't
+     * captured, or was given up on), and has been skipped. Only its length is
+     * provided.
+     */
+    TSE_GAP,
+
+    /**
+     * The direction has ended. Nothing more is handed over for it.
+     */
+    TSE_END
+} TcpStreamEvent;
+
+/**
+ * A single TCP connection being reassembled. Direction 0 is from the first
+ * endpoint of the key to the second, and direction 1 the other way around.
+ */
+typedef struct TcpStream {
+    FlowKey key;
+
+    /**
+     * The endpoint that opened the connection (or sent the first segment seen).
+     */
+    uint8_t initiator;
+
+    /**
+     * Free for the callback to use for each direction (e.g. to keep a file
+     * open), and NULL until it does.
+     */
+    void* user_data[2];
+} TcpStream;
+
+/**
+ * Called with the reassembled data of each direction of each stream, in order.
+ * The data is only valid for the duration of the call.
+ */
+typedef void (*TcpStreamCallback)(TcpStream* stream, UINT direction, TcpStreamEvent event, const OCTET* data,
+        size_t length, void* context);
+
+typedef struct TcpReassembler TcpReassembler;
+
+TcpReassembler* TcpReassembler_new(UINT max_streams, size_t max_memory, UINT idle_timeout,
+        TcpStreamCallback callback, void* context);
+void TcpReassembler_update(TcpReassembler* o, const FrameDescriptor* frame, const struct timespec* timestamp);
+void TcpReassembler_flush(TcpReassembler* o);
+void* TcpReassembler_getContext(const TcpReassembler* o);
+void TcpReassembler_free(TcpReassembler* o);
+void TcpStream_writeFiles(TcpStream* stream, UINT direction, TcpStreamEvent event, const OCTET* data,
+        size_t length, void* context);
+
+#endif
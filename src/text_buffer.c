@@ -0,0 +1,279 @@
+#include "text_buffer.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "common.h"
+#include "logger.h"
+
+#define HEX_OCTETS_PER_ROW          48
+#define HEX_ASCII_OCTETS_PER_ROW    16
+#define HEX_ASCII_ROW_SIZE          80
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static size_t appendHexRows(char* out, const OCTET* data, size_t size);
+static size_t appendHexAsciiRows(char* out, const OCTET* data, size_t size);
+
+/**
+ * Allocates and initializes a new, empty TextBuffer with room for the provided
+ * number of characters prior to returning a pointer to it.
+ */
+TextBuffer* TextBuffer_new(size_t capacity) {
+    TextBuffer* textBuffer = (TextBuffer*) malloc(sizeof(TextBuffer));
+
+    if (textBuffer == NULL || (textBuffer->data = (char*) malloc(capacity)) == NULL) {
+        fatal("Failed to allocate a %lu byte text buffer.", (ULONG) capacity);
+    }
+
+    textBuffer->length = 0;
+    textBuffer->capacity = capacity;
+
+    return textBuffer;
+}
+
+/**
+ * Empties the provided TextBuffer (without giving up its memory).
+ */
+void TextBuffer_clear(TextBuffer* o) {
+    o->length = 0;
+}
+
+/**
+ * Makes sure that there is room for at least the provided number of characters
+ * at the end of the provided TextBuffer and returns a pointer to that room.
+ * Whoever fills it in is expected to add the number of characters they
+ * actually wrote to the buffer's length.
+ */
+char* TextBuffer_reserve(TextBuffer* o, size_t size) {
+    if (o->length + size > o->capacity) {
+        size_t capacity = o->capacity * 2;
+
+        while (capacity < o->length + size) {
+            capacity *= 2;
+        }
+
+        if ((o->data = (char*) realloc(o->data, capacity)) == NULL) {
+            fatal("Failed to grow a text buffer to %lu bytes.", (ULONG) capacity);
+        }
+
+        o->capacity = capacity;
+    }
+
+    return o->data + o->length;
+}
+
+/**
+ * Appends the provided characters to the provided TextBuffer.
+ */
+void TextBuffer_append(TextBuffer* o, const char* text, size_t size) {
+    memcpy(TextBuffer_reserve(o, size), text, size);
+    o->length += size;
+}
+
+/**
+ * Appends the provided null-terminated string to the provided TextBuffer.
+ */
+void TextBuffer_appendString(TextBuffer* o, const char* text) {
+    TextBuffer_append(o, text, strlen(text));
+}
+
+/**
+ * Appends the result of formatting the provided printf(...) style format string
+ * to the provided TextBuffer. Meant for the odd value that has no faster way in.
+ */
+void TextBuffer_appendFormat(TextBuffer* o, const char* format, ...) {
+    va_list args;
+    size_t room = o->capacity - o->length;
+    int size;
+
+    va_start(args, format);
+    size = vsnprintf(o->data + o->length, room, format, args);
+    va_end(args);
+
+    // If it didn't fit, make room and do it again
+    if (size >= 0 && (size_t) size >= room) {
+        TextBuffer_reserve(o, size + 1);
+
+        va_start(args, format);
+        size = vsnprintf(o->data + o->length, size + 1, format, args);
+        va_end(args);
+    }
+
+    if (size > 0) {
+        o->length += size;
+    }
+}
+
+/**
+ * Appends the decimal representation of the provided value to the provided
+ * TextBuffer.
+ */
+void TextBuffer_appendUnsigned(TextBuffer* o, ULONG value) {
+    char digits[24];
+    size_t i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    TextBuffer_append(o, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * Appends the hex representation of the provided octets to the provided
+ * TextBuffer (see octetsToHexString(...)).
+ */
+void TextBuffer_appendHex(TextBuffer* o, const OCTET* octets, size_t num_octets, char sep, size_t sep_interval) {
+    char* out = TextBuffer_reserve(o, (num_octets * 4) + 1);
+
+    o->length += octetsToHexString((OCTET*) octets, num_octets, out, sep, sep_interval);
+}
+
+/**
+ * Appends the string representation of the provided IP address (of the provided
+ * address family) to the provided TextBuffer.
+ */
+void TextBuffer_appendAddress(TextBuffer* o, int family, const OCTET* address) {
+    char string[INET6_ADDRSTRLEN] = { 0 };
+    int i;
+
+    // NOTE ~> IPv4 addresses are far more common and are simple enough to not
+    //  need inet_ntop(...) (which goes through snprintf(...)).
+    if (family == AF_INET) {
+        for (i = 0; i < 4; i++) {
+            if (i > 0) {
+                TextBuffer_append(o, ".", 1);
+            }
+            TextBuffer_appendUnsigned(o, address[i]);
+        }
+
+        return;
+    }
+
+    inet_ntop(family, address, string, sizeof(string));
+    TextBuffer_appendString(o, string);
+}
+
+/**
+ * Appends a dump of the provided payload, in the provided format, to the
+ * provided TextBuffer. Every row of the dump starts on a new, indented line.
+ */
+void TextBuffer_appendDump(TextBuffer* o, const OCTET* data, size_t size, DumpFormat format) {
+    size_t rows;
+    char* out;
+
+    switch (format) {
+        case DF_HEX:
+            rows = (size + HEX_OCTETS_PER_ROW - 1) / HEX_OCTETS_PER_ROW;
+            out = TextBuffer_reserve(o, (rows * 2) + (size * 3));
+            o->length += appendHexRows(out, data, size);
+            break;
+
+        case DF_HEX_ASCII:
+            rows = (size + HEX_ASCII_OCTETS_PER_ROW - 1) / HEX_ASCII_OCTETS_PER_ROW;
+            out = TextBuffer_reserve(o, (rows * HEX_ASCII_ROW_SIZE) + 1);
+            o->length += appendHexAsciiRows(out, data, size);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Hands everything in the provided TextBuffer to the provided stream in one go
+ * and then empties the buffer.
+ */
+void TextBuffer_flush(TextBuffer* o, FILE* stream) {
+    if (o->length > 0) {
+        fwrite(o->data, 1, o->length, stream);
+    }
+
+    o->length = 0;
+}
+
+/**
+ * Frees the provided TextBuffer.
+ */
+void TextBuffer_free(TextBuffer* o) {
+    free(o->data);
+    free(o);
+}
+
+/**
+ * Writes rows of hex-formatted octets (each followed by a space) to the
+ * provided position and returns the number of characters written.
+ */
+static size_t appendHexRows(char* out, const OCTET* data, size_t size) {
+    char* start = out;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if ((i % HEX_OCTETS_PER_ROW) == 0) {
+            *out++ = '\n';
+            *out++ = '\t';
+        }
+
+        *out++ = hexDigits[data[i] >> 4];
+        *out++ = hexDigits[data[i] & 0x0f];
+        *out++ = ' ';
+    }
+
+    return out - start;
+}
+
+/**
+ * Writes rows of hex-formatted octets in the classic "hexdump -C" layout (an
+ * offset, two groups of eight octets, and the printable characters) to the
+ * provided position and returns the number of characters written.
+ */
+static size_t appendHexAsciiRows(char* out, const OCTET* data, size_t size) {
+    char* start = out;
+    size_t row, i;
+
+    for (row = 0; row < size; row += HEX_ASCII_OCTETS_PER_ROW) {
+        size_t count = (size - row < HEX_ASCII_OCTETS_PER_ROW) ? (size - row) : HEX_ASCII_OCTETS_PER_ROW;
+        int shift;
+
+        *out++ = '\n';
+        *out++ = '\t';
+
+        // NOTE ~> Offsets are written with four digits unless the payload is
+        //  big enough to need eight.
+        for (shift = (size > 0xffff) ? 28 : 12; shift >= 0; shift -= 4) {
+            *out++ = hexDigits[(row >> shift) & 0x0f];
+        }
+
+        *out++ = ' ';
+
+        for (i = 0; i < HEX_ASCII_OCTETS_PER_ROW; i++) {
+            if (i == 8) {
+                *out++ = ' ';
+            }
+
+            if (i < count) {
+                *out++ = ' ';
+                *out++ = hexDigits[data[row + i] >> 4];
+                *out++ = hexDigits[data[row + i] & 0x0f];
+            } else {
+                *out++ = ' ';
+                *out++ = ' ';
+                *out++ = ' ';
+            }
+        }
+
+        *out++ = ' ';
+        *out++ = ' ';
+        *out++ = '|';
+        octetsToCharString((OCTET*) data + row, count, out);
+        out += count;
+        *out++ = '|';
+    }
+
+    return out - start;
+}
\ No newline at end of file
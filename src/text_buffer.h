@@ -0,0 +1,52 @@
+#ifndef _TEXT_BUFFER_H_
+#define _TEXT_BUFFER_H_
+
+#include "common.h"
+#include <stdio.h>
+
+// NOTE ~> A text buffer collects everything that is to be printed about a
+//  frame so that it can be handed to stdio with a single call. Its memory is
+//  kept between frames, so once it has grown to fit the largest frame seen
+//  nothing is allocated any more.
+
+/**
+ * The ways in which a frame's payload can be dumped.
+ */
+typedef enum DumpFormat {
+    /**
+     * Rows of 48 hex-formatted octets.
+     */
+    DF_HEX,
+
+    /**
+     * Rows of 16 hex-formatted octets preceded by their offset and followed by
+     * their printable characters.
+     */
+    DF_HEX_ASCII,
+
+    /**
+     * Nothing at all.
+     */
+    DF_NONE
+} DumpFormat;
+
+typedef struct TextBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+TextBuffer* TextBuffer_new(size_t capacity);
+void TextBuffer_clear(TextBuffer* o);
+char* TextBuffer_reserve(TextBuffer* o, size_t size);
+void TextBuffer_append(TextBuffer* o, const char* text, size_t size);
+void TextBuffer_appendString(TextBuffer* o, const char* text);
+void TextBuffer_appendFormat(TextBuffer* o, const char* format, ...);
+void TextBuffer_appendUnsigned(TextBuffer* o, ULONG value);
+void TextBuffer_appendHex(TextBuffer* o, const OCTET* octets, size_t num_octets, char sep, size_t sep_interval);
+void TextBuffer_appendAddress(TextBuffer* o, int family, const OCTET* address);
+void TextBuffer_appendDump(TextBuffer* o, const OCTET* data, size_t size, DumpFormat format);
+void TextBuffer_flush(TextBuffer* o, FILE* stream);
+void TextBuffer_free(TextBuffer* o);
+
+#endif
\ No newline at end of file